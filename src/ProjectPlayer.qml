@@ -19,7 +19,11 @@ ProjectScene {
 	property alias cloneLimit: loader.cloneLimit
     property alias spriteFencing: loader.spriteFencing
     property alias mute: loader.mute
+    property alias textureAtlas: loader.textureAtlas
+    property alias precompileShaders: loader.precompileShaders
+    property alias shaderCache: loader.shaderCache
     property alias hqPen: projectPenLayer.hqPen
+    property bool singlePassRendering: false
     property bool showLoadingProgress: true
     readonly property bool loading: priv.loading
     readonly property int downloadedAssets: loader.downloadedAssets
@@ -85,6 +89,11 @@ ProjectScene {
 
         onStageChanged: stage.loadCostume();
 
+        onRedrawRequested: {
+            if (singlePassRendering)
+                stageCompositor.update();
+        }
+
         onCloneCreated: (cloneModel)=> clones.model.append({"spriteModel": cloneModel})
 
         onCloneDeleted: (cloneModel)=> {
@@ -172,6 +181,7 @@ ProjectScene {
             stageModel: loader.stage
             mouseArea: sceneMouseArea
             stageScale: root.stageScale
+            composited: singlePassRendering
             onStageModelChanged: stageModel.renderedTarget = this
             Component.onCompleted: stageModel.penLayer = projectPenLayer
         }
@@ -192,16 +202,15 @@ ProjectScene {
             scale: hqPen ? 1 : stageScale
             transformOrigin: Item.TopLeft
             visible: !priv.loading
+            opacity: singlePassRendering ? 0 : 1 // drawn by the compositor
+        }
 
-            onWidthChanged: {
-                if (!hqPen)
-                    refresh();
-            }
-
-            onHeightChanged: {
-                if (!hqPen)
-                    refresh();
-            }
+        StageCompositor {
+            id: stageCompositor
+            engine: loader.engine
+            penLayer: projectPenLayer
+            anchors.fill: parent
+            visible: singlePassRendering && !priv.loading
         }
 
         Component {
@@ -215,6 +224,7 @@ ProjectScene {
                     id: targetItem
                     mouseArea: sceneMouseArea
                     stageScale: root.stageScale
+                    composited: singlePassRendering
                     transform: Scale { xScale: targetItem.mirrorHorizontally ? -1 : 1 }
                     Component.onCompleted: {
                         engine = loader.engine;
@@ -8,7 +8,6 @@
 #include <scratchcpp/value.h>
 #include <scratchcpp/compilerconstant.h>
 #include <scratchcpp/stringptr.h>
-#include <scratchcpp/string_pool.h>
 #include <scratchcpp/string_functions.h>
 
 #include "penblocks.h"
@@ -40,10 +39,9 @@ inline QColor pen_convert_from_numeric_color(long color)
 
 static void pen_convert_color(const ValueData *color, QColor &dst)
 {
-    StringPtr *str = string_pool_new();
-
     if (value_isString(color)) {
-        value_toStringPtr(color, str);
+        // Read the string directly (no copy is needed)
+        const StringPtr *str = color->stringValue;
 
         if (str->size > 0 && str->data[0] == u'#') {
             if (str->size <= 7) // #RRGGBB
@@ -58,8 +56,6 @@ static void pen_convert_color(const ValueData *color, QColor &dst)
             dst = pen_convert_from_numeric_color(value_toLong(color));
     } else
         dst = pen_convert_from_numeric_color(value_toLong(color));
-
-    string_pool_free(str);
 }
 
 std::string PenBlocks::name() const
@@ -159,10 +155,16 @@ void PenBlocks::compileSetOrChangePenColorParam(Compiler *compiler, bool change)
     CompilerValue *value = compiler->addInput("VALUE");
     CompilerValue *changeValue = compiler->addConstValue(change);
 
-    if (paramInput->pointsToDropdownMenu()) {
-        static const std::unordered_set<std::string> options = { "color", "saturation", "brightness", "transparency" };
-        std::string option = paramInput->selectedMenuItem();
+    static const std::unordered_set<std::string> options = { "color", "saturation", "brightness", "transparency" };
+    std::string option;
+
+    // Resolve constant params at compile time
+    if (paramInput->pointsToDropdownMenu())
+        option = paramInput->selectedMenuItem();
+    else if (param->isConst())
+        option = dynamic_cast<CompilerConstant *>(param)->value().toString();
 
+    if (paramInput->pointsToDropdownMenu() || param->isConst()) {
         if (options.find(option) != options.cend()) {
             std::string f = "pen_set_or_change_" + option;
             compiler->addTargetFunctionCall(f, Compiler::StaticType::Void, { Compiler::StaticType::Number, Compiler::StaticType::Bool }, { value, changeValue });
@@ -229,11 +231,7 @@ CompilerValue *PenBlocks::compileChangePenHueBy(Compiler *compiler)
 CompilerValue *PenBlocks::compileSetPenHueToNumber(Compiler *compiler)
 {
     CompilerValue *hue = compiler->addInput("HUE");
-    CompilerValue *transparency = compiler->addConstValue(0);
-    CompilerValue *change = compiler->addConstValue(false);
-
-    compiler->addTargetFunctionCall("pen_set_or_change_pen_hue", Compiler::StaticType::Void, { Compiler::StaticType::Number, Compiler::StaticType::Bool }, { hue, change });
-    compiler->addTargetFunctionCall("pen_set_or_change_transparency", Compiler::StaticType::Void, { Compiler::StaticType::Number, Compiler::StaticType::Bool }, { transparency, change });
+    compiler->addTargetFunctionCall("pen_setPenHueToNumber", Compiler::StaticType::Void, { Compiler::StaticType::Number }, { hue });
     return nullptr;
 }
 
@@ -295,7 +293,7 @@ BLOCK_EXPORT void pen_setPenColorToHsbColor(Target *target, double h, double s,
     penState.brightness = b;
     penState.transparency = transparency;
 
-    penState.updateColor();
+    penState.invalidateColor();
 
     // Set the legacy "shade" value the same way Scratch 2 did.
     penState.shade = penState.brightness / 2;
@@ -324,28 +322,28 @@ BLOCK_EXPORT void pen_set_or_change_color(Target *target, double value, bool cha
 {
     PenState &penState = getTargetModel(target)->penState();
     penState.color = wrapClamp(value + (change ? penState.color : 0), 0, 100);
-    penState.updateColor();
+    penState.invalidateColor();
 }
 
 BLOCK_EXPORT void pen_set_or_change_saturation(Target *target, double value, bool change)
 {
     PenState &penState = getTargetModel(target)->penState();
     penState.saturation = std::clamp(value + (change ? penState.saturation : 0), COLOR_PARAM_MIN, COLOR_PARAM_MAX);
-    penState.updateColor();
+    penState.invalidateColor();
 }
 
 BLOCK_EXPORT void pen_set_or_change_brightness(Target *target, double value, bool change)
 {
     PenState &penState = getTargetModel(target)->penState();
     penState.brightness = std::clamp(value + (change ? penState.brightness : 0), COLOR_PARAM_MIN, COLOR_PARAM_MAX);
-    penState.updateColor();
+    penState.invalidateColor();
 }
 
 BLOCK_EXPORT void pen_set_or_change_transparency(Target *target, double value, bool change)
 {
     PenState &penState = getTargetModel(target)->penState();
     penState.transparency = std::clamp(value + (change ? penState.transparency : 0), COLOR_PARAM_MIN, COLOR_PARAM_MAX);
-    penState.updateColor();
+    penState.invalidateColor();
 }
 
 BLOCK_EXPORT void pen_set_or_change_color_param(Target *target, const StringPtr *param, double value, bool change)
@@ -412,7 +410,7 @@ inline void legacy_update_pen_color(PenState &penState)
     penState.saturation = 100 * hsv.saturationF();
     penState.brightness = 100 * hsv.valueF();
 
-    penState.updateColor();
+    penState.invalidateColor();
 }
 
 BLOCK_EXPORT void pen_set_or_change_pen_shade(Target *target, double shade, bool change)
@@ -441,3 +439,10 @@ BLOCK_EXPORT void pen_set_or_change_pen_hue(Target *target, double hue, bool cha
     pen_set_or_change_color(target, hue / 2.0, change);
     legacy_update_pen_color(getTargetModel(target)->penState());
 }
+
+BLOCK_EXPORT void pen_setPenHueToNumber(Target *target, double hue)
+{
+    // Sets the hue and resets the transparency in a single call
+    pen_set_or_change_pen_hue(target, hue, false);
+    getTargetModel(target)->penState().transparency = 0;
+}
@@ -6,31 +6,53 @@
 
 using namespace scratchcpprender;
 
+// Maximum memory used by the effect lookup tables (the least recently used tables are removed first)
+static const size_t EFFECT_LOOKUP_BUDGET = 16 * 1024 * 1024;
+
+// Number of texels transformed directly before a lookup table is created for the same texture and effects
+static const int EFFECT_LOOKUP_MIN_MISSES = 64;
+
+// Maximum number of tracked texture and effect combinations without a lookup table
+static const size_t EFFECT_LOOKUP_MAX_MISS_ENTRIES = 256;
+
+static const std::array<ShaderManager::Effect, 4> SHAPE_EFFECTS = { ShaderManager::Effect::Fisheye, ShaderManager::Effect::Whirl, ShaderManager::Effect::Pixelate, ShaderManager::Effect::Mosaic };
+
 CpuTextureManager::CpuTextureManager()
 {
 }
 
 CpuTextureManager::~CpuTextureManager()
 {
-    for (const auto &[handle, data] : m_textureData)
-        delete[] data;
 }
 
-GLubyte *CpuTextureManager::getTextureData(const Texture &texture)
+bool CpuTextureManager::getTextureData(const Texture &texture, std::vector<GLubyte> &dst)
+{
+    // The uncompressed data isn't cached, it's decoded from the spans on each call
+    const TextureSpans *spans = getTextureSpans(texture);
+
+    if (!spans)
+        return false;
+
+    dst.resize(texture.width() * texture.height() * 4); // 4 channels (RGBA)
+    spans->toRgba(dst.data());
+    return true;
+}
+
+const TextureSpans *CpuTextureManager::getTextureSpans(const Texture &texture)
 {
     if (!texture.isValid())
         return nullptr;
 
-    const GLuint handle = texture.handle();
-    auto it = m_textureData.find(handle);
+    const quint64 id = texture.id();
+    auto it = m_textureSpans.find(id);
 
-    if (it == m_textureData.cend()) {
+    if (it == m_textureSpans.cend()) {
         if (addTexture(texture))
-            return m_textureData[handle];
+            return &m_textureSpans[id];
         else
             return nullptr;
     } else
-        return it->second;
+        return &it->second;
 }
 
 void CpuTextureManager::getTextureConvexHullPoints(
@@ -46,83 +68,103 @@ void CpuTextureManager::getTextureConvexHullPoints(
         return;
 
     // Remove effects that don't change shape
-    if (effectMask != 0) {
-        const auto &allEffects = ShaderManager::effects();
-
-        for (ShaderManager::Effect effect : allEffects) {
-            if ((effectMask & effect) != 0 && !ShaderManager::effectShapeChanges(effect))
-                effectMask &= ~effect;
-        }
-    }
+    effectMask = shapeEffects(effectMask);
 
     // If there are no shape-changing effects, use cached hull points
     if (effectMask == 0) {
-        const GLuint handle = texture.handle();
-        auto it = m_convexHullPoints.find(handle);
+        const quint64 id = texture.id();
+        auto it = m_convexHullPoints.find(id);
 
         if (it == m_convexHullPoints.cend()) {
             if (addTexture(texture))
-                dst = m_convexHullPoints[handle];
+                dst = m_convexHullPoints[id];
         } else
             dst = it->second;
     } else
         readTexture(texture, skinSize, effectMask, effects, nullptr, dst);
 }
 
-QRgb CpuTextureManager::getPointColor(const Texture &texture, int x, int y, ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effects)
+QRgb CpuTextureManager::getPointColor(
+    const Texture &texture,
+    int x,
+    int y,
+    ShaderManager::Effect effectMask,
+    const std::unordered_map<ShaderManager::Effect, double> &effects,
+    const QSize &skinSize)
 {
+    const QPoint point(x, y);
+    QRgb color;
+    getPointColors(texture, &point, 1, effectMask, effects, &color, skinSize);
+    return color;
+}
+
+void CpuTextureManager::getPointColors(
+    const Texture &texture,
+    const QPoint *points,
+    int count,
+    ShaderManager::Effect effectMask,
+    const std::unordered_map<ShaderManager::Effect, double> &effects,
+    QRgb *dst,
+    const QSize &skinSize)
+{
+    // Same as getPointColor() for each point, but the effect values are converted and the colors are transformed only once
     const int width = texture.width();
     const int height = texture.height();
+    const ShaderManager::Effect shapeMask = shapeEffects(effectMask);
+    const TextureSpans *spans = getTextureSpans(texture);
+    ShaderManager::InstanceEffectValues uniforms = {};
 
-    if (effectMask != 0) {
-        // Get local position with effect transform
-        QVector2D transformedCoords;
-        const QVector2D localCoords(x / static_cast<float>(width), y / static_cast<float>(height));
-        EffectTransform::transformPoint(effectMask, effects, texture.size(), localCoords, transformedCoords);
-        x = transformedCoords.x() * width;
-        y = transformedCoords.y() * height;
-    }
+    if (effectMask != 0)
+        ShaderManager::getInstanceValuesForEffects(effects, uniforms);
 
-    if ((x < 0 || x >= width) || (y < 0 || y >= height))
-        return qRgba(0, 0, 0, 0);
+    EffectLookupKey key;
+
+    if (shapeMask != 0)
+        key = effectLookupKey(texture.size(), skinSize.isEmpty() ? texture.size() : skinSize, shapeMask, uniforms);
 
-    GLubyte *pixels = getTextureData(texture);
-    QRgb color = qRgba(pixels[(y * width + x) * 4], pixels[(y * width + x) * 4 + 1], pixels[(y * width + x) * 4 + 2], pixels[(y * width + x) * 4 + 3]);
+    for (int i = 0; i < count; i++) {
+        int x = points[i].x();
+        int y = points[i].y();
 
-    if (effectMask == 0)
-        return color;
-    else
-        return EffectTransform::transformColor(effectMask, effects, color);
+        // Get local position with effect transform
+        if (!spans || (shapeMask != 0 && !transformTexel(key, uniforms, x, y)) || (x < 0 || x >= width) || (y < 0 || y >= height))
+            dst[i] = qRgba(0, 0, 0, 0);
+        else
+            dst[i] = spans->pixel(x, y);
+    }
+
+    if (effectMask != 0)
+        EffectTransform::transformColors(effectMask, uniforms, dst, dst, count);
 }
 
-bool CpuTextureManager::textureContainsPoint(const Texture &texture, const QPointF &localPoint, ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effects)
+bool CpuTextureManager::textureContainsPoint(
+    const Texture &texture,
+    const QPointF &localPoint,
+    ShaderManager::Effect effectMask,
+    const std::unordered_map<ShaderManager::Effect, double> &effects,
+    const QSize &skinSize)
 {
     // https://github.com/scratchfoundation/scratch-render/blob/7b823985bc6fe92f572cc3276a8915e550f7c5e6/src/Silhouette.js#L219-L226
     const int width = texture.width();
     const int height = texture.height();
     int x = localPoint.x();
     int y = localPoint.y();
+    effectMask = shapeEffects(effectMask);
 
     if (effectMask != 0) {
         // Get local position with effect transform
-        QVector2D transformedCoords;
-        const QVector2D localCoords(x / static_cast<float>(width), y / static_cast<float>(height));
-        EffectTransform::transformPoint(effectMask, effects, texture.size(), localCoords, transformedCoords);
-        x = transformedCoords.x() * width;
-        y = transformedCoords.y() * height;
+        ShaderManager::InstanceEffectValues uniforms;
+        ShaderManager::getInstanceValuesForEffects(effects, uniforms);
+
+        if (!transformTexel(effectLookupKey(texture.size(), skinSize.isEmpty() ? texture.size() : skinSize, effectMask, uniforms), uniforms, x, y))
+            return false;
     }
 
     if ((x < 0 || x >= width) || (y < 0 || y >= height))
         return false;
 
-    GLubyte *pixels = getTextureData(texture);
-
-    if (pixels) {
-        QRgb color = qRgba(pixels[(y * width + x) * 4], pixels[(y * width + x) * 4 + 1], pixels[(y * width + x) * 4 + 2], pixels[(y * width + x) * 4 + 3]);
-        return qAlpha(color) > 0;
-    }
-
-    return false;
+    const TextureSpans *spans = getTextureSpans(texture);
+    return spans && spans->containsPixel(x, y);
 }
 
 void CpuTextureManager::removeTexture(const Texture &texture)
@@ -130,14 +172,176 @@ void CpuTextureManager::removeTexture(const Texture &texture)
     if (!texture.isValid())
         return;
 
-    const GLuint handle = texture.handle();
-    auto it = m_textureData.find(handle);
+    const quint64 id = texture.id();
+    m_textureSpans.erase(id);
+    m_convexHullPoints.erase(id);
+}
+
+bool CpuTextureManager::EffectLookupKey::operator==(const EffectLookupKey &other) const
+{
+    return textureSize == other.textureSize && skinSize == other.skinSize && effectMask == other.effectMask && values == other.values;
+}
+
+size_t CpuTextureManager::EffectLookupKeyHash::operator()(const EffectLookupKey &key) const
+{
+    size_t seed = qHashMulti(0, key.textureSize.width(), key.textureSize.height(), key.skinSize.width(), key.skinSize.height(), static_cast<int>(key.effectMask));
+
+    for (float value : key.values)
+        seed = qHashMulti(seed, value);
+
+    return seed;
+}
+
+ShaderManager::Effect CpuTextureManager::shapeEffects(ShaderManager::Effect effectMask)
+{
+    ShaderManager::Effect ret = ShaderManager::Effect::NoEffect;
 
-    if (it != m_textureData.cend()) {
-        delete it->second;
-        m_textureData.erase(it);
-        m_convexHullPoints.erase(handle);
+    for (ShaderManager::Effect effect : SHAPE_EFFECTS) {
+        if ((effectMask & effect) != 0)
+            ret |= effect;
     }
+
+    return ret;
+}
+
+const std::vector<int> &
+CpuTextureManager::getEffectLookupTable(const QSize &textureSize, const QSize &skinSize, ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effects)
+{
+    // The lookup table maps each texel (y * width + x) to the texel it's sampled from, or -1 if it's outside the texture
+    Q_ASSERT(effectMask == shapeEffects(effectMask));
+    ShaderManager::InstanceEffectValues uniforms;
+    ShaderManager::getInstanceValuesForEffects(effects, uniforms);
+    return effectLookupTable(effectLookupKey(textureSize, skinSize, effectMask, uniforms), uniforms);
+}
+
+bool CpuTextureManager::hasEffectLookupTable(const QSize &textureSize, const QSize &skinSize, ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effects)
+{
+    ShaderManager::InstanceEffectValues uniforms;
+    ShaderManager::getInstanceValuesForEffects(effects, uniforms);
+    return m_effectLookupIndex.find(effectLookupKey(textureSize, skinSize, shapeEffects(effectMask), uniforms)) != m_effectLookupIndex.cend();
+}
+
+size_t CpuTextureManager::effectLookupMemory()
+{
+    return m_effectLookupSize;
+}
+
+void CpuTextureManager::clearEffectLookupTables()
+{
+    m_effectLookupTables.clear();
+    m_effectLookupIndex.clear();
+    m_effectLookupMisses.clear();
+    m_effectLookupSize = 0;
+}
+
+CpuTextureManager::EffectLookupKey
+CpuTextureManager::effectLookupKey(const QSize &textureSize, const QSize &skinSize, ShaderManager::Effect effectMask, const ShaderManager::InstanceEffectValues &uniforms)
+{
+    // The shape-changing effects are the last ones in ShaderManager::InstanceEffectValues (in the same order as SHAPE_EFFECTS)
+    const size_t offset = uniforms.size() - SHAPE_EFFECTS.size();
+    EffectLookupKey key;
+    key.textureSize = textureSize;
+    key.skinSize = skinSize;
+    key.effectMask = effectMask;
+
+    for (size_t i = 0; i < SHAPE_EFFECTS.size(); i++) {
+        if ((effectMask & SHAPE_EFFECTS[i]) != 0)
+            key.values[i] = uniforms[offset + i];
+    }
+
+    return key;
+}
+
+const std::vector<int> &CpuTextureManager::effectLookupTable(const EffectLookupKey &key, const ShaderManager::InstanceEffectValues &uniforms)
+{
+    auto it = m_effectLookupIndex.find(key);
+
+    if (it != m_effectLookupIndex.cend()) {
+        // Move the table to the front
+        m_effectLookupTables.splice(m_effectLookupTables.begin(), m_effectLookupTables, it->second);
+        return it->second->table;
+    }
+
+    const int width = key.textureSize.width();
+    const int height = key.textureSize.height();
+    EffectLookupTable entry;
+    entry.key = key;
+    entry.table.reserve(width * height);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int transformedX = x;
+            int transformedY = y;
+
+            if (transformTexelDirectly(key.textureSize, key.skinSize, key.effectMask, uniforms, transformedX, transformedY))
+                entry.table.push_back(transformedY * width + transformedX);
+            else
+                entry.table.push_back(-1);
+        }
+    }
+
+    m_effectLookupMisses.erase(key);
+    m_effectLookupSize += entry.table.size() * sizeof(int);
+    m_effectLookupTables.push_front(std::move(entry));
+    m_effectLookupIndex[key] = m_effectLookupTables.begin();
+
+    // Remove the least recently used tables (but keep the new one)
+    while (m_effectLookupSize > EFFECT_LOOKUP_BUDGET && m_effectLookupTables.size() > 1) {
+        const EffectLookupTable &last = m_effectLookupTables.back();
+        m_effectLookupSize -= last.table.size() * sizeof(int);
+        m_effectLookupIndex.erase(last.key);
+        m_effectLookupTables.pop_back();
+    }
+
+    return m_effectLookupTables.front().table;
+}
+
+bool CpuTextureManager::transformTexel(const EffectLookupKey &key, const ShaderManager::InstanceEffectValues &uniforms, int &x, int &y)
+{
+    // Returns false if the transformed texel is outside the texture
+    const int width = key.textureSize.width();
+    const int height = key.textureSize.height();
+
+    // Texels outside the texture aren't in the lookup table
+    if ((x < 0 || x >= width) || (y < 0 || y >= height))
+        return transformTexelDirectly(key.textureSize, key.skinSize, key.effectMask, uniforms, x, y);
+
+    if (m_effectLookupIndex.find(key) == m_effectLookupIndex.cend()) {
+        // Building a table costs a transform per texel, so it's only worth it if many texels are requested
+        if (m_effectLookupMisses.size() >= EFFECT_LOOKUP_MAX_MISS_ENTRIES && m_effectLookupMisses.find(key) == m_effectLookupMisses.cend())
+            m_effectLookupMisses.clear();
+
+        if (++m_effectLookupMisses[key] <= EFFECT_LOOKUP_MIN_MISSES)
+            return transformTexelDirectly(key.textureSize, key.skinSize, key.effectMask, uniforms, x, y);
+    }
+
+    const int index = effectLookupTable(key, uniforms)[y * width + x];
+
+    if (index < 0)
+        return false;
+
+    x = index % width;
+    y = index / width;
+    return true;
+}
+
+bool CpuTextureManager::transformTexelDirectly(
+    const QSize &textureSize,
+    const QSize &skinSize,
+    ShaderManager::Effect effectMask,
+    const ShaderManager::InstanceEffectValues &uniforms,
+    int &x,
+    int &y)
+{
+    // Same as transformTexel(), but without the lookup table
+    const int width = textureSize.width();
+    const int height = textureSize.height();
+    QVector2D transformedCoords;
+    const QVector2D localCoords(x / static_cast<float>(width), y / static_cast<float>(height));
+    EffectTransform::transformPoint(effectMask, uniforms, skinSize, localCoords, transformedCoords);
+    x = transformedCoords.x() * width;
+    y = transformedCoords.y() * height;
+    return (x >= 0 && x < width) && (y >= 0 && y < height);
 }
 
 bool CpuTextureManager::addTexture(const Texture &tex)
@@ -145,10 +349,18 @@ bool CpuTextureManager::addTexture(const Texture &tex)
     if (!tex.isValid())
         return false;
 
-    const GLuint handle = tex.handle();
-    m_textureData[handle] = nullptr;
-    m_convexHullPoints[handle] = {};
-    return readTexture(tex, QSize(), ShaderManager::Effect::NoEffect, {}, &m_textureData[handle], m_convexHullPoints[handle]);
+    const quint64 id = tex.id();
+    GLubyte *pixels = nullptr;
+    std::vector<QPoint> points;
+
+    if (!readTexture(tex, QSize(), ShaderManager::Effect::NoEffect, {}, &pixels, points))
+        return false;
+
+    // Only keep the non-transparent pixels
+    m_textureSpans[id] = TextureSpans(pixels, tex.width(), tex.height());
+    m_convexHullPoints[id] = std::move(points);
+    delete[] pixels;
+    return true;
 }
 
 bool CpuTextureManager::readTexture(
@@ -195,9 +407,10 @@ bool CpuTextureManager::readTexture(
         return false;
     }
 
-    // Read pixels
+    // Read pixels (textures in an atlas only cover a part of the OpenGL texture)
+    const QPoint &offset = texture.atlasOffset();
     GLubyte *pixels = new GLubyte[width * height * 4]; // 4 channels (RGBA)
-    glF.glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glF.glReadPixels(offset.x(), offset.y(), width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
 
     std::vector<QPoint> leftHull;
     std::vector<QPoint> rightHull;
@@ -214,6 +427,11 @@ bool CpuTextureManager::readTexture(
 
     auto determinant = [](const QPoint &A, const QPoint &B, const QPoint &C) { return (B.x() - A.x()) * (C.y() - A.y()) - (B.y() - A.y()) * (C.x() - A.x()); };
 
+    const std::vector<int> *lookupTable = nullptr;
+
+    if (effectMask != 0)
+        lookupTable = &getEffectLookupTable(texture.size(), skinSize, effectMask, effects);
+
     // Get convex hull points (flipped vertically)
     // https://github.com/scratchfoundation/scratch-render/blob/0f6663f3148b4f994d58e19590e14c152f1cc2f8/src/RenderWebGL.js#L1829-L1955
     for (int y = 0; y < height; y++) {
@@ -222,26 +440,13 @@ bool CpuTextureManager::readTexture(
         const int flippedY = height - 1 - y;
 
         for (x = 0; x < width; x++) {
-            int transformedX = x;
-            int transformedY = flippedY;
-
-            if (effectMask != 0) {
-                // Get local position with effect transform
-                QVector2D transformedCoords;
-                const QVector2D localCoords(transformedX / static_cast<float>(width), transformedY / static_cast<float>(height));
-                EffectTransform::transformPoint(effectMask, effects, skinSize, localCoords, transformedCoords);
-                transformedX = transformedCoords.x() * width;
-                transformedY = transformedCoords.y() * height;
-            }
-
-            if ((transformedX >= 0 && transformedX < width) && (transformedY >= 0 && transformedY < height)) {
-                int index = (transformedY * width + transformedX) * 4;
+            // Get local position with effect transform
+            const int index = lookupTable ? (*lookupTable)[flippedY * width + x] : flippedY * width + x;
 
-                if (pixels[index + 3] > 0) {
-                    currentPoint.setX(x);
-                    currentPoint.setY(y);
-                    break;
-                }
+            if (index >= 0 && pixels[index * 4 + 3] > 0) {
+                currentPoint.setX(x);
+                currentPoint.setY(y);
+                break;
             }
         }
 
@@ -259,26 +464,13 @@ bool CpuTextureManager::readTexture(
         leftHull[++leftEndPointIndex] = currentPoint;
 
         for (x = width - 1; x >= 0; x--) {
-            int transformedX = x;
-            int transformedY = flippedY;
-
-            if (effectMask != 0) {
-                // Get local position with effect transform
-                QVector2D transformedCoords;
-                const QVector2D localCoords(transformedX / static_cast<float>(width), transformedY / static_cast<float>(height));
-                EffectTransform::transformPoint(effectMask, effects, skinSize, localCoords, transformedCoords);
-                transformedX = transformedCoords.x() * width;
-                transformedY = transformedCoords.y() * height;
-            }
-
-            if ((transformedX >= 0 && transformedX < width) && (transformedY >= 0 && transformedY < height)) {
-                int index = (transformedY * width + transformedX) * 4;
+            // Get local position with effect transform
+            const int index = lookupTable ? (*lookupTable)[flippedY * width + x] : flippedY * width + x;
 
-                if (pixels[index + 3] > 0) {
-                    currentPoint.setX(x);
-                    currentPoint.setY(y);
-                    break;
-                }
+            if (index >= 0 && pixels[index * 4 + 3] > 0) {
+                currentPoint.setX(x);
+                currentPoint.setY(y);
+                break;
             }
         }
 
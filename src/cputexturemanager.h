@@ -5,8 +5,11 @@
 #include <QPoint>
 #include <QtOpenGL>
 #include <unordered_map>
+#include <list>
+#include <array>
 
 #include "shadermanager.h"
+#include "texturespans.h"
 
 namespace scratchcpprender
 {
@@ -19,7 +22,8 @@ class CpuTextureManager
         CpuTextureManager();
         ~CpuTextureManager();
 
-        GLubyte *getTextureData(const Texture &texture);
+        bool getTextureData(const Texture &texture, std::vector<GLubyte> &dst);
+        const TextureSpans *getTextureSpans(const Texture &texture);
         void getTextureConvexHullPoints(
             const Texture &texture,
             const QSize &skinSize,
@@ -27,12 +31,70 @@ class CpuTextureManager
             const std::unordered_map<ShaderManager::Effect, double> &effects,
             std::vector<QPoint> &dst);
 
-        QRgb getPointColor(const Texture &texture, int x, int y, ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effects);
-        bool textureContainsPoint(const Texture &texture, const QPointF &localPoint, ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effects);
+        QRgb getPointColor(
+            const Texture &texture,
+            int x,
+            int y,
+            ShaderManager::Effect effectMask,
+            const std::unordered_map<ShaderManager::Effect, double> &effects,
+            const QSize &skinSize = QSize());
+        void getPointColors(
+            const Texture &texture,
+            const QPoint *points,
+            int count,
+            ShaderManager::Effect effectMask,
+            const std::unordered_map<ShaderManager::Effect, double> &effects,
+            QRgb *dst,
+            const QSize &skinSize = QSize());
+        bool textureContainsPoint(
+            const Texture &texture,
+            const QPointF &localPoint,
+            ShaderManager::Effect effectMask,
+            const std::unordered_map<ShaderManager::Effect, double> &effects,
+            const QSize &skinSize = QSize());
 
         void removeTexture(const Texture &texture);
 
+        static const std::vector<int> &
+        getEffectLookupTable(const QSize &textureSize, const QSize &skinSize, ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effects);
+        static bool hasEffectLookupTable(const QSize &textureSize, const QSize &skinSize, ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effects);
+        static size_t effectLookupMemory();
+        static void clearEffectLookupTables();
+
     private:
+        struct EffectLookupKey
+        {
+                QSize textureSize;
+                QSize skinSize;
+                ShaderManager::Effect effectMask = ShaderManager::Effect::NoEffect;
+                std::array<float, 4> values = { 0, 0, 0, 0 }; // uniform values of the shape-changing effects
+
+                bool operator==(const EffectLookupKey &other) const;
+        };
+
+        struct EffectLookupKeyHash
+        {
+                size_t operator()(const EffectLookupKey &key) const;
+        };
+
+        struct EffectLookupTable
+        {
+                EffectLookupKey key;
+                std::vector<int> table;
+        };
+
+        static ShaderManager::Effect shapeEffects(ShaderManager::Effect effectMask);
+        static EffectLookupKey effectLookupKey(const QSize &textureSize, const QSize &skinSize, ShaderManager::Effect effectMask, const ShaderManager::InstanceEffectValues &uniforms);
+        static const std::vector<int> &effectLookupTable(const EffectLookupKey &key, const ShaderManager::InstanceEffectValues &uniforms);
+        static bool transformTexel(const EffectLookupKey &key, const ShaderManager::InstanceEffectValues &uniforms, int &x, int &y);
+        static bool transformTexelDirectly(
+            const QSize &textureSize,
+            const QSize &skinSize,
+            ShaderManager::Effect effectMask,
+            const ShaderManager::InstanceEffectValues &uniforms,
+            int &x,
+            int &y);
+
         bool addTexture(const Texture &tex);
         bool readTexture(
             const Texture &texture,
@@ -43,8 +105,12 @@ class CpuTextureManager
             std::vector<QPoint> &points) const;
 
         static inline GLuint m_fbo = 0;          // single FBO for all texture managers
-        std::unordered_map<GLuint, GLubyte *> m_textureData;
-        std::unordered_map<GLuint, std::vector<QPoint>> m_convexHullPoints;
+        static inline std::list<EffectLookupTable> m_effectLookupTables; // shared by all texture managers, most recently used first
+        static inline std::unordered_map<EffectLookupKey, std::list<EffectLookupTable>::iterator, EffectLookupKeyHash> m_effectLookupIndex;
+        static inline size_t m_effectLookupSize = 0; // bytes
+        static inline std::unordered_map<EffectLookupKey, int, EffectLookupKeyHash> m_effectLookupMisses; // texels transformed without a lookup table
+        std::unordered_map<quint64, TextureSpans> m_textureSpans; // keyed by Texture::id()
+        std::unordered_map<quint64, std::vector<QPoint>> m_convexHullPoints;
 };
 
 } // namespace scratchcpprender
@@ -16,117 +16,182 @@ inline float fract(float x)
     return x - std::floor(x);
 }
 
-QRgb EffectTransform::transformColor(ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effectValues, QRgb color)
+// Add this to divisors to prevent division by 0 (same as in the shader)
+static const float EPSILON = 1e-3f;
+
+// Number of pixels processed at once by the color kernel
+static const int COLOR_LANES = 4;
+
+// Indices of the effects in ShaderManager::InstanceEffectValues
+static const int COLOR_INDEX = 0;
+static const int BRIGHTNESS_INDEX = 1;
+static const int GHOST_INDEX = 2;
+static const int FISHEYE_INDEX = 3;
+static const int WHIRL_INDEX = 4;
+static const int PIXELATE_INDEX = 5;
+static const int MOSAIC_INDEX = 6;
+
+inline void convertRGB2HSV(float r, float g, float b, float &h, float &s, float &v)
 {
-    // https://github.com/scratchfoundation/scratch-render/blob/e075e5f5ebc95dec4a2718551624ad587c56f0a6/src/EffectTransform.js#L40-L119
-    // If the color is fully transparent, don't bother attempting any transformations.
-    if (qAlpha(color) == 0)
-        return color;
+    // Branchless conversion from shaders/sprite.frag
+    // temp1.xy = sort B & G (largest first), temp1.zw = hue offsets
+    const bool blueLarger = b > g;
+    const float t1x = blueLarger ? b : g;
+    const float t1y = blueLarger ? g : b;
+    const float t1z = blueLarger ? -1.0f : 0.0f;
+    const float t1w = blueLarger ? 2.0f / 3.0f : -1.0f / 3.0f;
+
+    // temp2.x = the largest component, temp2.yw = the smaller components, temp2.z = the hue offset
+    const bool redLargest = r > t1x;
+    const float t2x = redLargest ? r : t1x;
+    const float t2y = t1y;
+    const float t2z = redLargest ? t1z : t1w;
+    const float t2w = redLargest ? t1x : r;
+
+    const float m = std::min(t2y, t2w);
+    const float c = t2x - m;
+
+    h = std::abs(t2z + (t2w - t2y) / (6.0f * c + EPSILON));
+    s = c / (t2x + EPSILON);
+    v = t2x;
+}
+
+inline void convertHSV2RGB(float h, float s, float v, float &r, float &g, float &b)
+{
+    // Branchless conversion from shaders/sprite.frag
+    const float c = v * s;
+    r = std::clamp(std::abs(h * 6.0f - 3.0f) - 1.0f, 0.0f, 1.0f) * c + v - c;
+    g = std::clamp(2.0f - std::abs(h * 6.0f - 2.0f), 0.0f, 1.0f) * c + v - c;
+    b = std::clamp(2.0f - std::abs(h * 6.0f - 4.0f), 0.0f, 1.0f) * c + v - c;
+}
+
+inline int toChannel(float value)
+{
+    // The GPU rounds to the nearest value when writing to the framebuffer
+    return static_cast<int>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
 
-    QColor inOutColor = QColor::fromRgba(color);
+QRgb EffectTransform::transformColor(ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effectValues, QRgb color)
+{
+    QRgb ret;
+    transformColors(effectMask, effectValues, &color, &ret, 1);
+    return ret;
+}
 
-    std::unordered_map<ShaderManager::Effect, float> uniforms;
-    ShaderManager::getUniformValuesForEffects(effectValues, uniforms);
+void EffectTransform::transformColors(ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effectValues, const QRgb *src, QRgb *dst, int count)
+{
+    ShaderManager::InstanceEffectValues uniforms;
+    ShaderManager::getInstanceValuesForEffects(effectValues, uniforms);
+    transformColors(effectMask, uniforms, src, dst, count);
+}
 
+void EffectTransform::transformColors(ShaderManager::Effect effectMask, const ShaderManager::InstanceEffectValues &uniforms, const QRgb *src, QRgb *dst, int count)
+{
+    // Same as the color part of shaders/sprite.frag, the uniform values are converted only once for all pixels
+    // https://github.com/scratchfoundation/scratch-render/blob/e075e5f5ebc95dec4a2718551624ad587c56f0a6/src/EffectTransform.js#L40-L119
     const bool enableColor = (effectMask & ShaderManager::Effect::Color) != 0;
     const bool enableBrightness = (effectMask & ShaderManager::Effect::Brightness) != 0;
-
-    if (enableColor || enableBrightness) {
-        // gl_FragColor.rgb /= gl_FragColor.a + epsilon;
-        // Here, we're dividing by the (previously pre-multiplied) alpha to ensure HSV is properly calculated
-        // for partially transparent pixels.
-        const float alpha = inOutColor.alphaF();
-
-        if (alpha == 0) {
-            inOutColor.setRed(255);
-            inOutColor.setGreen(255);
-            inOutColor.setBlue(255);
-        } else {
-            inOutColor.setRedF(inOutColor.redF() / alpha);
-            inOutColor.setGreenF(inOutColor.greenF() / alpha);
-            inOutColor.setBlueF(inOutColor.blueF() / alpha);
+    const float colorShift = uniforms[COLOR_INDEX];
+    const float brightness = uniforms[BRIGHTNESS_INDEX];
+    const float ghost = uniforms[GHOST_INDEX];
+
+    for (int i = 0; i < count; i += COLOR_LANES) {
+        const int n = std::min(COLOR_LANES, count - i);
+        float r[COLOR_LANES], g[COLOR_LANES], b[COLOR_LANES], a[COLOR_LANES];
+
+        for (int lane = 0; lane < COLOR_LANES; lane++) {
+            const QRgb color = lane < n ? src[i + lane] : 0;
+            r[lane] = qRed(color) / 255.0f;
+            g[lane] = qGreen(color) / 255.0f;
+            b[lane] = qBlue(color) / 255.0f;
+            a[lane] = qAlpha(color) / 255.0f;
         }
 
-        if (enableColor) {
-            // vec3 hsv = convertRGB2HSV(gl_FragColor.xyz);
-            QColor hsv = inOutColor.toHsv();
-
-            // this code forces grayscale values to be slightly saturated
-            // so that some slight change of hue will be visible
-            // const float minLightness = 0.11 / 2.0;
-            const float minV = 0.11f / 2.0f;
-            // const float minSaturation = 0.09;
-            const float minS = 0.09f;
-            // if (hsv.z < minLightness) hsv = vec3(0.0, 1.0, minLightness);
-            if (hsv.valueF() < minV) {
-                hsv.setHsvF(0.0f, 1.0f, minV);
-                // else if (hsv.y < minSaturation) hsv = vec3(0.0, minSaturation, hsv.z);
-            } else if (hsv.saturationF() < minS) {
-                hsv.setHsvF(0.0f, minS, hsv.valueF());
+        if (enableColor || enableBrightness) {
+            // Divide premultiplied alpha values for proper color processing
+            for (int lane = 0; lane < COLOR_LANES; lane++) {
+                const float alpha = a[lane] + EPSILON;
+                r[lane] = std::clamp(r[lane] / alpha, 0.0f, 1.0f);
+                g[lane] = std::clamp(g[lane] / alpha, 0.0f, 1.0f);
+                b[lane] = std::clamp(b[lane] / alpha, 0.0f, 1.0f);
             }
 
-            // hsv.x = mod(hsv.x + u_color, 1.0);
-            // if (hsv.x < 0.0) hsv.x += 1.0;
-            float hue = std::fmod(uniforms[ShaderManager::Effect::Color] + hsv.hueF(), 1.0f);
-
-            if (hue < 0.0f)
-                hue += 1.0f;
+            if (enableColor) {
+                for (int lane = 0; lane < COLOR_LANES; lane++) {
+                    float h, s, v;
+                    convertRGB2HSV(r[lane], g[lane], b[lane], h, s, v);
+
+                    // Force grayscale values to be slightly saturated
+                    const float minLightness = 0.11f / 2.0f;
+                    const float minSaturation = 0.09f;
+                    const bool dark = v < minLightness;
+                    const bool gray = !dark && s < minSaturation;
+                    h = (dark || gray) ? 0.0f : h;
+                    s = dark ? 1.0f : (gray ? minSaturation : s);
+                    v = dark ? minLightness : v;
+
+                    // hsv.x = mod(hsv.x + u_color, 1.0);
+                    h += colorShift;
+                    h -= std::floor(h);
+
+                    convertHSV2RGB(h, s, v, r[lane], g[lane], b[lane]);
+                }
+            }
 
-            hsv.setHsvF(hue, hsv.saturationF(), hsv.valueF());
+            if (enableBrightness) {
+                for (int lane = 0; lane < COLOR_LANES; lane++) {
+                    r[lane] = std::clamp(r[lane] + brightness, 0.0f, 1.0f);
+                    g[lane] = std::clamp(g[lane] + brightness, 0.0f, 1.0f);
+                    b[lane] = std::clamp(b[lane] + brightness, 0.0f, 1.0f);
+                }
+            }
 
-            // gl_FragColor.rgb = convertHSV2RGB(hsl);
-            inOutColor = hsv.toRgb();
+            // Re-multiply color values
+            for (int lane = 0; lane < COLOR_LANES; lane++) {
+                const float alpha = a[lane] + EPSILON;
+                r[lane] *= alpha;
+                g[lane] *= alpha;
+                b[lane] *= alpha;
+            }
         }
 
-        if (enableBrightness) {
-            const float brightness = uniforms[ShaderManager::Effect::Brightness] * 255.0f;
-            // gl_FragColor.rgb = clamp(gl_FragColor.rgb + vec3(u_brightness), vec3(0), vec3(1));
-            inOutColor.setRed(std::clamp(inOutColor.red() + brightness, 0.0f, 255.0f));
-            inOutColor.setGreen(std::clamp(inOutColor.green() + brightness, 0.0f, 255.0f));
-            inOutColor.setBlue(std::clamp(inOutColor.blue() + brightness, 0.0f, 255.0f));
+        for (int lane = 0; lane < COLOR_LANES; lane++) {
+            r[lane] *= ghost;
+            g[lane] *= ghost;
+            b[lane] *= ghost;
+            a[lane] *= ghost;
         }
 
-        // gl_FragColor.rgb *= gl_FragColor.a + epsilon;
-        // Now we're doing the reverse, premultiplying by the alpha once again.
-        inOutColor.setRedF(inOutColor.redF() * alpha);
-        inOutColor.setGreenF(inOutColor.greenF() * alpha);
-        inOutColor.setBlueF(inOutColor.blueF() * alpha);
-
-        // Restore alpha
-        inOutColor.setAlphaF(alpha);
-    }
-
-    const float ghost = uniforms[ShaderManager::Effect::Ghost];
-
-    if (ghost != 1) {
-        // gl_FragColor *= u_ghost
-        inOutColor.setRedF(inOutColor.redF() * ghost);
-        inOutColor.setGreenF(inOutColor.greenF() * ghost);
-        inOutColor.setBlueF(inOutColor.blueF() * ghost);
-        inOutColor.setAlphaF(inOutColor.alphaF() * ghost);
+        for (int lane = 0; lane < n; lane++) {
+            // If the color is fully transparent, don't bother attempting any transformations
+            const QRgb color = src[i + lane];
+            dst[i + lane] = qAlpha(color) == 0 ? color : qRgba(toChannel(r[lane]), toChannel(g[lane]), toChannel(b[lane]), toChannel(a[lane]));
+        }
     }
-
-    return inOutColor.rgba();
 }
 
 void EffectTransform::transformPoint(ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effectValues, const QSize &size, const QVector2D &vec, QVector2D &dst)
+{
+    ShaderManager::InstanceEffectValues uniforms;
+    ShaderManager::getInstanceValuesForEffects(effectValues, uniforms);
+    transformPoint(effectMask, uniforms, size, vec, dst);
+}
+
+void EffectTransform::transformPoint(ShaderManager::Effect effectMask, const ShaderManager::InstanceEffectValues &uniforms, const QSize &size, const QVector2D &vec, QVector2D &dst)
 {
     // https://github.com/scratchfoundation/scratch-render/blob/e075e5f5ebc95dec4a2718551624ad587c56f0a6/src/EffectTransform.js#L128-L194
     dst = vec;
 
-    std::unordered_map<ShaderManager::Effect, float> uniforms;
-    ShaderManager::getUniformValuesForEffects(effectValues, uniforms);
-
     if ((effectMask & ShaderManager::Effect::Mosaic) != 0) {
         // texcoord0 = fract(u_mosaic * texcoord0);
-        const float mosaic = uniforms[ShaderManager::Effect::Mosaic];
+        const float mosaic = uniforms[MOSAIC_INDEX];
         dst.setX(fract(mosaic * dst.x()));
         dst.setY(fract(mosaic * dst.y()));
     }
 
     if ((effectMask & ShaderManager::Effect::Pixelate) != 0) {
         // vec2 pixelTexelSize = u_skinSize / u_pixelate;
-        const float pixelate = uniforms[ShaderManager::Effect::Pixelate];
+        const float pixelate = uniforms[PIXELATE_INDEX];
         const float texelX = size.width() / pixelate;
         const float texelY = size.height() / pixelate;
         // texcoord0 = (floor(texcoord0 * pixelTexelSize) + kCenter) /
@@ -136,7 +201,7 @@ void EffectTransform::transformPoint(ShaderManager::Effect effectMask, const std
     }
 
     if ((effectMask & ShaderManager::Effect::Whirl) != 0) {
-        const float whirl = uniforms[ShaderManager::Effect::Whirl];
+        const float whirl = uniforms[WHIRL_INDEX];
         // const float kRadius = 0.5;
         const float RADIUS = 0.5f;
         // vec2 offset = texcoord0 - kCenter;
@@ -167,7 +232,7 @@ void EffectTransform::transformPoint(ShaderManager::Effect effectMask, const std
     }
 
     if ((effectMask & ShaderManager::Effect::Fisheye) != 0) {
-        const float fisheye = uniforms[ShaderManager::Effect::Fisheye];
+        const float fisheye = uniforms[FISHEYE_INDEX];
         // vec2 vec = (texcoord0 - kCenter) / kCenter;
         const float vX = (dst.x() - CENTER_X) / CENTER_X;
         const float vY = (dst.y() - CENTER_Y) / CENTER_Y;
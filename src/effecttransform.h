@@ -15,7 +15,10 @@ class EffectTransform
         EffectTransform() = delete;
 
         static QRgb transformColor(ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effectValues, QRgb color);
+        static void transformColors(ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effectValues, const QRgb *src, QRgb *dst, int count);
+        static void transformColors(ShaderManager::Effect effectMask, const ShaderManager::InstanceEffectValues &uniforms, const QRgb *src, QRgb *dst, int count);
         static void transformPoint(ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effectValues, const QSize &size, const QVector2D &vec, QVector2D &dst);
+        static void transformPoint(ShaderManager::Effect effectMask, const ShaderManager::InstanceEffectValues &uniforms, const QSize &size, const QVector2D &vec, QVector2D &dst);
 };
 
 } // namespace scratchcpprender
@@ -0,0 +1,295 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <scratchcpp/iengine.h>
+#include <QVector3D>
+#include <QMatrix4x4>
+
+#include "gputouchingquery.h"
+#include "irenderedtarget.h"
+#include "ipenlayer.h"
+#include "sharedquad.h"
+
+using namespace scratchcpprender;
+
+// Colors are compared with the same precision as RenderedTarget::colorMatches() and maskMatches()
+static const QVector3D COLOR_STEP(8, 8, 16);
+static const QVector3D MASK_STEP(8, 8, 8);
+
+int GpuTouchingQuery::areaThreshold()
+{
+    return m_areaThreshold;
+}
+
+// Sets the minimum area (in stage pixels) to check on the GPU, use a negative value to always check on the CPU
+void GpuTouchingQuery::setAreaThreshold(int threshold)
+{
+    m_areaThreshold = threshold;
+}
+
+// Returns true if the given area should be checked on the GPU
+bool GpuTouchingQuery::isSuitable(const QRectF &rect)
+{
+    if (m_areaThreshold < 0 || !QOpenGLContext::currentContext())
+        return false;
+
+    const QRect region = toRegion(rect);
+    return static_cast<qint64>(region.width()) * region.height() >= m_areaThreshold;
+}
+
+bool GpuTouchingQuery::touchingTargets(const IRenderedTarget *target, const QRectF &rect, const std::vector<IRenderedTarget *> &candidates)
+{
+    // https://github.com/scratchfoundation/scratch-render/blob/941562438fe3dd6e7d98d9387607d535dcd68d24/src/RenderWebGL.js#L1004-L1047
+    if (!target->engine() || candidates.empty())
+        return false;
+
+    const QRect region = toRegion(rect);
+    const QPoint origin = regionOrigin(target, region);
+    GLState state;
+    beginQuery(region.size(), state);
+
+    m_stencilFbo->bind();
+    m_glF->glClearStencil(0);
+    m_glF->glClear(GL_STENCIL_BUFFER_BIT);
+    markTarget(target, origin, false, 0);
+
+    // Count the candidate pixels which overlap the target
+    m_glF->glStencilFunc(GL_EQUAL, 1, 0xFF);
+    m_glF->glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    m_glF->glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    m_glF->glBeginQuery(GL_ANY_SAMPLES_PASSED, m_query);
+
+    for (IRenderedTarget *candidate : candidates)
+        candidate->render(1, origin, ShaderManager::DrawMode::Silhouette);
+
+    m_glF->glEndQuery(GL_ANY_SAMPLES_PASSED);
+    m_glF->glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    const bool ret = finishOcclusionQuery();
+    endQuery(state);
+    return ret;
+}
+
+bool GpuTouchingQuery::touchingColor(
+    const IRenderedTarget *target,
+    const QRectF &rect,
+    const std::vector<IRenderedTarget *> &candidates,
+    IPenLayer *penLayer,
+    QRgb color,
+    bool hasMask,
+    QRgb mask)
+{
+    // https://github.com/scratchfoundation/scratch-render/blob/0a04c2fb165f5c20406ec34ab2ea5682ae45d6e0/src/RenderWebGL.js#L843-L883
+    if (!target->engine())
+        return false;
+
+    // Flush pending pen lines (only if they're in the checked area)
+    QOpenGLFramebufferObject *penFbo = penLayer ? penLayer->framebufferObject() : nullptr;
+    const bool penFboBound = penFbo && penFbo->isBound();
+
+    if (penFboBound)
+        penLayer->flush(rect);
+
+    const QRect region = toRegion(rect);
+    const QPoint origin = regionOrigin(target, region);
+    GLState state;
+    beginQuery(region.size(), state);
+
+    // Draw the candidates in layer order (the pen layer is above the stage and below all sprites)
+    m_compositeFbo->bind();
+    m_glF->glDisable(GL_STENCIL_TEST);
+    m_glF->glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    m_glF->glClear(GL_COLOR_BUFFER_BIT);
+
+    const bool hasStage = std::any_of(candidates.cbegin(), candidates.cend(), [](IRenderedTarget *candidate) { return candidate->stageModel(); });
+
+    if (!hasStage)
+        drawPenLayer(penLayer, target, origin);
+
+    for (auto it = candidates.crbegin(); it != candidates.crend(); it++) {
+        (*it)->render(1, origin, ShaderManager::DrawMode::Default);
+
+        if ((*it)->stageModel())
+            drawPenLayer(penLayer, target, origin);
+    }
+
+    // Mark the target pixels (or the pixels matching the mask) in the stencil buffer
+    m_stencilFbo->bind();
+    m_glF->glEnable(GL_STENCIL_TEST);
+    m_glF->glClearStencil(0);
+    m_glF->glClear(GL_STENCIL_BUFFER_BIT);
+    markTarget(target, origin, hasMask, mask);
+
+    // Find the composited pixels of the given color inside the stencil
+    ShaderManager *shaderManager = ShaderManager::instance();
+    QOpenGLShaderProgram *program = shaderManager->getShaderProgram({}, ShaderManager::DrawMode::ColorMask);
+    Q_ASSERT(program);
+    program->bind();
+    ShaderManager::setUniforms(program, 0, region.size(), {});
+    ShaderManager::setColorMaskUniforms(program, color, COLOR_STEP);
+    ShaderManager::setMatrices(program, QMatrix4x4(), QMatrix4x4());
+
+    m_glF->glViewport(0, 0, m_compositeFbo->width(), m_compositeFbo->height());
+    m_glF->glDisable(GL_BLEND);
+    m_glF->glActiveTexture(GL_TEXTURE0);
+    m_glF->glBindTexture(GL_TEXTURE_2D, m_compositeFbo->texture());
+
+    m_glF->glStencilFunc(GL_EQUAL, 1, 0xFF);
+    m_glF->glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    m_glF->glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    m_glF->glBeginQuery(GL_ANY_SAMPLES_PASSED, m_query);
+    m_glF->glDrawArrays(GL_TRIANGLES, 0, SharedQuad::VERTEX_COUNT);
+    m_glF->glEndQuery(GL_ANY_SAMPLES_PASSED);
+    m_glF->glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    const bool ret = finishOcclusionQuery();
+    endQuery(state);
+
+    // The pen layer is still drawing (the FBO has been restored by endQuery(), but Qt doesn't know about it)
+    if (penFboBound)
+        penFbo->bind();
+
+    return ret;
+}
+
+QRect GpuTouchingQuery::toRegion(const QRectF &rect)
+{
+    // Same pixels as the CPU loops in RenderedTarget (the top and bottom of the rectangle are in Scratch coordinates)
+    return QRect(QPoint(rect.left(), rect.top()), QPoint(rect.right(), rect.bottom()));
+}
+
+QPoint GpuTouchingQuery::regionOrigin(const IRenderedTarget *target, const QRect &region)
+{
+    // Returns the position of the bottom left corner of the region in the stage framebuffer
+    libscratchcpp::IEngine *engine = target->engine();
+    Q_ASSERT(engine);
+    return QPoint(engine->stageWidth() / 2 + region.left(), engine->stageHeight() / 2 + region.top());
+}
+
+void GpuTouchingQuery::beginQuery(const QSize &size, GLState &state)
+{
+    if (!m_glF) {
+        m_glF = std::make_unique<QOpenGLExtraFunctions>();
+        m_glF->initializeOpenGLFunctions();
+    }
+
+    m_glF->glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &state.fbo);
+    m_glF->glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &state.vao);
+    m_glF->glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &state.vbo);
+    m_glF->glGetIntegerv(GL_VIEWPORT, state.viewport);
+    m_glF->glGetIntegerv(GL_SCISSOR_BOX, state.scissorBox);
+    state.scissorTest = m_glF->glIsEnabled(GL_SCISSOR_TEST);
+    state.depthTest = m_glF->glIsEnabled(GL_DEPTH_TEST);
+    state.stencilTest = m_glF->glIsEnabled(GL_STENCIL_TEST);
+
+    if (m_query == 0) {
+        // Create the shared resources (the quad is shared with the other renderers of the context)
+        m_glF->glGenQueries(1, &m_query);
+
+        QObject::connect(QOpenGLContext::currentContext(), &QOpenGLContext::aboutToBeDestroyed, []() {
+            if (QOpenGLContext::currentContext() && m_glF)
+                m_glF->glDeleteQueries(1, &m_query);
+
+            m_query = 0;
+            m_stencilFbo.reset();
+            m_compositeFbo.reset();
+            m_glF.reset();
+        });
+    }
+
+    // The framebuffers only grow, so that they don't have to be reallocated for every query
+    if (!m_stencilFbo || m_stencilFbo->width() < size.width() || m_stencilFbo->height() < size.height()) {
+        QSize fboSize = size;
+
+        if (m_stencilFbo)
+            fboSize = fboSize.expandedTo(m_stencilFbo->size());
+
+        QOpenGLFramebufferObjectFormat format;
+        format.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+
+        m_stencilFbo = std::make_unique<QOpenGLFramebufferObject>(fboSize, format);
+        m_compositeFbo = std::make_unique<QOpenGLFramebufferObject>(fboSize, format);
+    }
+
+    m_glF->glBindVertexArray(SharedQuad::vertexArray(QOpenGLContext::currentContext()));
+    m_glF->glDisable(GL_DEPTH_TEST);
+    m_glF->glEnable(GL_STENCIL_TEST);
+
+    // Only check the pixels of the region (the framebuffers may be larger)
+    m_glF->glEnable(GL_SCISSOR_TEST);
+    m_glF->glScissor(0, 0, size.width(), size.height());
+}
+
+void GpuTouchingQuery::endQuery(const GLState &state)
+{
+    m_glF->glBindFramebuffer(GL_FRAMEBUFFER, state.fbo);
+    m_glF->glBindVertexArray(state.vao);
+    m_glF->glBindBuffer(GL_ARRAY_BUFFER, state.vbo);
+    m_glF->glViewport(state.viewport[0], state.viewport[1], state.viewport[2], state.viewport[3]);
+
+    m_glF->glScissor(state.scissorBox[0], state.scissorBox[1], state.scissorBox[2], state.scissorBox[3]);
+
+    if (!state.scissorTest)
+        m_glF->glDisable(GL_SCISSOR_TEST);
+
+    if (state.depthTest)
+        m_glF->glEnable(GL_DEPTH_TEST);
+
+    if (!state.stencilTest)
+        m_glF->glDisable(GL_STENCIL_TEST);
+}
+
+void GpuTouchingQuery::markTarget(const IRenderedTarget *target, const QPoint &origin, bool hasMask, QRgb mask)
+{
+    m_glF->glStencilFunc(GL_ALWAYS, 1, 0xFF);
+    m_glF->glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    m_glF->glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+    if (hasMask) {
+        // The mask uniforms are kept when the target binds the program
+        QOpenGLShaderProgram *program = ShaderManager::instance()->getShaderProgram(target->graphicEffects(), ShaderManager::DrawMode::ColorMask);
+        Q_ASSERT(program);
+        program->bind();
+        ShaderManager::setColorMaskUniforms(program, mask, MASK_STEP);
+        target->render(1, origin, ShaderManager::DrawMode::ColorMask);
+    } else
+        target->render(1, origin, ShaderManager::DrawMode::Silhouette);
+
+    m_glF->glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void GpuTouchingQuery::drawPenLayer(IPenLayer *penLayer, const IRenderedTarget *target, const QPoint &origin)
+{
+    QOpenGLFramebufferObject *penFbo = penLayer ? penLayer->framebufferObject() : nullptr;
+
+    if (!penFbo)
+        return;
+
+    libscratchcpp::IEngine *engine = target->engine();
+    ShaderManager *shaderManager = ShaderManager::instance();
+    QOpenGLShaderProgram *program = shaderManager->getShaderProgram({});
+    Q_ASSERT(program);
+    program->bind();
+    ShaderManager::setUniforms(program, 0, penFbo->size(), {});
+    ShaderManager::setMatrices(program, QMatrix4x4(), QMatrix4x4());
+
+    // The pen layer FBO may cover only a part of the stage (sparse pen layers)
+    const QRectF rect = penLayer->framebufferRect();
+    const double stageWidth = engine->stageWidth();
+    const double stageHeight = engine->stageHeight();
+    m_glF->glViewport(-origin.x() + rect.x() * stageWidth, -origin.y() + (1 - rect.bottom()) * stageHeight, rect.width() * stageWidth, rect.height() * stageHeight);
+
+    // Pen layer pixels have premultiplied alpha
+    m_glF->glEnable(GL_BLEND);
+    m_glF->glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    m_glF->glActiveTexture(GL_TEXTURE0);
+    m_glF->glBindTexture(GL_TEXTURE_2D, penFbo->texture());
+    m_glF->glDrawArrays(GL_TRIANGLES, 0, SharedQuad::VERTEX_COUNT);
+}
+
+bool GpuTouchingQuery::finishOcclusionQuery()
+{
+    GLuint result = 0;
+    m_glF->glGetQueryObjectuiv(m_query, GL_QUERY_RESULT, &result);
+    return result != 0;
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLExtraFunctions>
+
+#include "shadermanager.h"
+
+namespace scratchcpprender
+{
+
+class IRenderedTarget;
+class IPenLayer;
+
+class GpuTouchingQuery
+{
+    public:
+        GpuTouchingQuery() = delete;
+
+        static int areaThreshold();
+        static void setAreaThreshold(int threshold);
+
+        static bool isSuitable(const QRectF &rect);
+
+        static bool touchingTargets(const IRenderedTarget *target, const QRectF &rect, const std::vector<IRenderedTarget *> &candidates);
+        static bool touchingColor(const IRenderedTarget *target, const QRectF &rect, const std::vector<IRenderedTarget *> &candidates, IPenLayer *penLayer, QRgb color, bool hasMask, QRgb mask);
+
+    private:
+        struct GLState
+        {
+                GLint fbo = 0;
+                GLint vao = 0;
+                GLint vbo = 0;
+                GLint viewport[4] = { 0, 0, 0, 0 };
+                GLint scissorBox[4] = { 0, 0, 0, 0 };
+                GLboolean scissorTest = GL_FALSE;
+                GLboolean depthTest = GL_FALSE;
+                GLboolean stencilTest = GL_FALSE;
+        };
+
+        static QRect toRegion(const QRectF &rect);
+        static QPoint regionOrigin(const IRenderedTarget *target, const QRect &region);
+        static void beginQuery(const QSize &size, GLState &state);
+        static void endQuery(const GLState &state);
+        static void markTarget(const IRenderedTarget *target, const QPoint &origin, bool hasMask, QRgb mask);
+        static void drawPenLayer(IPenLayer *penLayer, const IRenderedTarget *target, const QPoint &origin);
+        static bool finishOcclusionQuery();
+
+        static inline int m_areaThreshold = 128 * 128;
+        static inline std::unique_ptr<QOpenGLExtraFunctions> m_glF;
+        static inline std::unique_ptr<QOpenGLFramebufferObject> m_stencilFbo;   // silhouette of the querying target
+        static inline std::unique_ptr<QOpenGLFramebufferObject> m_compositeFbo; // candidates drawn in layer order
+        static inline GLuint m_query = 0;
+};
+
+} // namespace scratchcpprender
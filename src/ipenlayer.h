@@ -41,11 +41,18 @@ class IPenLayer : public QNanoQuickItem
         virtual void drawPoint(const PenAttributes &penAttributes, double x, double y) = 0;
         virtual void drawLine(const PenAttributes &penAttributes, double x0, double y0, double x1, double y1) = 0;
         virtual void stamp(IRenderedTarget *target) = 0;
+        virtual void flush(const QRectF &rect) = 0;
 
         virtual QOpenGLFramebufferObject *framebufferObject() const = 0;
+        virtual QRectF framebufferRect() const = 0;
+        virtual QRect takeDirtyRect() = 0;
+        virtual void addPaintTime(double time) = 0;
         virtual QRgb colorAtScratchPoint(double x, double y) const = 0;
+        virtual void colorsAtScratchRect(const QRect &rect, QRgb *dst) const = 0;
+        virtual void colorsAtScratchPoints(const std::vector<QPointF> &points, QRgb *dst) const = 0;
 
         virtual const libscratchcpp::Rect &getBounds() const = 0;
+        virtual libscratchcpp::Rect getFastBounds() const = 0;
 };
 
 } // namespace scratchcpprender
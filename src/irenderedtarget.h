@@ -19,6 +19,8 @@ class StageModel;
 class SpriteModel;
 class SceneMouseArea;
 class Texture;
+class TextureSpans;
+struct PenStamp;
 
 class IRenderedTarget : public QNanoQuickItem
 {
@@ -78,6 +80,8 @@ class IRenderedTarget : public QNanoQuickItem
         virtual bool mirrorHorizontally() const = 0;
 
         virtual void render(double scale) const = 0;
+        virtual void render(double scale, const QPoint &origin, ShaderManager::DrawMode drawMode) const = 0;
+        virtual bool getStamp(double scale, PenStamp &dst) const = 0;
 
         virtual Texture texture() const = 0;
         virtual const Texture &cpuTexture() const = 0;
@@ -91,6 +95,7 @@ class IRenderedTarget : public QNanoQuickItem
         virtual const std::vector<QPoint> &hullPoints() const = 0;
 
         virtual bool containsScratchPoint(double x, double y) const = 0;
+        virtual void getScratchSpans(const QRect &rect, TextureSpans &dst) const = 0;
         virtual QRgb colorAtScratchPoint(double x, double y) const = 0;
 
         virtual bool touchingClones(const std::vector<libscratchcpp::Sprite *> &clones) const = 0;
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "pencommandbuffer.h"
+
+using namespace scratchcpprender;
+
+size_t PenCommandBuffer::size() const
+{
+    return m_types.size();
+}
+
+bool PenCommandBuffer::empty() const
+{
+    return m_types.empty();
+}
+
+void PenCommandBuffer::clear()
+{
+    // The capacity is kept for the next frame
+    m_types.clear();
+    m_coords.clear();
+    m_diameters.clear();
+    m_colors.clear();
+}
+
+void PenCommandBuffer::addLine(float x0, float y0, float x1, float y1, float diameter, const QNanoColor &color)
+{
+    // If the start and end coordinates are the same, it's a point
+    m_types.push_back(x0 == x1 && y0 == y1 ? Type::Point : Type::Line);
+    m_coords.insert(m_coords.end(), { x0, y0, x1, y1 });
+    m_diameters.push_back(diameter);
+    m_colors.push_back(packColor(color));
+}
+
+void PenCommandBuffer::addStamp()
+{
+    // Keep the attribute arrays aligned with the commands
+    m_types.push_back(Type::Stamp);
+    m_coords.insert(m_coords.end(), { 0, 0, 0, 0 });
+    m_diameters.push_back(0);
+    m_colors.push_back(0);
+}
+
+PenCommandBuffer::Type PenCommandBuffer::type(size_t index) const
+{
+    return m_types[index];
+}
+
+const float *PenCommandBuffer::coords(size_t index) const
+{
+    return m_coords.data() + index * 4;
+}
+
+float PenCommandBuffer::diameter(size_t index) const
+{
+    return m_diameters[index];
+}
+
+quint32 PenCommandBuffer::color(size_t index) const
+{
+    return m_colors[index];
+}
+
+const float *PenCommandBuffer::diameters() const
+{
+    return m_diameters.data();
+}
+
+const quint32 *PenCommandBuffer::colors() const
+{
+    return m_colors.data();
+}
+
+QNanoColor PenCommandBuffer::nanoColor(size_t index) const
+{
+    const quint32 color = m_colors[index];
+    const uchar *bytes = reinterpret_cast<const uchar *>(&color);
+    return QNanoColor(bytes[0], bytes[1], bytes[2], bytes[3]);
+}
+
+quint32 PenCommandBuffer::packColor(const QNanoColor &color)
+{
+    // QNanoColor::red() etc. truncate the components, so round them instead
+    quint32 ret;
+    uchar *bytes = reinterpret_cast<uchar *>(&ret);
+    bytes[0] = qRound(color.redF() * 255.0f);
+    bytes[1] = qRound(color.greenF() * 255.0f);
+    bytes[2] = qRound(color.blueF() * 255.0f);
+    bytes[3] = qRound(color.alphaF() * 255.0f);
+    return ret;
+}
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QtGlobal>
+#include <qnanocolor.h>
+#include <vector>
+
+namespace scratchcpprender
+{
+
+// Queued pen commands stored as arrays of attributes which can be uploaded to vertex buffers directly
+class PenCommandBuffer
+{
+    public:
+        enum class Type : quint8
+        {
+            Line,
+            Point,
+            Stamp // the stamps are stored separately (in the same order)
+        };
+
+        PenCommandBuffer() = default;
+
+        size_t size() const;
+        bool empty() const;
+        void clear();
+
+        void addLine(float x0, float y0, float x1, float y1, float diameter, const QNanoColor &color);
+        void addStamp();
+
+        Type type(size_t index) const;
+        const float *coords(size_t index) const;
+        float diameter(size_t index) const;
+        quint32 color(size_t index) const;
+        QNanoColor nanoColor(size_t index) const;
+
+        const float *diameters() const;
+        const quint32 *colors() const;
+
+        static quint32 packColor(const QNanoColor &color);
+
+    private:
+        std::vector<Type> m_types;
+        std::vector<float> m_coords; // x0, y0, x1, y1 of each command
+        std::vector<float> m_diameters;
+        std::vector<quint32> m_colors; // RGBA bytes in memory order
+};
+
+} // namespace scratchcpprender
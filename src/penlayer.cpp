@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: LGPL-3.0-or-later
 
 #include <scratchcpp/costume.h>
+#include <QPainter>
 
 #include "penlayer.h"
 #include "penlayerpainter.h"
@@ -11,7 +12,11 @@
 using namespace scratchcpprender;
 
 static const double pi = std::acos(-1); // TODO: Use std::numbers::pi in C++20
-static const int PEN_LINES_RESERVE = 10240;
+static const int TILE_SIZE = 64;
+static const int SPARSE_TILE_SIZE = 256;
+static const QRect EMPTY_FBO_RECT(0, 0, 1, 1); // sparse pen layers without any content only have a single pixel
+static const qint64 FBO_POOL_BUDGET = 32 * 1024 * 1024; // bytes
+static const int FBO_BYTES_PER_PIXEL = 8;               // RGBA8 color and 24-bit depth with 8-bit stencil
 
 std::unordered_map<libscratchcpp::IEngine *, IPenLayer *> PenLayer::m_projectPenLayers;
 
@@ -19,25 +24,12 @@ PenLayer::PenLayer(QNanoQuickItem *parent) :
     IPenLayer(parent)
 {
     setSmooth(false);
-
-    // Reserve space for pen lines
-    m_penLines.reserve(PEN_LINES_RESERVE);
-
-    for (int i = 0; i < PEN_LINES_RESERVE; i++) {
-        m_penLines.push_back(PenLine());
-    }
 }
 
 PenLayer::~PenLayer()
 {
     if (m_engine)
         m_projectPenLayers.erase(m_engine);
-
-    if (m_vao != 0) {
-        // Delete vertex array and buffer
-        m_glF->glDeleteVertexArrays(1, &m_vao);
-        m_glF->glDeleteBuffers(1, &m_vbo);
-    }
 }
 
 bool PenLayer::antialiasingEnabled() const
@@ -85,30 +77,6 @@ void PenLayer::setEngine(libscratchcpp::IEngine *newEngine)
 
         refresh();
 
-        if (m_vao == 0) {
-            // Set up VBO and VAO
-            float vertices[] = { -1.0f, -1.0f, 0.0f, 0.0f, 1.0f, -1.0f, 1.0f, 0.0f, -1.0f, 1.0f, 0.0f, 1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 1.0f };
-
-            m_glF->glGenVertexArrays(1, &m_vao);
-            m_glF->glGenBuffers(1, &m_vbo);
-
-            m_glF->glBindVertexArray(m_vao);
-
-            m_glF->glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-            m_glF->glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-            // Position attribute
-            m_glF->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
-            m_glF->glEnableVertexAttribArray(0);
-
-            // Texture coordinate attribute
-            m_glF->glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(2 * sizeof(float)));
-            m_glF->glEnableVertexAttribArray(1);
-
-            m_glF->glBindVertexArray(0);
-            m_glF->glBindBuffer(GL_ARRAY_BUFFER, 0);
-        }
-
         bool wasBound = m_fbo->isBound();
 
         if (wasBound)
@@ -125,30 +93,37 @@ void PenLayer::setEngine(libscratchcpp::IEngine *newEngine)
 
 void PenLayer::beginFrame()
 {
+    // Lower the resolution if drawing and painting the frames takes too long (and increase it back if it's fast again),
+    // the time between the frames doesn't matter because it mostly depends on the frame rate
+    if (m_frameTime >= 0 && m_resolutionPolicy.addFrameTime(m_frameTime + m_paintTime))
+        m_refreshPending = true;
+
+    m_frameTime = -1;
+    m_paintTime = 0;
+    m_frameTimer.start();
+
+    if (m_refreshPending)
+        refresh();
+
     m_fbo->bind();
     m_glF->glDisable(GL_SCISSOR_TEST);
     m_glF->glDisable(GL_DEPTH_TEST);
 
-    m_glF->glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-    m_glF->glBindVertexArray(m_vao);
-
     m_penLineAdded = false;
     m_stampAdded = false;
 }
 
 void PenLayer::endFrame()
 {
-    m_glF->glBindVertexArray(0);
-    m_glF->glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    beginPainterFrame();
-    renderLines();
-    endPainterFrame();
+    flushCommands();
 
     m_fbo->release();
     m_glF->glEnable(GL_SCISSOR_TEST);
     m_glF->glEnable(GL_DEPTH_TEST);
 
+    if (m_frameTimer.isValid())
+        m_frameTime = m_frameTimer.nsecsElapsed() / 1e6;
+
     if (m_penLineAdded || m_stampAdded) {
         update();
         m_penLineAdded = false;
@@ -171,6 +146,129 @@ void PenLayer::setHqPen(bool newHqPen)
     refresh();
 }
 
+bool PenLayer::shadowRaster() const
+{
+    return m_raster != nullptr;
+}
+
+void PenLayer::setShadowRaster(bool newShadowRaster)
+{
+    if (shadowRaster() == newShadowRaster)
+        return;
+
+    if (newShadowRaster) {
+        // The raster is filled with the FBO content on first use
+        m_raster = std::make_unique<PenRaster>();
+        m_rasterSynced = false;
+    } else
+        m_raster.reset();
+
+    emit shadowRasterChanged();
+}
+
+bool PenLayer::instancedPen() const
+{
+    return m_instancedPen;
+}
+
+void PenLayer::setInstancedPen(bool newInstancedPen)
+{
+    if (m_instancedPen == newInstancedPen)
+        return;
+
+    m_instancedPen = newInstancedPen;
+    emit instancedPenChanged();
+}
+
+bool PenLayer::sparsePen() const
+{
+    return m_sparsePen;
+}
+
+void PenLayer::setSparsePen(bool newSparsePen)
+{
+    if (m_sparsePen == newSparsePen)
+        return;
+
+    m_sparsePen = newSparsePen;
+    emit sparsePenChanged();
+
+    // The FBO must cover the whole pen layer again (a sparse FBO is reduced when the pen layer is cleared)
+    if (!m_sparsePen)
+        refresh();
+}
+
+double PenLayer::maxScale() const
+{
+    return m_resolutionPolicy.maxScale();
+}
+
+void PenLayer::setMaxScale(double newMaxScale)
+{
+    if (m_resolutionPolicy.maxScale() == newMaxScale)
+        return;
+
+    m_resolutionPolicy.setMaxScale(newMaxScale);
+    emit maxScaleChanged();
+
+    // Applied at the next frame
+    m_refreshPending = true;
+    polish();
+}
+
+qint64 PenLayer::memoryBudget() const
+{
+    return m_resolutionPolicy.memoryBudget();
+}
+
+void PenLayer::setMemoryBudget(qint64 newMemoryBudget)
+{
+    if (m_resolutionPolicy.memoryBudget() == newMemoryBudget)
+        return;
+
+    m_resolutionPolicy.setMemoryBudget(newMemoryBudget);
+    emit memoryBudgetChanged();
+
+    // Applied at the next frame
+    m_refreshPending = true;
+    polish();
+}
+
+double PenLayer::targetFrameTime() const
+{
+    return m_resolutionPolicy.targetFrameTime();
+}
+
+void PenLayer::setTargetFrameTime(double newTargetFrameTime)
+{
+    if (m_resolutionPolicy.targetFrameTime() == newTargetFrameTime)
+        return;
+
+    m_resolutionPolicy.setTargetFrameTime(newTargetFrameTime);
+    emit targetFrameTimeChanged();
+
+    // Applied at the next frame
+    m_refreshPending = true;
+    polish();
+}
+
+double PenLayer::penScale() const
+{
+    // The ratio between the resolution of the pen layer and the resolution of the stage
+    return m_scale;
+}
+
+qint64 PenLayer::pooledFboMemory() const
+{
+    // The memory used by the unused FBOs which are kept for later resizes (in bytes)
+    qint64 ret = 0;
+
+    for (const auto &fbo : m_fboPool)
+        ret += fboMemory(fbo->size());
+
+    return ret;
+}
+
 void scratchcpprender::PenLayer::clear()
 {
     if (!m_fbo)
@@ -178,13 +276,31 @@ void scratchcpprender::PenLayer::clear()
 
     Q_ASSERT(m_fbo->isBound());
 
-    m_penLineCount = 0;
+    m_commands.clear();
+    m_stamps.clear();
+    m_pendingRect = QRect();
     m_penLineAdded = false;
     m_stampAdded = false;
+    m_fastBoundsEmpty = true;
 
     m_glF->glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     m_glF->glClear(GL_COLOR_BUFFER_BIT);
 
+    clearTiles();
+    m_dirtyRect = QRect(QPoint(0, 0), m_surfaceSize);
+
+    // Free the tiles of sparse pen layers (the FBO is kept in the pool for the next drawing)
+    if (m_sparsePen && m_fboUsed)
+        reallocateFbo(EMPTY_FBO_RECT, QRectF(), true);
+
+    m_fboUsed = false;
+
+    if (m_raster) {
+        m_raster->resize(m_surfaceSize);
+        m_raster->clear();
+        m_rasterSynced = true;
+    }
+
     m_textureDirty = true;
     m_boundsDirty = true;
     update();
@@ -202,6 +318,17 @@ void scratchcpprender::PenLayer::drawLine(const PenAttributes &penAttributes, do
 
     Q_ASSERT(m_fbo->isBound());
 
+    // Skip lines which are entirely outside the stage (with a margin for the offset and antialiasing)
+    const double radius = penAttributes.diameter / 2 + 1;
+    const double stageRight = m_surfaceSize.width() / 2 / m_scale;
+    const double stageTop = m_surfaceSize.height() / 2 / m_scale;
+
+    if (std::max(x0, x1) + radius < -stageRight || std::min(x0, x1) - radius > stageRight || std::max(y0, y1) + radius < -stageTop || std::min(y0, y1) - radius > stageTop)
+        return;
+
+    // Grow the fast bounds
+    addFastBounds(std::min(x0, x1) - radius, std::max(y0, y1) + radius, std::max(x0, x1) + radius, std::min(y0, y1) - radius);
+
     // Apply scale (HQ pen)
     x0 *= m_scale;
     y0 *= m_scale;
@@ -209,28 +336,22 @@ void scratchcpprender::PenLayer::drawLine(const PenAttributes &penAttributes, do
     y1 *= m_scale;
 
     // Translate to Scratch coordinate system
-    double stageWidthHalf = width() / 2;
-    double stageHeightHalf = height() / 2;
+    double stageWidthHalf = m_surfaceSize.width() / 2.0;
+    double stageHeightHalf = m_surfaceSize.height() / 2.0;
     x0 += stageWidthHalf;
     y0 = stageHeightHalf - y0;
     x1 += stageWidthHalf;
     y1 = stageHeightHalf - y1;
 
     // Render the line later
-    if (m_penLineCount == m_penLines.size()) {
-        m_penLines.reserve(m_penLineCount * 2);
+    m_commands.addLine(x0, y0, x1, y1, penAttributes.diameter * m_scale, penAttributes.color);
 
-        for (size_t i = m_penLineCount; i < m_penLineCount * 2; i++) {
-            m_penLines.push_back(PenLine());
-        }
-    }
+    // Mark the area covered by the line dirty (with a margin for antialiasing)
+    const double margin = penAttributes.diameter * m_scale / 2 + 1;
+    markDirty(QRectF(QPointF(std::min(x0, x1) - margin, std::min(y0, y1) - margin), QPointF(std::max(x0, x1) + margin, std::max(y0, y1) + margin)));
 
-    PenLine &line = m_penLines[m_penLineCount++];
-    line.x0 = x0;
-    line.y0 = y0;
-    line.x1 = x1;
-    line.y1 = y1;
-    line.attributes = penAttributes;
+    if (m_raster && m_rasterSynced)
+        m_raster->drawLine(x0, y0, x1, y1, penAttributes.diameter * m_scale, penAttributes.color, m_antialiasingEnabled);
 
     m_textureDirty = true;
     m_boundsDirty = true;
@@ -239,36 +360,79 @@ void scratchcpprender::PenLayer::drawLine(const PenAttributes &penAttributes, do
 
 void PenLayer::stamp(IRenderedTarget *target)
 {
-    if (!target || !m_fbo || !m_texture.isValid() || m_vao == 0 || m_vbo == 0)
+    if (!target || !m_fbo || !m_texture.isValid())
         return;
 
     Q_ASSERT(m_fbo->isBound());
 
-    if (m_penLineAdded) {
-        m_glF->glBindVertexArray(0);
-        m_glF->glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // Render the stamp later (together with lines and other stamps)
+    m_stamps.emplace_back();
 
-        beginPainterFrame();
-        renderLines();
-        endPainterFrame();
-        m_penLineAdded = false;
-
-        m_glF->glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-        m_glF->glBindVertexArray(m_vao);
+    if (!target->getStamp(m_scale, m_stamps.back())) {
+        m_stamps.pop_back();
+        return;
     }
 
-    target->render(m_scale);
+    m_commands.addStamp();
+
+    // Mark the area covered by the target dirty
+    const libscratchcpp::Rect bounds = target->getFastBounds();
+    const double stageWidthHalf = m_surfaceSize.width() / 2.0;
+    const double stageHeightHalf = m_surfaceSize.height() / 2.0;
+    markDirty(QRectF(
+        QPointF(bounds.left() * m_scale + stageWidthHalf - 1, stageHeightHalf - bounds.top() * m_scale - 1),
+        QPointF(bounds.right() * m_scale + stageWidthHalf + 1, stageHeightHalf - bounds.bottom() * m_scale + 1)));
+
+    if (m_raster && m_rasterSynced)
+        m_raster->stamp(target, m_scale);
+
+    addFastBounds(bounds.left() - 1, bounds.top() + 1, bounds.right() + 1, bounds.bottom() - 1);
 
     m_textureDirty = true;
     m_boundsDirty = true;
     m_stampAdded = true;
 }
 
+void PenLayer::flush(const QRectF &rect)
+{
+    // Renders the queued commands if they may change the given rectangle (in Scratch coordinates),
+    // the content drawn before is already in the FBO
+    const double stageWidthHalf = m_surfaceSize.width() / 2.0;
+    const double stageHeightHalf = m_surfaceSize.height() / 2.0;
+    const QRectF surfaceRect(
+        QPointF(rect.left() * m_scale + stageWidthHalf - 1, stageHeightHalf - rect.bottom() * m_scale - 1),
+        QPointF(rect.right() * m_scale + stageWidthHalf + 1, stageHeightHalf - rect.top() * m_scale + 1));
+
+    flushPending(surfaceRect.toAlignedRect());
+}
+
 void PenLayer::refresh()
 {
+    m_refreshPending = false;
+
     if (!m_glCtx || !m_surface || !m_engine || !m_glF)
         return;
 
+    const double stageWidth = m_engine->stageWidth();
+    QSize newSize(width(), height());
+    double scale = width() / stageWidth;
+
+    // The resolution of HQ pen layers may be lower than the resolution of the item (they're scaled when painted)
+    const double penScale = m_resolutionPolicy.scale(scale, newSize);
+
+    if (penScale < scale) {
+        newSize = QSize(std::max(1, qRound(width() * penScale / scale)), std::max(1, qRound(height() * penScale / scale)));
+        scale = newSize.width() / stageWidth;
+    }
+
+    // Skip the reallocation (and context switching) if the size didn't change and no queued commands use another scale
+    const bool resize = !(m_fbo && newSize == m_surfaceSize && (m_sparsePen || m_fboRect.size() == newSize));
+
+    if (!resize && (scale == m_scale || m_commands.empty())) {
+        m_scale = scale;
+        return;
+    }
+
     QOpenGLContext *oldCtx = QOpenGLContext::currentContext();
     QSurface *oldSurface = oldCtx->surface();
 
@@ -277,21 +441,28 @@ void PenLayer::refresh()
         m_glCtx->makeCurrent(m_surface);
     }
 
-    QOpenGLFramebufferObjectFormat fboFormat;
-    fboFormat.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+    // The queued commands use the old scale, so they must be rendered first
+    if (m_fbo && !m_commands.empty()) {
+        const bool bound = m_fbo->isBound();
 
-    QOpenGLFramebufferObject *newFbo = new QOpenGLFramebufferObject(width(), height(), fboFormat);
-    Q_ASSERT(newFbo->isValid());
+        if (!bound)
+            m_fbo->bind();
 
-    if (m_fbo) {
-        m_glF->glDisable(GL_SCISSOR_TEST);
-        QOpenGLFramebufferObject::blitFramebuffer(newFbo, m_fbo.get());
-        m_glF->glEnable(GL_SCISSOR_TEST);
+        flushCommands();
+
+        if (bound) {
+            // Restore the state of beginFrame()
+            m_fbo->bind();
+            m_glF->glDisable(GL_SCISSOR_TEST);
+            m_glF->glDisable(GL_DEPTH_TEST);
+        } else
+            m_fbo->release();
     }
 
-    m_fbo.reset(newFbo);
-    m_texture = Texture(m_fbo->texture(), m_fbo->size());
-    m_scale = width() / m_engine->stageWidth();
+    if (resize)
+        reallocateSurface(newSize);
+
+    m_scale = scale;
 
     if (oldCtx != m_glCtx) {
         m_glCtx->doneCurrent();
@@ -299,21 +470,73 @@ void PenLayer::refresh()
     }
 }
 
+void PenLayer::reallocateSurface(const QSize &newSize)
+{
+    const QSize oldSize = m_surfaceSize;
+    m_surfaceSize = newSize;
+    QRect rect(QPoint(0, 0), m_surfaceSize);
+    QRectF copyRect;
+
+    if (m_fbo) {
+        // Scale the old content to the new size
+        const double scaleX = m_surfaceSize.width() / static_cast<double>(oldSize.width());
+        const double scaleY = m_surfaceSize.height() / static_cast<double>(oldSize.height());
+        copyRect = QRectF(m_fboRect.x() * scaleX, m_fboRect.y() * scaleY, m_fboRect.width() * scaleX, m_fboRect.height() * scaleY);
+    }
+
+    if (m_sparsePen)
+        rect = m_fboUsed ? sparseRect(copyRect.toAlignedRect().intersected(rect)) : EMPTY_FBO_RECT;
+
+    // FBOs replaced because of a resize are kept in the pool
+    reallocateFbo(rect, m_sparsePen && !m_fboUsed ? QRectF() : copyRect, m_surfaceSize != oldSize);
+    resetTiles();
+    m_dirtyRect = QRect(QPoint(0, 0), m_surfaceSize);
+
+    // The shadow raster is resampled like the FBO
+    if (m_raster && m_rasterSynced)
+        m_raster->resize(m_surfaceSize);
+}
+
 QOpenGLFramebufferObject *PenLayer::framebufferObject() const
 {
+    // Pending resizes are applied at the next frame (see beginFrame() and updatePolish())
     return m_fbo.get();
 }
 
-QRgb PenLayer::colorAtScratchPoint(double x, double y) const
+QRectF PenLayer::framebufferRect() const
 {
-    if (m_textureDirty)
-        const_cast<PenLayer *>(this)->updateTexture();
+    // Returns the part of the pen layer covered by the FBO (1 is the whole width or height)
+    if (m_surfaceSize.isEmpty())
+        return QRectF();
+
+    const double width = m_surfaceSize.width();
+    const double height = m_surfaceSize.height();
+    return QRectF(m_fboRect.x() / width, m_fboRect.y() / height, m_fboRect.width() / width, m_fboRect.height() / height);
+}
+
+QRect PenLayer::takeDirtyRect()
+{
+    // Returns the part of the FBO which changed since the last call
+    flushPending(m_dirtyRect);
+
+    QRect rect = m_dirtyRect;
+    m_dirtyRect = QRect();
+    return rect;
+}
+
+void PenLayer::addPaintTime(double time)
+{
+    // Called by the painter, the time is added to the next frame time
+    m_paintTime += time;
+}
 
+QRgb PenLayer::colorAtScratchPoint(double x, double y) const
+{
     if (!m_texture.isValid())
         return qRgba(0, 0, 0, 0);
 
-    const double width = m_texture.width();
-    const double height = m_texture.height();
+    const double width = m_surfaceSize.width();
+    const double height = m_surfaceSize.height();
 
     // Apply scale (HQ pen)
     x *= m_scale;
@@ -327,82 +550,155 @@ QRgb PenLayer::colorAtScratchPoint(double x, double y) const
     if ((x < 0 || x >= width) || (y < 0 || y >= height))
         return qRgba(0, 0, 0, 0);
 
-    bool bound = m_fbo->isBound();
+    // Use the CPU copy if it's enabled
+    if (m_raster) {
+        syncRaster();
+        return m_raster->pixel(x, y);
+    }
 
-    if (bound)
-        const_cast<PenLayer *>(this)->endFrame();
+    // Only read back the tile which contains the point
+    const int column = x / TILE_SIZE;
+    const int row = y / TILE_SIZE;
+    const TextureSpans &tile = readTile(column, row);
+    return tile.pixel(x - column * TILE_SIZE, y - row * TILE_SIZE);
+}
 
-    GLubyte *data = m_textureManager.getTextureData(m_texture);
-    const int index = (y * width + x) * 4; // RGBA channels
-    Q_ASSERT(index >= 0 && index < width * height * 4);
+void PenLayer::colorsAtScratchRect(const QRect &rect, QRgb *dst) const
+{
+    // Samples the pixels of the rectangle (in Scratch coordinates, rows from top() to bottom() and columns from left() to right())
+    // into dst row by row, the colors are the same as the colors returned by colorAtScratchPoint()
+    if (rect.isEmpty())
+        return;
 
-    if (bound)
-        const_cast<PenLayer *>(this)->beginFrame();
+    std::fill(dst, dst + rect.width() * rect.height(), qRgba(0, 0, 0, 0));
 
-    return qRgba(data[index], data[index + 1], data[index + 2], data[index + 3]);
-}
+    if (!m_texture.isValid())
+        return;
 
-const libscratchcpp::Rect &PenLayer::getBounds() const
-{
-    if (m_textureDirty)
-        const_cast<PenLayer *>(this)->updateTexture();
+    const double width = m_surfaceSize.width();
+    const double height = m_surfaceSize.height();
 
-    if (m_boundsDirty) {
-        if (!m_texture.isValid()) {
-            m_bounds = libscratchcpp::Rect();
-            return m_bounds;
-        }
+    // The column of each x (the same in all rows)
+    std::vector<int> columns(rect.width());
 
-        m_boundsDirty = false;
-        double left = std::numeric_limits<double>::infinity();
-        double top = -std::numeric_limits<double>::infinity();
-        double right = -std::numeric_limits<double>::infinity();
-        double bottom = std::numeric_limits<double>::infinity();
-        const double width = m_texture.width();
-        const double height = m_texture.height();
-        std::vector<QPoint> points;
+    for (int i = 0; i < rect.width(); i++)
+        columns[i] = std::floor((rect.left() + i) * m_scale + width / 2.0);
 
-        bool bound = m_fbo->isBound();
+    const int left = std::max(columns.front(), 0);
+    const int right = std::min(columns.back(), m_surfaceSize.width() - 1);
+    const int top = std::max<int>(std::floor(-rect.bottom() * m_scale + height / 2.0), 0);
+    const int bottom = std::min<int>(std::floor(-rect.top() * m_scale + height / 2.0), m_surfaceSize.height() - 1);
 
-        if (bound)
-            const_cast<PenLayer *>(this)->endFrame();
+    if (left > right || top > bottom)
+        return;
 
-        m_textureManager.getTextureConvexHullPoints(m_texture, QSize(), ShaderManager::Effect::NoEffect, {}, points);
+    // Render pending commands (if they're in the rectangle) before reading the rows
+    if (m_raster)
+        syncRaster();
+    else
+        flushPending(QRect(QPoint(left, top), QPoint(right, bottom)));
 
-        if (bound)
-            const_cast<PenLayer *>(this)->beginFrame();
+    std::vector<QRgb> row(m_raster ? 0 : right - left + 1);
 
-        if (points.empty()) {
-            m_bounds = libscratchcpp::Rect();
-            return m_bounds;
+    for (int i = 0; i < rect.height(); i++) {
+        const int y = std::floor(-(rect.top() + i) * m_scale + height / 2.0);
+
+        if (y < top || y > bottom)
+            continue;
+
+        const QRgb *src;
+
+        if (m_raster)
+            src = reinterpret_cast<const QRgb *>(m_raster->image().constScanLine(y)) + left;
+        else {
+            readRow(y, left, row.size(), row.data());
+            src = row.data();
+        }
+
+        QRgb *rowDst = dst + i * rect.width();
+
+        for (int j = 0; j < rect.width(); j++) {
+            if (columns[j] >= left && columns[j] <= right)
+                rowDst[j] = src[columns[j] - left];
         }
+    }
+}
 
-        for (const QPointF &point : points) {
-            double x = point.x() - width / 2;
-            double y = -point.y() + height / 2;
+void PenLayer::colorsAtScratchPoints(const std::vector<QPointF> &points, QRgb *dst) const
+{
+    // Samples the given points (in Scratch coordinates) into dst, this is the same as calling colorAtScratchPoint() for each point
+    std::fill(dst, dst + points.size(), qRgba(0, 0, 0, 0));
 
-            if (x < left)
-                left = x;
+    if (points.empty() || !m_texture.isValid())
+        return;
 
-            if (x > right)
-                right = x;
+    const double width = m_surfaceSize.width();
+    const double height = m_surfaceSize.height();
+    std::vector<QPoint> surfacePoints;
+    surfacePoints.reserve(points.size());
+    QRect rect;
 
-            if (y > top)
-                top = y;
+    for (const QPointF &point : points) {
+        const QPoint surfacePoint(std::floor(point.x() * m_scale + width / 2.0), std::floor(-point.y() * m_scale + height / 2.0));
+        surfacePoints.push_back(surfacePoint);
+        rect |= QRect(surfacePoint, QSize(1, 1));
+    }
 
-            if (y < bottom)
-                bottom = y;
+    // Render pending commands (if they're near any of the points) only once
+    if (m_raster)
+        syncRaster();
+    else
+        flushPending(rect);
+
+    for (size_t i = 0; i < surfacePoints.size(); i++) {
+        const QPoint &point = surfacePoints[i];
+
+        if (point.x() < 0 || point.x() >= width || point.y() < 0 || point.y() >= height)
+            continue;
+
+        if (m_raster)
+            dst[i] = m_raster->pixel(point.x(), point.y());
+        else {
+            const int column = point.x() / TILE_SIZE;
+            const int row = point.y() / TILE_SIZE;
+            dst[i] = readTile(column, row).pixel(point.x() - column * TILE_SIZE, point.y() - row * TILE_SIZE);
         }
+    }
+}
+
+const libscratchcpp::Rect &PenLayer::getBounds() const
+{
+    if (m_textureDirty)
+        const_cast<PenLayer *>(this)->updateTexture();
+
+    if (m_boundsDirty) {
+        updateBounds();
 
-        m_bounds.setLeft(left / m_scale);
-        m_bounds.setTop(top / m_scale);
-        m_bounds.setRight(right / m_scale + 1);
-        m_bounds.setBottom(bottom / m_scale - 1);
+        // The exact bounds are tighter than the fast bounds
+        m_fastBounds = m_bounds;
+        m_fastBoundsEmpty = m_bounds.width() == 0 && m_bounds.height() == 0;
     }
 
     return m_bounds;
 }
 
+libscratchcpp::Rect PenLayer::getFastBounds() const
+{
+    // Returns bounds which contain all pixels of the pen layer, without reading it back
+    if (m_fastBoundsEmpty)
+        return libscratchcpp::Rect();
+
+    // Limit the bounds to the stage
+    const double stageWidthHalf = m_surfaceSize.width() / 2 / m_scale;
+    const double stageHeightHalf = m_surfaceSize.height() / 2 / m_scale;
+
+    return libscratchcpp::Rect(
+        std::max(m_fastBounds.left(), -stageWidthHalf),
+        std::min(m_fastBounds.top(), stageHeightHalf),
+        std::min(m_fastBounds.right(), stageWidthHalf),
+        std::max(m_fastBounds.bottom(), -stageHeightHalf));
+}
+
 IPenLayer *PenLayer::getProjectPenLayer(libscratchcpp::IEngine *engine)
 {
     auto it = m_projectPenLayers.find(engine);
@@ -434,20 +730,147 @@ QNanoQuickItemPainter *PenLayer::createItemPainter() const
 
 void PenLayer::geometryChange(const QRectF &newGeometry, const QRectF &oldGeometry)
 {
-    if (m_hqPen && newGeometry != oldGeometry)
-        refresh();
+    // Resizes are coalesced and the FBO is reallocated at most once per frame
+    if (newGeometry.size() != oldGeometry.size()) {
+        // Try the full resolution with the new size
+        m_resolutionPolicy.reset();
+        m_refreshPending = true;
+        polish();
+    }
 
     QNanoQuickItem::geometryChange(newGeometry, oldGeometry);
 }
 
+void PenLayer::updatePolish()
+{
+    if (m_refreshPending)
+        refresh();
+
+    QNanoQuickItem::updatePolish();
+}
+
+void PenLayer::reallocateFbo(const QRect &rect, const QRectF &copyRect, bool poolOldFbo)
+{
+    // Replaces the FBO with a new one which covers the given part of the pen layer
+    // and copies the old FBO to copyRect (both rectangles are in pen layer coordinates)
+    const bool bound = m_fbo && m_fbo->isBound();
+    GLint oldFbo = 0;
+    m_glF->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &oldFbo);
+
+    const GLboolean scissorTest = m_glF->glIsEnabled(GL_SCISSOR_TEST);
+    m_glF->glDisable(GL_SCISSOR_TEST);
+
+    QOpenGLFramebufferObjectFormat fboFormat;
+    fboFormat.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+
+    // Reuse a pooled FBO of exactly the same size (e.g. when the pen layer shrinks and grows again)
+    std::unique_ptr<QOpenGLFramebufferObject> newFbo;
+    auto it = std::find_if(m_fboPool.begin(), m_fboPool.end(), [&rect](const std::unique_ptr<QOpenGLFramebufferObject> &fbo) { return fbo->size() == rect.size(); });
+
+    if (it != m_fboPool.end()) {
+        newFbo = std::move(*it);
+        m_fboPool.erase(it);
+    } else
+        newFbo = std::make_unique<QOpenGLFramebufferObject>(rect.size(), fboFormat);
+
+    Q_ASSERT(newFbo->isValid());
+
+    // OpenGL uses the bottom left corner as origin
+    const QRect target = QRectF(copyRect.x() - rect.x(), rect.y() + rect.height() - copyRect.y() - copyRect.height(), copyRect.width(), copyRect.height()).toRect();
+    const bool copy = m_fbo && !target.isEmpty();
+
+    // Clear the part which isn't covered by the old FBO
+    if (!copy || target != QRect(QPoint(0, 0), rect.size())) {
+        newFbo->bind();
+        m_glF->glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        m_glF->glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    if (copy)
+        QOpenGLFramebufferObject::blitFramebuffer(newFbo.get(), target, m_fbo.get(), QRect(QPoint(0, 0), m_fbo->size()));
+
+    if (m_texture.isValid())
+        m_textureManager.removeTexture(m_texture);
+
+    // Keep the old FBO for later if requested, otherwise it's freed
+    if (m_fbo && poolOldFbo)
+        addToFboPool(std::move(m_fbo));
+
+    m_fbo = std::move(newFbo);
+    m_fboRect = rect;
+    m_texture = Texture(m_fbo->texture(), m_fbo->size());
+    m_textureDirty = true;
+
+    if (bound)
+        m_fbo->bind();
+    else
+        m_glF->glBindFramebuffer(GL_FRAMEBUFFER, oldFbo);
+
+    if (scissorTest)
+        m_glF->glEnable(GL_SCISSOR_TEST);
+}
+
+void PenLayer::addToFboPool(std::unique_ptr<QOpenGLFramebufferObject> fbo)
+{
+    // The pool is matched by exact size, so only one FBO is kept per size (the newest one)
+    const QSize size = fbo->size();
+    m_fboPool.erase(std::remove_if(m_fboPool.begin(), m_fboPool.end(), [&size](const std::unique_ptr<QOpenGLFramebufferObject> &pooled) { return pooled->size() == size; }), m_fboPool.end());
+
+    if (fboMemory(fbo->size()) > FBO_POOL_BUDGET)
+        return;
+
+    m_fboPool.push_back(std::move(fbo));
+
+    // Free the least recently used FBOs until the pool fits into the budget
+    while (pooledFboMemory() > FBO_POOL_BUDGET)
+        m_fboPool.erase(m_fboPool.begin());
+}
+
+qint64 PenLayer::fboMemory(const QSize &size)
+{
+    return static_cast<qint64>(size.width()) * size.height() * FBO_BYTES_PER_PIXEL;
+}
+
+QRect PenLayer::sparseRect(const QRect &rect) const
+{
+    // Aligns the rectangle to the tiles of sparse pen layers
+    const int left = rect.left() / SPARSE_TILE_SIZE * SPARSE_TILE_SIZE;
+    const int top = rect.top() / SPARSE_TILE_SIZE * SPARSE_TILE_SIZE;
+    const int right = (rect.right() / SPARSE_TILE_SIZE + 1) * SPARSE_TILE_SIZE;
+    const int bottom = (rect.bottom() / SPARSE_TILE_SIZE + 1) * SPARSE_TILE_SIZE;
+    return QRect(left, top, right - left, bottom - top).intersected(QRect(QPoint(0, 0), m_surfaceSize));
+}
+
+QRect PenLayer::surfaceViewport() const
+{
+    // The viewport which maps the whole pen layer to the FBO (in OpenGL coordinates)
+    return QRect(-m_fboRect.x(), m_fboRect.y() + m_fboRect.height() - m_surfaceSize.height(), m_surfaceSize.width(), m_surfaceSize.height());
+}
+
+QImage PenLayer::surfaceImage() const
+{
+    // Returns an image of the whole pen layer
+    if (m_fboRect == QRect(QPoint(0, 0), m_surfaceSize))
+        return m_fbo->toImage();
+
+    QImage image(m_surfaceSize, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    QPainter painter(&image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(m_fboRect.topLeft(), m_fbo->toImage());
+    return image;
+}
+
 void PenLayer::beginPainterFrame()
 {
-    m_painter->beginFrame(m_fbo->width(), m_fbo->height());
+    m_painter->beginFrame(m_surfaceSize.width(), m_surfaceSize.height());
 }
 
 void PenLayer::endPainterFrame()
 {
-    m_glF->glViewport(0, 0, m_fbo->width(), m_fbo->height());
+    const QRect viewport = surfaceViewport();
+    m_glF->glViewport(viewport.x(), viewport.y(), viewport.width(), viewport.height());
     m_painter->endFrame();
 }
 
@@ -460,37 +883,336 @@ void PenLayer::updateTexture()
     m_textureManager.removeTexture(m_texture);
 }
 
-void PenLayer::renderLines()
+void PenLayer::resetTiles()
+{
+    m_tileColumns = (m_surfaceSize.width() + TILE_SIZE - 1) / TILE_SIZE;
+    m_tileRows = (m_surfaceSize.height() + TILE_SIZE - 1) / TILE_SIZE;
+    m_tiles.assign(m_tileColumns * m_tileRows, PenTile());
+}
+
+void PenLayer::clearTiles()
+{
+    // The FBO is empty, so there's nothing to read back
+    for (PenTile &tile : m_tiles) {
+        tile.spans = TextureSpans();
+        tile.dirty = false;
+    }
+}
+
+void PenLayer::markDirty(const QRectF &rect)
+{
+    // The rectangle is in pen layer coordinates (the origin is in the top left corner)
+    const QRect dirtyRect = rect.toAlignedRect().intersected(QRect(QPoint(0, 0), m_surfaceSize));
+
+    if (dirtyRect.isEmpty())
+        return;
+
+    // Sparse pen layers grow when the commands are flushed (see flushCommands())
+    m_dirtyRect |= dirtyRect;
+    m_pendingRect |= dirtyRect;
+
+    if (m_tiles.empty() || rect.right() < 0 || rect.bottom() < 0 || rect.left() >= m_surfaceSize.width() || rect.top() >= m_surfaceSize.height())
+        return;
+
+    const int firstColumn = std::max(0.0, std::floor(rect.left())) / TILE_SIZE;
+    const int lastColumn = std::min(std::floor(rect.right()), m_surfaceSize.width() - 1.0) / TILE_SIZE;
+    const int firstRow = std::max(0.0, std::floor(rect.top())) / TILE_SIZE;
+    const int lastRow = std::min(std::floor(rect.bottom()), m_surfaceSize.height() - 1.0) / TILE_SIZE;
+
+    for (int row = firstRow; row <= lastRow; row++) {
+        for (int column = firstColumn; column <= lastColumn; column++)
+            m_tiles[row * m_tileColumns + column].dirty = true;
+    }
+}
+
+const TextureSpans &PenLayer::readTile(int column, int row) const
 {
-    for (size_t i = 0; i < m_penLineCount; i++) {
-        renderLine(m_penLines[i]);
+    PenTile &tile = m_tiles[row * m_tileColumns + column];
+
+    if (!tile.dirty)
+        return tile.spans;
+
+    const int x = column * TILE_SIZE;
+    const int y = row * TILE_SIZE;
+    const int width = std::min(TILE_SIZE, m_surfaceSize.width() - x);
+    const int height = std::min(TILE_SIZE, m_surfaceSize.height() - y);
+    std::vector<GLubyte> pixels(width * height * 4, 0); // 4 channels (RGBA)
+
+    // Render pending commands only if they change this tile
+    flushPending(QRect(x, y, width, height));
+
+    // Only read the part of the tile covered by the FBO (the rest is transparent)
+    const QRect readRect = QRect(x, y, width, height).intersected(m_fboRect);
+
+    if (!readRect.isEmpty()) {
+        // OpenGL uses the bottom left corner as origin
+        const int firstRow = height - 1 - (readRect.bottom() - y);
+        const bool bound = m_fbo->isBound();
+
+        if (!bound)
+            m_fbo->bind();
+
+        m_glF->glPixelStorei(GL_PACK_ROW_LENGTH, width);
+        m_glF->glReadPixels(
+            readRect.x() - m_fboRect.x(),
+            m_fboRect.bottom() - readRect.bottom(),
+            readRect.width(),
+            readRect.height(),
+            GL_RGBA,
+            GL_UNSIGNED_BYTE,
+            pixels.data() + (firstRow * width + readRect.x() - x) * 4);
+        m_glF->glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+
+        if (!bound)
+            m_fbo->release();
     }
 
-    m_penLineCount = 0;
+    // Flip vertically
+    const int rowSize = width * 4;
+
+    for (int i = 0; i < height / 2; i++)
+        std::swap_ranges(pixels.begin() + i * rowSize, pixels.begin() + (i + 1) * rowSize, pixels.begin() + (height - 1 - i) * rowSize);
+
+    tile.spans = TextureSpans(pixels.data(), width, height);
+    tile.dirty = false;
+    return tile.spans;
+}
+
+void PenLayer::readRow(int y, int x, int count, QRgb *dst) const
+{
+    // Reads count pixels of row y starting at x from the tiles (the pixels must be inside the pen layer)
+    const int row = y / TILE_SIZE;
+    const int end = x + count;
+
+    while (x < end) {
+        const int column = x / TILE_SIZE;
+        const int tileEnd = std::min((column + 1) * TILE_SIZE, end);
+        readTile(column, row).readRow(y - row * TILE_SIZE, x - column * TILE_SIZE, tileEnd - x, dst);
+        dst += tileEnd - x;
+        x = tileEnd;
+    }
+}
+
+void PenLayer::syncRaster() const
+{
+    if (m_rasterSynced)
+        return;
+
+    // Render pending commands
+    flushPending(m_pendingRect);
+
+    m_raster->setImage(surfaceImage());
+    m_rasterSynced = true;
+}
+
+void PenLayer::updateBounds() const
+{
+    if (!m_texture.isValid()) {
+        m_bounds = libscratchcpp::Rect();
+        return;
+    }
+
+    m_boundsDirty = false;
+
+    // Use the CPU copy if it's enabled
+    if (m_raster) {
+        syncRaster();
+        const QRect rect = m_raster->opaqueRect();
+
+        if (rect.isNull())
+            m_bounds = libscratchcpp::Rect();
+        else {
+            const double width = m_surfaceSize.width();
+            const double height = m_surfaceSize.height();
+            m_bounds.setLeft((rect.left() - width / 2) / m_scale);
+            m_bounds.setTop((-rect.top() + height / 2) / m_scale);
+            m_bounds.setRight((rect.right() - width / 2) / m_scale + 1);
+            m_bounds.setBottom((-rect.bottom() + height / 2) / m_scale - 1);
+        }
+
+        return;
+    }
+
+    double left = std::numeric_limits<double>::infinity();
+    double top = -std::numeric_limits<double>::infinity();
+    double right = -std::numeric_limits<double>::infinity();
+    double bottom = std::numeric_limits<double>::infinity();
+    const double width = m_surfaceSize.width();
+    const double height = m_surfaceSize.height();
+    std::vector<QPoint> points;
+
+    // The bounds include this frame's lines
+    flushPending(m_pendingRect);
+
+    m_textureManager.getTextureConvexHullPoints(m_texture, QSize(), ShaderManager::Effect::NoEffect, {}, points);
+
+    if (points.empty()) {
+        m_bounds = libscratchcpp::Rect();
+        return;
+    }
+
+    // The points are in FBO coordinates
+    for (const QPointF &point : points) {
+        double x = point.x() + m_fboRect.x() - width / 2;
+        double y = -(point.y() + m_fboRect.y()) + height / 2;
+
+        if (x < left)
+            left = x;
+
+        if (x > right)
+            right = x;
+
+        if (y > top)
+            top = y;
+
+        if (y < bottom)
+            bottom = y;
+    }
+
+    m_bounds.setLeft(left / m_scale);
+    m_bounds.setTop(top / m_scale);
+    m_bounds.setRight(right / m_scale + 1);
+    m_bounds.setBottom(bottom / m_scale - 1);
+}
+
+void PenLayer::addFastBounds(double left, double top, double right, double bottom)
+{
+    if (m_fastBoundsEmpty) {
+        m_fastBounds = libscratchcpp::Rect(left, top, right, bottom);
+        m_fastBoundsEmpty = false;
+        return;
+    }
+
+    m_fastBounds.setLeft(std::min(m_fastBounds.left(), left));
+    m_fastBounds.setTop(std::max(m_fastBounds.top(), top));
+    m_fastBounds.setRight(std::max(m_fastBounds.right(), right));
+    m_fastBounds.setBottom(std::min(m_fastBounds.bottom(), bottom));
+}
+
+void PenLayer::flushCommands()
+{
+    // Allocate the tiles of sparse pen layers drawn into by the queued commands (at most once per flush)
+    if (m_sparsePen && !m_pendingRect.isEmpty() && !(m_fboUsed && m_fboRect.contains(m_pendingRect))) {
+        const QRect fboRect = sparseRect(m_fboUsed ? (m_fboRect | m_pendingRect) : m_pendingRect);
+
+        if (fboRect != m_fboRect)
+            reallocateFbo(fboRect, m_fboUsed ? QRectF(m_fboRect) : QRectF(), true);
+    }
+
+    if (!m_pendingRect.isEmpty())
+        m_fboUsed = true;
+
+    // Render the queued commands in order, runs of lines and stamps are rendered separately
+    const size_t count = m_commands.size();
+    size_t stampIndex = 0;
+    size_t i = 0;
+
+    while (i < count) {
+        const size_t first = i;
+        const bool stamp = m_commands.type(first) == PenCommandBuffer::Type::Stamp;
+
+        do
+            i++;
+        while (i < count && (m_commands.type(i) == PenCommandBuffer::Type::Stamp) == stamp);
+
+        if (stamp) {
+            if (!m_stampRenderer)
+                m_stampRenderer = std::make_unique<StampRenderer>();
+
+            m_stampRenderer->render(m_stamps.data() + stampIndex, i - first, surfaceViewport());
+            stampIndex += i - first;
+        } else
+            renderLines(first, i);
+    }
+
+    m_commands.clear();
+    m_stamps.clear();
+    m_pendingRect = QRect();
 }
 
-void PenLayer::renderLine(const PenLine &line)
+void PenLayer::flushPending(const QRect &rect) const
 {
-    // Set pen attributes
-    const double diameter = line.attributes.diameter * m_scale;
-    m_painter->setLineWidth(diameter);
-    m_painter->setStrokeStyle(line.attributes.color);
-    m_painter->setFillStyle(line.attributes.color);
+    // Renders the queued commands (if they intersect the given rectangle) without releasing the FBO
+    if (!m_pendingRect.intersects(rect))
+        return;
+
+    Q_ASSERT(m_fbo->isBound());
+    const_cast<PenLayer *>(this)->flushCommands();
+
+    // Restore the state of beginFrame()
+    m_fbo->bind();
+    m_glF->glDisable(GL_SCISSOR_TEST);
+    m_glF->glDisable(GL_DEPTH_TEST);
+}
+
+void PenLayer::renderLines(size_t first, size_t end)
+{
+    if (m_instancedPen) {
+        if (!m_lineRenderer)
+            m_lineRenderer = std::make_unique<PenLineRenderer>();
+
+        // Draw the lines without tessellating them in QNanoPainter
+        if (m_lineRenderer->isValid()) {
+            m_lineRenderer->render(m_commands, first, end - first, surfaceViewport(), m_antialiasingEnabled);
+            return;
+        }
+    }
+
+    beginPainterFrame();
+    paintLines(first, end);
+    endPainterFrame();
+}
+
+void PenLayer::paintLines(size_t first, size_t end)
+{
+    // Line joins, caps and antialiasing are the same for all lines
     m_painter->setLineJoin(QNanoPainter::JOIN_ROUND);
     m_painter->setLineCap(QNanoPainter::CAP_ROUND);
     m_painter->setAntialias(m_antialiasingEnabled ? 1.0f : 0.0f);
-    m_painter->beginPath();
-
-    // Width 1 and 3 lines need to be offset by 0.5
-    const double offset = (std::fmod(std::max(4 - diameter, 0.0), 2)) / 2;
-
-    // If the start and end coordinates are the same, draw a point, otherwise draw a line
-    if (line.x0 == line.x1 && line.y0 == line.y1) {
-        m_painter->circle(line.x0 + offset, line.y0 + offset, diameter / 2);
-        m_painter->fill();
-    } else {
-        m_painter->moveTo(line.x0 + offset, line.y0 + offset);
-        m_painter->lineTo(line.x1 + offset, line.y1 + offset);
-        m_painter->stroke();
+
+    auto sameAttributes = [this](size_t a, size_t b) { return m_commands.diameter(a) == m_commands.diameter(b) && m_commands.color(a) == m_commands.color(b); };
+
+    size_t last = end; // command with the last set attributes
+    size_t i = first;
+
+    while (i < end) {
+        const size_t start = i;
+        const PenCommandBuffer::Type type = m_commands.type(start);
+        const bool point = type == PenCommandBuffer::Type::Point;
+        const double diameter = m_commands.diameter(start);
+
+        // Only set pen attributes if they change
+        if (last == end || !sameAttributes(start, last)) {
+            const QNanoColor color = m_commands.nanoColor(start);
+            m_painter->setLineWidth(diameter);
+            m_painter->setStrokeStyle(color);
+            m_painter->setFillStyle(color);
+            last = start;
+        }
+
+        // Width 1 and 3 lines need to be offset by 0.5
+        const double offset = (std::fmod(std::max(4 - diameter, 0.0), 2)) / 2;
+
+        // Overlapping shapes in a single path are blended only once, so translucent points are filled separately
+        const bool opaque = m_commands.nanoColor(start).alpha() == 255;
+
+        // Submit consecutive lines (or points) with the same attributes as a single path
+        m_painter->beginPath();
+
+        do {
+            const float *coords = m_commands.coords(i++);
+
+            if (point)
+                m_painter->circle(coords[0] + offset, coords[1] + offset, diameter / 2);
+            else {
+                m_painter->moveTo(coords[0] + offset, coords[1] + offset);
+                m_painter->lineTo(coords[2] + offset, coords[3] + offset);
+            }
+        } while (i < end && (!point || opaque) && m_commands.type(i) == type && sameAttributes(i, start));
+
+        if (point)
+            m_painter->fill();
+        else
+            m_painter->stroke();
     }
 }
@@ -4,13 +4,21 @@
 
 #include <QOpenGLFramebufferObject>
 #include <QOpenGLExtraFunctions>
+#include <QElapsedTimer>
 #include <qnanopainter.h>
 #include <scratchcpp/iengine.h>
 
 #include "ipenlayer.h"
 #include "texture.h"
 #include "cputexturemanager.h"
+#include "texturespans.h"
+#include "penraster.h"
+#include "penlinerenderer.h"
+#include "pencommandbuffer.h"
+#include "penstamp.h"
+#include "stamprenderer.h"
 #include "penattributes.h"
+#include "penresolutionpolicy.h"
 
 namespace scratchcpprender
 {
@@ -21,6 +29,12 @@ class PenLayer : public IPenLayer
         QML_ELEMENT
         Q_PROPERTY(libscratchcpp::IEngine *engine READ engine WRITE setEngine NOTIFY engineChanged)
         Q_PROPERTY(bool hqPen READ hqPen WRITE setHqPen NOTIFY hqPenChanged)
+        Q_PROPERTY(bool shadowRaster READ shadowRaster WRITE setShadowRaster NOTIFY shadowRasterChanged)
+        Q_PROPERTY(bool instancedPen READ instancedPen WRITE setInstancedPen NOTIFY instancedPenChanged)
+        Q_PROPERTY(bool sparsePen READ sparsePen WRITE setSparsePen NOTIFY sparsePenChanged)
+        Q_PROPERTY(double maxScale READ maxScale WRITE setMaxScale NOTIFY maxScaleChanged)
+        Q_PROPERTY(qint64 memoryBudget READ memoryBudget WRITE setMemoryBudget NOTIFY memoryBudgetChanged)
+        Q_PROPERTY(double targetFrameTime READ targetFrameTime WRITE setTargetFrameTime NOTIFY targetFrameTimeChanged)
 
     public:
         PenLayer(QNanoQuickItem *parent = nullptr);
@@ -38,17 +52,45 @@ class PenLayer : public IPenLayer
         bool hqPen() const;
         void setHqPen(bool newHqPen);
 
+        bool shadowRaster() const;
+        void setShadowRaster(bool newShadowRaster);
+
+        bool instancedPen() const;
+        void setInstancedPen(bool newInstancedPen);
+
+        bool sparsePen() const;
+        void setSparsePen(bool newSparsePen);
+
+        double maxScale() const;
+        void setMaxScale(double newMaxScale);
+
+        qint64 memoryBudget() const;
+        void setMemoryBudget(qint64 newMemoryBudget);
+
+        double targetFrameTime() const;
+        void setTargetFrameTime(double newTargetFrameTime);
+
+        double penScale() const;
+        qint64 pooledFboMemory() const;
+
         void clear() override;
         void drawPoint(const PenAttributes &penAttributes, double x, double y) override;
         void drawLine(const PenAttributes &penAttributes, double x0, double y0, double x1, double y1) override;
         void stamp(IRenderedTarget *target) override;
+        void flush(const QRectF &rect) override;
 
         Q_INVOKABLE void refresh();
 
         QOpenGLFramebufferObject *framebufferObject() const override;
+        QRectF framebufferRect() const override;
+        QRect takeDirtyRect() override;
+        void addPaintTime(double time) override;
         QRgb colorAtScratchPoint(double x, double y) const override;
+        void colorsAtScratchRect(const QRect &rect, QRgb *dst) const override;
+        void colorsAtScratchPoints(const std::vector<QPointF> &points, QRgb *dst) const override;
 
         const libscratchcpp::Rect &getBounds() const override;
+        libscratchcpp::Rect getFastBounds() const override;
 
         static IPenLayer *getProjectPenLayer(libscratchcpp::IEngine *engine);
 
@@ -59,36 +101,71 @@ class PenLayer : public IPenLayer
     signals:
         void engineChanged();
         void hqPenChanged();
+        void shadowRasterChanged();
+        void instancedPenChanged();
+        void sparsePenChanged();
+        void maxScaleChanged();
+        void memoryBudgetChanged();
+        void targetFrameTimeChanged();
 
     protected:
         QNanoQuickItemPainter *createItemPainter() const override;
         void geometryChange(const QRectF &newGeometry, const QRectF &oldGeometry) override;
+        void updatePolish() override;
 
     private:
-        struct PenLine
+        struct PenTile
         {
-                double x0;
-                double y0;
-                double x1;
-                double y1;
-                PenAttributes attributes;
+                TextureSpans spans;
+                bool dirty = true;
         };
 
+        void reallocateSurface(const QSize &newSize);
+        void reallocateFbo(const QRect &rect, const QRectF &copyRect, bool poolOldFbo = false);
+        void addToFboPool(std::unique_ptr<QOpenGLFramebufferObject> fbo);
+        static qint64 fboMemory(const QSize &size);
+        QRect sparseRect(const QRect &rect) const;
+        QRect surfaceViewport() const;
+        QImage surfaceImage() const;
+
         void beginPainterFrame();
         void endPainterFrame();
         void updateTexture();
 
-        void renderLines();
-        void renderLine(const PenLine &line);
+        void resetTiles();
+        void clearTiles();
+        void markDirty(const QRectF &rect);
+        const TextureSpans &readTile(int column, int row) const;
+        void readRow(int y, int x, int count, QRgb *dst) const;
+
+        void syncRaster() const;
+
+        void updateBounds() const;
+        void addFastBounds(double left, double top, double right, double bottom);
+
+        void flushCommands();
+        void flushPending(const QRect &rect) const;
+        void renderLines(size_t first, size_t end);
+        void paintLines(size_t first, size_t end);
 
         static std::unordered_map<libscratchcpp::IEngine *, IPenLayer *> m_projectPenLayers;
         bool m_antialiasingEnabled = true;
         libscratchcpp::IEngine *m_engine = nullptr;
         bool m_hqPen = false;
         std::unique_ptr<QOpenGLFramebufferObject> m_fbo;
+        std::vector<std::unique_ptr<QOpenGLFramebufferObject>> m_fboPool; // replaced FBOs which can be reused later (matched by exact size)
+        bool m_refreshPending = false;                                     // the size or resolution changed and the FBO hasn't been reallocated yet
+        QSize m_surfaceSize;      // size of the whole pen layer (in pixels)
+        QRect m_fboRect;          // the part of the pen layer covered by the FBO
+        bool m_sparsePen = false; // if enabled, the FBO only covers the tiles which have been drawn into
+        bool m_fboUsed = false;   // whether anything has been flushed since the FBO was cleared
         mutable QOpenGLContext *m_glCtx = nullptr;
         mutable QSurface *m_surface = nullptr;
         double m_scale = 1;
+        PenResolutionPolicy m_resolutionPolicy;
+        QElapsedTimer m_frameTimer; // measures the time spent between beginFrame() and endFrame()
+        double m_frameTime = -1;    // in milliseconds, -1 if there isn't any finished frame
+        double m_paintTime = 0;     // time spent by the painter since the last frame (in milliseconds)
         std::unique_ptr<QNanoPainter> m_painter;
         std::unique_ptr<QOpenGLExtraFunctions> m_glF;
         Texture m_texture;
@@ -96,13 +173,23 @@ class PenLayer : public IPenLayer
         mutable CpuTextureManager m_textureManager;
         mutable bool m_boundsDirty = true;
         mutable libscratchcpp::Rect m_bounds;
-        GLuint m_vbo = 0;
-        GLuint m_vao = 0;
+        mutable libscratchcpp::Rect m_fastBounds; // grows with each line and stamp until the pen layer is cleared
+        mutable bool m_fastBoundsEmpty = true;
+        mutable std::vector<PenTile> m_tiles; // readbacks of the FBO split into tiles (row-major)
+        int m_tileColumns = 0;
+        int m_tileRows = 0;
+        QRect m_dirtyRect;   // changed part of the FBO which hasn't been displayed yet
+        QRect m_pendingRect; // part of the FBO covered by the queued commands (the FBO contains the last flushed state)
+        std::unique_ptr<PenRaster> m_raster;
+        mutable bool m_rasterSynced = false;
+        bool m_instancedPen = false;
+        std::unique_ptr<PenLineRenderer> m_lineRenderer;
+        std::unique_ptr<StampRenderer> m_stampRenderer;
 
         bool m_penLineAdded = false;
         bool m_stampAdded = false;
-        std::vector<PenLine> m_penLines;
-        size_t m_penLineCount = 0;
+        PenCommandBuffer m_commands;
+        std::vector<PenStamp> m_stamps; // one for each stamp command
 };
 
 } // namespace scratchcpprender
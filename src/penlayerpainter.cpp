@@ -1,5 +1,8 @@
 // SPDX-License-Identifier: LGPL-3.0-or-later
 
+#include <QQuickOpenGLUtils>
+#include <QElapsedTimer>
+
 #include "penlayerpainter.h"
 #include "penlayer.h"
 
@@ -21,11 +24,52 @@ void PenLayerPainter::paint(QNanoPainter *painter)
     if (!context || !m_fbo)
         return;
 
+    QElapsedTimer timer;
+    timer.start();
+
     // Custom FBO - only used for testing
     QOpenGLFramebufferObject *targetFbo = m_targetFbo ? m_targetFbo : framebufferObject();
 
-    // Blit the FBO to the item FBO
-    QOpenGLFramebufferObject::blitFramebuffer(targetFbo, m_fbo);
+    // The part of the item FBO covered by the pen layer FBO
+    const QRect targetRect(
+        qRound(m_fboRect.x() * targetFbo->width()),
+        qRound(m_fboRect.y() * targetFbo->height()),
+        qRound(m_fboRect.width() * targetFbo->width()),
+        qRound(m_fboRect.height() * targetFbo->height()));
+
+    // OpenGL uses the bottom left corner as origin
+    auto toGlRect = [](const QRect &rect, int height) { return QRect(rect.x(), height - rect.y() - rect.height(), rect.width(), rect.height()); };
+
+    // The whole FBO must be blitted if the item FBO is new, the pen layer FBO has been replaced or it's scaled
+    if (m_fullBlit || m_fbo != m_blittedFbo || targetRect.size() != m_fbo->size()) {
+        if (targetRect != QRect(QPoint(0, 0), targetFbo->size())) {
+            // Clear the part which isn't covered by the pen layer FBO
+            QOpenGLFunctions *glF = context->functions();
+            GLint oldFbo = 0;
+            glF->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &oldFbo);
+            targetFbo->bind();
+            glF->glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glF->glClear(GL_COLOR_BUFFER_BIT);
+            glF->glBindFramebuffer(GL_FRAMEBUFFER, oldFbo);
+        }
+
+        // Pen layers with a reduced resolution are upscaled with filtering
+        const GLenum filter = targetRect.width() > m_fbo->width() ? GL_LINEAR : GL_NEAREST;
+        QOpenGLFramebufferObject::blitFramebuffer(targetFbo, toGlRect(targetRect, targetFbo->height()), m_fbo, QRect(QPoint(0, 0), m_fbo->size()), GL_COLOR_BUFFER_BIT, filter);
+        m_fullBlit = false;
+        m_blittedFbo = m_fbo;
+    } else if (!m_dirtyRect.isEmpty()) {
+        // Blit the changed part of the FBO to the item FBO (the pen layer has the same size as the item FBO here)
+        const QRect rect = m_dirtyRect.intersected(targetRect);
+
+        if (!rect.isEmpty()) {
+            const QRect sourceRect = rect.translated(-targetRect.topLeft());
+            QOpenGLFramebufferObject::blitFramebuffer(targetFbo, toGlRect(rect, targetFbo->height()), m_fbo, toGlRect(sourceRect, m_fbo->height()));
+        }
+    }
+
+    m_dirtyRect = QRect();
+    m_paintTime += timer.nsecsElapsed() / 1e6;
 }
 
 void PenLayerPainter::synchronize(QNanoQuickItem *item)
@@ -33,6 +77,33 @@ void PenLayerPainter::synchronize(QNanoQuickItem *item)
     IPenLayer *penLayer = dynamic_cast<IPenLayer *>(item);
     Q_ASSERT(penLayer);
 
-    if (penLayer)
+    if (penLayer) {
         m_fbo = penLayer->framebufferObject();
+        m_fboRect = penLayer->framebufferRect();
+        m_dirtyRect |= penLayer->takeDirtyRect();
+
+        // Let the pen layer count the blits into its frame time
+        if (m_paintTime > 0) {
+            penLayer->addPaintTime(m_paintTime);
+            m_paintTime = 0;
+        }
+    }
+}
+
+void PenLayerPainter::render()
+{
+    // Unlike QNanoQuickItemPainter::render(), this doesn't clear the item FBO,
+    // so only the changed part of the pen layer needs to be blitted
+    paint(nullptr);
+    QQuickOpenGLUtils::resetOpenGLState();
+}
+
+QOpenGLFramebufferObject *PenLayerPainter::createFramebufferObject(const QSize &size)
+{
+    // The new item FBO is empty
+    m_fullBlit = true;
+
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+    return new QOpenGLFramebufferObject(size, format);
 }
@@ -18,8 +18,16 @@ class PenLayerPainter : public QNanoQuickItemPainter
         void synchronize(QNanoQuickItem *item) override;
 
     private:
+        void render() override;
+        QOpenGLFramebufferObject *createFramebufferObject(const QSize &size) override;
+
         QOpenGLFramebufferObject *m_targetFbo = nullptr;
         QOpenGLFramebufferObject *m_fbo = nullptr;
+        QRectF m_fboRect;                                 // the part of the pen layer covered by the FBO
+        QOpenGLFramebufferObject *m_blittedFbo = nullptr; // the pen layer FBO which was blitted last time
+        bool m_fullBlit = true;
+        QRect m_dirtyRect;
+        double m_paintTime = 0; // reported to the pen layer (in milliseconds)
 };
 
 } // namespace scratchcpprender
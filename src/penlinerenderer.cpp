@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <QOpenGLShaderProgram>
+#include <QVector2D>
+
+#include "penlinerenderer.h"
+#include "pencommandbuffer.h"
+#include "shadermanager.h"
+
+using namespace scratchcpprender;
+
+static const QString VERTEX_SHADER_SRC = ":/qt/qml/ScratchCPP/Render/shaders/penline.vert";
+static const QString FRAGMENT_SHADER_SRC = ":/qt/qml/ScratchCPP/Render/shaders/penline.frag";
+
+static const char *VIEWPORT_SIZE_UNIFORM = "u_viewportSize";
+static const char *ANTIALIASING_UNIFORM = "u_antialiasing";
+
+PenLineRenderer::PenLineRenderer()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    Q_ASSERT(context);
+
+    if (!context) {
+        qWarning("PenLineRenderer must be constructed with a valid OpenGL context.");
+        return;
+    }
+
+    m_glF.initializeOpenGLFunctions();
+
+    m_program = std::make_unique<QOpenGLShaderProgram>();
+    m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, ShaderManager::shaderSource(VERTEX_SHADER_SRC));
+    m_program->addShaderFromSourceCode(QOpenGLShader::Fragment, ShaderManager::shaderSource(FRAGMENT_SHADER_SRC));
+
+    if (!m_program->link()) {
+        qWarning() << "error: failed to link the pen line shader program:" << m_program->log();
+        m_program.reset();
+        return;
+    }
+
+    // Corners of the quad which is expanded around each line
+    float corners[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+
+    m_glF.glGenVertexArrays(1, &m_vao);
+    m_glF.glGenBuffers(1, &m_quadVbo);
+    m_glF.glGenBuffers(1, &m_instanceVbo);
+
+    m_glF.glBindVertexArray(m_vao);
+
+    m_glF.glBindBuffer(GL_ARRAY_BUFFER, m_quadVbo);
+    m_glF.glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    m_glF.glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
+    m_glF.glEnableVertexAttribArray(0);
+
+    // Instance attributes (end points, diameter and color) are set when rendering
+    for (GLuint i = 1; i <= 3; i++) {
+        m_glF.glEnableVertexAttribArray(i);
+        m_glF.glVertexAttribDivisor(i, 1);
+    }
+
+    m_glF.glBindVertexArray(0);
+    m_glF.glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+PenLineRenderer::~PenLineRenderer()
+{
+    if (m_vao != 0) {
+        m_glF.glDeleteVertexArrays(1, &m_vao);
+        m_glF.glDeleteBuffers(1, &m_quadVbo);
+        m_glF.glDeleteBuffers(1, &m_instanceVbo);
+    }
+}
+
+bool PenLineRenderer::isValid() const
+{
+    return m_program && m_vao != 0;
+}
+
+void PenLineRenderer::render(const PenCommandBuffer &commands, size_t first, size_t count, const QRect &viewport, bool antialiasing)
+{
+    if (count == 0 || !isValid())
+        return;
+
+    m_glF.glBindVertexArray(m_vao);
+    m_glF.glBindBuffer(GL_ARRAY_BUFFER, m_instanceVbo);
+
+    // The attribute arrays of the commands are stored one after another
+    const size_t coordsSize = count * 4 * sizeof(float);
+    const size_t diametersSize = count * sizeof(float);
+    const size_t colorsSize = count * sizeof(quint32);
+    const size_t size = coordsSize + diametersSize + colorsSize;
+
+    // Reuse the instance buffer, it only grows
+    if (size > m_instanceCapacity) {
+        m_instanceCapacity = std::max(size, m_instanceCapacity * 2);
+        m_glF.glBufferData(GL_ARRAY_BUFFER, m_instanceCapacity, nullptr, GL_STREAM_DRAW);
+    }
+
+    m_glF.glBufferSubData(GL_ARRAY_BUFFER, 0, coordsSize, commands.coords(first));
+    m_glF.glBufferSubData(GL_ARRAY_BUFFER, coordsSize, diametersSize, commands.diameters() + first);
+    m_glF.glBufferSubData(GL_ARRAY_BUFFER, coordsSize + diametersSize, colorsSize, commands.colors() + first);
+
+    m_glF.glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, (void *)0);
+    m_glF.glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 0, (void *)coordsSize);
+    m_glF.glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, (void *)(coordsSize + diametersSize));
+
+    m_program->bind();
+    m_program->setUniformValue(VIEWPORT_SIZE_UNIFORM, QVector2D(viewport.width(), viewport.height()));
+    m_program->setUniformValue(ANTIALIASING_UNIFORM, antialiasing ? 1.0f : 0.0f);
+
+    m_glF.glViewport(viewport.x(), viewport.y(), viewport.width(), viewport.height());
+    m_glF.glEnable(GL_BLEND);
+    m_glF.glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    // Lines are drawn in order, so overlapping lines are blended in the same way as separate draw calls
+    m_glF.glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+
+    m_program->release();
+    m_glF.glBindVertexArray(0);
+    m_glF.glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
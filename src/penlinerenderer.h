@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QOpenGLExtraFunctions>
+#include <memory>
+
+class QOpenGLShaderProgram;
+
+namespace scratchcpprender
+{
+
+class PenCommandBuffer;
+
+// Draws pen lines and points as round-capped capsules in a single instanced draw call
+class PenLineRenderer
+{
+    public:
+        PenLineRenderer();
+        PenLineRenderer(const PenLineRenderer &) = delete;
+        ~PenLineRenderer();
+
+        bool isValid() const;
+
+        void render(const PenCommandBuffer &commands, size_t first, size_t count, const QRect &viewport, bool antialiasing);
+
+    private:
+        QOpenGLExtraFunctions m_glF;
+        std::unique_ptr<QOpenGLShaderProgram> m_program;
+        GLuint m_vao = 0;
+        GLuint m_quadVbo = 0;
+        GLuint m_instanceVbo = 0;
+        size_t m_instanceCapacity = 0; // size of the instance buffer
+};
+
+} // namespace scratchcpprender
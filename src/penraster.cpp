@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <QPainter>
+#include <scratchcpp/rect.h>
+
+#include "penraster.h"
+#include "irenderedtarget.h"
+
+using namespace scratchcpprender;
+
+const QImage &PenRaster::image() const
+{
+    return m_image;
+}
+
+void PenRaster::setImage(const QImage &image)
+{
+    // Colors are premultiplied like in the FBO
+    m_image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+}
+
+void PenRaster::resize(const QSize &size)
+{
+    if (m_image.size() == size)
+        return;
+
+    if (m_image.isNull()) {
+        m_image = QImage(size, QImage::Format_ARGB32_Premultiplied);
+        m_image.fill(Qt::transparent);
+    } else
+        m_image = m_image.scaled(size, Qt::IgnoreAspectRatio, Qt::FastTransformation); // the FBO is blitted without filtering
+}
+
+void PenRaster::clear()
+{
+    m_image.fill(Qt::transparent);
+}
+
+void PenRaster::drawLine(double x0, double y0, double x1, double y1, double diameter, const QNanoColor &color, bool antialiasing)
+{
+    // The coordinates are in the FBO coordinate system, see PenLayer::renderLines()
+    if (m_image.isNull())
+        return;
+
+    const QColor qColor(color.red(), color.green(), color.blue(), color.alpha());
+    QPainter painter(&m_image);
+    painter.setRenderHint(QPainter::Antialiasing, antialiasing);
+
+    // Width 1 and 3 lines need to be offset by 0.5
+    const double offset = (std::fmod(std::max(4 - diameter, 0.0), 2)) / 2;
+
+    // If the start and end coordinates are the same, draw a point, otherwise draw a line
+    if (x0 == x1 && y0 == y1) {
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(qColor);
+        painter.drawEllipse(QPointF(x0 + offset, y0 + offset), diameter / 2, diameter / 2);
+    } else {
+        painter.setPen(QPen(qColor, diameter, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+        painter.drawLine(QPointF(x0 + offset, y0 + offset), QPointF(x1 + offset, y1 + offset));
+    }
+}
+
+void PenRaster::stamp(const IRenderedTarget *target, double scale)
+{
+    if (m_image.isNull() || !target)
+        return;
+
+    const double width = m_image.width();
+    const double height = m_image.height();
+
+    // Only process the pixels covered by the target
+    const libscratchcpp::Rect bounds = target->getFastBounds();
+    const int left = std::max(0.0, std::floor(bounds.left() * scale + width / 2));
+    const int right = std::min(width, std::ceil(bounds.right() * scale + width / 2));
+    const int top = std::max(0.0, std::floor(height / 2 - bounds.top() * scale));
+    const int bottom = std::min(height, std::ceil(height / 2 - bounds.bottom() * scale));
+
+    for (int y = top; y < bottom; y++) {
+        QRgb *line = reinterpret_cast<QRgb *>(m_image.scanLine(y));
+        const double scratchY = (height / 2 - y - 0.5) / scale;
+
+        for (int x = left; x < right; x++) {
+            // Both colors are premultiplied
+            const QRgb src = target->colorAtScratchPoint((x + 0.5 - width / 2) / scale, scratchY);
+            const int srcAlpha = qAlpha(src);
+
+            if (srcAlpha == 0)
+                continue;
+
+            const QRgb dst = line[x];
+            const int inv = 255 - srcAlpha;
+            line[x] = qRgba(
+                qRed(src) + (qRed(dst) * inv + 127) / 255,
+                qGreen(src) + (qGreen(dst) * inv + 127) / 255,
+                qBlue(src) + (qBlue(dst) * inv + 127) / 255,
+                srcAlpha + (qAlpha(dst) * inv + 127) / 255);
+        }
+    }
+}
+
+QRgb PenRaster::pixel(int x, int y) const
+{
+    if (x < 0 || x >= m_image.width() || y < 0 || y >= m_image.height())
+        return qRgba(0, 0, 0, 0);
+
+    // The color is premultiplied
+    return reinterpret_cast<const QRgb *>(m_image.constScanLine(y))[x];
+}
+
+QRect PenRaster::opaqueRect() const
+{
+    // Returns the bounding rectangle of the non-transparent pixels
+    int left = m_image.width();
+    int right = -1;
+    int top = -1;
+    int bottom = -1;
+
+    for (int y = 0; y < m_image.height(); y++) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(m_image.constScanLine(y));
+        int x;
+
+        for (x = 0; x < m_image.width(); x++) {
+            if (qAlpha(line[x]) > 0)
+                break;
+        }
+
+        if (x == m_image.width())
+            continue;
+
+        if (top == -1)
+            top = y;
+
+        bottom = y;
+        left = std::min(left, x);
+
+        for (x = m_image.width() - 1; x > right; x--) {
+            if (qAlpha(line[x]) > 0) {
+                right = x;
+                break;
+            }
+        }
+    }
+
+    if (top == -1)
+        return QRect();
+
+    return QRect(QPoint(left, top), QPoint(right, bottom));
+}
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QImage>
+#include <qnanocolor.h>
+
+namespace scratchcpprender
+{
+
+class IRenderedTarget;
+
+// CPU copy of the pen layer, rasterized in software from the same lines and stamps as the FBO
+class PenRaster
+{
+    public:
+        PenRaster() = default;
+
+        const QImage &image() const;
+        void setImage(const QImage &image);
+
+        void resize(const QSize &size);
+        void clear();
+
+        void drawLine(double x0, double y0, double x1, double y1, double diameter, const QNanoColor &color, bool antialiasing);
+        void stamp(const IRenderedTarget *target, double scale);
+
+        QRgb pixel(int x, int y) const;
+        QRect opaqueRect() const;
+
+    private:
+        QImage m_image;
+};
+
+} // namespace scratchcpprender
@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <cmath>
+#include <algorithm>
+
+#include "penresolutionpolicy.h"
+
+using namespace scratchcpprender;
+
+static const int FRAME_WINDOW = 30;            // number of frames the average frame time is computed from
+static const double MAX_FRAME_TIME = 1000;     // longer frames (e.g. after the project was paused) are ignored
+static const double DOWNSCALE_STEP = 0.75;     // the frame time factor is multiplied by this when the frames are slow
+static const double MIN_FRAME_TIME_FACTOR = 0.25;
+static const double UPSCALE_THRESHOLD = 0.5;   // the frame time factor is increased if the frames take less than this part of the target frame time
+static const int UPSCALE_WINDOWS = 3;          // number of consecutive fast windows before the frame time factor is increased
+
+double PenResolutionPolicy::maxScale() const
+{
+    return m_maxScale;
+}
+
+void PenResolutionPolicy::setMaxScale(double newMaxScale)
+{
+    m_maxScale = newMaxScale;
+}
+
+qint64 PenResolutionPolicy::memoryBudget() const
+{
+    return m_memoryBudget;
+}
+
+void PenResolutionPolicy::setMemoryBudget(qint64 newMemoryBudget)
+{
+    m_memoryBudget = newMemoryBudget;
+}
+
+double PenResolutionPolicy::targetFrameTime() const
+{
+    return m_targetFrameTime;
+}
+
+void PenResolutionPolicy::setTargetFrameTime(double newTargetFrameTime)
+{
+    m_targetFrameTime = newTargetFrameTime;
+    reset();
+}
+
+double PenResolutionPolicy::frameTimeFactor() const
+{
+    return m_frameTimeFactor;
+}
+
+void PenResolutionPolicy::reset()
+{
+    // Tries the full resolution again
+    m_frameTimeFactor = 1;
+    m_frameTimeSum = 0;
+    m_frameCount = 0;
+    m_fastWindows = 0;
+}
+
+double PenResolutionPolicy::scale(double requestedScale, const QSize &requestedSize) const
+{
+    // Returns the scale of the pen layer for the requested scale (the size of the item divided by the size of the stage),
+    // the limits never reduce the resolution below the resolution of the stage
+    double scale = requestedScale * m_frameTimeFactor;
+
+    if (m_maxScale > 0)
+        scale = std::min(scale, m_maxScale);
+
+    if (m_memoryBudget > 0 && !requestedSize.isEmpty()) {
+        const double size = static_cast<double>(BYTES_PER_PIXEL) * requestedSize.width() * requestedSize.height();
+        scale = std::min(scale, requestedScale * std::sqrt(m_memoryBudget / size));
+    }
+
+    return std::min(requestedScale, std::max(scale, 1.0));
+}
+
+bool PenResolutionPolicy::addFrameTime(double frameTime)
+{
+    // Returns true if the frame time factor has changed
+    if (m_targetFrameTime <= 0 || frameTime > MAX_FRAME_TIME)
+        return false;
+
+    m_frameTimeSum += frameTime;
+    m_frameCount++;
+
+    if (m_frameCount < FRAME_WINDOW)
+        return false;
+
+    const double average = m_frameTimeSum / m_frameCount;
+    m_frameTimeSum = 0;
+    m_frameCount = 0;
+
+    if (average > m_targetFrameTime) {
+        m_fastWindows = 0;
+
+        if (m_frameTimeFactor <= MIN_FRAME_TIME_FACTOR)
+            return false;
+
+        m_frameTimeFactor = std::max(m_frameTimeFactor * DOWNSCALE_STEP, MIN_FRAME_TIME_FACTOR);
+        return true;
+    }
+
+    // Increase the resolution again if the frames are much faster than needed for a while
+    // (the gap between the thresholds prevents switching back and forth)
+    if (average >= m_targetFrameTime * UPSCALE_THRESHOLD || m_frameTimeFactor >= 1) {
+        m_fastWindows = 0;
+        return false;
+    }
+
+    if (++m_fastWindows < UPSCALE_WINDOWS)
+        return false;
+
+    m_fastWindows = 0;
+    m_frameTimeFactor = std::min(m_frameTimeFactor / DOWNSCALE_STEP, 1.0);
+    return true;
+}
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QSize>
+
+namespace scratchcpprender
+{
+
+// Limits the resolution of HQ pen layers by a maximum scale, a memory budget and the frame time
+class PenResolutionPolicy
+{
+    public:
+        PenResolutionPolicy() = default;
+
+        double maxScale() const;
+        void setMaxScale(double newMaxScale);
+
+        qint64 memoryBudget() const;
+        void setMemoryBudget(qint64 newMemoryBudget);
+
+        double targetFrameTime() const;
+        void setTargetFrameTime(double newTargetFrameTime);
+
+        double frameTimeFactor() const;
+        void reset();
+
+        double scale(double requestedScale, const QSize &requestedSize) const;
+        bool addFrameTime(double frameTime);
+
+        static const int BYTES_PER_PIXEL = 8; // RGBA and combined depth/stencil
+
+    private:
+        double m_maxScale = 0;        // 0 means no limit
+        qint64 m_memoryBudget = 0;    // in bytes, 0 means no limit
+        double m_targetFrameTime = 0; // in milliseconds, 0 disables the downscaling
+        double m_frameTimeFactor = 1; // reduced when the frames take too long
+        double m_frameTimeSum = 0;
+        int m_frameCount = 0;
+        int m_fastWindows = 0; // consecutive frame windows which were much faster than the target
+};
+
+} // namespace scratchcpprender
@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QOpenGLFunctions>
+#include <QMatrix4x4>
+
+#include "shadermanager.h"
+
+namespace scratchcpprender
+{
+
+// A queued stamp of a target (everything needed to draw it later in an instanced draw call)
+struct PenStamp
+{
+        GLuint texture = 0;
+        QSize skinSize;
+        ShaderManager::Effect effectMask = ShaderManager::Effect::NoEffect;
+        ShaderManager::InstanceEffectValues effectValues = {};
+        QRectF uvRect = QRectF(0, 0, 1, 1); // part of the texture used by the skin (see Texture::uvRect())
+        QRect viewport;                     // the target is rendered into this part of the pen layer
+        QMatrix4x4 matrix;                  // projection * model matrix
+};
+
+} // namespace scratchcpprender
@@ -2,7 +2,8 @@
 
 #pragma once
 
-#include <QColor>
+#include <QtGlobal>
+#include <climits>
 
 #include "penattributes.h"
 
@@ -16,9 +17,12 @@ struct PenState
         double saturation = 100;
         double brightness = 100;
         double transparency = 0;
-        double shade = 50; // for legacy blocks
+        double shade = 50;       // for legacy blocks
+        bool colorDirty = false; // the color in penAttributes is updated before it's used
         PenAttributes penAttributes;
 
+        void invalidateColor() { colorDirty = true; }
+
         void updateColor()
         {
             int h = color * 360 / 100;
@@ -31,7 +35,54 @@ struct PenState
             const int v = brightness * 255 / 100;
             const int a = 255 - transparency * 255 / 100;
 
-            penAttributes.color = QNanoColor::fromQColor(QColor::fromHsv(h, s, v, a));
+            penAttributes.color = colorFromHsv(h, s, v, a);
+            colorDirty = false;
+        }
+
+        static QNanoColor colorFromHsv(int h, int s, int v, int a)
+        {
+            // Same as QNanoColor::fromQColor(QColor::fromHsv(h, s, v, a)), QColor uses 16-bit components
+            const int saturation = s * 0x101;
+            const int value = v * 0x101;
+            auto toByte = [](int component) { return (component - (component >> 8) + 0x80) >> 8; };
+
+            if (saturation == 0) {
+                const int gray = toByte(value);
+                return QNanoColor(gray, gray, gray, a);
+            }
+
+            const float hue = (h % 360) / 60.0f;
+            const float sF = saturation / float(USHRT_MAX);
+            const float vF = value / float(USHRT_MAX);
+            const int i = int(hue);
+            const float f = hue - i;
+            const float p = vF * (1.0f - sF);
+            const float q = vF * (1.0f - (sF * f));
+            const float t = vF * (1.0f - (sF * (1.0f - f)));
+            float r, g, b;
+
+            switch (i) {
+                case 0:
+                    r = vF, g = t, b = p;
+                    break;
+                case 1:
+                    r = q, g = vF, b = p;
+                    break;
+                case 2:
+                    r = p, g = vF, b = t;
+                    break;
+                case 3:
+                    r = p, g = q, b = vF;
+                    break;
+                case 4:
+                    r = t, g = p, b = vF;
+                    break;
+                default:
+                    r = vF, g = p, b = q;
+                    break;
+            }
+
+            return QNanoColor(toByte(qRound(r * USHRT_MAX)), toByte(qRound(g * USHRT_MAX)), toByte(qRound(b * USHRT_MAX)), a);
         }
 };
 
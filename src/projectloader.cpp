@@ -13,11 +13,15 @@
 #include "listmonitormodel.h"
 #include "renderedtarget.h"
 #include "penlayer.h"
+#include "skin.h"
+#include "shadermanager.h"
 #include "blocks/penblocks.h"
 
 using namespace scratchcpprender;
 using namespace libscratchcpp;
 
+static const int SHADER_PRECOMPILATION_BUDGET = 4; // ms per frame
+
 ProjectLoader::ProjectLoader(QObject *parent) :
     QObject(parent)
 {
@@ -70,6 +74,9 @@ void ProjectLoader::setFileName(const QString &newFileName)
 
     clear();
 
+    // The shader programs are precompiled again for the new project
+    m_shadersQueued = false;
+
     m_project.setFileName(m_fileName.toStdString());
     m_loadStatus = LoadStatus::Loading;
 
@@ -242,6 +249,19 @@ void ProjectLoader::timerEvent(QTimerEvent *event)
         if (penLayer)
             penLayer->endFrame();
 
+        // Compile the shader programs of all effect combinations between frames (so that they're ready before they're used)
+        if (m_precompileShaders && m_glCtx) {
+            ShaderManager *shaderManager = ShaderManager::instance();
+
+            if (!m_shadersQueued) {
+                shaderManager->queuePrecompilation(ShaderManager::allEffectMasks());
+                m_shadersQueued = true;
+            }
+
+            if (shaderManager->precompilationPending())
+                shaderManager->precompile(SHADER_PRECOMPILATION_BUDGET);
+        }
+
         if (m_running != m_engine->isRunning()) {
             m_running = !m_running;
             emit runningChanged();
@@ -434,6 +454,7 @@ void ProjectLoader::redraw()
     }
 
     m_engine->updateMonitors();
+    emit redrawRequested();
 }
 
 void ProjectLoader::addClone(SpriteModel *model)
@@ -654,6 +675,50 @@ void ProjectLoader::setMute(bool newMute)
     emit muteChanged();
 }
 
+bool ProjectLoader::textureAtlas() const
+{
+    return Skin::atlasEnabled();
+}
+
+void ProjectLoader::setTextureAtlas(bool newTextureAtlas)
+{
+    // Only costumes loaded after this call are affected, so this should be set before loading the project
+    if (Skin::atlasEnabled() == newTextureAtlas)
+        return;
+
+    Skin::setAtlasEnabled(newTextureAtlas);
+    emit textureAtlasChanged();
+}
+
+bool ProjectLoader::precompileShaders() const
+{
+    return m_precompileShaders;
+}
+
+void ProjectLoader::setPrecompileShaders(bool newPrecompileShaders)
+{
+    if (m_precompileShaders == newPrecompileShaders)
+        return;
+
+    m_precompileShaders = newPrecompileShaders;
+    emit precompileShadersChanged();
+}
+
+bool ProjectLoader::shaderCache() const
+{
+    return ShaderManager::programCacheEnabled();
+}
+
+void ProjectLoader::setShaderCache(bool newShaderCache)
+{
+    // Linked shader programs are stored in the cache location (see ShaderManager::programCacheDirectory())
+    if (ShaderManager::programCacheEnabled() == newShaderCache)
+        return;
+
+    ShaderManager::setProgramCacheEnabled(newShaderCache);
+    emit shaderCacheChanged();
+}
+
 unsigned int ProjectLoader::downloadedAssets() const
 {
     return m_downloadedAssets;
@@ -42,6 +42,9 @@ class ProjectLoader : public QObject
         Q_PROPERTY(int cloneLimit READ cloneLimit WRITE setCloneLimit NOTIFY cloneLimitChanged)
         Q_PROPERTY(bool spriteFencing READ spriteFencing WRITE setSpriteFencing NOTIFY spriteFencingChanged)
         Q_PROPERTY(bool mute READ mute WRITE setMute NOTIFY muteChanged)
+        Q_PROPERTY(bool textureAtlas READ textureAtlas WRITE setTextureAtlas NOTIFY textureAtlasChanged)
+        Q_PROPERTY(bool precompileShaders READ precompileShaders WRITE setPrecompileShaders NOTIFY precompileShadersChanged)
+        Q_PROPERTY(bool shaderCache READ shaderCache WRITE setShaderCache NOTIFY shaderCacheChanged)
         Q_PROPERTY(unsigned int downloadedAssets READ downloadedAssets NOTIFY downloadedAssetsChanged)
         Q_PROPERTY(unsigned int assetCount READ assetCount NOTIFY assetCountChanged)
 
@@ -110,6 +113,15 @@ class ProjectLoader : public QObject
         bool mute() const;
         void setMute(bool newMute);
 
+        bool textureAtlas() const;
+        void setTextureAtlas(bool newTextureAtlas);
+
+        bool precompileShaders() const;
+        void setPrecompileShaders(bool newPrecompileShaders);
+
+        bool shaderCache() const;
+        void setShaderCache(bool newShaderCache);
+
         unsigned int downloadedAssets() const;
 
         unsigned int assetCount() const;
@@ -135,6 +147,9 @@ class ProjectLoader : public QObject
         void cloneLimitChanged();
         void spriteFencingChanged();
         void muteChanged();
+        void textureAtlasChanged();
+        void precompileShadersChanged();
+        void shaderCacheChanged();
         void downloadedAssetsChanged();
         void assetCountChanged();
         void cloneCreated(SpriteModel *model);
@@ -143,6 +158,7 @@ class ProjectLoader : public QObject
         void monitorRemoved(MonitorModel *model);
         void questionAsked(QString question);
         void questionAborted();
+        void redrawRequested();
 
     protected:
         void timerEvent(QTimerEvent *event) override;
@@ -185,6 +201,8 @@ class ProjectLoader : public QObject
         int m_cloneLimit = 300;
         bool m_spriteFencing = true;
         bool m_mute = false;
+        bool m_precompileShaders = false;
+        bool m_shadersQueued = false;
         std::atomic<unsigned int> m_downloadedAssets = 0;
         std::atomic<unsigned int> m_assetCount = 0;
         std::atomic<bool> m_stopLoading = false;
@@ -16,6 +16,9 @@
 #include "svgskin.h"
 #include "cputexturemanager.h"
 #include "penlayer.h"
+#include "gputouchingquery.h"
+#include "penstamp.h"
+#include "sharedquad.h"
 
 using namespace scratchcpprender;
 using namespace libscratchcpp;
@@ -52,6 +55,7 @@ void RenderedTarget::updateVisibility(bool visible)
     setVisible(visible);
     calculatePos();
     m_convexHullDirty = true;
+    m_transformedHullDirty = true;
 }
 
 void RenderedTarget::updateX(double x)
@@ -236,6 +240,7 @@ void RenderedTarget::setEngine(IEngine *newEngine)
     m_penLayer = PenLayer::getProjectPenLayer(m_engine);
     m_convexHullDirty = true;
     m_transformedHullDirty = true;
+    m_fastBoundsDirty = true;
     clearGraphicEffects();
     m_hullPoints.clear();
 
@@ -356,6 +361,22 @@ void RenderedTarget::setStageScale(double newStageScale)
     emit stageScaleChanged();
 }
 
+bool RenderedTarget::composited() const
+{
+    return m_composited;
+}
+
+void RenderedTarget::setComposited(bool newComposited)
+{
+    // Composited targets are drawn by the stage compositor, so they don't have their own FBO
+    if (m_composited == newComposited)
+        return;
+
+    m_composited = newComposited;
+    update();
+    emit compositedChanged();
+}
+
 qreal RenderedTarget::width() const
 {
     return QNanoQuickItem::width();
@@ -379,6 +400,10 @@ void RenderedTarget::setHeight(qreal height)
 Rect RenderedTarget::getBounds() const
 {
     // https://github.com/scratchfoundation/scratch-render/blob/c3ede9c3d54769730c7b023021511e2aba167b1f/src/Rectangle.js#L33-L55
+    // The bounds relative to the position are cached until the transformed hull points change
+    if (!m_transformedHullDirty && !m_boundsDirty)
+        return Rect(m_localBounds.left() + m_x, m_localBounds.top() + m_y, m_localBounds.right() + m_x, m_localBounds.bottom() + m_y);
+
     double left = std::numeric_limits<double>::infinity();
     double top = -std::numeric_limits<double>::infinity();
     double right = -std::numeric_limits<double>::infinity();
@@ -403,6 +428,11 @@ Rect RenderedTarget::getBounds() const
             bottom = y;
     }
 
+    if (!m_transformedHullDirty) {
+        m_localBounds = Rect(left, top, right, bottom);
+        m_boundsDirty = false;
+    }
+
     return Rect(left + m_x, top + m_y, right + m_x, bottom + m_y);
 }
 
@@ -430,6 +460,9 @@ Rect RenderedTarget::getFastBounds() const
     if (!m_costume || !m_skin || !m_texture.isValid() || !m_cpuTexture.isValid())
         return Rect(m_x, m_y, m_x, m_y);
 
+    if (!m_fastBoundsDirty)
+        return Rect(m_localFastBounds.left() + m_x, m_localFastBounds.top() + m_y, m_localFastBounds.right() + m_x, m_localFastBounds.bottom() + m_y);
+
     const double textureScale = m_skin->getTextureScale(m_cpuTexture);
     const double bitmapRes = m_costume->bitmapResolution();
     const double width = m_cpuTexture.width() * m_size / textureScale / bitmapRes;
@@ -458,6 +491,9 @@ Rect RenderedTarget::getFastBounds() const
     const double minY = std::min(yList);
     const double maxY = std::max(yList);
 
+    m_localFastBounds = Rect(minX, maxY, maxX, minY);
+    m_fastBoundsDirty = false;
+
     return Rect(minX + m_x, maxY + m_y, maxX + m_x, minY + m_y);
 }
 
@@ -471,6 +507,17 @@ QNanoQuickItemPainter *RenderedTarget::createItemPainter() const
     return new TargetPainter();
 }
 
+QSGNode *RenderedTarget::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data)
+{
+    if (m_composited) {
+        // Delete the node with the painter and its FBO
+        delete oldNode;
+        return nullptr;
+    }
+
+    return IRenderedTarget::updatePaintNode(oldNode, data);
+}
+
 void RenderedTarget::mousePressEvent(QMouseEvent *event)
 {
     if (event->button() == Qt::LeftButton)
@@ -515,61 +562,87 @@ void RenderedTarget::mouseMoveEvent(QMouseEvent *event)
 }
 
 void RenderedTarget::render(double scale) const
+{
+    render(scale, QPoint(), ShaderManager::DrawMode::Default);
+}
+
+void RenderedTarget::render(double scale, const QPoint &origin, ShaderManager::DrawMode drawMode) const
 {
     if (!m_glF) {
         m_glF = std::make_unique<QOpenGLFunctions>();
         m_glF->initializeOpenGLFunctions();
     }
 
-    if (!m_cpuTexture.isValid())
-        return;
-
-    const float stageWidth = m_engine->stageWidth() * scale;
-    const float stageHeight = m_engine->stageHeight() * scale;
-
-    libscratchcpp::Rect bounds = getFastBounds();
-    bounds.snapToInt();
+    QRect viewport;
+    QMatrix4x4 modelMatrix, projectionMatrix;
 
-    if (!bounds.intersects(libscratchcpp::Rect(-stageWidth / 2, stageHeight / 2, stageWidth / 2, -stageHeight / 2)))
+    if (!getRenderGeometry(scale, origin, viewport, modelMatrix, projectionMatrix))
         return;
 
-    QMatrix4x4 modelMatrix, projectionMatrix;
-    getMatrices(modelMatrix, projectionMatrix);
-    modelMatrix.scale(scale);
-    projectionMatrix.scale(1.0f / scale);
-
     m_glF->glEnable(GL_BLEND);
     m_glF->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    m_glF->glViewport((stageWidth / 2) + bounds.left() * scale, (stageHeight / 2) + bounds.bottom() * scale, bounds.width() * scale, bounds.height() * scale);
+    m_glF->glViewport(viewport.x(), viewport.y(), viewport.width(), viewport.height());
 
     ShaderManager *shaderManager = ShaderManager::instance();
+    QOpenGLShaderProgram *program;
 
-    if (!m_shaderProgram) {
-        m_shaderProgram = shaderManager->getShaderProgram(this, m_graphicEffects);
-        Q_ASSERT(m_shaderProgram);
-        Q_ASSERT(m_shaderProgram->isLinked());
+    if (drawMode == ShaderManager::DrawMode::Default) {
+        if (!m_shaderProgram) {
+            m_shaderProgram = shaderManager->getShaderProgram(m_graphicEffects);
+            Q_ASSERT(m_shaderProgram);
+            Q_ASSERT(m_shaderProgram->isLinked());
+        }
+
+        program = m_shaderProgram;
+    } else {
+        // Other draw modes are only used by GPU queries, so the uniforms may be stale
+        program = shaderManager->getShaderProgram(m_graphicEffects, drawMode);
+        Q_ASSERT(program);
+        Q_ASSERT(program->isLinked());
 
-        m_shaderProgram->bind();
-        ShaderManager::setUniforms(m_shaderProgram, 0, m_cpuTexture.size(), m_graphicEffects);
+        program->bind();
+        ShaderManager::setUniforms(program, 0, skinSize(), m_graphicEffects, m_cpuTexture.uvRect());
     }
 
     GLint currentProgram = 0;
     m_glF->glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
 
-    if (static_cast<GLuint>(currentProgram) != m_shaderProgram->programId())
-        m_shaderProgram->bind();
+    if (static_cast<GLuint>(currentProgram) != program->programId())
+        program->bind();
+
+    // The program is shared with other targets (nothing is uploaded if the uniforms didn't change)
+    if (drawMode == ShaderManager::DrawMode::Default)
+        ShaderManager::updateUniforms(program, 0, skinSize(), m_graphicEffects, m_cpuTexture.uvRect());
 
     m_glF->glActiveTexture(GL_TEXTURE0);
     m_glF->glBindTexture(GL_TEXTURE_2D, m_cpuTexture.handle());
 
-    m_shaderProgram->setUniformValue("u_projectionMatrix", projectionMatrix);
-    m_shaderProgram->setUniformValue("u_modelMatrix", modelMatrix);
-    m_glF->glDrawArrays(GL_TRIANGLES, 0, 6);
+    ShaderManager::setMatrices(program, projectionMatrix, modelMatrix);
+    m_glF->glDrawArrays(GL_TRIANGLES, 0, SharedQuad::VERTEX_COUNT);
 
     // NOTE: Keep the shader program bound for future use
 }
 
+bool RenderedTarget::getStamp(double scale, PenStamp &dst) const
+{
+    // Gets everything needed to render the target later (with other stamps)
+    QRect viewport;
+    QMatrix4x4 modelMatrix, projectionMatrix;
+
+    if (!getRenderGeometry(scale, QPoint(), viewport, modelMatrix, projectionMatrix))
+        return false;
+
+    dst.texture = m_cpuTexture.handle();
+    dst.skinSize = skinSize();
+    dst.uvRect = m_cpuTexture.uvRect();
+    dst.effectMask = ShaderManager::effectMask(m_graphicEffects);
+    ShaderManager::getInstanceValuesForEffects(m_graphicEffects, dst.effectValues);
+    dst.viewport = viewport;
+    dst.matrix = projectionMatrix * modelMatrix;
+    return true;
+}
+
 Texture RenderedTarget::texture() const
 {
     return m_texture;
@@ -680,6 +753,29 @@ bool RenderedTarget::containsScratchPoint(double x, double y) const
     return containsLocalPoint(mapFromScratchToLocal(QPointF(x, y)));
 }
 
+void RenderedTarget::getScratchSpans(const QRect &rect, TextureSpans &dst) const
+{
+    // Row i of dst is the row rect.top() + i of the stage (in Scratch coordinates) and column j is rect.left() + j
+    dst = TextureSpans(rect.width());
+    std::vector<TextureSpans::Span> row;
+
+    if (!m_engine || !m_skin || !m_costume) {
+        for (int y = rect.top(); y <= rect.bottom(); y++)
+            dst.addRow(row);
+
+        return;
+    }
+
+    // Without shape-changing effects, stage rows can be mapped to texture spans
+    const ShaderManager::Effect shapeMask = ShaderManager::Effect::Fisheye | ShaderManager::Effect::Whirl | ShaderManager::Effect::Pixelate | ShaderManager::Effect::Mosaic;
+    const TextureSpans *textureSpans = (m_graphicEffectMask & shapeMask) == 0 ? textureManager()->getTextureSpans(m_cpuTexture) : nullptr;
+
+    for (int y = rect.top(); y <= rect.bottom(); y++) {
+        getScratchRowSpans(y, rect.left(), rect.right(), textureSpans, row);
+        dst.addRow(row);
+    }
+}
+
 QRgb RenderedTarget::colorAtScratchPoint(double x, double y) const
 {
     // NOTE: Only this target is processed! Use sampleColor3b() to get the final color.
@@ -698,7 +794,41 @@ QRgb RenderedTarget::colorAtScratchPoint(double x, double y) const
     if ((x < 0 || x >= width) || (y < 0 || y >= height))
         return qRgba(0, 0, 0, 0);
 
-    return textureManager()->getPointColor(m_cpuTexture, x, y, m_graphicEffectMask, m_graphicEffects);
+    return textureManager()->getPointColor(m_cpuTexture, x, y, m_graphicEffectMask, m_graphicEffects, skinSize());
+}
+
+void RenderedTarget::colorsAtScratchPoints(const std::vector<QPointF> &points, QRgb *dst) const
+{
+    // Same as calling colorAtScratchPoint() for each point, but the graphic effects are applied to all colors at once
+    std::fill(dst, dst + points.size(), qRgba(0, 0, 0, 0));
+
+    if (!m_engine || !m_cpuTexture.isValid())
+        return;
+
+    const double width = m_cpuTexture.width();
+    const double height = m_cpuTexture.height();
+    std::vector<QPoint> localPoints;
+    std::vector<size_t> indexes;
+    localPoints.reserve(points.size());
+    indexes.reserve(points.size());
+
+    for (size_t i = 0; i < points.size(); i++) {
+        // Translate the coordinates and skip the points outside the texture
+        const QPointF point = mapFromScratchToLocal(points[i]);
+        const double x = std::floor(point.x());
+        const double y = std::floor(point.y());
+
+        if ((x >= 0 && x < width) && (y >= 0 && y < height)) {
+            localPoints.push_back(QPoint(x, y));
+            indexes.push_back(i);
+        }
+    }
+
+    std::vector<QRgb> colors(localPoints.size());
+    textureManager()->getPointColors(m_cpuTexture, localPoints.data(), localPoints.size(), m_graphicEffectMask, m_graphicEffects, colors.data(), skinSize());
+
+    for (size_t i = 0; i < indexes.size(); i++)
+        dst[indexes[i]] = colors[i];
 }
 
 bool RenderedTarget::touchingClones(const std::vector<libscratchcpp::Sprite *> &clones) const
@@ -718,16 +848,32 @@ bool RenderedTarget::touchingClones(const std::vector<libscratchcpp::Sprite *> &
     if (united.isEmpty() || candidates.empty())
         return false;
 
-    // Loop through the points of the union
-    for (int y = united.top(); y <= united.bottom(); y++) {
-        for (int x = united.left(); x <= united.right(); x++) {
-            if (this->containsScratchPoint(x, y)) {
-                for (IRenderedTarget *candidate : candidates) {
-                    if (candidate->containsScratchPoint(x, y))
-                        return true;
-                }
-            }
-        }
+    // Large areas are checked faster on the GPU
+    if (GpuTouchingQuery::isSuitable(united))
+        return GpuTouchingQuery::touchingTargets(this, united, candidates);
+
+    // Get the pixels of the union covered by each target as spans (the same points as in a per-pixel loop)
+    const int left = united.left();
+    const int top = united.top();
+    const int right = std::floor(united.right());
+    const int bottom = std::floor(united.bottom());
+
+    if (right < left || bottom < top)
+        return false;
+
+    const QRect rect(QPoint(left, top), QPoint(right, bottom));
+    TextureSpans spans, candidateSpans;
+    getScratchSpans(rect, spans);
+
+    if (spans.isEmpty())
+        return false;
+
+    // Intersect the spans row by row (transparent runs are skipped)
+    for (IRenderedTarget *candidate : candidates) {
+        candidate->getScratchSpans(rect, candidateSpans);
+
+        if (spans.intersects(candidateSpans, QPoint(0, 0)))
+            return true;
     }
 
     return false;
@@ -763,7 +909,7 @@ void RenderedTarget::calculatePos()
     else
         setTransformOrigin(QQuickItem::Center);
 
-    m_transformedHullDirty = true;
+    // NOTE: The transformed hull points and bounds are relative to the position, so they don't change here
     m_matricesDirty = true;
 }
 
@@ -798,13 +944,14 @@ void RenderedTarget::calculateRotation()
         emit mirrorHorizontallyChanged();
 
     m_transformedHullDirty = true;
+    m_fastBoundsDirty = true;
     m_matricesDirty = true;
 }
 
 void RenderedTarget::calculateSize()
 {
     if (m_skin && m_costume) {
-        GLuint oldTexture = m_cpuTexture.handle();
+        quint64 oldTexture = m_cpuTexture.id();
         bool wasValid = m_cpuTexture.isValid();
         m_texture = m_skin->getTexture(m_size * m_stageScale);
         m_cpuTexture = m_skin->getTexture(m_size);
@@ -812,13 +959,15 @@ void RenderedTarget::calculateSize()
         m_height = m_texture.height();
         setScale(m_size * m_stageScale / m_skin->getTextureScale(m_texture) / m_costume->bitmapResolution());
 
-        if (wasValid && m_cpuTexture.handle() != oldTexture)
+        if (wasValid && m_cpuTexture.id() != oldTexture)
             m_convexHullDirty = true;
 
         m_transformedHullDirty = true;
         m_matricesDirty = true;
         m_shaderProgram = nullptr;
     }
+
+    m_fastBoundsDirty = true;
 }
 
 void RenderedTarget::handleSceneMouseMove(qreal x, qreal y)
@@ -846,7 +995,7 @@ void RenderedTarget::updateHullPoints()
         return;
     }
 
-    textureManager()->getTextureConvexHullPoints(m_cpuTexture, m_skin->getTexture(1).size(), m_graphicEffectMask, m_graphicEffects, m_hullPoints);
+    textureManager()->getTextureConvexHullPoints(m_cpuTexture, skinSize(), m_graphicEffectMask, m_graphicEffects, m_hullPoints);
 }
 
 const std::vector<QPointF> &RenderedTarget::transformedHullPoints() const
@@ -856,6 +1005,7 @@ const std::vector<QPointF> &RenderedTarget::transformedHullPoints() const
         return m_transformedHullPoints;
 
     m_transformedHullPoints.clear();
+    m_boundsDirty = true;
 
     if (!m_costume || !m_skin || !m_texture.isValid() || !m_cpuTexture.isValid())
         return m_transformedHullPoints;
@@ -888,7 +1038,100 @@ const std::vector<QPointF> &RenderedTarget::transformedHullPoints() const
 
 bool RenderedTarget::containsLocalPoint(const QPointF &point) const
 {
-    return textureManager()->textureContainsPoint(m_cpuTexture, point, m_graphicEffectMask, m_graphicEffects);
+    return textureManager()->textureContainsPoint(m_cpuTexture, point, m_graphicEffectMask, m_graphicEffects, skinSize());
+}
+
+void RenderedTarget::getScratchRowSpans(int y, int left, int right, const TextureSpans *textureSpans, std::vector<TextureSpans::Span> &dst) const
+{
+    // Finds the points of the row between left and right covered by this target (the spans are relative to left)
+    dst.clear();
+    auto contains = [this, y](int x) { return containsLocalPoint(mapFromScratchToLocal(QPointF(x, y))); };
+
+    auto addSpan = [&dst, left](int start, int end) {
+        // Merge spans which touch
+        if (!dst.empty() && start - left <= dst.back().end)
+            dst.back().end = std::max(dst.back().end, end - left + 1);
+        else
+            dst.push_back({ start - left, end - left + 1, -1 });
+    };
+
+    const QPointF first = mapFromScratchToLocal(QPointF(left, y));
+    const QPointF last = mapFromScratchToLocal(QPointF(right, y));
+    const double step = right > left ? (last.x() - first.x()) / (right - left) : 0; // texture pixels per stage pixel
+
+    if (!textureSpans || step == 0 || first.y() != last.y()) {
+        // The row isn't a part of a texture row (e.g. rotated sprites), so test each point
+        for (int x = left; x <= right; x++) {
+            if (!contains(x))
+                continue;
+
+            const int start = x;
+
+            while (x < right && contains(x + 1))
+                x++;
+
+            addSpan(start, x);
+        }
+
+        return;
+    }
+
+    // Map the spans of the texture row to the stage, only the points at the edges of the spans are tested
+    // (this gives the same result as testing each point, but transparent runs are skipped)
+    const int textureY = first.y();
+    const int count = textureSpans->spanCount(textureY);
+    const TextureSpans::Span *spans = textureSpans->rowSpans(textureY);
+
+    for (int i = 0; i < count; i++) {
+        // Spans must be added from the left (mirrored sprites have the texture spans in the opposite order)
+        const TextureSpans::Span &span = spans[step > 0 ? i : count - 1 - i];
+
+        // Local coordinates are truncated, so (-1, 1) belongs to the first column
+        const double spanStart = span.start == 0 ? -1 : span.start;
+        const double a = left + (spanStart - first.x()) / step;
+        const double b = left + (span.end - first.x()) / step;
+        const double from = std::min(a, b);
+        const double to = std::max(a, b);
+
+        if (to < left - 1 || from > right + 1)
+            continue;
+
+        // Points of the previous spans don't have to be tested again
+        const int minStart = dst.empty() ? left : left + dst.back().end;
+
+        if (minStart > right)
+            break;
+
+        int start = static_cast<int>(std::clamp(std::ceil(from), static_cast<double>(minStart), static_cast<double>(right)));
+        int end = static_cast<int>(std::clamp(std::ceil(to) - 1, static_cast<double>(start), static_cast<double>(right)));
+
+        // Correct the edges (the mapping may be off by one point because of rounding)
+        while (start <= end && !contains(start))
+            start++;
+
+        if (start > end)
+            continue;
+
+        while (start > minStart && contains(start - 1))
+            start--;
+
+        while (!contains(end))
+            end--;
+
+        while (end < right && contains(end + 1))
+            end++;
+
+        addSpan(start, end);
+    }
+}
+
+QSize RenderedTarget::skinSize() const
+{
+    // The shape-changing effects use the size of the skin, not of the current texture (the CPU and the GPU must use the same size)
+    if (!m_skin)
+        return QSize();
+
+    return m_skin->getTexture(1).size();
 }
 
 QPointF RenderedTarget::transformPoint(double scratchX, double scratchY, double originX, double originY, double rot) const
@@ -983,20 +1226,36 @@ bool RenderedTarget::touchingColor(Rgb color, bool hasMask, Rgb mask) const
         return false;
     }
 
-    // Loop through the points of the union
-    for (int y = bounds.top(); y <= bounds.bottom(); y++) {
-        for (int x = bounds.left(); x <= bounds.right(); x++) {
-            if (hasMask ? maskMatches(colorAtScratchPoint(x, y), mask3b) : this->containsScratchPoint(x, y)) {
-                QRgb pixelColor = sampleColor3b(x, y, candidates);
-
-                if (colorMatches(rgb, pixelColor)) {
-                    // Restore ghost effect value
-                    if (hasMask && ghostValue != 0) {
-                        m_graphicEffects[ShaderManager::Effect::Ghost] = ghostValue;
-                        m_graphicEffectMask |= ShaderManager::Effect::Ghost;
-                    }
+    bool touching = false;
+
+    if (GpuTouchingQuery::isSuitable(bounds)) {
+        // Large areas are checked faster on the GPU
+        touching = GpuTouchingQuery::touchingColor(this, bounds, candidates, m_penLayer, rgb, hasMask, mask3b);
+    } else {
+        // Loop through the points of the union (with a mask, the colors of each row are sampled at once)
+        const int left = bounds.left();
+        std::vector<QPointF> row;
+        std::vector<QRgb> rowColors;
 
-                    return true;
+        for (int y = bounds.top(); !touching && y <= bounds.bottom(); y++) {
+            if (hasMask) {
+                row.clear();
+
+                for (int x = left; x <= bounds.right(); x++)
+                    row.push_back(QPointF(x, y));
+
+                rowColors.resize(row.size());
+                colorsAtScratchPoints(row, rowColors.data());
+            }
+
+            for (int x = left; x <= bounds.right(); x++) {
+                if (hasMask ? maskMatches(rowColors[x - left], mask3b) : this->containsScratchPoint(x, y)) {
+                    QRgb pixelColor = sampleColor3b(x, y, candidates);
+
+                    if (colorMatches(rgb, pixelColor)) {
+                        touching = true;
+                        break;
+                    }
                 }
             }
         }
@@ -1008,7 +1267,7 @@ bool RenderedTarget::touchingColor(Rgb color, bool hasMask, Rgb mask) const
         m_graphicEffectMask |= ShaderManager::Effect::Ghost;
     }
 
-    return false;
+    return touching;
 }
 
 QRectF RenderedTarget::touchingBounds() const
@@ -1068,7 +1327,7 @@ QRectF RenderedTarget::candidatesBounds(const QRectF &targetRect, const std::vec
 
     // Check pen layer
     if (m_penLayer)
-        united = united.united(rectIntersection(targetRect, m_penLayer->getBounds()));
+        united = united.united(rectIntersection(targetRect, m_penLayer->getFastBounds()));
 
     return united;
 }
@@ -1186,6 +1445,35 @@ QRgb RenderedTarget::sampleColor3b(double x, double y, const std::vector<IRender
     return qRgb(r, g, b);
 }
 
+bool RenderedTarget::getRenderGeometry(double scale, const QPoint &origin, QRect &viewport, QMatrix4x4 &modelMatrix, QMatrix4x4 &projectionMatrix) const
+{
+    // Returns false if the target can't be rendered or it's outside the stage
+    if (!m_cpuTexture.isValid())
+        return false;
+
+    const float stageWidth = m_engine->stageWidth() * scale;
+    const float stageHeight = m_engine->stageHeight() * scale;
+
+    libscratchcpp::Rect bounds = getFastBounds();
+    bounds.snapToInt();
+
+    if (!bounds.intersects(libscratchcpp::Rect(-stageWidth / 2, stageHeight / 2, stageWidth / 2, -stageHeight / 2)))
+        return false;
+
+    getMatrices(modelMatrix, projectionMatrix);
+    modelMatrix.scale(scale);
+    projectionMatrix.scale(1.0f / scale);
+
+    // The viewport is truncated in the same way as by glViewport()
+    viewport.setRect(
+        (stageWidth / 2) + bounds.left() * scale - origin.x(),
+        (stageHeight / 2) + bounds.bottom() * scale - origin.y(),
+        bounds.width() * scale,
+        bounds.height() * scale);
+
+    return true;
+}
+
 void RenderedTarget::getMatrices(QMatrix4x4 &modelMatrix, QMatrix4x4 &projectionMatrix) const
 {
     if (m_matricesDirty) {
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <qnanoquickitem.h>
+#include <scratchcpp/rect.h>
 #include <QBuffer>
 #include <QMutex>
 #include <QtSvg/QSvgRenderer>
@@ -10,6 +11,7 @@
 
 #include "irenderedtarget.h"
 #include "texture.h"
+#include "texturespans.h"
 
 Q_MOC_INCLUDE("stagemodel.h");
 Q_MOC_INCLUDE("spritemodel.h");
@@ -32,6 +34,7 @@ class RenderedTarget : public IRenderedTarget
         Q_PROPERTY(bool mirrorHorizontally READ mirrorHorizontally NOTIFY mirrorHorizontallyChanged)
         Q_PROPERTY(SceneMouseArea *mouseArea READ mouseArea WRITE setMouseArea NOTIFY mouseAreaChanged)
         Q_PROPERTY(double stageScale READ stageScale WRITE setStageScale NOTIFY stageScaleChanged)
+        Q_PROPERTY(bool composited READ composited WRITE setComposited NOTIFY compositedChanged)
 
     public:
         RenderedTarget(QQuickItem *parent = nullptr);
@@ -70,6 +73,9 @@ class RenderedTarget : public IRenderedTarget
         double stageScale() const override;
         void setStageScale(double newStageScale) override;
 
+        bool composited() const;
+        void setComposited(bool newComposited);
+
         qreal width() const override;
         void setWidth(qreal width) override;
 
@@ -86,6 +92,8 @@ class RenderedTarget : public IRenderedTarget
         bool mirrorHorizontally() const override;
 
         void render(double scale) const override;
+        void render(double scale, const QPoint &origin, ShaderManager::DrawMode drawMode) const override;
+        bool getStamp(double scale, PenStamp &dst) const override;
 
         Texture texture() const override;
         const Texture &cpuTexture() const override;
@@ -100,6 +108,7 @@ class RenderedTarget : public IRenderedTarget
 
         Q_INVOKABLE bool contains(const QPointF &point) const override;
         bool containsScratchPoint(double x, double y) const override;
+        void getScratchSpans(const QRect &rect, TextureSpans &dst) const override;
         QRgb colorAtScratchPoint(double x, double y) const override;
 
         bool touchingClones(const std::vector<libscratchcpp::Sprite *> &) const override;
@@ -113,9 +122,11 @@ class RenderedTarget : public IRenderedTarget
         void mouseAreaChanged();
         void mirrorHorizontallyChanged();
         void stageScaleChanged();
+        void compositedChanged();
 
     protected:
         QNanoQuickItemPainter *createItemPainter() const override;
+        QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data) override;
         void mousePressEvent(QMouseEvent *event) override;
         void mouseReleaseEvent(QMouseEvent *event) override;
         void mouseMoveEvent(QMouseEvent *event) override;
@@ -129,6 +140,9 @@ class RenderedTarget : public IRenderedTarget
         void updateHullPoints();
         const std::vector<QPointF> &transformedHullPoints() const;
         bool containsLocalPoint(const QPointF &point) const;
+        void getScratchRowSpans(int y, int left, int right, const TextureSpans *textureSpans, std::vector<TextureSpans::Span> &dst) const;
+        void colorsAtScratchPoints(const std::vector<QPointF> &points, QRgb *dst) const;
+        QSize skinSize() const;
         QPointF transformPoint(double scratchX, double scratchY, double originX, double originY, double rot) const;
         QPointF transformPoint(double scratchX, double scratchY, double originX, double originY, double sinRot, double cosRot) const;
         QPointF mapFromStageWithOriginPoint(const QPointF &scenePoint) const;
@@ -146,6 +160,7 @@ class RenderedTarget : public IRenderedTarget
         QRgb sampleColor3b(double x, double y, const std::vector<IRenderedTarget *> &targets) const;
 
         void getMatrices(QMatrix4x4 &modelMatrix, QMatrix4x4 &projectionMatrix) const;
+        bool getRenderGeometry(double scale, const QPoint &origin, QRect &viewport, QMatrix4x4 &modelMatrix, QMatrix4x4 &projectionMatrix) const;
 
         libscratchcpp::IEngine *m_engine = nullptr;
         libscratchcpp::Costume *m_costume = nullptr;
@@ -175,12 +190,17 @@ class RenderedTarget : public IRenderedTarget
         libscratchcpp::Sprite::RotationStyle m_rotationStyle = libscratchcpp::Sprite::RotationStyle::AllAround;
         bool m_mirrorHorizontally = false;
         double m_stageScale = 1;
+        bool m_composited = false;
         qreal m_maximumWidth = std::numeric_limits<double>::infinity();
         qreal m_maximumHeight = std::numeric_limits<double>::infinity();
         bool m_convexHullDirty = true;
         std::vector<QPoint> m_hullPoints;
         mutable bool m_transformedHullDirty = true;
         mutable std::vector<QPointF> m_transformedHullPoints; // NOTE: Use transformedHullPoints();
+        mutable bool m_boundsDirty = true;
+        mutable libscratchcpp::Rect m_localBounds; // NOTE: Use getBounds()! (relative to the position)
+        mutable bool m_fastBoundsDirty = true;
+        mutable libscratchcpp::Rect m_localFastBounds; // NOTE: Use getFastBounds()! (relative to the position)
         mutable bool m_matricesDirty = false;
         mutable QMatrix4x4 m_modelMatrix;      // NOTE: Use getMatrices()!
         mutable QMatrix4x4 m_projectionMatrix; // NOTE: Use getMatrices()!
@@ -3,6 +3,15 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLContext>
 #include <QFile>
+#include <QVector3D>
+#include <QVector4D>
+#include <QMatrix4x4>
+#include <QElapsedTimer>
+#include <QOpenGLExtraFunctions>
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QSaveFile>
+#include <QDir>
 #include <scratchcpp/scratchconfiguration.h>
 
 #include "shadermanager.h"
@@ -32,6 +41,22 @@ static const QString SHADER_PREFIX = "#version 300 es\n";
 
 static const char *TEXTURE_UNIT_UNIFORM = "u_skin";
 static const char *SKIN_SIZE_UNIFORM = "u_skinSize";
+static const char *UV_RECT_UNIFORM = "u_uvRect";
+static const char *PROJECTION_MATRIX_UNIFORM = "u_projectionMatrix";
+static const char *MODEL_MATRIX_UNIFORM = "u_modelMatrix";
+static const char *COLOR_MASK_UNIFORM = "u_colorMask";
+static const char *COLOR_MASK_STEP_UNIFORM = "u_colorMaskStep";
+
+// Bump this when the format of the cached program binaries changes
+static const QString PROGRAM_CACHE_VERSION = "v1";
+static const quint32 PROGRAM_CACHE_MAGIC = 0x53435042; // "SCPB"
+
+static const int DRAW_MODE_KEY_SHIFT = 8; // draw modes are stored above the effect bits in the program cache keys
+
+// The order of the effect values in the vertex attributes of instanced shader programs
+static const std::array<ShaderManager::Effect, 7> INSTANCE_EFFECTS = { ShaderManager::Effect::Color,   ShaderManager::Effect::Brightness, ShaderManager::Effect::Ghost,
+                                                                       ShaderManager::Effect::Fisheye, ShaderManager::Effect::Whirl,      ShaderManager::Effect::Pixelate,
+                                                                       ShaderManager::Effect::Mosaic };
 
 static const std::unordered_map<ShaderManager::Effect, const char *> EFFECT_TO_NAME = {
     { ShaderManager::Effect::Color, "color" }, { ShaderManager::Effect::Brightness, "brightness" }, { ShaderManager::Effect::Ghost, "ghost" },  { ShaderManager::Effect::Fisheye, "fisheye" },
@@ -53,6 +78,12 @@ static const std::unordered_map<ShaderManager::Effect, ConverterFunc> EFFECT_CON
     { ShaderManager::Effect::Mosaic, [](float x) { return std::max(1.0f, std::min(std::round((std::abs(x) + 10.0f) / 10.0f), 512.0f)); } }
 };
 
+static const std::unordered_map<ShaderManager::DrawMode, const char *> DRAW_MODE_TO_NAME = {
+    { ShaderManager::DrawMode::Default, "default" },
+    { ShaderManager::DrawMode::Silhouette, "silhouette" },
+    { ShaderManager::DrawMode::ColorMask, "colorMask" }
+};
+
 static const std::unordered_map<ShaderManager::Effect, bool> EFFECT_SHAPE_CHANGES = {
     { ShaderManager::Effect::Color, false }, { ShaderManager::Effect::Brightness, false }, { ShaderManager::Effect::Ghost, false }, { ShaderManager::Effect::Fisheye, true },
     { ShaderManager::Effect::Whirl, true },  { ShaderManager::Effect::Pixelate, true },    { ShaderManager::Effect::Mosaic, true }
@@ -76,15 +107,15 @@ ShaderManager::ShaderManager(QObject *parent) :
     }
 
     // Compile the vertex shader (it will be used in any shader program)
-    QByteArray vertexShaderSource;
-    QFile vertSource(VERTEX_SHADER_SRC);
-    vertSource.open(QFile::ReadOnly);
-    vertexShaderSource = SHADER_PREFIX.toUtf8() + vertSource.readAll();
-
     m_vertexShader = new QOpenGLShader(QOpenGLShader::Vertex, this);
-    m_vertexShader->compileSourceCode(vertexShaderSource);
+    m_vertexShader->compileSourceCode(shaderSource(VERTEX_SHADER_SRC));
     Q_ASSERT(m_vertexShader->isCompiled());
 
+    // Compile the vertex shader for instanced drawing
+    m_instancedVertexShader = new QOpenGLShader(QOpenGLShader::Vertex, this);
+    m_instancedVertexShader->compileSourceCode(shaderSource(VERTEX_SHADER_SRC, "#define INSTANCED\n"));
+    Q_ASSERT(m_instancedVertexShader->isCompiled());
+
     // Load the fragment shader source code
     QFile fragSource(FRAGMENT_SHADER_SRC);
     fragSource.open(QFile::ReadOnly);
@@ -97,42 +128,69 @@ ShaderManager *ShaderManager::instance()
     return globalInstance;
 }
 
-QOpenGLShaderProgram *ShaderManager::getShaderProgram(const IRenderedTarget *target, const std::unordered_map<Effect, double> &effectValues)
+QOpenGLShaderProgram *ShaderManager::getShaderProgram(const std::unordered_map<Effect, double> &effectValues, DrawMode drawMode)
 {
-    int effectBits = 0;
-    bool firstSet = false;
-
-    for (const auto &[effect, value] : effectValues) {
-        if (value != 0)
-            effectBits |= static_cast<int>(effect);
-    }
+    return findOrCreateShaderProgram(effectMask(effectValues), drawMode);
+}
 
-    // Find the selected effect combination
-    auto it = m_shaderPrograms.find(effectBits);
+QOpenGLShaderProgram *ShaderManager::getInstancedShaderProgram(Effect effectMask)
+{
+    // Instanced programs are shared, the effect values are vertex attributes
+    auto it = m_instancedShaderPrograms.find(static_cast<int>(effectMask));
 
-    if (it == m_shaderPrograms.cend()) {
-        // Create a new shader program if this combination doesn't exist yet
-        QOpenGLShaderProgram *program = createShaderProgram(effectValues);
+    if (it != m_instancedShaderPrograms.cend())
+        return it->second;
 
-        if (program)
-            m_shaderPrograms[effectBits] = { { target, program } };
+    QOpenGLShaderProgram *program = createShaderProgram(effectMask, DrawMode::Default, true);
 
-        return program;
-    } else {
-        const auto &map = it->second;
-        auto it = map.find(target);
+    if (program)
+        m_instancedShaderPrograms[static_cast<int>(effectMask)] = program;
 
-        if (it == map.cend()) {
-            // Create a new shader program if this combination doesn't exist for the given target
-            QOpenGLShaderProgram *program = createShaderProgram(effectValues);
+    return program;
+}
 
-            if (program)
-                m_shaderPrograms[effectBits][target] = program;
+void ShaderManager::queuePrecompilation(const std::vector<Effect> &effectMasks)
+{
+    // The programs are compiled later by precompile() (with the default draw mode)
+    m_precompilationQueue.insert(m_precompilationQueue.end(), effectMasks.cbegin(), effectMasks.cend());
+}
 
-            return program;
-        } else
-            return it->second;
+bool ShaderManager::precompile(int timeBudget)
+{
+    // Compiles queued programs until the time budget (in milliseconds) runs out, at least one program is compiled
+    // Returns true if there are programs left in the queue
+    QElapsedTimer timer;
+    timer.start();
+
+    while (!m_precompilationQueue.empty()) {
+        // Compile in the queued order (the most common combinations should be queued first)
+        const Effect mask = m_precompilationQueue.front();
+        m_precompilationQueue.erase(m_precompilationQueue.begin());
+        findOrCreateShaderProgram(mask, DrawMode::Default);
+
+        if (timer.elapsed() >= timeBudget)
+            break;
     }
+
+    return !m_precompilationQueue.empty();
+}
+
+bool ShaderManager::precompilationPending() const
+{
+    return !m_precompilationQueue.empty();
+}
+
+std::vector<ShaderManager::Effect> ShaderManager::allEffectMasks()
+{
+    // Every combination of the effects
+    const int count = 1 << EFFECT_TO_NAME.size();
+    std::vector<Effect> ret;
+    ret.reserve(count);
+
+    for (int i = 0; i < count; i++)
+        ret.push_back(static_cast<Effect>(i));
+
+    return ret;
 }
 
 void ShaderManager::getUniformValuesForEffects(const std::unordered_map<Effect, double> &effectValues, std::unordered_map<Effect, float> &dst)
@@ -153,20 +211,124 @@ void ShaderManager::getUniformValuesForEffects(const std::unordered_map<Effect,
     }
 }
 
-void ShaderManager::setUniforms(QOpenGLShaderProgram *program, int textureUnit, const QSize skinSize, const std::unordered_map<Effect, double> &effectValues)
+void ShaderManager::setUniforms(QOpenGLShaderProgram *program, int textureUnit, const QSize skinSize, const std::unordered_map<Effect, double> &effectValues, const QRectF &uvRect)
 {
+    UniformState &state = uniformState(program);
+    const UniformLocations &locations = state.locations;
+
     // Set the texture unit
-    program->setUniformValue(TEXTURE_UNIT_UNIFORM, textureUnit);
+    program->setUniformValue(locations.skin, textureUnit);
 
     // Set skin size
-    program->setUniformValue(SKIN_SIZE_UNIFORM, QVector2D(skinSize.width(), skinSize.height()));
+    program->setUniformValue(locations.skinSize, QVector2D(skinSize.width(), skinSize.height()));
+
+    // Set the part of the texture used by the skin
+    program->setUniformValue(locations.uvRect, QVector4D(uvRect.x(), uvRect.y(), uvRect.width(), uvRect.height()));
+
+    // Set uniform values (effects which aren't in the map are reset)
+    for (size_t i = 0; i < INSTANCE_EFFECTS.size(); i++) {
+        const Effect effect = INSTANCE_EFFECTS[i];
+        const auto it = effectValues.find(effect);
+        const float value = it == effectValues.cend() ? 0.0f : it->second;
+        program->setUniformValue(locations.effects[i], EFFECT_CONVERTER.at(effect)(value));
+    }
+
+    state.valid = true;
+    state.textureUnit = textureUnit;
+    state.skinSize = skinSize;
+    state.effectValues = effectValues;
+    state.uvRect = uvRect;
+}
+
+void ShaderManager::updateUniforms(QOpenGLShaderProgram *program, int textureUnit, const QSize skinSize, const std::unordered_map<Effect, double> &effectValues, const QRectF &uvRect)
+{
+    // Programs are shared, so the last values are stored per program
+    const UniformState &state = uniformState(program);
+
+    if (state.valid && state.textureUnit == textureUnit && state.skinSize == skinSize && state.effectValues == effectValues && state.uvRect == uvRect)
+        return;
 
-    // Set uniform values
+    setUniforms(program, textureUnit, skinSize, effectValues, uvRect);
+}
+
+void ShaderManager::setMatrices(QOpenGLShaderProgram *program, const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &modelMatrix)
+{
+    const UniformLocations &locations = uniformState(program).locations;
+    program->setUniformValue(locations.projectionMatrix, projectionMatrix);
+    program->setUniformValue(locations.modelMatrix, modelMatrix);
+}
+
+void ShaderManager::setColorMaskUniforms(QOpenGLShaderProgram *program, QRgb color, const QVector3D &step)
+{
+    // The step is the size of the color "buckets" which are compared (in the 0-255 range)
+    program->setUniformValue(COLOR_MASK_UNIFORM, QVector3D(qRed(color) / 255.0f, qGreen(color) / 255.0f, qBlue(color) / 255.0f));
+    program->setUniformValue(COLOR_MASK_STEP_UNIFORM, step);
+}
+
+void ShaderManager::setInstancedUniforms(QOpenGLShaderProgram *program, int textureUnit, const QSize skinSize)
+{
+    const UniformLocations &locations = uniformState(program).locations;
+    program->setUniformValue(locations.skin, textureUnit);
+    program->setUniformValue(locations.skinSize, QVector2D(skinSize.width(), skinSize.height()));
+}
+
+void ShaderManager::getInstanceValuesForEffects(const std::unordered_map<Effect, double> &effectValues, InstanceEffectValues &dst)
+{
     std::unordered_map<Effect, float> values;
     getUniformValuesForEffects(effectValues, values);
 
-    for (const auto &[effect, value] : values)
-        program->setUniformValue(EFFECT_UNIFORM_NAME.at(effect), value);
+    for (size_t i = 0; i < INSTANCE_EFFECTS.size(); i++)
+        dst[i] = values[INSTANCE_EFFECTS[i]];
+}
+
+ShaderManager::Effect ShaderManager::effectMask(const std::unordered_map<Effect, double> &effectValues)
+{
+    // Returns the effects with non-zero values
+    Effect mask = Effect::NoEffect;
+
+    for (const auto &[effect, value] : effectValues) {
+        if (value != 0)
+            mask |= effect;
+    }
+
+    return mask;
+}
+
+QByteArray ShaderManager::shaderSource(const QString &fileName, const QByteArray &defines)
+{
+    // Returns the source code of the given shader with the GLSL version of the platform and the given defines
+    QFile file(fileName);
+    file.open(QFile::ReadOnly);
+    return SHADER_PREFIX.toUtf8() + defines + file.readAll();
+}
+
+bool ShaderManager::programCacheEnabled()
+{
+    return m_programCacheEnabled;
+}
+
+void ShaderManager::setProgramCacheEnabled(bool enabled)
+{
+    // The program binary cache is disabled by default, so that e.g. tests don't write into the user's cache directory
+    m_programCacheEnabled = enabled;
+}
+
+QString ShaderManager::programCacheDirectory()
+{
+    // Program binaries are stored in a subdirectory for the cache version
+    const QString base = m_customProgramCacheDirectory ? m_programCacheDirectory : QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/shaders";
+
+    if (base.isEmpty())
+        return QString();
+
+    return base + "/" + PROGRAM_CACHE_VERSION;
+}
+
+void ShaderManager::setProgramCacheDirectory(const QString &path)
+{
+    // An empty path disables the program binary cache
+    m_programCacheDirectory = path;
+    m_customProgramCacheDirectory = true;
 }
 
 const std::unordered_set<ShaderManager::Effect> &ShaderManager::effects()
@@ -194,33 +356,220 @@ void ShaderManager::registerEffects()
     }
 }
 
-QOpenGLShaderProgram *ShaderManager::createShaderProgram(const std::unordered_map<Effect, double> &effectValues)
+ShaderManager::UniformState &ShaderManager::uniformState(QOpenGLShaderProgram *program)
+{
+    auto it = m_uniformStates.find(program);
+
+    if (it != m_uniformStates.cend())
+        return it->second;
+
+    // Look up the uniform locations once (unused uniforms are -1, setting them has no effect)
+    UniformState state;
+    UniformLocations &locations = state.locations;
+    locations.skin = program->uniformLocation(TEXTURE_UNIT_UNIFORM);
+    locations.skinSize = program->uniformLocation(SKIN_SIZE_UNIFORM);
+    locations.uvRect = program->uniformLocation(UV_RECT_UNIFORM);
+    locations.projectionMatrix = program->uniformLocation(PROJECTION_MATRIX_UNIFORM);
+    locations.modelMatrix = program->uniformLocation(MODEL_MATRIX_UNIFORM);
+
+    for (size_t i = 0; i < INSTANCE_EFFECTS.size(); i++)
+        locations.effects[i] = program->uniformLocation(EFFECT_UNIFORM_NAME.at(INSTANCE_EFFECTS[i]));
+
+    QObject::connect(program, &QObject::destroyed, [program]() { m_uniformStates.erase(program); });
+    return m_uniformStates.insert({ program, std::move(state) }).first->second;
+}
+
+QOpenGLShaderProgram *ShaderManager::findOrCreateShaderProgram(Effect effectMask, DrawMode drawMode)
+{
+    const int key = static_cast<int>(effectMask) | (static_cast<int>(drawMode) << DRAW_MODE_KEY_SHIFT);
+    auto it = m_shaderPrograms.find(key);
+
+    if (it != m_shaderPrograms.cend())
+        return it->second;
+
+    // Create a new shader program if this combination doesn't exist yet
+    QOpenGLShaderProgram *program = createShaderProgram(effectMask, drawMode);
+
+    if (program)
+        m_shaderPrograms[key] = program;
+
+    return program;
+}
+
+QOpenGLShaderProgram *ShaderManager::createShaderProgram(Effect effectMask, DrawMode drawMode, bool instanced)
 {
     QOpenGLContext *context = QOpenGLContext::currentContext();
-    Q_ASSERT(context && m_vertexShader);
+    QOpenGLShader *vertexShader = instanced ? m_instancedVertexShader : m_vertexShader;
+    Q_ASSERT(context && vertexShader);
 
-    if (!context || !m_vertexShader)
+    if (!context || !vertexShader)
         return nullptr;
 
     // Version must be defined in the first line
     QByteArray fragSource = SHADER_PREFIX.toUtf8();
 
     // Add defines for the effects
-    for (const auto &[effect, value] : effectValues) {
-        if (value != 0) {
+    for (const auto &[effect, name] : EFFECT_TO_NAME) {
+        if ((effectMask & effect) != Effect::NoEffect) {
             fragSource.push_back("#define ENABLE_");
-            fragSource.push_back(EFFECT_TO_NAME.at(effect));
+            fragSource.push_back(name);
             fragSource.push_back('\n');
         }
     }
 
+    if (instanced)
+        fragSource.push_back("#define INSTANCED\n");
+
+    // Add define for the draw mode
+    fragSource.push_back("#define DRAW_MODE_");
+    fragSource.push_back(DRAW_MODE_TO_NAME.at(drawMode));
+    fragSource.push_back('\n');
+
     // Add the actual fragment shader
     fragSource.push_back(m_fragmentShaderSource);
 
     QOpenGLShaderProgram *program = new QOpenGLShaderProgram(this);
-    program->addShader(m_vertexShader);
+
+    // Try to load the linked program from the disk cache first
+    const QString cacheKey = programCacheKey(vertexShader, fragSource);
+
+    if (!cacheKey.isEmpty() && loadProgramBinary(program, cacheKey)) {
+        uniformState(program);
+        return program;
+    }
+
+    program->addShader(vertexShader);
     program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragSource);
-    program->link();
+
+    if (instanced) {
+        // The quad uses locations 0 and 1 (like in the other programs)
+        program->bindAttributeLocation("a_position", 0);
+        program->bindAttributeLocation("a_texCoord", 1);
+        program->bindAttributeLocation("a_matrix", INSTANCE_MATRIX_LOCATION);
+        program->bindAttributeLocation("a_effects", INSTANCE_EFFECTS_LOCATION);
+        program->bindAttributeLocation("a_shapeEffects", INSTANCE_SHAPE_EFFECTS_LOCATION);
+        program->bindAttributeLocation("a_uvRect", INSTANCE_UV_RECT_LOCATION);
+    }
+
+    if (!cacheKey.isEmpty()) {
+        QOpenGLExtraFunctions glF(context);
+        glF.initializeOpenGLFunctions();
+        glF.glProgramParameteri(program->programId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    if (program->link() && !cacheKey.isEmpty())
+        saveProgramBinary(program, cacheKey);
+
+    // Cache the uniform locations
+    uniformState(program);
 
     return program;
 }
+
+QString ShaderManager::programCacheKey(const QOpenGLShader *vertexShader, const QByteArray &fragmentSource)
+{
+    // Returns an empty string if the cache is disabled or the driver doesn't support program binaries
+    if (!m_programCacheEnabled || programCacheDirectory().isEmpty())
+        return QString();
+
+    QOpenGLExtraFunctions glF(QOpenGLContext::currentContext());
+    glF.initializeOpenGLFunctions();
+    GLint formats = 0;
+    glF.glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+    if (formats <= 0)
+        return QString();
+
+    // Binaries only work with the same driver, so it's a part of the key (the sources include sprite.frag)
+    const GLubyte *vendor = glF.glGetString(GL_VENDOR);
+    const GLubyte *renderer = glF.glGetString(GL_RENDERER);
+    const GLubyte *version = glF.glGetString(GL_VERSION);
+
+    if (!vendor || !renderer || !version)
+        return QString();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(reinterpret_cast<const char *>(vendor));
+    hash.addData(reinterpret_cast<const char *>(renderer));
+    hash.addData(reinterpret_cast<const char *>(version));
+    hash.addData(vertexShader->sourceCode());
+    hash.addData(fragmentSource);
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+bool ShaderManager::loadProgramBinary(QOpenGLShaderProgram *program, const QString &key)
+{
+    QFile file(programCacheDirectory() + "/" + key + ".bin");
+
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_6_0);
+    quint32 magic = 0;
+    quint32 format = 0;
+    QByteArray binary;
+    stream >> magic >> format >> binary;
+    file.close();
+
+    if (stream.status() != QDataStream::Ok || magic != PROGRAM_CACHE_MAGIC || binary.isEmpty()) {
+        file.remove();
+        return false;
+    }
+
+    if (!program->create())
+        return false;
+
+    QOpenGLExtraFunctions glF(QOpenGLContext::currentContext());
+    glF.initializeOpenGLFunctions();
+    glF.glProgramBinary(program->programId(), format, binary.constData(), binary.size());
+
+    GLint linked = GL_FALSE;
+    glF.glGetProgramiv(program->programId(), GL_LINK_STATUS, &linked);
+
+    if (linked == GL_FALSE) {
+        // The binary is outdated (e.g. after a driver update), compile from source instead
+        file.remove();
+        return false;
+    }
+
+    // There are no shaders, so link() only checks the link status of the loaded binary
+    return program->link();
+}
+
+void ShaderManager::saveProgramBinary(QOpenGLShaderProgram *program, const QString &key)
+{
+    QOpenGLExtraFunctions glF(QOpenGLContext::currentContext());
+    glF.initializeOpenGLFunctions();
+
+    GLint length = 0;
+    glF.glGetProgramiv(program->programId(), GL_PROGRAM_BINARY_LENGTH, &length);
+
+    if (length <= 0)
+        return;
+
+    QByteArray binary(length, Qt::Uninitialized);
+    GLenum format = 0;
+    glF.glGetProgramBinary(program->programId(), length, &length, &format, binary.data());
+
+    if (length <= 0)
+        return;
+
+    binary.resize(length);
+
+    const QString dir = programCacheDirectory();
+
+    if (!QDir().mkpath(dir))
+        return;
+
+    // Write to a temporary file first, so that other instances never read incomplete binaries
+    QSaveFile file(dir + "/" + key + ".bin");
+
+    if (!file.open(QFile::WriteOnly))
+        return;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << PROGRAM_CACHE_MAGIC << static_cast<quint32>(format) << binary;
+    file.commit();
+}
@@ -3,17 +3,22 @@
 #pragma once
 
 #include <QObject>
+#include <QRgb>
+#include <QSize>
+#include <QRectF>
 #include <memory>
+#include <array>
+#include <vector>
 #include <unordered_set>
 
 class QOpenGLShaderProgram;
 class QOpenGLShader;
+class QVector3D;
+class QMatrix4x4;
 
 namespace scratchcpprender
 {
 
-class IRenderedTarget;
-
 class ShaderManager : public QObject
 {
     public:
@@ -29,13 +34,51 @@ class ShaderManager : public QObject
             Mosaic = 1 << 6
         };
 
+        enum class DrawMode
+        {
+            Default,
+            Silhouette, // only opaque pixels are drawn (in a single color), used for stencil-based touching checks
+            ColorMask   // only pixels matching the u_colorMask uniform are drawn
+        };
+
+        // Effect values of instanced shader programs in the order of the vertex attributes
+        using InstanceEffectValues = std::array<float, 7>;
+
+        // Vertex attribute locations of instanced shader programs
+        static constexpr int INSTANCE_MATRIX_LOCATION = 2; // 4 locations, one for each column
+        static constexpr int INSTANCE_EFFECTS_LOCATION = 6;
+        static constexpr int INSTANCE_SHAPE_EFFECTS_LOCATION = 7;
+        static constexpr int INSTANCE_UV_RECT_LOCATION = 8;
+
         explicit ShaderManager(QObject *parent = nullptr);
 
         static ShaderManager *instance();
 
-        QOpenGLShaderProgram *getShaderProgram(const IRenderedTarget *target, const std::unordered_map<Effect, double> &effectValues);
+        QOpenGLShaderProgram *getShaderProgram(const std::unordered_map<Effect, double> &effectValues, DrawMode drawMode = DrawMode::Default);
+        QOpenGLShaderProgram *getInstancedShaderProgram(Effect effectMask);
+
+        void queuePrecompilation(const std::vector<Effect> &effectMasks);
+        bool precompile(int timeBudget);
+        bool precompilationPending() const;
+        static std::vector<Effect> allEffectMasks();
+
         static void getUniformValuesForEffects(const std::unordered_map<Effect, double> &effectValues, std::unordered_map<Effect, float> &dst);
-        static void setUniforms(QOpenGLShaderProgram *program, int textureUnit, const QSize skinSize, const std::unordered_map<Effect, double> &effectValues);
+        static void
+        setUniforms(QOpenGLShaderProgram *program, int textureUnit, const QSize skinSize, const std::unordered_map<Effect, double> &effectValues, const QRectF &uvRect = QRectF(0, 0, 1, 1));
+        static void
+        updateUniforms(QOpenGLShaderProgram *program, int textureUnit, const QSize skinSize, const std::unordered_map<Effect, double> &effectValues, const QRectF &uvRect = QRectF(0, 0, 1, 1));
+        static void setMatrices(QOpenGLShaderProgram *program, const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &modelMatrix);
+        static void setColorMaskUniforms(QOpenGLShaderProgram *program, QRgb color, const QVector3D &step);
+        static void setInstancedUniforms(QOpenGLShaderProgram *program, int textureUnit, const QSize skinSize);
+        static void getInstanceValuesForEffects(const std::unordered_map<Effect, double> &effectValues, InstanceEffectValues &dst);
+        static Effect effectMask(const std::unordered_map<Effect, double> &effectValues);
+
+        static QByteArray shaderSource(const QString &fileName, const QByteArray &defines = QByteArray());
+
+        static bool programCacheEnabled();
+        static void setProgramCacheEnabled(bool enabled);
+        static QString programCacheDirectory();
+        static void setProgramCacheDirectory(const QString &path);
 
         static const std::unordered_set<Effect> &effects();
         static bool effectShapeChanges(Effect effect);
@@ -48,13 +91,47 @@ class ShaderManager : public QObject
 
         static void registerEffects();
 
-        QOpenGLShaderProgram *createShaderProgram(const std::unordered_map<Effect, double> &effectValues);
+        QOpenGLShaderProgram *findOrCreateShaderProgram(Effect effectMask, DrawMode drawMode);
+        QOpenGLShaderProgram *createShaderProgram(Effect effectMask, DrawMode drawMode, bool instanced = false);
+
+        static QString programCacheKey(const QOpenGLShader *vertexShader, const QByteArray &fragmentSource);
+        static bool loadProgramBinary(QOpenGLShaderProgram *program, const QString &key);
+        static void saveProgramBinary(QOpenGLShaderProgram *program, const QString &key);
+
+        struct UniformLocations
+        {
+                int skin = -1;
+                int skinSize = -1;
+                int uvRect = -1;
+                int projectionMatrix = -1;
+                int modelMatrix = -1;
+                std::array<int, 7> effects = { -1, -1, -1, -1, -1, -1, -1 }; // in the order of the instance effect values
+        };
+
+        struct UniformState
+        {
+                UniformLocations locations;
+                bool valid = false; // false until setUniforms() is called
+                int textureUnit = 0;
+                QSize skinSize;
+                std::unordered_map<Effect, double> effectValues;
+                QRectF uvRect;
+        };
+
+        static UniformState &uniformState(QOpenGLShaderProgram *program);
 
         static Registrar m_registrar;
         static std::unordered_set<Effect> m_effects;
+        static inline std::unordered_map<const QOpenGLShaderProgram *, UniformState> m_uniformStates; // uniform locations and the last values passed to setUniforms()
+        static inline bool m_programCacheEnabled = false;
+        static inline QString m_programCacheDirectory;
+        static inline bool m_customProgramCacheDirectory = false;
 
         QOpenGLShader *m_vertexShader = nullptr;
-        std::unordered_map<int, std::unordered_map<const IRenderedTarget *, QOpenGLShaderProgram *>> m_shaderPrograms;
+        QOpenGLShader *m_instancedVertexShader = nullptr;
+        std::unordered_map<int, QOpenGLShaderProgram *> m_instancedShaderPrograms;
+        std::unordered_map<int, QOpenGLShaderProgram *> m_shaderPrograms; // shared by all targets, the uniforms are set before drawing
+        std::vector<Effect> m_precompilationQueue;
         QByteArray m_fragmentShaderSource;
 };
 
@@ -0,0 +1,36 @@
+#undef lowp
+#undef mediump
+#undef highp
+
+precision highp float;
+
+uniform float u_antialiasing;
+
+in vec2 v_position;
+flat in vec4 v_line;
+flat in float v_radius;
+flat in vec4 v_color;
+
+out vec4 fragColor;
+
+float segmentDistance(vec2 p, vec2 a, vec2 b)
+{
+    vec2 pa = p - a;
+    vec2 ba = b - a;
+    float h = clamp(dot(pa, ba) / max(dot(ba, ba), 1e-6), 0.0, 1.0);
+    return length(pa - ba * h);
+}
+
+void main()
+{
+    float dist = segmentDistance(v_position, v_line.xy, v_line.zw);
+
+    // Without antialiasing, pixels whose center is inside the line are covered
+    float coverage = u_antialiasing > 0.0 ? clamp(v_radius - dist + 0.5, 0.0, 1.0) : step(dist, v_radius);
+
+    if (coverage <= 0.0)
+        discard;
+
+    // Premultiplied alpha
+    fragColor = vec4(v_color.rgb * v_color.a, v_color.a) * coverage;
+}
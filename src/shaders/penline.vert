@@ -0,0 +1,36 @@
+// Expands a quad around a round-capped line (capsule), the instance attributes describe the line
+uniform vec2 u_viewportSize;
+
+layout(location = 0) in vec2 a_corner;
+layout(location = 1) in vec4 a_line;
+layout(location = 2) in float a_diameter;
+layout(location = 3) in vec4 a_color;
+
+out vec2 v_position;
+flat out vec4 v_line;
+flat out float v_radius;
+flat out vec4 v_color;
+
+void main() {
+    // Width 1 and 3 lines need to be offset by 0.5 (like in QNanoPainter)
+    float offset = mod(max(4.0 - a_diameter, 0.0), 2.0) / 2.0;
+    float radius = a_diameter / 2.0;
+    vec2 p0 = a_line.xy + offset;
+    vec2 p1 = a_line.zw + offset;
+    vec2 dir = p1 - p0;
+    float len = length(dir);
+    vec2 u = len > 0.0 ? dir / len : vec2(1.0, 0.0);
+    vec2 v = vec2(-u.y, u.x);
+
+    // Add 1 pixel for antialiasing
+    float extent = radius + 1.0;
+    vec2 pos = (p0 + p1) * 0.5 + u * a_corner.x * (len * 0.5 + extent) + v * a_corner.y * extent;
+
+    v_position = pos;
+    v_line = vec4(p0, p1);
+    v_radius = radius;
+    v_color = a_color;
+
+    // The origin is in the top left corner
+    gl_Position = vec4(2.0 * pos.x / u_viewportSize.x - 1.0, 1.0 - 2.0 * pos.y / u_viewportSize.y, 0.0, 1.0);
+}
@@ -6,39 +6,54 @@
 
 precision mediump float;
 
+// Instanced draws pass the effect values per instance
+#ifdef INSTANCED
+#define EFFECT_VALUE flat in
+#else
+#define EFFECT_VALUE uniform
+#endif // INSTANCED
+
 #ifdef ENABLE_color
-uniform float u_color;
+EFFECT_VALUE float u_color;
 #endif // ENABLE_color
 
 #ifdef ENABLE_brightness
-uniform float u_brightness;
+EFFECT_VALUE float u_brightness;
 #endif // ENABLE_brightness
 
 #ifdef ENABLE_ghost
-uniform float u_ghost;
+EFFECT_VALUE float u_ghost;
 #endif // ENABLE_ghost
 
 #ifdef ENABLE_fisheye
-uniform float u_fisheye;
+EFFECT_VALUE float u_fisheye;
 #endif // ENABLE_fisheye
 
 #ifdef ENABLE_whirl
-uniform float u_whirl;
+EFFECT_VALUE float u_whirl;
 #endif // ENABLE_whirl
 
 #ifdef ENABLE_pixelate
-uniform float u_pixelate;
+EFFECT_VALUE float u_pixelate;
 uniform vec2 u_skinSize;
 #endif // ENABLE_pixelate
 
 #ifdef ENABLE_mosaic
-uniform float u_mosaic;
+EFFECT_VALUE float u_mosaic;
 #endif // ENABLE_mosaic
 
+#ifdef DRAW_MODE_colorMask
+uniform vec3 u_colorMask;
+uniform vec3 u_colorMaskStep;
+#endif // DRAW_MODE_colorMask
+
 in vec2 v_texCoord;
 out vec4 fragColor;
 uniform sampler2D u_skin;
 
+// The part of the texture used by the skin (x, y, width, height), textures in an atlas only use a part of it
+EFFECT_VALUE highp vec4 u_uvRect;
+
 // Add this to divisors to prevent division by 0, which results in NaNs propagating through calculations.
 // Smaller values can cause problems on some mobile devices.
 const float epsilon = 1e-3;
@@ -148,7 +163,12 @@ void main()
     }
     #endif // ENABLE_fisheye
 
-    fragColor = texture(u_skin, texcoord0);
+    // Map to the skin rectangle and keep the samples inside it (like GL_CLAMP_TO_EDGE)
+    highp vec2 halfTexel = 0.5 / vec2(textureSize(u_skin, 0));
+    highp vec2 uv = u_uvRect.xy + clamp(texcoord0, 0.0, 1.0) * u_uvRect.zw;
+    uv = clamp(uv, u_uvRect.xy + halfTexel, u_uvRect.xy + u_uvRect.zw - halfTexel);
+
+    fragColor = texture(u_skin, uv);
 
     #if defined(ENABLE_color) || defined(ENABLE_brightness)
     // Divide premultiplied alpha values for proper color processing
@@ -181,7 +201,26 @@ void main()
 
     #endif // defined(ENABLE_color) || defined(ENABLE_brightness)
 
+    #ifdef DRAW_MODE_silhouette
+    // Discard fully transparent pixels for stencil test (the ghost effect is ignored)
+    if (fragColor.a == 0.0)
+        discard;
+
+    fragColor = vec4(1.0);
+    #else // DRAW_MODE_silhouette
+
     #ifdef ENABLE_ghost
     fragColor *= u_ghost;
     #endif // ENABLE_ghost
+
+    #ifdef DRAW_MODE_colorMask
+    // Compare the color "buckets" the same way the CPU implementation compares the high bits
+    vec3 colorBuckets = floor((fragColor.rgb * 255.0 + 0.5) / u_colorMaskStep);
+    vec3 maskBuckets = floor((u_colorMask * 255.0 + 0.5) / u_colorMaskStep);
+
+    if (any(notEqual(colorBuckets, maskBuckets)))
+        discard;
+    #endif // DRAW_MODE_colorMask
+
+    #endif // DRAW_MODE_silhouette
 }
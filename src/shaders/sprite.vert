@@ -1,11 +1,40 @@
+#ifdef INSTANCED
+in mat4 a_matrix;       // projection * model matrix of the instance
+in vec4 a_effects;      // color, brightness, ghost, fisheye
+in vec3 a_shapeEffects; // whirl, pixelate, mosaic
+in vec4 a_uvRect;       // part of the texture used by the skin
+
+flat out float u_color;
+flat out float u_brightness;
+flat out float u_ghost;
+flat out float u_fisheye;
+flat out float u_whirl;
+flat out float u_pixelate;
+flat out float u_mosaic;
+flat out vec4 u_uvRect;
+#else
 uniform mat4 u_projectionMatrix;
 uniform mat4 u_modelMatrix;
+#endif // INSTANCED
+
 in vec2 a_position;
 in vec2 a_texCoord;
 
 out vec2 v_texCoord;
 
 void main() {
+#ifdef INSTANCED
+    gl_Position = a_matrix * vec4(a_position, 0, 1);
+    u_color = a_effects.x;
+    u_brightness = a_effects.y;
+    u_ghost = a_effects.z;
+    u_fisheye = a_effects.w;
+    u_whirl = a_shapeEffects.x;
+    u_pixelate = a_shapeEffects.y;
+    u_mosaic = a_shapeEffects.z;
+    u_uvRect = a_uvRect;
+#else
     gl_Position = u_projectionMatrix * u_modelMatrix * vec4(a_position, 0, 1);
+#endif // INSTANCED
     v_texCoord = a_texCoord;
 }
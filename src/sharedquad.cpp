@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "sharedquad.h"
+
+using namespace scratchcpprender;
+
+GLuint SharedQuad::vertexArray(QOpenGLContext *context)
+{
+    // Returns a vertex array with the position (location 0) and texture coordinate (location 1) attributes of the quad
+    return resources(context).vao;
+}
+
+void SharedQuad::setVertexAttributes(QOpenGLContext *context, QOpenGLExtraFunctions *glF)
+{
+    // Sets the attributes of the quad in the currently bound vertex array (for vertex arrays with additional attributes)
+    glF->glBindBuffer(GL_ARRAY_BUFFER, resources(context).vbo);
+
+    // Position attribute
+    glF->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
+    glF->glEnableVertexAttribArray(0);
+
+    // Texture coordinate attribute
+    glF->glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(2 * sizeof(float)));
+    glF->glEnableVertexAttribArray(1);
+}
+
+SharedQuad::Resources &SharedQuad::resources(QOpenGLContext *context)
+{
+    Q_ASSERT(context);
+    auto it = m_resources.find(context);
+
+    if (it != m_resources.cend())
+        return it->second;
+
+    QOpenGLExtraFunctions glF(context);
+    glF.initializeOpenGLFunctions();
+    Resources &resources = m_resources[context];
+
+    // Set up vertex data and buffers for a quad
+    float vertices[] = { -1.0f, -1.0f, 0.0f, 0.0f, 1.0f, -1.0f, 1.0f, 0.0f, -1.0f, 1.0f, 0.0f, 1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 1.0f };
+
+    GLint oldVao = 0;
+    GLint oldVbo = 0;
+    glF.glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &oldVao);
+    glF.glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &oldVbo);
+
+    glF.glGenVertexArrays(1, &resources.vao);
+    glF.glGenBuffers(1, &resources.vbo);
+
+    glF.glBindVertexArray(resources.vao);
+    glF.glBindBuffer(GL_ARRAY_BUFFER, resources.vbo);
+    glF.glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    setVertexAttributes(context, &glF);
+
+    // Restore the bindings (the quad can be created while drawing)
+    glF.glBindVertexArray(oldVao);
+    glF.glBindBuffer(GL_ARRAY_BUFFER, oldVbo);
+
+    QObject::connect(context, &QOpenGLContext::aboutToBeDestroyed, context, [context]() {
+        auto it = m_resources.find(context);
+
+        if (it == m_resources.cend())
+            return;
+
+        if (QOpenGLContext::currentContext() == context) {
+            QOpenGLExtraFunctions glF(context);
+            glF.initializeOpenGLFunctions();
+            glF.glDeleteVertexArrays(1, &it->second.vao);
+            glF.glDeleteBuffers(1, &it->second.vbo);
+        }
+
+        m_resources.erase(it);
+    });
+
+    return resources;
+}
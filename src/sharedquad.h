@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QOpenGLExtraFunctions>
+#include <unordered_map>
+
+namespace scratchcpprender
+{
+
+// The quad which textures are drawn on, there's one for each OpenGL context
+class SharedQuad
+{
+    public:
+        SharedQuad() = delete;
+
+        static GLuint vertexArray(QOpenGLContext *context);
+        static void setVertexAttributes(QOpenGLContext *context, QOpenGLExtraFunctions *glF);
+
+        static const int VERTEX_COUNT = 6;
+
+    private:
+        struct Resources
+        {
+                GLuint vao = 0;
+                GLuint vbo = 0;
+        };
+
+        static Resources &resources(QOpenGLContext *context);
+
+        static inline std::unordered_map<QOpenGLContext *, Resources> m_resources;
+};
+
+} // namespace scratchcpprender
@@ -7,6 +7,9 @@
 
 using namespace scratchcpprender;
 
+static const int ATLAS_SIZE = 1024;
+static const int MAX_ATLAS_TEXTURE_SIZE = 256; // larger textures get their own OpenGL texture
+
 Skin::Skin()
 {
     QOpenGLContext *context = QOpenGLContext::currentContext();
@@ -16,12 +19,24 @@ Skin::Skin()
         QObject::connect(context, &QOpenGLContext::aboutToBeDestroyed, []() {
             // Destroy textures
             m_textures.clear();
+            m_atlases.clear();
         });
 
         m_connectedCtx = context;
     }
 }
 
+bool Skin::atlasEnabled()
+{
+    return m_atlasEnabled;
+}
+
+void Skin::setAtlasEnabled(bool enabled)
+{
+    // Only affects textures created after this call
+    m_atlasEnabled = enabled;
+}
+
 Texture Skin::createAndPaintTexture(int width, int height)
 {
     QOpenGLContext *context = QOpenGLContext::currentContext();
@@ -55,6 +70,14 @@ Texture Skin::createAndPaintTexture(int width, int height)
         }
     }
 
+    // Pack small textures into an atlas
+    if (m_atlasEnabled && width <= MAX_ATLAS_TEXTURE_SIZE && height <= MAX_ATLAS_TEXTURE_SIZE) {
+        Texture texture = addToAtlas(image);
+
+        if (texture.isValid())
+            return texture;
+    }
+
     // Create final texture from the image
     auto texture = std::make_shared<QOpenGLTexture>(image);
     m_textures.push_back(texture);
@@ -67,3 +90,23 @@ Texture Skin::createAndPaintTexture(int width, int height)
 
     return Texture(texture->textureId(), width, height);
 }
+
+Texture Skin::addToAtlas(const QImage &image)
+{
+    for (const auto &atlas : m_atlases) {
+        Texture texture = atlas->addTexture(image);
+
+        if (texture.isValid())
+            return texture;
+    }
+
+    // All atlases are full
+
+    auto atlas = std::make_unique<TextureAtlas>(ATLAS_SIZE);
+
+    if (!atlas->isValid())
+        return Texture();
+
+    m_atlases.push_back(std::move(atlas));
+    return m_atlases.back()->addTexture(image);
+}
@@ -6,6 +6,8 @@
 #include <QSizeF>
 #include <QtOpenGL>
 
+#include "textureatlas.h"
+
 namespace scratchcpprender
 {
 
@@ -21,12 +23,19 @@ class Skin
         virtual Texture getTexture(double scale) const = 0;
         virtual double getTextureScale(const Texture &texture) const = 0;
 
+        static bool atlasEnabled();
+        static void setAtlasEnabled(bool enabled);
+
     protected:
         Texture createAndPaintTexture(int width, int height);
         virtual void paint(QPainter *painter) = 0;
 
     private:
+        static Texture addToAtlas(const QImage &image);
+
         static inline std::vector<std::shared_ptr<QOpenGLTexture>> m_textures;
+        static inline std::vector<std::unique_ptr<TextureAtlas>> m_atlases; // small textures are packed into these if enabled
+        static inline bool m_atlasEnabled = false;
         static inline QOpenGLContext *m_connectedCtx = nullptr;
 };
 
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <scratchcpp/stage.h>
+#include <scratchcpp/sprite.h>
+
+#include "stagecompositor.h"
+#include "stagecompositorpainter.h"
+#include "irenderedtarget.h"
+#include "ipenlayer.h"
+#include "stagemodel.h"
+#include "spritemodel.h"
+
+using namespace scratchcpprender;
+using namespace libscratchcpp;
+
+StageCompositor::StageCompositor(QQuickItem *parent) :
+    QNanoQuickItem(parent)
+{
+    setSmooth(false);
+}
+
+libscratchcpp::IEngine *StageCompositor::engine() const
+{
+    return m_engine;
+}
+
+void StageCompositor::setEngine(libscratchcpp::IEngine *newEngine)
+{
+    if (m_engine == newEngine)
+        return;
+
+    m_engine = newEngine;
+    update();
+    emit engineChanged();
+}
+
+IPenLayer *StageCompositor::penLayer() const
+{
+    return m_penLayer;
+}
+
+void StageCompositor::setPenLayer(IPenLayer *newPenLayer)
+{
+    if (m_penLayer == newPenLayer)
+        return;
+
+    m_penLayer = newPenLayer;
+    update();
+    emit penLayerChanged();
+}
+
+void StageCompositor::getTargets(std::vector<IRenderedTarget *> &dst) const
+{
+    // Gets the visible targets in the order they're drawn (the stage is first)
+    dst.clear();
+
+    if (!m_engine)
+        return;
+
+    m_engine->getVisibleTargets(m_visibleTargets);
+
+    // The visible targets are sorted from the top
+    for (auto it = m_visibleTargets.crbegin(); it != m_visibleTargets.crend(); it++) {
+        Target *target = *it;
+        Q_ASSERT(target);
+
+        if (!target)
+            continue;
+
+        IRenderedTarget *renderedTarget = nullptr;
+
+        if (target->isStage()) {
+            StageModel *model = static_cast<StageModel *>(static_cast<Stage *>(target)->getInterface());
+
+            if (model)
+                renderedTarget = model->renderedTarget();
+        } else {
+            SpriteModel *model = static_cast<SpriteModel *>(static_cast<Sprite *>(target)->getInterface());
+
+            if (model)
+                renderedTarget = model->renderedTarget();
+        }
+
+        if (renderedTarget)
+            dst.push_back(renderedTarget);
+    }
+}
+
+QNanoQuickItemPainter *StageCompositor::createItemPainter() const
+{
+    return new StageCompositorPainter;
+}
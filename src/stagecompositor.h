@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <qnanoquickitem.h>
+#include <scratchcpp/iengine.h>
+
+Q_MOC_INCLUDE("ipenlayer.h");
+
+namespace scratchcpprender
+{
+
+class IRenderedTarget;
+class IPenLayer;
+
+// Draws the stage, the pen layer and all sprites (including clones) into a single framebuffer.
+// The rendered targets should be composited, so that they aren't drawn twice.
+class StageCompositor : public QNanoQuickItem
+{
+        Q_OBJECT
+        QML_ELEMENT
+        Q_PROPERTY(libscratchcpp::IEngine *engine READ engine WRITE setEngine NOTIFY engineChanged)
+        Q_PROPERTY(IPenLayer *penLayer READ penLayer WRITE setPenLayer NOTIFY penLayerChanged)
+
+    public:
+        StageCompositor(QQuickItem *parent = nullptr);
+
+        libscratchcpp::IEngine *engine() const;
+        void setEngine(libscratchcpp::IEngine *newEngine);
+
+        IPenLayer *penLayer() const;
+        void setPenLayer(IPenLayer *newPenLayer);
+
+        void getTargets(std::vector<IRenderedTarget *> &dst) const;
+
+    signals:
+        void engineChanged();
+        void penLayerChanged();
+
+    protected:
+        QNanoQuickItemPainter *createItemPainter() const override;
+
+    private:
+        libscratchcpp::IEngine *m_engine = nullptr;
+        IPenLayer *m_penLayer = nullptr;
+        mutable std::vector<libscratchcpp::Target *> m_visibleTargets;
+};
+
+} // namespace scratchcpprender
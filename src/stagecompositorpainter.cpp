@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <QOpenGLShaderProgram>
+
+#include "stagecompositorpainter.h"
+#include "stagecompositor.h"
+#include "stamprenderer.h"
+#include "sharedquad.h"
+#include "irenderedtarget.h"
+#include "ipenlayer.h"
+#include "texture.h"
+
+using namespace scratchcpprender;
+
+StageCompositorPainter::StageCompositorPainter(QOpenGLFramebufferObject *fbo) :
+    m_fbo(fbo)
+{
+}
+
+StageCompositorPainter::~StageCompositorPainter()
+{
+}
+
+void StageCompositorPainter::paint(QNanoPainter *painter)
+{
+    if (QThread::currentThread() != qApp->thread())
+        qFatal("Error: Rendering must happen in the GUI thread to work correctly. Did you initialize the library using scratchcpprender::init()?");
+
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    Q_ASSERT(context);
+
+    if (!context)
+        return;
+
+    // Custom FBO - only used for testing
+    QOpenGLFramebufferObject *targetFbo = m_fbo ? m_fbo : framebufferObject();
+
+    // Cancel current frame because we're using a custom FBO
+    if (painter)
+        painter->cancelFrame();
+
+    if (!m_glF) {
+        m_glF = std::make_unique<QOpenGLExtraFunctions>();
+        m_glF->initializeOpenGLFunctions();
+
+        m_stampRenderer = std::make_unique<StampRenderer>();
+    }
+
+    targetFbo->bind();
+    m_glF->glDisable(GL_DEPTH_TEST);
+    m_glF->glDisable(GL_SCISSOR_TEST);
+    m_glF->glDisable(GL_STENCIL_TEST);
+    m_glF->glViewport(0, 0, targetFbo->width(), targetFbo->height());
+    m_glF->glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    m_glF->glClear(GL_COLOR_BUFFER_BIT);
+    m_drawCalls = 0;
+
+    if (m_engine && m_engine->stageWidth() > 0) {
+        const QRect viewport(QPoint(0, 0), targetFbo->size());
+        const double scale = targetFbo->width() / static_cast<double>(m_engine->stageWidth());
+        m_stamps.clear();
+
+        // The pen layer is above the stage and below all sprites
+        if (m_targets.empty() || !m_targets.front()->stageModel())
+            drawPenLayer(viewport.size());
+
+        for (IRenderedTarget *target : m_targets) {
+            PenStamp stamp;
+
+            if (target->getStamp(scale, stamp)) {
+                // Use the texture with the stage scale (the stamp has the texture without it)
+                const Texture texture = target->texture();
+
+                if (texture.isValid()) {
+                    stamp.texture = texture.handle();
+                    stamp.uvRect = texture.uvRect();
+                }
+
+                m_stamps.push_back(stamp);
+            }
+
+            if (target->stageModel()) {
+                m_drawCalls += m_stampRenderer->render(m_stamps.data(), m_stamps.size(), viewport);
+                m_stamps.clear();
+                drawPenLayer(viewport.size());
+            }
+        }
+
+        // Consecutive sprites with the same texture and effects (e.g. clones) are drawn in a single draw call
+        m_drawCalls += m_stampRenderer->render(m_stamps.data(), m_stamps.size(), viewport);
+    }
+
+    m_glF->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void StageCompositorPainter::synchronize(QNanoQuickItem *item)
+{
+    StageCompositor *compositor = dynamic_cast<StageCompositor *>(item);
+    Q_ASSERT(compositor);
+
+    if (!compositor)
+        return;
+
+    m_engine = compositor->engine();
+    m_penLayer = compositor->penLayer();
+    compositor->getTargets(m_targets);
+
+    // Composited targets don't have their own painter which would load the costumes
+    for (IRenderedTarget *target : m_targets) {
+        if (!target->costumesLoaded())
+            target->loadCostumes();
+    }
+}
+
+int StageCompositorPainter::drawCalls() const
+{
+    return m_drawCalls;
+}
+
+void StageCompositorPainter::drawPenLayer(const QSize &size)
+{
+    QOpenGLFramebufferObject *penFbo = m_penLayer ? m_penLayer->framebufferObject() : nullptr;
+
+    if (!penFbo)
+        return;
+
+    ShaderManager *shaderManager = ShaderManager::instance();
+    QOpenGLShaderProgram *program = shaderManager->getShaderProgram({});
+    Q_ASSERT(program);
+
+    if (!program)
+        return;
+
+    program->bind();
+    ShaderManager::updateUniforms(program, 0, penFbo->size(), {});
+    ShaderManager::setMatrices(program, QMatrix4x4(), QMatrix4x4());
+
+    // The pen layer FBO may cover only a part of the stage (sparse pen layers)
+    const QRectF rect = m_penLayer->framebufferRect();
+    m_glF->glViewport(rect.x() * size.width(), (1 - rect.bottom()) * size.height(), rect.width() * size.width(), rect.height() * size.height());
+
+    // Pen layer pixels have premultiplied alpha
+    m_glF->glEnable(GL_BLEND);
+    m_glF->glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    m_glF->glBindVertexArray(SharedQuad::vertexArray(QOpenGLContext::currentContext()));
+    m_glF->glActiveTexture(GL_TEXTURE0);
+    m_glF->glBindTexture(GL_TEXTURE_2D, penFbo->texture());
+    m_glF->glDrawArrays(GL_TRIANGLES, 0, SharedQuad::VERTEX_COUNT);
+    m_glF->glBindVertexArray(0);
+    m_drawCalls++;
+
+    program->release();
+    m_glF->glViewport(0, 0, size.width(), size.height());
+}
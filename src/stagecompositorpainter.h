@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <qnanoquickitempainter.h>
+#include <QOpenGLExtraFunctions>
+#include <scratchcpp/iengine.h>
+
+#include "penstamp.h"
+
+namespace scratchcpprender
+{
+
+class IRenderedTarget;
+class IPenLayer;
+class StampRenderer;
+
+class StageCompositorPainter : public QNanoQuickItemPainter
+{
+    public:
+        StageCompositorPainter(QOpenGLFramebufferObject *fbo = nullptr);
+        ~StageCompositorPainter();
+
+        void paint(QNanoPainter *painter) override;
+        void synchronize(QNanoQuickItem *item) override;
+
+        int drawCalls() const;
+
+    private:
+        void drawPenLayer(const QSize &size);
+
+        QOpenGLFramebufferObject *m_fbo = nullptr;
+        libscratchcpp::IEngine *m_engine = nullptr;
+        IPenLayer *m_penLayer = nullptr;
+        std::vector<IRenderedTarget *> m_targets; // in layer order (the stage is first)
+        std::vector<PenStamp> m_stamps;
+        std::unique_ptr<StampRenderer> m_stampRenderer;
+        std::unique_ptr<QOpenGLExtraFunctions> m_glF;
+        int m_drawCalls = 0; // in the last frame
+};
+
+} // namespace scratchcpprender
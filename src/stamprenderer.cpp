@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <QOpenGLShaderProgram>
+
+#include "stamprenderer.h"
+#include "penstamp.h"
+#include "sharedquad.h"
+
+using namespace scratchcpprender;
+
+static const int INSTANCE_SIZE = 16 + 4 + 3 + 4; // matrix, effects, shape effects and UV rectangle (floats)
+
+StampRenderer::StampRenderer()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    Q_ASSERT(context);
+
+    if (!context) {
+        qWarning("StampRenderer must be constructed with a valid OpenGL context.");
+        return;
+    }
+
+    m_glF.initializeOpenGLFunctions();
+
+    m_glF.glGenVertexArrays(1, &m_vao);
+    m_glF.glGenBuffers(1, &m_instanceVbo);
+
+    m_glF.glBindVertexArray(m_vao);
+
+    // The vertex array has its own instance attributes, but it uses the quad buffer of the context
+    SharedQuad::setVertexAttributes(context, &m_glF);
+
+    // Instance attributes (matrix columns, effect values and UV rectangle) are set when rendering
+    for (GLuint i = ShaderManager::INSTANCE_MATRIX_LOCATION; i <= ShaderManager::INSTANCE_UV_RECT_LOCATION; i++) {
+        m_glF.glEnableVertexAttribArray(i);
+        m_glF.glVertexAttribDivisor(i, 1);
+    }
+
+    m_glF.glBindVertexArray(0);
+    m_glF.glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+StampRenderer::~StampRenderer()
+{
+    if (m_vao != 0) {
+        m_glF.glDeleteVertexArrays(1, &m_vao);
+        m_glF.glDeleteBuffers(1, &m_instanceVbo);
+    }
+}
+
+bool StampRenderer::isValid() const
+{
+    return m_vao != 0;
+}
+
+int StampRenderer::render(const PenStamp *stamps, size_t count, const QRect &viewport)
+{
+    // Returns the number of draw calls
+    if (count == 0 || !isValid())
+        return 0;
+
+    // Each stamp was rendered into its own viewport, so map that viewport into the given viewport
+    m_instanceData.resize(count * INSTANCE_SIZE);
+    float *data = m_instanceData.data();
+    const float width = viewport.width();
+    const float height = viewport.height();
+
+    for (size_t i = 0; i < count; i++) {
+        const PenStamp &stamp = stamps[i];
+        const QRect &stampViewport = stamp.viewport;
+        QMatrix4x4 viewportMatrix;
+        viewportMatrix.translate((2 * stampViewport.x() + stampViewport.width()) / width - 1, (2 * stampViewport.y() + stampViewport.height()) / height - 1);
+        viewportMatrix.scale(stampViewport.width() / width, stampViewport.height() / height);
+
+        const QMatrix4x4 matrix = viewportMatrix * stamp.matrix;
+        std::copy(matrix.constData(), matrix.constData() + 16, data); // column-major
+        std::copy(stamp.effectValues.begin(), stamp.effectValues.end(), data + 16);
+        data[23] = stamp.uvRect.x();
+        data[24] = stamp.uvRect.y();
+        data[25] = stamp.uvRect.width();
+        data[26] = stamp.uvRect.height();
+        data += INSTANCE_SIZE;
+    }
+
+    m_glF.glBindVertexArray(m_vao);
+    m_glF.glBindBuffer(GL_ARRAY_BUFFER, m_instanceVbo);
+
+    // Reuse the instance buffer, it only grows
+    const size_t size = m_instanceData.size() * sizeof(float);
+
+    if (size > m_instanceCapacity) {
+        m_instanceCapacity = std::max(size, m_instanceCapacity * 2);
+        m_glF.glBufferData(GL_ARRAY_BUFFER, m_instanceCapacity, nullptr, GL_STREAM_DRAW);
+    }
+
+    m_glF.glBufferSubData(GL_ARRAY_BUFFER, 0, size, m_instanceData.data());
+
+    m_glF.glViewport(viewport.x(), viewport.y(), viewport.width(), viewport.height());
+    m_glF.glEnable(GL_BLEND);
+    m_glF.glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    m_glF.glActiveTexture(GL_TEXTURE0);
+
+    ShaderManager *shaderManager = ShaderManager::instance();
+    const GLsizei stride = INSTANCE_SIZE * sizeof(float);
+    size_t i = 0;
+    int drawCalls = 0;
+
+    while (i < count) {
+        // Group consecutive stamps which use the same texture and shader program (textures in an atlas share the handle)
+        const size_t first = i;
+        const PenStamp &stamp = stamps[first];
+        const bool usesSkinSize = (stamp.effectMask & ShaderManager::Effect::Pixelate) != 0; // u_skinSize is only used by the pixelate effect
+
+        do
+            i++;
+        while (i < count && stamps[i].texture == stamp.texture && stamps[i].effectMask == stamp.effectMask && (!usesSkinSize || stamps[i].skinSize == stamp.skinSize));
+
+        QOpenGLShaderProgram *program = shaderManager->getInstancedShaderProgram(stamp.effectMask);
+        Q_ASSERT(program);
+
+        if (!program)
+            continue;
+
+        program->bind();
+        ShaderManager::setInstancedUniforms(program, 0, stamp.skinSize);
+        m_glF.glBindTexture(GL_TEXTURE_2D, stamp.texture);
+
+        // There's no base instance in OpenGL ES, so point the attributes to the first stamp of the group
+        const size_t offset = first * stride;
+
+        for (int column = 0; column < 4; column++)
+            m_glF.glVertexAttribPointer(ShaderManager::INSTANCE_MATRIX_LOCATION + column, 4, GL_FLOAT, GL_FALSE, stride, (void *)(offset + column * 4 * sizeof(float)));
+
+        m_glF.glVertexAttribPointer(ShaderManager::INSTANCE_EFFECTS_LOCATION, 4, GL_FLOAT, GL_FALSE, stride, (void *)(offset + 16 * sizeof(float)));
+        m_glF.glVertexAttribPointer(ShaderManager::INSTANCE_SHAPE_EFFECTS_LOCATION, 3, GL_FLOAT, GL_FALSE, stride, (void *)(offset + 20 * sizeof(float)));
+        m_glF.glVertexAttribPointer(ShaderManager::INSTANCE_UV_RECT_LOCATION, 4, GL_FLOAT, GL_FALSE, stride, (void *)(offset + 23 * sizeof(float)));
+
+        // Stamps are drawn in order, so they're blended in the same way as separate draw calls
+        m_glF.glDrawArraysInstanced(GL_TRIANGLES, 0, SharedQuad::VERTEX_COUNT, i - first);
+        program->release();
+        drawCalls++;
+    }
+
+    m_glF.glBindVertexArray(0);
+    m_glF.glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return drawCalls;
+}
@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QOpenGLExtraFunctions>
+#include <vector>
+
+namespace scratchcpprender
+{
+
+struct PenStamp;
+
+// Draws queued stamps, consecutive stamps with the same texture and effects are drawn in a single instanced draw call
+class StampRenderer
+{
+    public:
+        StampRenderer();
+        StampRenderer(const StampRenderer &) = delete;
+        ~StampRenderer();
+
+        bool isValid() const;
+
+        int render(const PenStamp *stamps, size_t count, const QRect &viewport);
+
+    private:
+        QOpenGLExtraFunctions m_glF;
+        GLuint m_vao = 0;
+        GLuint m_instanceVbo = 0;
+        size_t m_instanceCapacity = 0;     // size of the instance buffer
+        std::vector<float> m_instanceData; // matrix and effect values of each stamp
+};
+
+} // namespace scratchcpprender
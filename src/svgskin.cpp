@@ -47,7 +47,7 @@ Texture SVGSkin::getTexture(double scale) const
 
 double SVGSkin::getTextureScale(const Texture &texture) const
 {
-    auto it = m_textureIndexes.find(texture.handle());
+    auto it = m_textureIndexes.find(texture.id());
 
     if (it != m_textureIndexes.cend())
         return std::pow(2, it->second - INDEX_OFFSET);
@@ -82,9 +82,9 @@ Texture SVGSkin::createScaledTexture(int index)
     const Texture texture = createAndPaintTexture(viewBox.width() * scale, viewBox.height() * scale);
 
     if (texture.isValid()) {
-        m_textures[index] = texture.handle();
-        m_textureIndexes[texture.handle()] = index;
-        m_textureObjects[texture.handle()] = texture;
+        m_textures[index] = texture.id();
+        m_textureIndexes[texture.id()] = index;
+        m_textureObjects[texture.id()] = texture;
     }
 
     return texture;
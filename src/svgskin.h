@@ -31,9 +31,9 @@ class SVGSkin : public Skin
     private:
         Texture createScaledTexture(int index);
 
-        std::unordered_map<int, GLuint> m_textures;
-        std::unordered_map<GLuint, int> m_textureIndexes; // reverse map of m_textures
-        std::unordered_map<GLuint, Texture> m_textureObjects;
+        std::unordered_map<int, quint64> m_textures;
+        std::unordered_map<quint64, int> m_textureIndexes; // reverse map of m_textures
+        std::unordered_map<quint64, Texture> m_textureObjects;
         QSvgRenderer m_svgRen;
         int m_maxIndex = 0;
 };
@@ -50,6 +50,10 @@ PenState &TargetModel::penState()
 
 PenAttributes &TargetModel::penAttributes()
 {
+    // The color is only computed when it's needed (e.g. not when the pen is up)
+    if (m_penState.colorDirty)
+        m_penState.updateColor();
+
     return m_penState.penAttributes;
 }
 
@@ -63,7 +67,7 @@ void TargetModel::setPenDown(bool newPenDown)
     m_penState.penDown = newPenDown;
 
     if (m_penState.penDown && m_penLayer)
-        drawPenPoint(m_penLayer, m_penState.penAttributes);
+        drawPenPoint(m_penLayer, penAttributes());
 }
 
 const TextBubbleShape::Type &TargetModel::bubbleType() const
@@ -157,7 +161,7 @@ void TargetModel::updateCostume(libscratchcpp::Costume *costume)
 void TargetModel::onMoved(double oldX, double oldY, double newX, double newY)
 {
     if (m_penState.penDown && m_penLayer)
-        drawPenLine(m_penLayer, m_penState.penAttributes, oldX, oldY, newX, newY);
+        drawPenLine(m_penLayer, penAttributes(), oldX, oldY, newX, newY);
 }
 
 void TargetModel::setGraphicEffect(libscratchcpp::IGraphicsEffect *effect, double value)
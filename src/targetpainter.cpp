@@ -9,6 +9,7 @@
 #include "spritemodel.h"
 #include "bitmapskin.h"
 #include "shadermanager.h"
+#include "sharedquad.h"
 
 using namespace scratchcpprender;
 
@@ -46,56 +47,27 @@ void TargetPainter::paint(QNanoPainter *painter)
     if (!texture.isValid())
         return;
 
-    // Create a FBO for the current texture
-    unsigned int fbo;
-    glF.glGenFramebuffers(1, &fbo);
-    glF.glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glF.glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture.handle(), 0);
-
-    if (glF.glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        qWarning() << "error: framebuffer incomplete (" + m_target->scratchTarget()->name() + ")";
-        glF.glDeleteFramebuffers(1, &fbo);
-        return;
-    }
-
     // Get the shader program for the current set of effects
     ShaderManager *shaderManager = ShaderManager::instance();
 
     const auto &effects = m_target->graphicEffects();
-    QOpenGLShaderProgram *shaderProgram = shaderManager->getShaderProgram(m_target, effects);
+    QOpenGLShaderProgram *shaderProgram = shaderManager->getShaderProgram(effects);
     Q_ASSERT(shaderProgram);
     Q_ASSERT(shaderProgram->isLinked());
 
-    // Set up vertex data and buffers for a quad
-    float vertices[] = { -1.0f, -1.0f, 0.0f, 0.0f, 1.0f, -1.0f, 1.0f, 0.0f, -1.0f, 1.0f, 0.0f, 1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 1.0f };
-
-    GLuint VBO, VAO;
-    glF.glGenVertexArrays(1, &VAO);
-    glF.glGenBuffers(1, &VBO);
-
-    glF.glBindVertexArray(VAO);
-
-    glF.glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glF.glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-    // Position attribute
-    glF.glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
-    glF.glEnableVertexAttribArray(0);
-
-    // Texture coordinate attribute
-    glF.glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(2 * sizeof(float)));
-    glF.glEnableVertexAttribArray(1);
-
-    // Render to the target framebuffer
+    // Render to the target framebuffer (the quad is shared by all painters of the context)
     glF.glBindFramebuffer(GL_FRAMEBUFFER, targetFbo->handle());
     shaderProgram->bind();
-    glF.glBindVertexArray(VAO);
+    glF.glBindVertexArray(SharedQuad::vertexArray(context));
     glF.glActiveTexture(GL_TEXTURE0);
     glF.glBindTexture(GL_TEXTURE_2D, texture.handle());
-    shaderManager->setUniforms(shaderProgram, 0, QSize(m_target->costumeWidth(), m_target->costumeHeight()), effects); // set texture and effect uniforms
-    shaderProgram->setUniformValue("u_projectionMatrix", QMatrix4x4());
-    shaderProgram->setUniformValue("u_modelMatrix", QMatrix4x4());
-    glF.glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    // Set texture and effect uniforms (skipped if they didn't change since the last draw)
+    shaderManager->updateUniforms(shaderProgram, 0, QSize(m_target->costumeWidth(), m_target->costumeHeight()), effects, texture.uvRect());
+
+    // The matrices are always set because the program is shared with RenderedTarget::render() and other targets
+    ShaderManager::setMatrices(shaderProgram, QMatrix4x4(), QMatrix4x4());
+    glF.glDrawArrays(GL_TRIANGLES, 0, SharedQuad::VERTEX_COUNT);
 
     // Process the resulting texture
     // NOTE: This must happen now, not later, because the alpha channel can be used here
@@ -103,12 +75,8 @@ void TargetPainter::paint(QNanoPainter *painter)
 
     // Cleanup
     shaderProgram->release();
+    glF.glBindVertexArray(0);
     glF.glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glF.glDeleteFramebuffers(1, &fbo);
-
-    // Delete vertex array and buffer
-    glF.glDeleteVertexArrays(1, &VAO);
-    glF.glDeleteBuffers(1, &VBO);
 }
 
 void TargetPainter::synchronize(QNanoQuickItem *item)
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <qnanoquickitempainter.h>
+#include <QOpenGLFunctions>
 
 namespace scratchcpprender
 {
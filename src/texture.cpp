@@ -21,6 +21,15 @@ Texture::Texture(GLuint texture, int width, int height) :
 {
 }
 
+Texture::Texture(GLuint texture, const QSize &size, const QPoint &atlasOffset, const QSize &atlasSize) :
+    m_handle(texture),
+    m_isValid(true),
+    m_size(size),
+    m_atlasOffset(atlasOffset),
+    m_atlasSize(atlasSize)
+{
+}
+
 GLuint Texture::handle() const
 {
     return m_handle;
@@ -46,6 +55,33 @@ int Texture::height() const
     return m_size.height();
 }
 
+bool Texture::isInAtlas() const
+{
+    return !m_atlasSize.isEmpty();
+}
+
+const QPoint &Texture::atlasOffset() const
+{
+    return m_atlasOffset;
+}
+
+QRectF Texture::uvRect() const
+{
+    // Returns the part of the OpenGL texture covered by this texture (in texture coordinates)
+    if (m_atlasSize.isEmpty())
+        return QRectF(0, 0, 1, 1);
+
+    const double width = m_atlasSize.width();
+    const double height = m_atlasSize.height();
+    return QRectF(m_atlasOffset.x() / width, m_atlasOffset.y() / height, m_size.width() / width, m_size.height() / height);
+}
+
+quint64 Texture::id() const
+{
+    // Unique key of the texture (textures in an atlas share the handle)
+    return (static_cast<quint64>(m_handle) << 32) | (static_cast<quint64>(m_atlasOffset.y()) << 16) | m_atlasOffset.x();
+}
+
 QImage Texture::toImage() const
 {
     if (!m_isValid)
@@ -95,7 +131,9 @@ QImage Texture::toImage() const
     // Blit the FBO to the Qt FBO
     glF.glBindFramebuffer(GL_READ_FRAMEBUFFER, textureFbo);
     glF.glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo.handle());
-    glF.glBlitFramebuffer(0, 0, m_size.width(), m_size.height(), 0, 0, fbo.width(), fbo.height(), GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    const int x = m_atlasOffset.x();
+    const int y = m_atlasOffset.y();
+    glF.glBlitFramebuffer(x, y, x + m_size.width(), y + m_size.height(), 0, 0, fbo.width(), fbo.height(), GL_COLOR_BUFFER_BIT, GL_NEAREST);
     glF.glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     glF.glDeleteFramebuffers(1, &textureFbo);
@@ -116,6 +154,12 @@ void Texture::release()
 {
     QOpenGLContext *context = QOpenGLContext::currentContext();
 
+    if (m_isValid && isInAtlas()) {
+        // The atlas texture is owned by the atlas
+        m_isValid = false;
+        return;
+    }
+
     if (m_isValid && context) {
         QOpenGLExtraFunctions glF(context);
         glF.initializeOpenGLFunctions();
@@ -126,7 +170,7 @@ void Texture::release()
 
 bool Texture::operator==(const Texture &texture) const
 {
-    return (!m_isValid && !texture.m_isValid) || (m_isValid && texture.m_isValid && m_handle == texture.m_handle);
+    return (!m_isValid && !texture.m_isValid) || (m_isValid && texture.m_isValid && m_handle == texture.m_handle && m_atlasOffset == texture.m_atlasOffset);
 }
 
 bool scratchcpprender::Texture::operator!=(const Texture &texture) const
@@ -13,6 +13,7 @@ class Texture
         Texture();
         Texture(GLuint texture, const QSize &size);
         Texture(GLuint texture, int width, int height);
+        Texture(GLuint texture, const QSize &size, const QPoint &atlasOffset, const QSize &atlasSize);
 
         GLuint handle() const;
         bool isValid() const;
@@ -20,6 +21,11 @@ class Texture
         int width() const;
         int height() const;
 
+        bool isInAtlas() const;
+        const QPoint &atlasOffset() const;
+        QRectF uvRect() const;
+        quint64 id() const;
+
         QImage toImage() const;
 
         void release();
@@ -31,6 +37,8 @@ class Texture
         GLuint m_handle = 0;
         bool m_isValid = false;
         QSize m_size;
+        QPoint m_atlasOffset; // position in the atlas texture
+        QSize m_atlasSize;    // size of the atlas texture (empty if the texture isn't in an atlas)
 };
 
 } // namespace scratchcpprender
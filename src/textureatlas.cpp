@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "textureatlas.h"
+
+using namespace scratchcpprender;
+
+TextureAtlas::TextureAtlas(int size) :
+    m_size(size)
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    Q_ASSERT(context);
+
+    if (!context || size <= 0) {
+        qWarning("TextureAtlas must be constructed with a valid OpenGL context.");
+        return;
+    }
+
+    m_glF.initializeOpenGLFunctions();
+
+    // The atlas is transparent, so the padding doesn't have to be uploaded
+    std::vector<GLubyte> pixels(size * size * 4, 0);
+
+    m_glF.glGenTextures(1, &m_handle);
+    m_glF.glBindTexture(GL_TEXTURE_2D, m_handle);
+    m_glF.glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    m_glF.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    m_glF.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    m_glF.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    m_glF.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    m_glF.glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+TextureAtlas::~TextureAtlas()
+{
+    if (m_handle != 0 && QOpenGLContext::currentContext())
+        m_glF.glDeleteTextures(1, &m_handle);
+}
+
+bool TextureAtlas::isValid() const
+{
+    return m_handle != 0;
+}
+
+GLuint TextureAtlas::handle() const
+{
+    return m_handle;
+}
+
+int TextureAtlas::size() const
+{
+    return m_size;
+}
+
+Texture TextureAtlas::addTexture(const QImage &image)
+{
+    // Returns an invalid texture if there isn't enough space
+    if (!isValid() || image.isNull())
+        return Texture();
+
+    QPoint pos;
+
+    if (!allocate(image.size(), pos))
+        return Texture();
+
+    // RGBA rows are always 4-byte aligned, so the default unpack alignment can be used
+    const QImage rgba = image.convertToFormat(QImage::Format_RGBA8888);
+    m_glF.glBindTexture(GL_TEXTURE_2D, m_handle);
+    m_glF.glTexSubImage2D(GL_TEXTURE_2D, 0, pos.x(), pos.y(), rgba.width(), rgba.height(), GL_RGBA, GL_UNSIGNED_BYTE, rgba.constBits());
+    m_glF.glBindTexture(GL_TEXTURE_2D, 0);
+
+    return Texture(m_handle, image.size(), pos, QSize(m_size, m_size));
+}
+
+bool TextureAtlas::allocate(const QSize &size, QPoint &dst)
+{
+    const int width = size.width() + 2 * PADDING;
+    const int height = size.height() + 2 * PADDING;
+
+    if (width > m_size || height > m_size)
+        return false;
+
+    // Use the lowest shelf which has enough space (to waste as little height as possible)
+    Shelf *best = nullptr;
+
+    for (Shelf &shelf : m_shelves) {
+        if (shelf.height >= height && shelf.width + width <= m_size && (!best || shelf.height < best->height))
+            best = &shelf;
+    }
+
+    if (!best) {
+        // Start a new shelf
+        if (m_usedHeight + height > m_size)
+            return false;
+
+        m_shelves.push_back({ m_usedHeight, height, 0 });
+        m_usedHeight += height;
+        best = &m_shelves.back();
+    }
+
+    dst = QPoint(best->width + PADDING, best->y + PADDING);
+    best->width += width;
+    return true;
+}
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QOpenGLExtraFunctions>
+#include <QImage>
+#include <vector>
+
+#include "texture.h"
+
+namespace scratchcpprender
+{
+
+// Packs small textures into rows ("shelves") of a single OpenGL texture,
+// so that targets with different costumes can be drawn without binding another texture
+class TextureAtlas
+{
+    public:
+        static const int PADDING = 1; // transparent border around each texture
+
+        TextureAtlas(int size);
+        TextureAtlas(const TextureAtlas &) = delete;
+        ~TextureAtlas();
+
+        bool isValid() const;
+        GLuint handle() const;
+        int size() const;
+
+        Texture addTexture(const QImage &image);
+
+    private:
+        struct Shelf
+        {
+                int y = 0;
+                int height = 0;
+                int width = 0; // used width
+        };
+
+        bool allocate(const QSize &size, QPoint &dst);
+
+        int m_size = 0;
+        GLuint m_handle = 0;
+        std::vector<Shelf> m_shelves;
+        int m_usedHeight = 0;
+        QOpenGLExtraFunctions m_glF;
+};
+
+} // namespace scratchcpprender
@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <algorithm>
+
+#include "texturespans.h"
+
+using namespace scratchcpprender;
+
+TextureSpans::TextureSpans(const GLubyte *pixels, int width, int height) :
+    m_width(width),
+    m_height(height)
+{
+    // pixels: RGBA, rows ordered from top to bottom
+    m_rows.reserve(height + 1);
+
+    for (int y = 0; y < height; y++) {
+        m_rows.push_back(m_spans.size());
+        const GLubyte *row = pixels + y * width * 4;
+        int x = 0;
+
+        while (x < width) {
+            // Skip transparent pixels
+            while (x < width && row[x * 4 + 3] == 0)
+                x++;
+
+            if (x >= width)
+                break;
+
+            Span span;
+            span.start = x;
+            span.colorOffset = m_colors.size();
+
+            while (x < width && row[x * 4 + 3] != 0) {
+                const GLubyte *pixel = row + x * 4;
+                m_colors.push_back(qRgba(pixel[0], pixel[1], pixel[2], pixel[3]));
+                x++;
+            }
+
+            span.end = x;
+            m_spans.push_back(span);
+        }
+    }
+
+    m_rows.push_back(m_spans.size());
+    m_spans.shrink_to_fit();
+    m_colors.shrink_to_fit();
+}
+
+TextureSpans::TextureSpans(int width) :
+    m_width(width),
+    m_rows({ 0 })
+{
+    // Rows are added using addRow()
+}
+
+void TextureSpans::addRow(const std::vector<Span> &spans)
+{
+    // Adds a row of sorted spans without colors (e.g. the shape of a sprite in stage coordinates)
+    for (const Span &span : spans) {
+        Q_ASSERT(span.start >= 0 && span.start < span.end && span.end <= m_width);
+        m_spans.push_back({ span.start, span.end, -1 });
+    }
+
+    m_rows.push_back(m_spans.size());
+    m_height++;
+}
+
+int TextureSpans::width() const
+{
+    return m_width;
+}
+
+int TextureSpans::height() const
+{
+    return m_height;
+}
+
+bool TextureSpans::isEmpty() const
+{
+    // Returns true if there are no non-transparent pixels
+    return m_spans.empty();
+}
+
+QRgb TextureSpans::pixel(int x, int y) const
+{
+    const Span *span = findSpan(x, y);
+
+    if (span && span->colorOffset >= 0)
+        return m_colors[span->colorOffset + x - span->start];
+
+    return qRgba(0, 0, 0, 0);
+}
+
+bool TextureSpans::containsPixel(int x, int y) const
+{
+    return findSpan(x, y);
+}
+
+void TextureSpans::readRow(int y, int x, int count, QRgb *dst) const
+{
+    // Reads count pixels of row y starting at x (pixels outside the texture are transparent)
+    std::fill(dst, dst + count, qRgba(0, 0, 0, 0));
+
+    const Span *spans = rowSpans(y);
+    const int n = spanCount(y);
+    const int end = x + count;
+
+    for (int i = 0; i < n; i++) {
+        const Span &span = spans[i];
+
+        if (span.end <= x)
+            continue;
+
+        if (span.start >= end)
+            break;
+
+        if (span.colorOffset < 0)
+            continue;
+
+        const int start = std::max(span.start, x);
+        const int stop = std::min(span.end, end);
+        const auto colors = m_colors.cbegin() + span.colorOffset - span.start;
+        std::copy(colors + start, colors + stop, dst + start - x);
+    }
+}
+
+int TextureSpans::spanCount(int y) const
+{
+    if (y < 0 || y >= m_height)
+        return 0;
+
+    return m_rows[y + 1] - m_rows[y];
+}
+
+const TextureSpans::Span *TextureSpans::rowSpans(int y) const
+{
+    if (y < 0 || y >= m_height)
+        return nullptr;
+
+    return m_spans.data() + m_rows[y];
+}
+
+bool TextureSpans::rowIntersects(int y, const TextureSpans &other, int otherY, int offset) const
+{
+    // Checks whether row y overlaps row otherY of the other texture shifted by offset pixels to the right
+    const int count = spanCount(y);
+    const int otherCount = other.spanCount(otherY);
+
+    if (count == 0 || otherCount == 0)
+        return false;
+
+    const Span *spans = rowSpans(y);
+    const Span *otherSpans = other.rowSpans(otherY);
+    int i = 0, j = 0;
+
+    while (i < count && j < otherCount) {
+        const Span &a = spans[i];
+        const int otherStart = otherSpans[j].start + offset;
+        const int otherEnd = otherSpans[j].end + offset;
+
+        if (a.start < otherEnd && otherStart < a.end)
+            return true;
+
+        // Advance the span which ends first
+        if (a.end <= otherEnd)
+            i++;
+        else
+            j++;
+    }
+
+    return false;
+}
+
+bool TextureSpans::intersects(const TextureSpans &other, const QPoint &offset) const
+{
+    // The pixel (x, y) of the other texture is at (x + offset.x(), y + offset.y())
+    const int top = std::max(0, offset.y());
+    const int bottom = std::min(m_height, other.m_height + offset.y());
+
+    for (int y = top; y < bottom; y++) {
+        if (rowIntersects(y, other, y - offset.y(), offset.x()))
+            return true;
+    }
+
+    return false;
+}
+
+void TextureSpans::toRgba(GLubyte *dst) const
+{
+    memset(dst, 0, m_width * m_height * 4);
+
+    for (int y = 0; y < m_height; y++) {
+        const Span *spans = rowSpans(y);
+        const int count = spanCount(y);
+        GLubyte *row = dst + y * m_width * 4;
+
+        for (int i = 0; i < count; i++) {
+            const Span &span = spans[i];
+
+            if (span.colorOffset < 0)
+                continue;
+
+            for (int x = span.start; x < span.end; x++) {
+                const QRgb color = m_colors[span.colorOffset + x - span.start];
+                GLubyte *pixel = row + x * 4;
+                pixel[0] = qRed(color);
+                pixel[1] = qGreen(color);
+                pixel[2] = qBlue(color);
+                pixel[3] = qAlpha(color);
+            }
+        }
+    }
+}
+
+size_t TextureSpans::memoryUsage() const
+{
+    return m_rows.capacity() * sizeof(int) + m_spans.capacity() * sizeof(Span) + m_colors.capacity() * sizeof(QRgb);
+}
+
+const TextureSpans::Span *TextureSpans::findSpan(int x, int y) const
+{
+    if (x < 0 || x >= m_width || y < 0 || y >= m_height)
+        return nullptr;
+
+    // Binary search for the last span which starts at or before x
+    const Span *begin = m_spans.data() + m_rows[y];
+    const Span *end = m_spans.data() + m_rows[y + 1];
+    const Span *it = std::upper_bound(begin, end, x, [](int x, const Span &span) { return x < span.start; });
+
+    if (it == begin)
+        return nullptr;
+
+    --it;
+    return x < it->end ? it : nullptr;
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QtOpenGL>
+#include <vector>
+
+namespace scratchcpprender
+{
+
+// Stores the non-transparent pixels of a texture as sorted [start, end) spans per row
+// and the colors of these pixels (fully transparent pixels take no memory)
+class TextureSpans
+{
+    public:
+        struct Span
+        {
+                int start;       // first pixel of the span
+                int end;         // one past the last pixel of the span
+                int colorOffset; // index of the color of the first pixel (-1 if the span has no colors)
+        };
+
+        TextureSpans() = default;
+        TextureSpans(const GLubyte *pixels, int width, int height);
+        explicit TextureSpans(int width);
+
+        void addRow(const std::vector<Span> &spans);
+
+        int width() const;
+        int height() const;
+        bool isEmpty() const;
+
+        QRgb pixel(int x, int y) const;
+        bool containsPixel(int x, int y) const;
+        void readRow(int y, int x, int count, QRgb *dst) const;
+
+        int spanCount(int y) const;
+        const Span *rowSpans(int y) const;
+
+        bool rowIntersects(int y, const TextureSpans &other, int otherY, int offset) const;
+        bool intersects(const TextureSpans &other, const QPoint &offset) const;
+
+        void toRgba(GLubyte *dst) const;
+
+        size_t memoryUsage() const;
+
+    private:
+        const Span *findSpan(int x, int y) const;
+
+        int m_width = 0;
+        int m_height = 0;
+        std::vector<int> m_rows; // index of the first span of each row (and the total span count at the end)
+        std::vector<Span> m_spans;
+        std::vector<QRgb> m_colors;
+};
+
+} // namespace scratchcpprender
@@ -706,6 +706,43 @@ TEST_F(PenBlocksTest, ChangePenColorParamBy_Saturation)
     EXPECT_EQ(model.penAttributes().color.alpha(), 255);
 }
 
+TEST_F(PenBlocksTest, ChangePenColorParamBy_ConstParamName)
+{
+    auto sprite = std::make_shared<Sprite>();
+    sprite->setEngine(&m_engineMock);
+
+    RenderedTarget renderedTarget;
+    SpriteModel model;
+    model.init(sprite.get());
+    model.setRenderedTarget(&renderedTarget);
+    sprite->setInterface(&model);
+
+    ScriptBuilder builder(m_extension.get(), m_engine, sprite);
+    builder.addBlock("pen_changePenColorParamBy");
+    builder.addValueInput("COLOR_PARAM", "saturation");
+    builder.addValueInput("VALUE", 23.5);
+
+    PenState &penState = model.penState();
+    penState.color = 12.67;
+    penState.saturation = 39.21;
+    penState.brightness = 58.82;
+    penState.updateColor();
+
+    auto thread = buildScript(builder, sprite.get());
+
+    EXPECT_CALL(m_engineMock, requestRedraw).Times(0);
+    thread->run();
+
+    // The color is only computed when it's used
+    ASSERT_TRUE(model.penState().colorDirty);
+
+    EXPECT_EQ(model.penAttributes().color.red(), 149);
+    EXPECT_EQ(model.penAttributes().color.green(), 126);
+    EXPECT_EQ(model.penAttributes().color.blue(), 56);
+    EXPECT_EQ(model.penAttributes().color.alpha(), 255);
+    ASSERT_FALSE(model.penState().colorDirty);
+}
+
 TEST_F(PenBlocksTest, ChangePenColorParamBy_Saturation_OutOfRange)
 {
     auto sprite = std::make_shared<Sprite>();
@@ -81,7 +81,7 @@ TEST_F(EffectTransformTest, BrightnessEffect)
     // 50
     m_effects[ShaderManager::Effect::Brightness] = 50;
     color = qRgba(255, 0, 0, 255);
-    ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgb(255, 127, 127));
+    ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgb(255, 128, 128));
 
     color = qRgba(100, 255, 200, 128);
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgba(128, 128, 128, 128));
@@ -193,3 +193,39 @@ TEST_F(EffectTransformTest, MosaicEffect)
     ASSERT_EQ(std::round(dst.x() * 1000.0f) / 1000.0f, 0.8f);
     ASSERT_EQ(std::round(dst.y() * 1000.0f) / 1000.0f, 0.28f);
 }
+
+TEST_F(EffectTransformTest, TransformColors)
+{
+    static const QRgb colors[] = { qRgba(255, 0, 0, 255), qRgba(0, 0, 0, 0), qRgba(100, 255, 200, 128), qRgba(12, 34, 56, 78), qRgba(255, 255, 255, 255) };
+    m_effects[ShaderManager::Effect::Color] = 65;
+    m_effects[ShaderManager::Effect::Brightness] = -20;
+    m_effects[ShaderManager::Effect::Ghost] = 30;
+    const auto mask = ShaderManager::Effect::Color | ShaderManager::Effect::Brightness | ShaderManager::Effect::Ghost;
+
+    ShaderManager::InstanceEffectValues uniforms;
+    ShaderManager::getInstanceValuesForEffects(m_effects, uniforms);
+
+    // Counts which aren't multiples of the number of colors processed at once
+    for (int count : { 1, 3, 5 }) {
+        QRgb dst[5] = { 0, 0, 0, 0, 0 };
+        EffectTransform::transformColors(mask, m_effects, colors, dst, count);
+
+        for (int i = 0; i < count; i++)
+            ASSERT_EQ(dst[i], EffectTransform::transformColor(mask, m_effects, colors[i]));
+
+        // The pixels after count aren't written
+        for (int i = count; i < 5; i++)
+            ASSERT_EQ(dst[i], 0u);
+
+        // Converted uniform values
+        QRgb dst2[5] = { 0, 0, 0, 0, 0 };
+        EffectTransform::transformColors(mask, uniforms, colors, dst2, count);
+        ASSERT_EQ(memcmp(dst, dst2, sizeof(dst)), 0);
+
+        // In place
+        QRgb data[5];
+        memcpy(data, colors, sizeof(data));
+        EffectTransform::transformColors(mask, uniforms, data, data, count);
+        ASSERT_EQ(memcmp(data, dst, count * sizeof(QRgb)), 0);
+    }
+}
@@ -25,11 +25,18 @@ class PenLayerMock : public IPenLayer
         MOCK_METHOD(void, drawPoint, (const PenAttributes &, double, double), (override));
         MOCK_METHOD(void, drawLine, (const PenAttributes &, double, double, double, double), (override));
         MOCK_METHOD(void, stamp, (IRenderedTarget *), (override));
+        MOCK_METHOD(void, flush, (const QRectF &), (override));
 
         MOCK_METHOD(QOpenGLFramebufferObject *, framebufferObject, (), (const, override));
+        MOCK_METHOD(QRectF, framebufferRect, (), (const, override));
+        MOCK_METHOD(QRect, takeDirtyRect, (), (override));
+        MOCK_METHOD(void, addPaintTime, (double), (override));
         MOCK_METHOD(QRgb, colorAtScratchPoint, (double, double), (const, override));
+        MOCK_METHOD(void, colorsAtScratchRect, (const QRect &, QRgb *), (const, override));
+        MOCK_METHOD(void, colorsAtScratchPoints, (const std::vector<QPointF> &, QRgb *), (const, override));
 
         MOCK_METHOD(const libscratchcpp::Rect &, getBounds, (), (const, override));
+        MOCK_METHOD(libscratchcpp::Rect, getFastBounds, (), (const, override));
 
         MOCK_METHOD(QNanoQuickItemPainter *, createItemPainter, (), (const, override));
 };
@@ -2,6 +2,8 @@
 
 #include <irenderedtarget.h>
 #include <texture.h>
+#include <texturespans.h>
+#include <penstamp.h>
 #include <qnanoquickitem.h>
 #include <scratchcpp/rect.h>
 #include <gmock/gmock.h>
@@ -62,6 +64,8 @@ class RenderedTargetMock : public IRenderedTarget
         MOCK_METHOD(bool, mirrorHorizontally, (), (const, override));
 
         MOCK_METHOD(void, render, (double), (const, override));
+        MOCK_METHOD(void, render, (double, const QPoint &, ShaderManager::DrawMode), (const, override));
+        MOCK_METHOD(bool, getStamp, (double, PenStamp &), (const, override));
 
         MOCK_METHOD(Texture, texture, (), (const, override));
         MOCK_METHOD(const Texture &, cpuTexture, (), (const, override));
@@ -76,6 +80,7 @@ class RenderedTargetMock : public IRenderedTarget
 
         MOCK_METHOD(bool, contains, (const QPointF &), (const, override));
         MOCK_METHOD(bool, containsScratchPoint, (double, double), (const, override));
+        MOCK_METHOD(void, getScratchSpans, (const QRect &, TextureSpans &), (const, override));
         MOCK_METHOD(QRgb, colorAtScratchPoint, (double, double), (const, override));
 
         MOCK_METHOD(bool, touchingClones, (const std::vector<libscratchcpp::Sprite *> &), (const, override));
@@ -0,0 +1,82 @@
+#include <pencommandbuffer.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+
+TEST(PenCommandBufferTest, Empty)
+{
+    PenCommandBuffer buffer;
+    ASSERT_TRUE(buffer.empty());
+    ASSERT_EQ(buffer.size(), 0);
+}
+
+TEST(PenCommandBufferTest, AddLine)
+{
+    PenCommandBuffer buffer;
+    buffer.addLine(1.5f, 2, 3, -4.25f, 2.5f, QNanoColor(255, 128, 0, 64));
+    buffer.addLine(5, 6, 5, 6, 10, QNanoColor(0, 0, 255));
+    ASSERT_FALSE(buffer.empty());
+    ASSERT_EQ(buffer.size(), 2);
+
+    ASSERT_EQ(buffer.type(0), PenCommandBuffer::Type::Line);
+    const float *coords = buffer.coords(0);
+    ASSERT_EQ(coords[0], 1.5f);
+    ASSERT_EQ(coords[1], 2);
+    ASSERT_EQ(coords[2], 3);
+    ASSERT_EQ(coords[3], -4.25f);
+    ASSERT_EQ(buffer.diameter(0), 2.5f);
+    ASSERT_EQ(buffer.nanoColor(0), QNanoColor(255, 128, 0, 64));
+
+    ASSERT_EQ(buffer.type(1), PenCommandBuffer::Type::Point);
+    coords = buffer.coords(1);
+    ASSERT_EQ(coords[0], 5);
+    ASSERT_EQ(coords[3], 6);
+    ASSERT_EQ(buffer.diameter(1), 10);
+    ASSERT_EQ(buffer.nanoColor(1), QNanoColor(0, 0, 255));
+
+    // The arrays are contiguous
+    ASSERT_EQ(buffer.coords(1), buffer.coords(0) + 4);
+    ASSERT_EQ(buffer.diameters()[1], 10);
+    ASSERT_EQ(buffer.colors()[1], buffer.color(1));
+
+    buffer.clear();
+    ASSERT_TRUE(buffer.empty());
+    ASSERT_EQ(buffer.size(), 0);
+}
+
+TEST(PenCommandBufferTest, AddStamp)
+{
+    PenCommandBuffer buffer;
+    buffer.addLine(1, 2, 3, 4, 1, QNanoColor(255, 0, 0));
+    buffer.addStamp();
+    buffer.addLine(5, 6, 7, 8, 2, QNanoColor(0, 255, 0));
+    ASSERT_EQ(buffer.size(), 3);
+
+    ASSERT_EQ(buffer.type(1), PenCommandBuffer::Type::Stamp);
+
+    // Stamps keep the attribute arrays aligned
+    ASSERT_EQ(buffer.type(2), PenCommandBuffer::Type::Line);
+    ASSERT_EQ(buffer.coords(2)[0], 5);
+    ASSERT_EQ(buffer.diameters()[2], 2);
+    ASSERT_EQ(buffer.nanoColor(2), QNanoColor(0, 255, 0));
+}
+
+TEST(PenCommandBufferTest, PackColor)
+{
+    // RGBA bytes in memory order
+    const quint32 color = PenCommandBuffer::packColor(QNanoColor(1, 2, 3, 4));
+    const uchar *bytes = reinterpret_cast<const uchar *>(&color);
+    ASSERT_EQ(bytes[0], 1);
+    ASSERT_EQ(bytes[1], 2);
+    ASSERT_EQ(bytes[2], 3);
+    ASSERT_EQ(bytes[3], 4);
+
+    // Components are rounded
+    QNanoColor nanoColor;
+    nanoColor.setRedF(0.999f);
+    nanoColor.setGreenF(0.5f);
+    nanoColor.setBlueF(0.0f);
+    nanoColor.setAlphaF(1.0f);
+    ASSERT_EQ(PenCommandBuffer::packColor(nanoColor), PenCommandBuffer::packColor(QNanoColor(255, 128, 0, 255)));
+}
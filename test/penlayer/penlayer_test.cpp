@@ -3,6 +3,7 @@
 #include <QBuffer>
 #include <QFile>
 #include <QSignalSpy>
+#include <QThread>
 #include <penlayer.h>
 #include <penattributes.h>
 #include <projectloader.h>
@@ -135,7 +136,7 @@ TEST_F(PenLayerTest, FramebufferObject)
     ASSERT_EQ(fbo->format().attachment(), QOpenGLFramebufferObject::CombinedDepthStencil);
     ASSERT_EQ(fbo->format().samples(), 0);
 
-    EXPECT_CALL(engine3, stageWidth()).Times(3).WillRepeatedly(Return(100));
+    EXPECT_CALL(engine3, stageWidth()).Times(2).WillRepeatedly(Return(100));
     penLayer.setHqPen(true);
     penLayer.setWidth(500);
     penLayer.setHeight(400);
@@ -169,6 +170,98 @@ TEST_F(PenLayerTest, Refresh)
     ASSERT_EQ(fbo->height(), 400);
 }
 
+TEST_F(PenLayerTest, CoalescedResize)
+{
+    PenLayer penLayer;
+
+    EngineMock engine;
+    penLayer.setWidth(480);
+    penLayer.setHeight(360);
+    EXPECT_CALL(engine, stageWidth()).WillOnce(Return(480));
+    penLayer.setEngine(&engine);
+
+    QOpenGLFramebufferObject *fbo = penLayer.framebufferObject();
+    const GLuint texture = fbo->texture();
+
+    // The size didn't change
+    EXPECT_CALL(engine, stageWidth()).WillOnce(Return(480));
+    penLayer.refresh();
+    ASSERT_EQ(penLayer.framebufferObject(), fbo);
+
+    // Multiple resizes result in a single reallocation
+    EXPECT_CALL(engine, stageWidth()).Times(2).WillRepeatedly(Return(480));
+    penLayer.setHqPen(true);
+    penLayer.setWidth(500);
+    penLayer.setHeight(400);
+    penLayer.setWidth(240);
+    penLayer.setHeight(180);
+
+    // The FBO is reallocated at the next frame
+    ASSERT_EQ(penLayer.framebufferObject(), fbo);
+    penLayer.beginFrame();
+    penLayer.endFrame();
+    fbo = penLayer.framebufferObject();
+    ASSERT_EQ(fbo->size(), QSize(240, 180));
+
+    // The old FBO is reused when the pen layer grows again
+    penLayer.setWidth(480);
+    penLayer.setHeight(360);
+
+    EXPECT_CALL(engine, stageWidth()).WillOnce(Return(480));
+    penLayer.beginFrame();
+    penLayer.endFrame();
+    fbo = penLayer.framebufferObject();
+    ASSERT_EQ(fbo->size(), QSize(480, 360));
+    ASSERT_EQ(fbo->texture(), texture);
+}
+
+TEST_F(PenLayerTest, FboPool)
+{
+    PenLayer penLayer;
+
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    penLayer.setHqPen(true);
+    penLayer.setWidth(480);
+    penLayer.setHeight(360);
+    penLayer.setEngine(&engine);
+    ASSERT_EQ(penLayer.pooledFboMemory(), 0);
+
+    auto resize = [&penLayer](int width, int height) {
+        penLayer.setWidth(width);
+        penLayer.setHeight(height);
+        penLayer.refresh();
+    };
+
+    // FBOs replaced by a resize are pooled
+    QOpenGLFramebufferObject *fbo = penLayer.framebufferObject();
+    resize(250, 190);
+    ASSERT_EQ(penLayer.pooledFboMemory(), 480 * 360 * 8);
+
+    // The pooled FBO is reused when the pen layer grows back to the same size
+    resize(480, 360);
+    ASSERT_EQ(penLayer.framebufferObject(), fbo);
+    ASSERT_EQ(penLayer.pooledFboMemory(), 250 * 190 * 8);
+
+    // FBOs are matched by exact size (the 250x190 FBO stays in the pool)
+    resize(240, 180);
+    ASSERT_EQ(penLayer.pooledFboMemory(), 250 * 190 * 8 + 480 * 360 * 8);
+    resize(230, 170);
+    ASSERT_EQ(penLayer.pooledFboMemory(), 250 * 190 * 8 + 480 * 360 * 8 + 240 * 180 * 8);
+
+    // FBOs which don't fit into the budget aren't pooled
+    resize(2100, 2000);
+    ASSERT_EQ(penLayer.pooledFboMemory(), 250 * 190 * 8 + 480 * 360 * 8 + 240 * 180 * 8 + 230 * 170 * 8);
+    resize(480, 360);
+    ASSERT_EQ(penLayer.pooledFboMemory(), 250 * 190 * 8 + 240 * 180 * 8 + 230 * 170 * 8);
+
+    // The least recently pooled FBOs are freed when the pool exceeds the budget
+    resize(1500, 1500);
+    resize(1400, 1400);
+    resize(480, 360);
+    ASSERT_EQ(penLayer.pooledFboMemory(), 1400 * 1400 * 8);
+}
+
 TEST_F(PenLayerTest, GetProjectPenLayer)
 {
     PenLayer penLayer;
@@ -294,7 +387,7 @@ TEST_F(PenLayerTest, DrawPoint)
     }
 
     // Test HQ pen - resize existing texture
-    EXPECT_CALL(engine, stageWidth()).Times(3).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageWidth()).Times(2).WillRepeatedly(Return(480));
     penLayer.setHqPen(true);
     penLayer.setWidth(720);
     penLayer.setHeight(540);
@@ -627,3 +720,798 @@ TEST_F(PenLayerTest, TextureData)
 
     penLayer.endFrame();
 }
+
+TEST_F(PenLayerTest, TiledColorQueries)
+{
+    PenLayer penLayer;
+    penLayer.setWidth(480);
+    penLayer.setHeight(360);
+    penLayer.setAntialiasingEnabled(false);
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    penLayer.setEngine(&engine);
+
+    penLayer.beginFrame();
+
+    PenAttributes attr;
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 4;
+    penLayer.drawPoint(attr, -200, 150);
+    ASSERT_EQ(penLayer.colorAtScratchPoint(-200, 150), qRgb(255, 0, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(200, -150), 0);
+
+    // Draw into a distant tile
+    attr.color = QNanoColor(0, 0, 255);
+    penLayer.drawPoint(attr, 200, -150);
+    ASSERT_EQ(penLayer.colorAtScratchPoint(-200, 150), qRgb(255, 0, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(200, -150), qRgb(0, 0, 255));
+
+    // Draw across a tile border
+    attr.color = QNanoColor(0, 255, 0);
+    penLayer.drawLine(attr, -200, 150, 200, 150);
+    ASSERT_EQ(penLayer.colorAtScratchPoint(-100, 150), qRgb(0, 255, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(100, 150), qRgb(0, 255, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(200, -150), qRgb(0, 0, 255));
+
+    penLayer.clear();
+    ASSERT_EQ(penLayer.colorAtScratchPoint(-100, 150), 0);
+    ASSERT_EQ(penLayer.colorAtScratchPoint(200, -150), 0);
+
+    penLayer.endFrame();
+}
+
+TEST_F(PenLayerTest, BatchedColorQueries)
+{
+    for (bool shadowRaster : { false, true }) {
+        for (bool hqPen : { false, true }) {
+            PenLayer penLayer;
+            penLayer.setShadowRaster(shadowRaster);
+            penLayer.setHqPen(hqPen);
+            penLayer.setWidth(hqPen ? 720 : 480);
+            penLayer.setHeight(hqPen ? 540 : 360);
+            penLayer.setAntialiasingEnabled(false);
+            EngineMock engine;
+            EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+            EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+            penLayer.setEngine(&engine);
+
+            penLayer.beginFrame();
+
+            PenAttributes attr;
+            attr.color = QNanoColor(255, 0, 0);
+            attr.diameter = 5;
+            penLayer.drawLine(attr, -190, 90, -150, 115);
+
+            attr.color = QNanoColor(0, 0, 255, 128);
+            penLayer.drawLine(attr, -175, 120, -160, 80);
+
+            // The rectangle crosses tile borders and the stage border
+            const QRect rect(QPoint(-245, 70), QPoint(-140, 130));
+            std::vector<QRgb> colors(rect.width() * rect.height());
+            penLayer.colorsAtScratchRect(rect, colors.data());
+
+            std::vector<QPointF> points;
+            std::vector<QRgb> expected;
+
+            for (int y = rect.top(); y <= rect.bottom(); y++) {
+                for (int x = rect.left(); x <= rect.right(); x++) {
+                    points.push_back(QPointF(x, y));
+                    expected.push_back(penLayer.colorAtScratchPoint(x, y));
+                }
+            }
+
+            ASSERT_EQ(colors, expected);
+            ASSERT_EQ(colors[(100 - rect.top()) * rect.width() + (-174 - rect.left())], qRgb(255, 0, 0));
+
+            std::vector<QRgb> pointColors(points.size());
+            penLayer.colorsAtScratchPoints(points, pointColors.data());
+            ASSERT_EQ(pointColors, expected);
+
+            // Outside the stage
+            colors.assign(4, qRgb(1, 2, 3));
+            penLayer.colorsAtScratchRect(QRect(300, 0, 2, 2), colors.data());
+            ASSERT_EQ(colors, std::vector<QRgb>(4, qRgba(0, 0, 0, 0)));
+
+            penLayer.endFrame();
+        }
+    }
+}
+
+TEST_F(PenLayerTest, ShadowRaster)
+{
+    PenLayer penLayer;
+    ASSERT_FALSE(penLayer.shadowRaster());
+    QSignalSpy spy(&penLayer, &PenLayer::shadowRasterChanged);
+    penLayer.setShadowRaster(true);
+    ASSERT_TRUE(penLayer.shadowRaster());
+    ASSERT_EQ(spy.count(), 1);
+    penLayer.setShadowRaster(true);
+    ASSERT_EQ(spy.count(), 1);
+
+    penLayer.setWidth(480);
+    penLayer.setHeight(360);
+    penLayer.setAntialiasingEnabled(false);
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    penLayer.setEngine(&engine);
+
+    penLayer.beginFrame();
+
+    PenAttributes attr;
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 6;
+    penLayer.drawLine(attr, -100, 50, 100, 50);
+    ASSERT_EQ(penLayer.colorAtScratchPoint(0, 50), qRgb(255, 0, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(0, 0), 0);
+
+    Rect bounds = penLayer.getBounds();
+    ASSERT_EQ(bounds.top(), 53);
+    ASSERT_EQ(bounds.bottom(), 47);
+
+    // Disable and enable the raster again (it's copied from the FBO)
+    penLayer.setShadowRaster(false);
+    ASSERT_EQ(spy.count(), 2);
+    penLayer.setShadowRaster(true);
+    attr.color = QNanoColor(0, 0, 255);
+    penLayer.drawPoint(attr, 0, 0);
+    ASSERT_EQ(penLayer.colorAtScratchPoint(0, 50), qRgb(255, 0, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(0, 0), qRgb(0, 0, 255));
+
+    penLayer.clear();
+    ASSERT_EQ(penLayer.colorAtScratchPoint(0, 50), 0);
+    ASSERT_EQ(penLayer.colorAtScratchPoint(0, 0), 0);
+
+    bounds = penLayer.getBounds();
+    ASSERT_EQ(bounds.left(), 0);
+    ASSERT_EQ(bounds.top(), 0);
+    ASSERT_EQ(bounds.right(), 0);
+    ASSERT_EQ(bounds.bottom(), 0);
+
+    penLayer.endFrame();
+}
+
+TEST_F(PenLayerTest, FastBounds)
+{
+    PenLayer penLayer;
+    penLayer.setWidth(480);
+    penLayer.setHeight(360);
+    penLayer.setAntialiasingEnabled(false);
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    penLayer.setEngine(&engine);
+
+    Rect bounds = penLayer.getFastBounds();
+    ASSERT_EQ(bounds.left(), 0);
+    ASSERT_EQ(bounds.top(), 0);
+    ASSERT_EQ(bounds.right(), 0);
+    ASSERT_EQ(bounds.bottom(), 0);
+
+    penLayer.beginFrame();
+
+    PenAttributes attr;
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 1;
+    penLayer.drawLine(attr, -3, 2, 3, -2);
+    bounds = penLayer.getFastBounds();
+    ASSERT_EQ(bounds.left(), -4.5);
+    ASSERT_EQ(bounds.top(), 3.5);
+    ASSERT_EQ(bounds.right(), 4.5);
+    ASSERT_EQ(bounds.bottom(), -3.5);
+
+    // The bounds grow and are limited to the stage
+    attr.diameter = 10;
+    penLayer.drawPoint(attr, 239, 0);
+    bounds = penLayer.getFastBounds();
+    ASSERT_EQ(bounds.left(), -4.5);
+    ASSERT_EQ(bounds.top(), 6);
+    ASSERT_EQ(bounds.right(), 240);
+    ASSERT_EQ(bounds.bottom(), -6);
+
+    // Exact bounds tighten the fast bounds
+    const Rect &exactBounds = penLayer.getBounds();
+    bounds = penLayer.getFastBounds();
+    ASSERT_EQ(bounds.left(), exactBounds.left());
+    ASSERT_EQ(bounds.top(), exactBounds.top());
+    ASSERT_EQ(bounds.right(), exactBounds.right());
+    ASSERT_EQ(bounds.bottom(), exactBounds.bottom());
+
+    penLayer.clear();
+    bounds = penLayer.getFastBounds();
+    ASSERT_EQ(bounds.left(), 0);
+    ASSERT_EQ(bounds.top(), 0);
+    ASSERT_EQ(bounds.right(), 0);
+    ASSERT_EQ(bounds.bottom(), 0);
+
+    penLayer.endFrame();
+}
+
+TEST_F(PenLayerTest, BatchedLines)
+{
+    PenLayer penLayer;
+    penLayer.setWidth(480);
+    penLayer.setHeight(360);
+    penLayer.setAntialiasingEnabled(false);
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    penLayer.setEngine(&engine);
+
+    penLayer.beginFrame();
+
+    // Lines with the same attributes
+    PenAttributes attr;
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 4;
+
+    for (int i = 0; i < 10; i++)
+        penLayer.drawLine(attr, -100, i * 10, 100, i * 10);
+
+    // Draw order is kept
+    attr.color = QNanoColor(0, 0, 255);
+    penLayer.drawLine(attr, 0, -10, 0, 100);
+
+    attr.color = QNanoColor(255, 0, 0);
+    penLayer.drawLine(attr, 50, -10, 50, 100);
+
+    ASSERT_EQ(penLayer.colorAtScratchPoint(-50, 0), qRgb(255, 0, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(-50, 90), qRgb(255, 0, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(0, 50), qRgb(0, 0, 255));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(50, 50), qRgb(255, 0, 0));
+
+    // Overlapping translucent points are blended twice
+    attr.color = QNanoColor(0, 128, 0, 128);
+    attr.diameter = 10;
+    penLayer.drawPoint(attr, -150, -100);
+    penLayer.drawPoint(attr, -150, -100);
+    ASSERT_EQ(penLayer.colorAtScratchPoint(-150, -100), qRgba(0, 96, 0, 192));
+
+    penLayer.endFrame();
+}
+
+TEST_F(PenLayerTest, InstancedPen)
+{
+    PenLayer penLayer;
+    QSignalSpy spy(&penLayer, &PenLayer::instancedPenChanged);
+    ASSERT_FALSE(penLayer.instancedPen());
+
+    penLayer.setInstancedPen(true);
+    ASSERT_TRUE(penLayer.instancedPen());
+    ASSERT_EQ(spy.count(), 1);
+
+    penLayer.setInstancedPen(true);
+    ASSERT_EQ(spy.count(), 1);
+
+    penLayer.setAntialiasingEnabled(false);
+    penLayer.setWidth(480);
+    penLayer.setHeight(360);
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    penLayer.setEngine(&engine);
+
+    // Points
+    penLayer.beginFrame();
+    PenAttributes attr;
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 3;
+
+    penLayer.drawPoint(attr, 63, 164);
+    penLayer.drawPoint(attr, -56, 93);
+    penLayer.drawPoint(attr, 130, 77);
+
+    attr.color = QNanoColor(0, 128, 0, 128);
+    attr.diameter = 10;
+
+    penLayer.drawPoint(attr, 152, -158);
+    penLayer.drawPoint(attr, -228, 145);
+    penLayer.drawPoint(attr, -100, 139);
+
+    attr.color = QNanoColor(255, 50, 200, 185);
+    attr.diameter = 25.6;
+
+    penLayer.drawPoint(attr, -11, 179);
+    penLayer.drawPoint(attr, 90, -48);
+    penLayer.drawPoint(attr, -54, 21);
+    penLayer.endFrame();
+
+    {
+        QOpenGLFramebufferObject *fbo = penLayer.framebufferObject();
+        QImage image = fbo->toImage();
+        QImage ref("points.png");
+        ASSERT_LE(fuzzyCompareImages(image, ref), 0.01);
+    }
+
+    // Lines
+    penLayer.beginFrame();
+    penLayer.clear();
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 3;
+
+    penLayer.drawLine(attr, 63, 164, -56, 93);
+    penLayer.drawLine(attr, 130, 77, 125, -22);
+
+    attr.color = QNanoColor(0, 128, 0, 128);
+    attr.diameter = 225;
+
+    penLayer.drawLine(attr, -225, 25, -175, -25);
+
+    attr.diameter = 10;
+    penLayer.drawLine(attr, -100, 139, 20, 72);
+
+    attr.color = QNanoColor(255, 50, 200, 185);
+    attr.diameter = 25.6;
+
+    penLayer.drawLine(attr, -11, 179, 90, -48);
+    penLayer.drawLine(attr, -54, 21, 88, -6);
+    penLayer.endFrame();
+
+    {
+        QOpenGLFramebufferObject *fbo = penLayer.framebufferObject();
+        QImage image = fbo->toImage().scaled(240, 180);
+        QImage ref("lines.png");
+        ASSERT_LE(fuzzyCompareImages(image, ref), 0.05);
+    }
+}
+
+TEST_F(PenLayerTest, Polylines)
+{
+    PenLayer penLayer;
+    penLayer.setWidth(480);
+    penLayer.setHeight(360);
+    penLayer.setAntialiasingEnabled(false);
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    penLayer.setEngine(&engine);
+
+    penLayer.beginFrame();
+
+    // Connected opaque lines cover their joints
+    PenAttributes attr;
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 4;
+    penLayer.drawLine(attr, -100, 0, -50, 0);
+    penLayer.drawLine(attr, -50, 0, -50, 50);
+    penLayer.drawLine(attr, -50, 50, 0, 50);
+    ASSERT_EQ(penLayer.colorAtScratchPoint(-75, 0), qRgb(255, 0, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(-50, 0), qRgb(255, 0, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(-50, 25), qRgb(255, 0, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(-25, 50), qRgb(255, 0, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(-25, 25), 0);
+
+    // Translucent lines are still blended at the joints
+    attr.color = QNanoColor(0, 128, 0, 128);
+    penLayer.drawLine(attr, 50, -100, 100, -100);
+    penLayer.drawLine(attr, 100, -100, 150, -100);
+    ASSERT_EQ(penLayer.colorAtScratchPoint(75, -100), qRgba(0, 64, 0, 128));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(100, -100), qRgba(0, 96, 0, 192));
+
+    penLayer.endFrame();
+}
+
+TEST_F(PenLayerTest, AntialiasedPolylines)
+{
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+
+    PenLayer penLayer, refLayer;
+
+    for (PenLayer *layer : { &penLayer, &refLayer }) {
+        layer->setWidth(480);
+        layer->setHeight(360);
+        layer->setAntialiasingEnabled(true);
+        layer->setEngine(&engine);
+    }
+
+    PenAttributes attr;
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 7.5;
+    const std::vector<std::array<double, 4>> lines = { { -100, 0, -50, 20 }, { -50, 20, -20, 70 }, { -20, 70, 60, 40 }, { 60, 40, 10, -30 } };
+
+    // Lines in a single frame
+    penLayer.beginFrame();
+
+    for (const auto &line : lines)
+        penLayer.drawLine(attr, line[0], line[1], line[2], line[3]);
+
+    penLayer.endFrame();
+
+    // Each line in its own frame (never in the same path)
+    for (const auto &line : lines) {
+        refLayer.beginFrame();
+        refLayer.drawLine(attr, line[0], line[1], line[2], line[3]);
+        refLayer.endFrame();
+    }
+
+    // Antialiased joints match the separately drawn lines
+    const QImage image = penLayer.framebufferObject()->toImage();
+    const QImage ref = refLayer.framebufferObject()->toImage();
+    ASSERT_EQ(image, ref);
+}
+
+TEST_F(PenLayerTest, OffStageLines)
+{
+    PenLayer penLayer;
+    penLayer.setWidth(480);
+    penLayer.setHeight(360);
+    penLayer.setAntialiasingEnabled(false);
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    penLayer.setEngine(&engine);
+
+    penLayer.beginFrame();
+
+    PenAttributes attr;
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 10;
+    penLayer.drawLine(attr, -300, 0, -260, 100);
+    penLayer.drawLine(attr, 0, 200, 100, 300);
+    penLayer.drawPoint(attr, 250, -190);
+
+    // Lines outside the stage are skipped
+    Rect bounds = penLayer.getFastBounds();
+    ASSERT_EQ(bounds.left(), 0);
+    ASSERT_EQ(bounds.top(), 0);
+    ASSERT_EQ(bounds.right(), 0);
+    ASSERT_EQ(bounds.bottom(), 0);
+
+    // Lines which reach the stage with their width are kept
+    penLayer.drawPoint(attr, 243, 0);
+    ASSERT_EQ(penLayer.colorAtScratchPoint(239, 0), qRgb(255, 0, 0));
+
+    bounds = penLayer.getFastBounds();
+    ASSERT_EQ(bounds.right(), 240);
+
+    penLayer.endFrame();
+}
+
+TEST_F(PenLayerTest, BatchedStamps)
+{
+    static const std::chrono::milliseconds timeout(5000);
+    auto startTime = std::chrono::steady_clock::now();
+
+    ProjectLoader loader;
+    loader.setFileName("stamp_env.sb3");
+
+    while (loader.loadStatus() != ProjectLoader::LoadStatus::Loaded)
+        ASSERT_LE(std::chrono::steady_clock::now(), startTime + timeout);
+
+    SpriteModel *sprite = loader.spriteList().front();
+    RenderedTarget target;
+    target.setSpriteModel(sprite);
+    target.setEngine(loader.engine());
+    target.loadCostumes();
+    target.updateCostume(sprite->sprite()->currentCostume().get());
+    target.setGraphicEffect(ShaderManager::Effect::Ghost, 30);
+    sprite->setRenderedTarget(&target);
+
+    auto stampAll = [&target](PenLayer &penLayer, bool flush) {
+        penLayer.beginFrame();
+
+        for (int i = 0; i < 5; i++) {
+            target.updateX(-150 + i * 60);
+            target.updateY(-100 + i * 40);
+            target.setGraphicEffect(ShaderManager::Effect::Ghost, i * 15);
+            penLayer.stamp(&target);
+
+            if (flush) {
+                penLayer.endFrame();
+                penLayer.beginFrame();
+            }
+        }
+
+        penLayer.endFrame();
+    };
+
+    // Stamps of the same target are drawn at once, the result must be the same as when they're drawn separately
+    auto init = [](PenLayer &penLayer, EngineMock &engine) {
+        penLayer.setWidth(480);
+        penLayer.setHeight(360);
+        EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+        EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+        penLayer.setEngine(&engine);
+    };
+
+    PenLayer batched, separate;
+    EngineMock engine1, engine2;
+    init(batched, engine1);
+    init(separate, engine2);
+
+    stampAll(batched, false);
+    stampAll(separate, true);
+
+    ASSERT_GT(batched.getBounds().width(), 0);
+    ASSERT_EQ(batched.framebufferObject()->toImage(), separate.framebufferObject()->toImage());
+}
+
+TEST_F(PenLayerTest, DirtyRect)
+{
+    PenLayer penLayer;
+    penLayer.setWidth(480);
+    penLayer.setHeight(360);
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    penLayer.setEngine(&engine);
+
+    // The whole FBO is dirty after it's created and cleared
+    ASSERT_EQ(penLayer.takeDirtyRect(), QRect(0, 0, 480, 360));
+    ASSERT_TRUE(penLayer.takeDirtyRect().isNull());
+
+    penLayer.beginFrame();
+
+    PenAttributes attr;
+    attr.diameter = 4;
+    penLayer.drawLine(attr, -100, 50, -50, 20);
+    penLayer.drawPoint(attr, 10, -10);
+
+    // FBO coordinates with a margin of (diameter / 2 + 1)
+    ASSERT_EQ(penLayer.takeDirtyRect(), QRect(QPoint(137, 127), QPoint(252, 192)));
+    ASSERT_TRUE(penLayer.takeDirtyRect().isNull());
+
+    penLayer.clear();
+    ASSERT_EQ(penLayer.takeDirtyRect(), QRect(0, 0, 480, 360));
+
+    penLayer.endFrame();
+}
+
+TEST_F(PenLayerTest, PendingCommands)
+{
+    PenLayer penLayer;
+    penLayer.setAntialiasingEnabled(false);
+    EngineMock engine;
+    penLayer.setWidth(480);
+    penLayer.setHeight(360);
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    penLayer.setEngine(&engine);
+
+    PenAttributes attr;
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 3;
+
+    auto fboPixel = [&penLayer](int x, int y) { return penLayer.framebufferObject()->toImage().pixel(x, y); };
+
+    penLayer.beginFrame();
+    penLayer.drawLine(attr, -200, 150, -180, 150);
+
+    // Reading other parts of the pen layer doesn't render the line
+    ASSERT_EQ(penLayer.colorAtScratchPoint(200, -150), qRgba(0, 0, 0, 0));
+    penLayer.flush(QRectF(100, -160, 120, 50));
+    ASSERT_EQ(fboPixel(45, 30), qRgba(0, 0, 0, 0));
+
+    // The line is rendered when it's read
+    ASSERT_EQ(penLayer.colorAtScratchPoint(-190, 150), qRgb(255, 0, 0));
+    ASSERT_EQ(fboPixel(45, 30), qRgb(255, 0, 0));
+
+    penLayer.drawLine(attr, 180, -150, 200, -150);
+    penLayer.flush(QRectF(150, -160, 100, 20));
+    ASSERT_EQ(fboPixel(430, 330), qRgb(255, 0, 0));
+    ASSERT_TRUE(penLayer.framebufferObject()->isBound());
+
+    penLayer.endFrame();
+}
+
+TEST_F(PenLayerTest, ResolutionPolicy)
+{
+    PenLayer penLayer;
+    penLayer.setAntialiasingEnabled(false);
+    penLayer.setHqPen(true);
+    penLayer.setWidth(960);
+    penLayer.setHeight(720);
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    penLayer.setEngine(&engine);
+
+    ASSERT_EQ(penLayer.maxScale(), 0);
+    ASSERT_EQ(penLayer.memoryBudget(), 0);
+    ASSERT_EQ(penLayer.targetFrameTime(), 0);
+    ASSERT_EQ(penLayer.penScale(), 2);
+    ASSERT_EQ(penLayer.framebufferObject()->size(), QSize(960, 720));
+
+    PenAttributes attr;
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 10;
+
+    penLayer.beginFrame();
+    penLayer.drawLine(attr, -100, 50, 100, 50);
+    penLayer.endFrame();
+
+    // Maximum scale
+    QSignalSpy maxScaleSpy(&penLayer, &PenLayer::maxScaleChanged);
+    penLayer.setMaxScale(1.5);
+    ASSERT_EQ(penLayer.maxScale(), 1.5);
+    ASSERT_EQ(maxScaleSpy.count(), 1);
+
+    // The resolution changes at the next frame
+    ASSERT_EQ(penLayer.penScale(), 2);
+    ASSERT_EQ(penLayer.framebufferObject()->size(), QSize(960, 720));
+    penLayer.beginFrame();
+    penLayer.endFrame();
+    ASSERT_EQ(penLayer.penScale(), 1.5);
+    ASSERT_EQ(penLayer.framebufferObject()->size(), QSize(720, 540));
+
+    // The lines are kept
+    ASSERT_EQ(penLayer.colorAtScratchPoint(0, 50), qRgb(255, 0, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(0, 0), qRgba(0, 0, 0, 0));
+
+    // Memory budget (lines queued before a refresh in the middle of a frame are rendered at the old scale)
+    QSignalSpy memoryBudgetSpy(&penLayer, &PenLayer::memoryBudgetChanged);
+    penLayer.beginFrame();
+    penLayer.drawLine(attr, -100, -50, 100, -50);
+    penLayer.setMemoryBudget(480 * 360 * PenResolutionPolicy::BYTES_PER_PIXEL);
+    ASSERT_EQ(penLayer.memoryBudget(), 480 * 360 * PenResolutionPolicy::BYTES_PER_PIXEL);
+    ASSERT_EQ(memoryBudgetSpy.count(), 1);
+    penLayer.refresh();
+    penLayer.endFrame();
+    ASSERT_EQ(penLayer.penScale(), 1);
+    ASSERT_EQ(penLayer.framebufferObject()->size(), QSize(480, 360));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(0, 50), qRgb(255, 0, 0));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(0, -50), qRgb(255, 0, 0));
+
+    // Target frame time
+    QSignalSpy targetFrameTimeSpy(&penLayer, &PenLayer::targetFrameTimeChanged);
+    penLayer.setTargetFrameTime(40);
+    ASSERT_EQ(penLayer.targetFrameTime(), 40);
+    ASSERT_EQ(targetFrameTimeSpy.count(), 1);
+
+    // Full resolution
+    penLayer.setMaxScale(0);
+    penLayer.setMemoryBudget(0);
+    penLayer.beginFrame();
+    penLayer.endFrame();
+    ASSERT_EQ(penLayer.penScale(), 2);
+    ASSERT_EQ(penLayer.framebufferObject()->size(), QSize(960, 720));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(0, 50), qRgb(255, 0, 0));
+}
+
+TEST_F(PenLayerTest, TargetFrameTime)
+{
+    PenLayer penLayer;
+    penLayer.setAntialiasingEnabled(false);
+    penLayer.setHqPen(true);
+    penLayer.setWidth(960);
+    penLayer.setHeight(720);
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    penLayer.setEngine(&engine);
+    penLayer.setTargetFrameTime(10);
+
+    PenAttributes attr;
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 10;
+
+    auto frame = [&penLayer, &attr](int drawTime) {
+        penLayer.beginFrame();
+        penLayer.drawLine(attr, -100, 50, 100, 50);
+
+        if (drawTime > 0)
+            QThread::msleep(drawTime);
+
+        penLayer.endFrame();
+    };
+
+    // Cheap frames don't lower the resolution even if the time between them is longer than the target
+    for (int i = 0; i < 90; i++) {
+        frame(0);
+        QThread::msleep(15);
+    }
+
+    ASSERT_EQ(penLayer.penScale(), 2);
+    ASSERT_EQ(penLayer.framebufferObject()->size(), QSize(960, 720));
+
+    // Slow frames lower it
+    for (int i = 0; i < 31; i++)
+        frame(20);
+
+    ASSERT_LT(penLayer.penScale(), 2);
+    ASSERT_LT(penLayer.framebufferObject()->width(), 960);
+
+    // The time spent by the painter counts too
+    const double scale = penLayer.penScale();
+
+    for (int i = 0; i < 31; i++) {
+        frame(0);
+        penLayer.addPaintTime(20);
+    }
+
+    ASSERT_LT(penLayer.penScale(), scale);
+
+    // The resolution goes back up once the frames are fast again
+    for (int i = 0; i < 500 && penLayer.penScale() < 2; i++)
+        frame(0);
+
+    ASSERT_EQ(penLayer.penScale(), 2);
+    ASSERT_EQ(penLayer.framebufferObject()->size(), QSize(960, 720));
+    ASSERT_EQ(penLayer.colorAtScratchPoint(0, 50), qRgb(255, 0, 0));
+}
+
+TEST_F(PenLayerTest, SparsePen)
+{
+    PenLayer sparse, full;
+    EngineMock engine1, engine2;
+    ASSERT_FALSE(sparse.sparsePen());
+    QSignalSpy spy(&sparse, &PenLayer::sparsePenChanged);
+    sparse.setSparsePen(true);
+    ASSERT_TRUE(sparse.sparsePen());
+    ASSERT_EQ(spy.count(), 1);
+
+    for (auto [penLayer, engine] : { std::make_pair(&sparse, &engine1), std::make_pair(&full, &engine2) }) {
+        penLayer->setWidth(960);
+        penLayer->setHeight(720);
+        EXPECT_CALL(*engine, stageWidth()).WillRepeatedly(Return(960));
+        EXPECT_CALL(*engine, stageHeight()).WillRepeatedly(Return(720));
+        penLayer->setEngine(engine);
+    }
+
+    // Nothing is allocated until something is drawn
+    ASSERT_EQ(sparse.framebufferObject()->size(), QSize(1, 1));
+    ASSERT_EQ(full.framebufferObject()->size(), QSize(960, 720));
+    ASSERT_EQ(full.framebufferRect(), QRectF(0, 0, 1, 1));
+
+    PenAttributes attr;
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 6;
+
+    auto draw = [&attr](PenLayer &penLayer, double x0, double y0, double x1, double y1) {
+        penLayer.beginFrame();
+        penLayer.drawLine(attr, x0, y0, x1, y1);
+        penLayer.endFrame();
+    };
+
+    // Only the tiles which are drawn into are allocated
+    draw(sparse, -470, 350, -400, 300);
+    draw(full, -470, 350, -400, 300);
+    ASSERT_EQ(sparse.framebufferObject()->size(), QSize(256, 256));
+    ASSERT_EQ(sparse.pooledFboMemory(), 1 * 1 * 8);
+    ASSERT_EQ(sparse.framebufferRect(), QRectF(0, 0, 256 / 960.0, 256 / 720.0));
+    ASSERT_EQ(sparse.colorAtScratchPoint(-470, 350), full.colorAtScratchPoint(-470, 350));
+    ASSERT_EQ(sparse.colorAtScratchPoint(0, 0), qRgba(0, 0, 0, 0));
+
+    draw(sparse, 200, -200, 200, -200);
+    draw(full, 200, -200, 200, -200);
+    ASSERT_EQ(sparse.framebufferObject()->size(), QSize(768, 720));
+    ASSERT_EQ(sparse.pooledFboMemory(), 1 * 1 * 8 + 256 * 256 * 8);
+    ASSERT_EQ(full.framebufferObject()->toImage().copy(0, 0, 768, 720), sparse.framebufferObject()->toImage());
+    ASSERT_EQ(sparse.colorAtScratchPoint(-470, 350), full.colorAtScratchPoint(-470, 350));
+    ASSERT_EQ(sparse.colorAtScratchPoint(200, -200), full.colorAtScratchPoint(200, -200));
+
+    // The bounds are the same
+    const Rect &bounds = sparse.getBounds();
+    const Rect &fullBounds = full.getBounds();
+    ASSERT_EQ(bounds.left(), fullBounds.left());
+    ASSERT_EQ(bounds.top(), fullBounds.top());
+    ASSERT_EQ(bounds.right(), fullBounds.right());
+    ASSERT_EQ(bounds.bottom(), fullBounds.bottom());
+
+    // The tiles are freed when the pen layer is cleared
+    QOpenGLFramebufferObject *fbo = sparse.framebufferObject();
+    sparse.beginFrame();
+    sparse.clear();
+    sparse.endFrame();
+    ASSERT_EQ(sparse.framebufferObject()->size(), QSize(1, 1));
+
+    // The replaced FBOs are kept in the pool
+    ASSERT_EQ(sparse.pooledFboMemory(), 256 * 256 * 8 + 768 * 720 * 8);
+
+    // The FBO grows once per flush (the 256x208 FBO needed by the first line alone isn't allocated)
+    sparse.beginFrame();
+    sparse.drawLine(attr, 200, -200, 200, -200);
+    sparse.drawLine(attr, -470, 350, -400, 300);
+    sparse.endFrame();
+    ASSERT_EQ(sparse.framebufferObject(), fbo);
+    ASSERT_EQ(sparse.pooledFboMemory(), 256 * 256 * 8 + 1 * 1 * 8);
+    ASSERT_EQ(full.framebufferObject()->toImage().copy(0, 0, 768, 720), sparse.framebufferObject()->toImage());
+
+    // Disabling sparse pen allocates the whole pen layer
+    sparse.setSparsePen(false);
+    ASSERT_EQ(spy.count(), 2);
+    ASSERT_EQ(sparse.framebufferObject()->size(), QSize(960, 720));
+}
@@ -0,0 +1,120 @@
+#include <penraster.h>
+#include <renderedtargetmock.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+using namespace libscratchcpp;
+
+using ::testing::Return;
+using ::testing::_;
+
+// Converts Scratch coordinates to the coordinate system of a 480x360 pen layer
+static void drawLine(PenRaster &raster, const QNanoColor &color, double diameter, double x0, double y0, double x1, double y1)
+{
+    raster.drawLine(x0 + 240, 180 - y0, x1 + 240, 180 - y1, diameter, color, false);
+}
+
+TEST(PenRasterTest, Resize)
+{
+    PenRaster raster;
+    ASSERT_TRUE(raster.image().isNull());
+    ASSERT_EQ(raster.pixel(0, 0), 0);
+
+    raster.resize(QSize(4, 2));
+    ASSERT_EQ(raster.image().size(), QSize(4, 2));
+    ASSERT_EQ(raster.pixel(3, 1), 0);
+    ASSERT_TRUE(raster.opaqueRect().isNull());
+
+    QImage image(4, 2, QImage::Format_ARGB32);
+    image.fill(Qt::transparent);
+    image.setPixel(1, 0, qRgb(255, 0, 0));
+    raster.setImage(image);
+    raster.resize(QSize(8, 4));
+    ASSERT_EQ(raster.pixel(2, 0), qRgb(255, 0, 0));
+    ASSERT_EQ(raster.pixel(3, 1), qRgb(255, 0, 0));
+    ASSERT_EQ(raster.pixel(4, 0), 0);
+    ASSERT_EQ(raster.opaqueRect(), QRect(2, 0, 2, 2));
+
+    raster.clear();
+    ASSERT_EQ(raster.pixel(2, 0), 0);
+    ASSERT_TRUE(raster.opaqueRect().isNull());
+}
+
+TEST(PenRasterTest, DrawPoint)
+{
+    PenRaster raster;
+    raster.resize(QSize(480, 360));
+
+    QNanoColor color(255, 0, 0);
+    drawLine(raster, color, 3, 63, 164, 63, 164);
+    drawLine(raster, color, 3, -56, 93, -56, 93);
+    drawLine(raster, color, 3, 130, 77, 130, 77);
+
+    color = QNanoColor(0, 128, 0, 128);
+    drawLine(raster, color, 10, 152, -158, 152, -158);
+    drawLine(raster, color, 10, -228, 145, -228, 145);
+    drawLine(raster, color, 10, -100, 139, -100, 139);
+
+    color = QNanoColor(255, 50, 200, 185);
+    drawLine(raster, color, 25.6, -11, 179, -11, 179);
+    drawLine(raster, color, 25.6, 90, -48, 90, -48);
+    drawLine(raster, color, 25.6, -54, 21, -54, 21);
+
+    ASSERT_EQ(raster.pixel(63 + 240, 180 - 164), qRgb(255, 0, 0));
+
+    QImage ref("points.png");
+    ASSERT_LE(fuzzyCompareImages(raster.image(), ref), 0.01);
+}
+
+TEST(PenRasterTest, DrawLine)
+{
+    PenRaster raster;
+    raster.resize(QSize(480, 360));
+
+    QNanoColor color(255, 0, 0);
+    drawLine(raster, color, 3, 63, 164, -56, 93);
+    drawLine(raster, color, 3, 130, 77, 125, -22);
+
+    color = QNanoColor(0, 128, 0, 128);
+    drawLine(raster, color, 225, -225, 25, -175, -25);
+    drawLine(raster, color, 10, -100, 139, 20, 72);
+
+    color = QNanoColor(255, 50, 200, 185);
+    drawLine(raster, color, 25.6, -11, 179, 90, -48);
+    drawLine(raster, color, 25.6, -54, 21, 88, -6);
+
+    QImage ref("lines.png");
+    ASSERT_LE(fuzzyCompareImages(raster.image().scaled(240, 180), ref), 0.05);
+}
+
+TEST(PenRasterTest, Stamp)
+{
+    PenRaster raster;
+    raster.resize(QSize(10, 10));
+    RenderedTargetMock target;
+
+    // Scale 1: the target covers pixels [3, 7) in both directions
+    EXPECT_CALL(target, getFastBounds()).WillOnce(Return(Rect(-2, 2, 2, -2)));
+    EXPECT_CALL(target, colorAtScratchPoint(_, _)).Times(16).WillRepeatedly(Return(qRgba(0, 64, 0, 128)));
+    raster.stamp(&target, 1);
+    ASSERT_EQ(raster.pixel(2, 5), 0);
+    ASSERT_EQ(raster.pixel(3, 3), qRgba(0, 64, 0, 128));
+    ASSERT_EQ(raster.pixel(6, 6), qRgba(0, 64, 0, 128));
+    ASSERT_EQ(raster.pixel(7, 6), 0);
+    ASSERT_EQ(raster.opaqueRect(), QRect(3, 3, 4, 4));
+
+    // Blend with the previous stamp
+    EXPECT_CALL(target, getFastBounds()).WillOnce(Return(Rect(-2, 2, 2, -2)));
+    EXPECT_CALL(target, colorAtScratchPoint(_, _)).Times(16).WillRepeatedly(Return(qRgba(0, 64, 0, 128)));
+    raster.stamp(&target, 1);
+    ASSERT_EQ(raster.pixel(5, 5), qRgba(0, 96, 0, 192));
+
+    // Scale 2: pixel centers are sampled in Scratch coordinates
+    raster.clear();
+    EXPECT_CALL(target, getFastBounds()).WillOnce(Return(Rect(0, 0.5, 0.5, 0)));
+    EXPECT_CALL(target, colorAtScratchPoint(0.25, 0.25)).WillOnce(Return(qRgb(255, 0, 0)));
+    raster.stamp(&target, 2);
+    ASSERT_EQ(raster.pixel(5, 4), qRgb(255, 0, 0));
+    ASSERT_EQ(raster.opaqueRect(), QRect(5, 4, 1, 1));
+}
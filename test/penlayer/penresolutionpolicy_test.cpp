@@ -0,0 +1,134 @@
+#include <penresolutionpolicy.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+
+TEST(PenResolutionPolicyTest, Defaults)
+{
+    PenResolutionPolicy policy;
+    ASSERT_EQ(policy.maxScale(), 0);
+    ASSERT_EQ(policy.memoryBudget(), 0);
+    ASSERT_EQ(policy.targetFrameTime(), 0);
+    ASSERT_EQ(policy.frameTimeFactor(), 1);
+
+    ASSERT_EQ(policy.scale(1, QSize(480, 360)), 1);
+    ASSERT_EQ(policy.scale(0.5, QSize(240, 180)), 0.5);
+    ASSERT_EQ(policy.scale(8, QSize(3840, 2880)), 8);
+}
+
+TEST(PenResolutionPolicyTest, MaxScale)
+{
+    PenResolutionPolicy policy;
+    policy.setMaxScale(2);
+    ASSERT_EQ(policy.maxScale(), 2);
+
+    ASSERT_EQ(policy.scale(1.5, QSize(720, 540)), 1.5);
+    ASSERT_EQ(policy.scale(4, QSize(1920, 1440)), 2);
+
+    // The resolution of the stage is always allowed
+    policy.setMaxScale(0.5);
+    ASSERT_EQ(policy.scale(4, QSize(1920, 1440)), 1);
+    ASSERT_EQ(policy.scale(0.75, QSize(360, 270)), 0.75);
+}
+
+TEST(PenResolutionPolicyTest, MemoryBudget)
+{
+    PenResolutionPolicy policy;
+    policy.setMemoryBudget(960 * 720 * PenResolutionPolicy::BYTES_PER_PIXEL);
+    ASSERT_EQ(policy.memoryBudget(), 960 * 720 * PenResolutionPolicy::BYTES_PER_PIXEL);
+
+    ASSERT_EQ(policy.scale(2, QSize(960, 720)), 2);
+    ASSERT_EQ(policy.scale(8, QSize(3840, 2880)), 2);
+    ASSERT_EQ(policy.scale(1.5, QSize(720, 540)), 1.5);
+
+    policy.setMemoryBudget(1000);
+    ASSERT_EQ(policy.scale(8, QSize(3840, 2880)), 1);
+}
+
+TEST(PenResolutionPolicyTest, FrameTime)
+{
+    PenResolutionPolicy policy;
+
+    // Disabled by default
+    for (int i = 0; i < 100; i++)
+        ASSERT_FALSE(policy.addFrameTime(500));
+
+    ASSERT_EQ(policy.frameTimeFactor(), 1);
+
+    policy.setTargetFrameTime(40);
+    ASSERT_EQ(policy.targetFrameTime(), 40);
+
+    // Fast frames
+    for (int i = 0; i < 100; i++)
+        ASSERT_FALSE(policy.addFrameTime(35));
+
+    ASSERT_EQ(policy.frameTimeFactor(), 1);
+
+    // Pauses are ignored
+    for (int i = 0; i < 100; i++)
+        ASSERT_FALSE(policy.addFrameTime(5000));
+
+    ASSERT_EQ(policy.frameTimeFactor(), 1);
+
+    // Slow frames reduce the resolution after a while
+    int i = 0;
+
+    while (!policy.addFrameTime(60))
+        i++;
+
+    ASSERT_GT(i, 0);
+    ASSERT_LT(policy.frameTimeFactor(), 1);
+    ASSERT_LT(policy.scale(4, QSize(1920, 1440)), 4);
+    ASSERT_GE(policy.scale(4, QSize(1920, 1440)), 1);
+
+    // The factor has a minimum
+    for (int i = 0; i < 1000; i++)
+        policy.addFrameTime(60);
+
+    ASSERT_GT(policy.frameTimeFactor(), 0);
+    ASSERT_FALSE(policy.addFrameTime(60));
+
+    // Frames which are only slightly faster than the target don't increase the resolution
+    const double minFactor = policy.frameTimeFactor();
+
+    for (int i = 0; i < 1000; i++)
+        ASSERT_FALSE(policy.addFrameTime(30));
+
+    ASSERT_EQ(policy.frameTimeFactor(), minFactor);
+
+    // Much faster frames increase it after a while
+    i = 0;
+
+    while (!policy.addFrameTime(10))
+        i++;
+
+    ASSERT_GE(i, 60);
+    ASSERT_GT(policy.frameTimeFactor(), minFactor);
+
+    // A slow window in between restarts the counting
+    const double factor = policy.frameTimeFactor();
+
+    for (int i = 0; i < 60; i++)
+        ASSERT_FALSE(policy.addFrameTime(10));
+
+    for (int i = 0; i < 29; i++)
+        ASSERT_FALSE(policy.addFrameTime(100));
+
+    ASSERT_TRUE(policy.addFrameTime(100));
+    ASSERT_LT(policy.frameTimeFactor(), factor);
+
+    // The full resolution is reached again
+    for (int i = 0; i < 1000; i++)
+        policy.addFrameTime(10);
+
+    ASSERT_EQ(policy.frameTimeFactor(), 1);
+
+    for (int i = 0; i < 100; i++)
+        ASSERT_FALSE(policy.addFrameTime(10));
+
+    ASSERT_EQ(policy.frameTimeFactor(), 1);
+
+    policy.reset();
+    ASSERT_EQ(policy.frameTimeFactor(), 1);
+}
@@ -6,6 +6,7 @@
 using namespace scratchcpprender;
 
 using ::testing::Return;
+using ::testing::Gt;
 using ::testing::ReturnRef;
 
 class PenLayerPainterTest : public testing::Test
@@ -63,6 +64,7 @@ TEST_F(PenLayerPainterTest, Paint)
     PenLayerMock penLayer;
 
     EXPECT_CALL(penLayer, framebufferObject()).WillOnce(Return(&refFbo));
+    EXPECT_CALL(penLayer, framebufferRect()).WillOnce(Return(QRectF(0, 0, 1, 1)));
     penLayerPainter.synchronize(&penLayer);
 
     // Paint
@@ -79,3 +81,107 @@ TEST_F(PenLayerPainterTest, Paint)
 
     context.doneCurrent();
 }
+
+TEST_F(PenLayerPainterTest, DirtyRect)
+{
+    QOpenGLContext context;
+    QOffscreenSurface surface;
+    createContextAndSurface(&context, &surface);
+    QOpenGLFunctions glF(&context);
+    glF.initializeOpenGLFunctions();
+    glF.glDisable(GL_SCISSOR_TEST);
+
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+
+    QOpenGLFramebufferObject penFbo(40, 60, format);
+    QOpenGLFramebufferObject fbo(40, 60, format);
+
+    auto fill = [&glF](QOpenGLFramebufferObject &fbo, float r, float g, float b) {
+        fbo.bind();
+        glF.glClearColor(r, g, b, 1.0f);
+        glF.glClear(GL_COLOR_BUFFER_BIT);
+        fbo.release();
+    };
+
+    PenLayerPainter penLayerPainter(&fbo);
+    PenLayerMock penLayer;
+    QNanoPainter painter;
+    EXPECT_CALL(penLayer, framebufferObject()).WillRepeatedly(Return(&penFbo));
+    EXPECT_CALL(penLayer, framebufferRect()).WillRepeatedly(Return(QRectF(0, 0, 1, 1)));
+
+    // The whole FBO is blitted the first time
+    fill(penFbo, 1, 0, 0);
+    EXPECT_CALL(penLayer, takeDirtyRect()).WillOnce(Return(QRect()));
+    penLayerPainter.synchronize(&penLayer);
+    penLayerPainter.paint(&painter);
+    ASSERT_EQ(fbo.toImage(), penFbo.toImage());
+
+    // Then only the changed part is blitted
+    fill(penFbo, 0, 0, 1);
+    EXPECT_CALL(penLayer, takeDirtyRect()).WillOnce(Return(QRect(5, 10, 20, 15)));
+    EXPECT_CALL(penLayer, addPaintTime(Gt(0)));
+    penLayerPainter.synchronize(&penLayer);
+    penLayerPainter.paint(&painter);
+
+    QImage image = fbo.toImage();
+    ASSERT_EQ(image.pixel(5, 10), qRgb(0, 0, 255));
+    ASSERT_EQ(image.pixel(24, 24), qRgb(0, 0, 255));
+    ASSERT_EQ(image.pixel(4, 10), qRgb(255, 0, 0));
+    ASSERT_EQ(image.pixel(25, 24), qRgb(255, 0, 0));
+    ASSERT_EQ(image.pixel(24, 25), qRgb(255, 0, 0));
+    ASSERT_EQ(image.pixel(20, 50), qRgb(255, 0, 0));
+
+    // Nothing is blitted if nothing has changed
+    fill(penFbo, 0, 1, 0);
+    EXPECT_CALL(penLayer, takeDirtyRect()).WillOnce(Return(QRect()));
+    EXPECT_CALL(penLayer, addPaintTime(Gt(0)));
+    penLayerPainter.synchronize(&penLayer);
+    penLayerPainter.paint(&painter);
+    ASSERT_EQ(fbo.toImage(), image);
+
+    context.doneCurrent();
+}
+
+TEST_F(PenLayerPainterTest, PartialFbo)
+{
+    QOpenGLContext context;
+    QOffscreenSurface surface;
+    createContextAndSurface(&context, &surface);
+    QOpenGLFunctions glF(&context);
+    glF.initializeOpenGLFunctions();
+    glF.glDisable(GL_SCISSOR_TEST);
+
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+
+    // The pen layer FBO only covers the bottom right quarter
+    QOpenGLFramebufferObject penFbo(20, 30, format);
+    QOpenGLFramebufferObject fbo(40, 60, format);
+    penFbo.bind();
+    glF.glClearColor(1.0f, 0.0f, 0.0f, 1.0f);
+    glF.glClear(GL_COLOR_BUFFER_BIT);
+    penFbo.release();
+    fbo.bind();
+    glF.glClearColor(0.0f, 0.0f, 1.0f, 1.0f);
+    glF.glClear(GL_COLOR_BUFFER_BIT);
+    fbo.release();
+
+    PenLayerPainter penLayerPainter(&fbo);
+    PenLayerMock penLayer;
+    QNanoPainter painter;
+    EXPECT_CALL(penLayer, framebufferObject()).WillOnce(Return(&penFbo));
+    EXPECT_CALL(penLayer, framebufferRect()).WillOnce(Return(QRectF(0.5, 0.5, 0.5, 0.5)));
+    EXPECT_CALL(penLayer, takeDirtyRect()).WillOnce(Return(QRect()));
+    penLayerPainter.synchronize(&penLayer);
+    penLayerPainter.paint(&painter);
+
+    // The rest of the item FBO is cleared
+    QImage image = fbo.toImage();
+    ASSERT_EQ(image.pixel(19, 29), qRgba(0, 0, 0, 0));
+    ASSERT_EQ(image.pixel(39, 29), qRgba(0, 0, 0, 0));
+    ASSERT_EQ(image.pixel(20, 30), qRgb(255, 0, 0));
+    ASSERT_EQ(image.pixel(39, 59), qRgb(255, 0, 0));
+
+    context.doneCurrent();
+}
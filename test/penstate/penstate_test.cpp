@@ -13,6 +13,7 @@ TEST(PenStateTest, DefaultPenState)
     ASSERT_EQ(state.brightness, 100);
     ASSERT_EQ(state.transparency, 0);
     ASSERT_EQ(state.shade, 50);
+    ASSERT_FALSE(state.colorDirty);
 
     PenAttributes defaultAttributes;
     ASSERT_EQ(state.penAttributes.color, defaultAttributes.color);
@@ -30,3 +31,27 @@ TEST(PenStateTest, UpdateColor)
     state.updateColor();
     ASSERT_EQ(state.penAttributes.color, QNanoColor::fromQColor(QColor::fromHsv(283, 114, 31, 162)));
 }
+
+TEST(PenStateTest, InvalidateColor)
+{
+    PenState state;
+    state.color = 20;
+    state.invalidateColor();
+    ASSERT_TRUE(state.colorDirty);
+
+    state.updateColor();
+    ASSERT_FALSE(state.colorDirty);
+    ASSERT_EQ(state.penAttributes.color, QNanoColor::fromQColor(QColor::fromHsv(72, 255, 255, 255)));
+}
+
+TEST(PenStateTest, ColorFromHsv)
+{
+    // Must be exactly the same as QColor
+    for (int h = 0; h < 360; h++) {
+        for (int s = 0; s <= 255; s += 3) {
+            for (int v = 0; v <= 255; v += 5) {
+                ASSERT_EQ(PenState::colorFromHsv(h, s, v, 128), QNanoColor::fromQColor(QColor::fromHsv(h, s, v, 128)));
+            }
+        }
+    }
+}
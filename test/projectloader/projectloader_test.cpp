@@ -5,6 +5,8 @@
 #include <valuemonitormodel.h>
 #include <listmonitormodel.h>
 #include <penlayer.h>
+#include <skin.h>
+#include <shadermanager.h>
 // #include <blocks/penblocks.h>
 #include <enginemock.h>
 #include <renderedtargetmock.h>
@@ -410,3 +412,64 @@ TEST_F(ProjectLoaderTest, Mute)
     ASSERT_EQ(spy.count(), 1);
     ASSERT_FALSE(loader.mute());
 }
+
+TEST_F(ProjectLoaderTest, PrecompileShaders)
+{
+    ProjectLoader loader;
+    ASSERT_FALSE(loader.precompileShaders());
+
+    QSignalSpy spy(&loader, SIGNAL(precompileShadersChanged()));
+    loader.setPrecompileShaders(true);
+    ASSERT_EQ(spy.count(), 1);
+    ASSERT_TRUE(loader.precompileShaders());
+
+    spy.clear();
+    loader.setPrecompileShaders(true);
+    ASSERT_EQ(spy.count(), 0);
+
+    loader.setPrecompileShaders(false);
+    ASSERT_EQ(spy.count(), 1);
+    ASSERT_FALSE(loader.precompileShaders());
+}
+
+TEST_F(ProjectLoaderTest, ShaderCache)
+{
+    ProjectLoader loader;
+    ASSERT_FALSE(loader.shaderCache());
+
+    QSignalSpy spy(&loader, SIGNAL(shaderCacheChanged()));
+    loader.setShaderCache(true);
+    ASSERT_EQ(spy.count(), 1);
+    ASSERT_TRUE(loader.shaderCache());
+    ASSERT_TRUE(ShaderManager::programCacheEnabled());
+
+    spy.clear();
+    loader.setShaderCache(true);
+    ASSERT_EQ(spy.count(), 0);
+
+    loader.setShaderCache(false);
+    ASSERT_EQ(spy.count(), 1);
+    ASSERT_FALSE(loader.shaderCache());
+    ASSERT_FALSE(ShaderManager::programCacheEnabled());
+}
+
+TEST_F(ProjectLoaderTest, TextureAtlas)
+{
+    ProjectLoader loader;
+    ASSERT_FALSE(loader.textureAtlas());
+
+    QSignalSpy spy(&loader, SIGNAL(textureAtlasChanged()));
+    loader.setTextureAtlas(true);
+    ASSERT_EQ(spy.count(), 1);
+    ASSERT_TRUE(loader.textureAtlas());
+    ASSERT_TRUE(Skin::atlasEnabled());
+
+    spy.clear();
+    loader.setTextureAtlas(true);
+    ASSERT_EQ(spy.count(), 0);
+
+    loader.setTextureAtlas(false);
+    ASSERT_EQ(spy.count(), 1);
+    ASSERT_FALSE(loader.textureAtlas());
+    ASSERT_FALSE(Skin::atlasEnabled());
+}
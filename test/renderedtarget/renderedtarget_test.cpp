@@ -1,5 +1,7 @@
 #include <QtTest/QSignalSpy>
 #include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFramebufferObject>
 #include <QOffscreenSurface>
 #include <qnanopainter.h>
 #include <renderedtarget.h>
@@ -7,6 +9,9 @@
 #include <spritemodel.h>
 #include <scenemousearea.h>
 #include <penlayer.h>
+#include <gputouchingquery.h>
+#include <sharedquad.h>
+#include <penstamp.h>
 #include <scratchcpp/stage.h>
 #include <scratchcpp/sprite.h>
 #include <scratchcpp/costume.h>
@@ -33,10 +38,13 @@ class RenderedTargetTest : public testing::Test
         {
             // Create OpenGL context
             createContextAndSurface(&m_context, &m_surface);
+            m_gpuAreaThreshold = GpuTouchingQuery::areaThreshold();
         }
 
         void TearDown() override
         {
+            // Restore the GPU touching query threshold even if a test fails
+            GpuTouchingQuery::setAreaThreshold(m_gpuAreaThreshold);
             emit m_context.aboutToBeDestroyed();
             m_context.doneCurrent();
         }
@@ -61,6 +69,7 @@ class RenderedTargetTest : public testing::Test
 
         QOpenGLContext m_context;
         QOffscreenSurface m_surface;
+        int m_gpuAreaThreshold = 0;
 };
 
 TEST_F(RenderedTargetTest, Constructors)
@@ -721,6 +730,24 @@ TEST_F(RenderedTargetTest, StageScale)
     ASSERT_EQ(spy.count(), 1);
 }
 
+TEST_F(RenderedTargetTest, Composited)
+{
+    RenderedTarget target;
+    QSignalSpy spy(&target, &RenderedTarget::compositedChanged);
+    ASSERT_FALSE(target.composited());
+
+    target.setComposited(true);
+    ASSERT_TRUE(target.composited());
+    ASSERT_EQ(spy.count(), 1);
+
+    target.setComposited(true);
+    ASSERT_EQ(spy.count(), 1);
+
+    target.setComposited(false);
+    ASSERT_FALSE(target.composited());
+    ASSERT_EQ(spy.count(), 2);
+}
+
 TEST_F(RenderedTargetTest, GraphicEffects)
 {
     RenderedTarget target;
@@ -909,6 +936,87 @@ TEST_F(RenderedTargetTest, GetFastBounds)
     ASSERT_EQ(std::round(bounds.bottom() * 100) / 100, 1143.65);
 }
 
+TEST_F(RenderedTargetTest, BoundsCache)
+{
+    RenderedTarget target;
+
+    Sprite sprite;
+    sprite.setDirection(-46.37);
+    sprite.setSize(67.98);
+    SpriteModel spriteModel;
+    sprite.setInterface(&spriteModel);
+    target.setSpriteModel(&spriteModel);
+    EngineMock engine;
+    target.setEngine(&engine);
+    auto costume = std::make_shared<Costume>("", "", "png");
+    std::string costumeData = readFileStr("image.png");
+    char *data = (char *)malloc((costumeData.size() + 1) * sizeof(char));
+    memcpy(data, costumeData.c_str(), (costumeData.size() + 1) * sizeof(char));
+    costume->setData(costumeData.size(), static_cast<void *>(data));
+    costume->setRotationCenterX(-15);
+    costume->setRotationCenterY(48);
+    sprite.addCostume(costume);
+
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    target.loadCostumes();
+    target.updateCostume(costume.get());
+    target.beforeRedraw();
+
+    const Rect bounds = target.getBounds();
+    const Rect fastBounds = target.getFastBounds();
+
+    // Repeated calls return the cached bounds
+    for (int i = 0; i < 2; i++) {
+        Rect rect = target.getBounds();
+        ASSERT_EQ(rect.left(), bounds.left());
+        ASSERT_EQ(rect.top(), bounds.top());
+        ASSERT_EQ(rect.right(), bounds.right());
+        ASSERT_EQ(rect.bottom(), bounds.bottom());
+
+        rect = target.getFastBounds();
+        ASSERT_EQ(rect.left(), fastBounds.left());
+        ASSERT_EQ(rect.top(), fastBounds.top());
+        ASSERT_EQ(rect.right(), fastBounds.right());
+        ASSERT_EQ(rect.bottom(), fastBounds.bottom());
+    }
+
+    // Moving the sprite only translates the bounds
+    target.updateX(25);
+    target.updateY(-40);
+
+    Rect rect = target.getBounds();
+    ASSERT_EQ(rect.left(), bounds.left() + 25);
+    ASSERT_EQ(rect.top(), bounds.top() - 40);
+    ASSERT_EQ(rect.right(), bounds.right() + 25);
+    ASSERT_EQ(rect.bottom(), bounds.bottom() - 40);
+
+    rect = target.getFastBounds();
+    ASSERT_EQ(rect.left(), fastBounds.left() + 25);
+    ASSERT_EQ(rect.top(), fastBounds.top() - 40);
+    ASSERT_EQ(rect.right(), fastBounds.right() + 25);
+    ASSERT_EQ(rect.bottom(), fastBounds.bottom() - 40);
+
+    // Rotating and resizing the sprite invalidates the cache
+    target.updateX(0);
+    target.updateY(0);
+    target.updateDirection(90);
+
+    rect = target.getBounds();
+    ASSERT_NE(rect.width(), bounds.width());
+    rect = target.getFastBounds();
+    ASSERT_NE(rect.width(), fastBounds.width());
+
+    const Rect rotatedBounds = target.getBounds();
+    const Rect rotatedFastBounds = target.getFastBounds();
+    target.updateSize(200);
+
+    rect = target.getBounds();
+    ASSERT_NE(rect.width(), rotatedBounds.width());
+    rect = target.getFastBounds();
+    ASSERT_NE(rect.width(), rotatedFastBounds.width());
+}
+
 TEST_F(RenderedTargetTest, TouchingClones)
 {
     EngineMock engine;
@@ -944,103 +1052,67 @@ TEST_F(RenderedTargetTest, TouchingClones)
     target.setWidth(3);
     target.setHeight(3);
 
+    // The clones return the points they cover in the union of the bounding rectangles (the target doesn't cover (2, -2))
+    auto scratchSpans = [](const std::vector<QPoint> &points) {
+        return [points](const QRect &rect, TextureSpans &dst) {
+            std::vector<GLubyte> pixels(rect.width() * rect.height() * 4, 0);
+
+            for (const QPoint &point : points) {
+                if (rect.contains(point))
+                    pixels[((point.y() - rect.top()) * rect.width() + point.x() - rect.left()) * 4 + 3] = 255;
+            }
+
+            dst = TextureSpans(pixels.data(), rect.width(), rect.height());
+        };
+    };
+
+    const QRect rect(1, -3, 3, 3);
     EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(2, 1, 6, -5)));
     EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(-5, -1, 1, -8)));
-    EXPECT_CALL(target1, containsScratchPoint(1, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(2, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(2, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(3, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(3, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(1, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(3, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(3, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(1, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(2, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(2, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(3, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(3, -1)).WillOnce(Return(false));
+    EXPECT_CALL(target1, getScratchSpans(rect, _)).WillOnce(Invoke(scratchSpans({})));
+    EXPECT_CALL(target2, getScratchSpans(rect, _)).WillOnce(Invoke(scratchSpans({})));
     ASSERT_FALSE(target.touchingClones({ &clone1, &clone2 }));
 
     EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(2, 1, 6, -5)));
     EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(-5, -1, 1, -8)));
-    EXPECT_CALL(target1, containsScratchPoint(1, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(2, -3)).WillOnce(Return(true));
+    EXPECT_CALL(target1, getScratchSpans(rect, _)).WillOnce(Invoke(scratchSpans({ { 2, -3 } })));
+    EXPECT_CALL(target2, getScratchSpans).Times(0);
     ASSERT_TRUE(target.touchingClones({ &clone1, &clone2 }));
 
+    EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(2, 1, 6, -5)));
+    EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(-5, -1, 1, -8)));
+    EXPECT_CALL(target1, getScratchSpans(rect, _)).WillOnce(Invoke(scratchSpans({ { 2, -2 } })));
+    EXPECT_CALL(target2, getScratchSpans(rect, _)).WillOnce(Invoke(scratchSpans({ { 0, -3 }, { 4, -1 } })));
+    ASSERT_FALSE(target.touchingClones({ &clone1, &clone2 }));
+
     EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(5, 1, 6, -5)));
     EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(-5, -1, 2, -8)));
-    EXPECT_CALL(target1, containsScratchPoint(1, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(2, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(2, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(3, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(3, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(1, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(3, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(3, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(1, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(2, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(2, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(3, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(3, -1)).WillOnce(Return(false));
+    EXPECT_CALL(target1, getScratchSpans(rect, _)).WillOnce(Invoke(scratchSpans({})));
+    EXPECT_CALL(target2, getScratchSpans(rect, _)).WillOnce(Invoke(scratchSpans({})));
     ASSERT_FALSE(target.touchingClones({ &clone1, &clone2 }));
 
     EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(2, 1, 6, -5)));
     EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(-5, -6, 2, -8)));
-    EXPECT_CALL(target1, containsScratchPoint(1, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(2, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(2, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(3, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(3, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(1, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(3, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(3, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(1, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(2, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(2, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(3, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(3, -1)).WillOnce(Return(false));
+    EXPECT_CALL(target1, getScratchSpans(rect, _)).WillOnce(Invoke(scratchSpans({})));
+    EXPECT_CALL(target2, getScratchSpans(rect, _)).WillOnce(Invoke(scratchSpans({})));
     ASSERT_FALSE(target.touchingClones({ &clone1, &clone2 }));
 
     EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(2, 1, 6, -5)));
     EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(-5, -6.5, 1.8, -8)));
-    EXPECT_CALL(target1, containsScratchPoint(1, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(2, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(2, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(3, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(3, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(1, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(3, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(3, -2)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(1, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(2, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(2, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target1, containsScratchPoint(3, -1)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(3, -1)).WillOnce(Return(false));
+    EXPECT_CALL(target1, getScratchSpans(rect, _)).WillOnce(Invoke(scratchSpans({})));
+    EXPECT_CALL(target2, getScratchSpans(rect, _)).WillOnce(Invoke(scratchSpans({})));
     ASSERT_FALSE(target.touchingClones({ &clone1, &clone2 }));
 
     EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(2, 1, 6, -5)));
     EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(-5, -6, 2, -8)));
-    EXPECT_CALL(target1, containsScratchPoint(1, -3)).WillOnce(Return(false));
-    EXPECT_CALL(target2, containsScratchPoint(1, -3)).WillOnce(Return(true));
+    EXPECT_CALL(target1, getScratchSpans(rect, _)).WillOnce(Invoke(scratchSpans({})));
+    EXPECT_CALL(target2, getScratchSpans(rect, _)).WillOnce(Invoke(scratchSpans({ { 1, -3 } })));
     ASSERT_TRUE(target.touchingClones({ &clone1, &clone2 }));
 
     EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(5, 1, 6, -5)));
     EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(-5, -6, 2, -8)));
-    EXPECT_CALL(target1, containsScratchPoint).Times(0);
-    EXPECT_CALL(target2, containsScratchPoint).Times(0);
+    EXPECT_CALL(target1, getScratchSpans).Times(0);
+    EXPECT_CALL(target2, getScratchSpans).Times(0);
     ASSERT_FALSE(target.touchingClones({ &clone1, &clone2 }));
 
     // Out of bounds: top left
@@ -1048,8 +1120,8 @@ TEST_F(RenderedTargetTest, TouchingClones)
     target.updateY(200);
     EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(2 - 300, 1 + 200, 6 - 300, -5 + 200)));
     EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(-5 - 300, -6.5 + 200, 1.8 - 300, -8 + 200)));
-    EXPECT_CALL(target1, containsScratchPoint).Times(0);
-    EXPECT_CALL(target2, containsScratchPoint).Times(0);
+    EXPECT_CALL(target1, getScratchSpans).Times(0);
+    EXPECT_CALL(target2, getScratchSpans).Times(0);
     ASSERT_FALSE(target.touchingClones({ &clone1, &clone2 }));
 
     // Out of bounds: top right
@@ -1057,8 +1129,8 @@ TEST_F(RenderedTargetTest, TouchingClones)
     target.updateY(200);
     EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(2 + 300, 1 + 200, 6 + 300, -5 + 200)));
     EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(-5 + 300, -6.5 + 200, 1.8 + 300, -8 + 200)));
-    EXPECT_CALL(target1, containsScratchPoint).Times(0);
-    EXPECT_CALL(target2, containsScratchPoint).Times(0);
+    EXPECT_CALL(target1, getScratchSpans).Times(0);
+    EXPECT_CALL(target2, getScratchSpans).Times(0);
     ASSERT_FALSE(target.touchingClones({ &clone1, &clone2 }));
 
     // Out of bounds: bottom right
@@ -1066,8 +1138,8 @@ TEST_F(RenderedTargetTest, TouchingClones)
     target.updateY(-200);
     EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(2 + 300, 1 - 200, 6 + 300, -5 - 200)));
     EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(-5 + 300, -6.5 - 200, 1.8 + 300, -8 - 200)));
-    EXPECT_CALL(target1, containsScratchPoint).Times(0);
-    EXPECT_CALL(target2, containsScratchPoint).Times(0);
+    EXPECT_CALL(target1, getScratchSpans).Times(0);
+    EXPECT_CALL(target2, getScratchSpans).Times(0);
     ASSERT_FALSE(target.touchingClones({ &clone1, &clone2 }));
 
     // Out of bounds: bottom left
@@ -1075,11 +1147,112 @@ TEST_F(RenderedTargetTest, TouchingClones)
     target.updateY(-200);
     EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(2 - 300, 1 - 200, 6 - 300, -5 - 200)));
     EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(-5 - 300, -6.5 - 200, 1.8 - 300, -8 - 200)));
-    EXPECT_CALL(target1, containsScratchPoint).Times(0);
-    EXPECT_CALL(target2, containsScratchPoint).Times(0);
+    EXPECT_CALL(target1, getScratchSpans).Times(0);
+    EXPECT_CALL(target2, getScratchSpans).Times(0);
     ASSERT_FALSE(target.touchingClones({ &clone1, &clone2 }));
 }
 
+TEST_F(RenderedTargetTest, ScratchSpans)
+{
+    EngineMock engine;
+    auto sprite1 = std::make_shared<Sprite>();
+    auto sprite2 = std::make_shared<Sprite>();
+    SpriteModel model1, model2;
+    sprite1->setInterface(&model1);
+    sprite2->setInterface(&model2);
+
+    QQuickItem parent;
+    parent.setWidth(480);
+    parent.setHeight(360);
+
+    RenderedTarget target1(&parent), target2(&parent);
+    target1.setEngine(&engine);
+    target2.setEngine(&engine);
+    target1.setSpriteModel(&model1);
+    target2.setSpriteModel(&model2);
+    model1.setRenderedTarget(&target1);
+    model2.setRenderedTarget(&target2);
+
+    // Load costumes
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    std::string costumeData = readFileStr("image.png");
+
+    for (auto [sprite, target] : { std::make_pair(sprite1, &target1), std::make_pair(sprite2, &target2) }) {
+        auto costume = std::make_shared<Costume>("", "", "png");
+        char *data = (char *)malloc((costumeData.size() + 1) * sizeof(char));
+        memcpy(data, costumeData.c_str(), (costumeData.size() + 1) * sizeof(char));
+        costume->setData(costumeData.size(), static_cast<void *>(data));
+        sprite->addCostume(costume);
+        target->loadCostumes();
+        target->updateCostume(costume.get());
+        target->updateSize(1000);
+        target->beforeRedraw();
+    }
+
+    // The spans and the clone check must give the same result as the per-pixel checks
+    const QRect rect(-100, -100, 200, 200);
+    GpuTouchingQuery::setAreaThreshold(-1);
+
+    auto check = [&target1, &target2, &sprite2, &rect]() {
+        bool touching = false;
+
+        for (RenderedTarget *target : { &target1, &target2 }) {
+            TextureSpans spans;
+            target->getScratchSpans(rect, spans);
+            ASSERT_EQ(spans.width(), rect.width());
+            ASSERT_EQ(spans.height(), rect.height());
+
+            for (int y = rect.top(); y <= rect.bottom(); y++) {
+                for (int x = rect.left(); x <= rect.right(); x++)
+                    ASSERT_EQ(spans.containsPixel(x - rect.left(), y - rect.top()), target->containsScratchPoint(x, y)) << x << " " << y;
+            }
+        }
+
+        for (int y = rect.top(); y <= rect.bottom() && !touching; y++) {
+            for (int x = rect.left(); x <= rect.right() && !touching; x++)
+                touching = target1.containsScratchPoint(x, y) && target2.containsScratchPoint(x, y);
+        }
+
+        ASSERT_EQ(target1.touchingClones({ sprite2.get() }), touching);
+    };
+
+    // Unrotated sprites at fractional positions
+    target1.updateX(-10.5);
+    target1.updateY(3.25);
+    target2.updateX(12.75);
+    target2.updateY(-7.5);
+    check();
+
+    // Different sizes
+    target2.updateSize(373.5);
+    check();
+
+    target2.updateSize(45.2);
+    check();
+
+    // Mirrored sprite
+    target2.updateSize(1000);
+    target1.updateRotationStyle(Sprite::RotationStyle::LeftRight);
+    target1.updateDirection(-90);
+    check();
+
+    // Rotated sprite
+    target1.updateRotationStyle(Sprite::RotationStyle::AllAround);
+    target1.updateDirection(30);
+    check();
+
+    // Shape-changing effect
+    target1.updateDirection(90);
+    target1.setGraphicEffect(ShaderManager::Effect::Whirl, 50);
+    check();
+
+    // Sprites further apart
+    target1.clearGraphicEffects();
+    target2.updateX(90);
+    check();
+}
+
 TEST_F(RenderedTargetTest, TouchingColor)
 {
     EngineMock engine;
@@ -1164,7 +1337,7 @@ TEST_F(RenderedTargetTest, TouchingColor)
     EXPECT_CALL(stageTarget, stageModel()).WillRepeatedly(Return(&stageModel));
     EXPECT_CALL(target1, stageModel()).WillRepeatedly(Return(nullptr));
     EXPECT_CALL(target2, stageModel()).WillRepeatedly(Return(nullptr));
-    EXPECT_CALL(penLayer, getBounds()).WillRepeatedly(ReturnRef(penBounds));
+    EXPECT_CALL(penLayer, getFastBounds()).WillRepeatedly(Return(penBounds));
 
     static const Rgb color1 = 4286611711;  // "purple"
     static const Rgb color2 = 596083443;   // close to color1 and transparent
@@ -1328,3 +1501,134 @@ TEST_F(RenderedTargetTest, TouchingColor)
     EXPECT_CALL(stageTarget, colorAtScratchPoint).Times(0);
     ASSERT_FALSE(target.touchingColor(color1));
 }
+
+TEST_F(RenderedTargetTest, GpuTouchingQueries)
+{
+    EngineMock engine;
+    auto sprite1 = std::make_shared<Sprite>();
+    auto sprite2 = std::make_shared<Sprite>();
+    SpriteModel model1, model2;
+    sprite1->setInterface(&model1);
+    sprite2->setInterface(&model2);
+    sprite1->setLayerOrder(1);
+    sprite2->setLayerOrder(2);
+
+    EXPECT_CALL(engine, getVisibleTargets(_)).WillRepeatedly(Invoke([&sprite1, &sprite2](std::vector<Target *> &dst) { dst = { sprite2.get(), sprite1.get() }; }));
+
+    QQuickItem parent;
+    parent.setWidth(480);
+    parent.setHeight(360);
+
+    RenderedTarget target1(&parent), target2(&parent);
+    target1.setEngine(&engine);
+    target2.setEngine(&engine);
+    target1.setSpriteModel(&model1);
+    target2.setSpriteModel(&model2);
+    model1.setRenderedTarget(&target1);
+    model2.setRenderedTarget(&target2);
+
+    // Load costumes
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    std::string costumeData = readFileStr("image.png");
+
+    for (auto [sprite, target] : { std::make_pair(sprite1, &target1), std::make_pair(sprite2, &target2) }) {
+        auto costume = std::make_shared<Costume>("", "", "png");
+        char *data = (char *)malloc((costumeData.size() + 1) * sizeof(char));
+        memcpy(data, costumeData.c_str(), (costumeData.size() + 1) * sizeof(char));
+        costume->setData(costumeData.size(), static_cast<void *>(data));
+        sprite->addCostume(costume);
+        target->loadCostumes();
+        target->updateCostume(costume.get());
+        target->updateSize(4000);
+        target->beforeRedraw();
+    }
+
+    // The results must be the same on the CPU and on the GPU
+    auto check = [&target1, &target2, &sprite2](double x, double colorX, bool expected) {
+        target1.updateX(0);
+        target1.updateY(0);
+        target2.updateX(x);
+        target2.updateY(0);
+        const QRgb color = target2.colorAtScratchPoint(colorX, 60);
+
+        GpuTouchingQuery::setAreaThreshold(-1);
+        ASSERT_EQ(target1.touchingClones({ sprite2.get() }), expected);
+        ASSERT_EQ(target1.touchingColor(color), expected);
+
+        GpuTouchingQuery::setAreaThreshold(0);
+        ASSERT_EQ(target1.touchingClones({ sprite2.get() }), expected);
+        ASSERT_EQ(target1.touchingColor(color), expected);
+    };
+
+    check(50, 30, true);
+    check(-100, -30, true);
+    check(150, 170, false); // only the bounding rectangles overlap
+}
+
+TEST_F(RenderedTargetTest, ShapeEffectsAtScale)
+{
+    EngineMock engine;
+    Sprite sprite;
+    SpriteModel model;
+    model.init(&sprite);
+
+    QQuickItem parent;
+    parent.setWidth(480);
+    parent.setHeight(360);
+    RenderedTarget target(&parent);
+    target.setEngine(&engine);
+    target.setSpriteModel(&model);
+
+    // Load a vector costume (its texture depends on the size)
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    auto costume = std::make_shared<Costume>("", "", "svg");
+    std::string costumeData = readFileStr("image.svg");
+    char *data = (char *)malloc((costumeData.size() + 1) * sizeof(char));
+    memcpy(data, costumeData.c_str(), (costumeData.size() + 1) * sizeof(char));
+    costume->setData(costumeData.size(), static_cast<void *>(data));
+    sprite.addCostume(costume);
+    target.loadCostumes();
+    target.updateCostume(costume.get());
+    target.updateSize(200);
+    target.setGraphicEffect(ShaderManager::Effect::Pixelate, 100);
+    target.beforeRedraw();
+    ASSERT_EQ(target.cpuTexture().size(), QSize(96, 96));
+
+    // Stamps use the size of the skin, not of the texture
+    PenStamp stamp;
+    ASSERT_TRUE(target.getStamp(1, stamp));
+    ASSERT_EQ(stamp.skinSize, QSize(48, 48));
+
+    // Render the target on the GPU
+    QOpenGLExtraFunctions glF(&m_context);
+    glF.initializeOpenGLFunctions();
+    QOpenGLFramebufferObject fbo(480, 360);
+    fbo.bind();
+    glF.glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glF.glClear(GL_COLOR_BUFFER_BIT);
+    glF.glBindVertexArray(SharedQuad::vertexArray(&m_context));
+    target.render(1);
+    fbo.release();
+    const QImage image = fbo.toImage();
+
+    // The pixelated shape must be the same on the CPU and on the GPU
+    const Rect &bounds = target.getBounds();
+    const QRect rect = QRect(QPoint(std::floor(bounds.left()) + 240 - 2, 180 - std::ceil(bounds.top()) - 2), QPoint(std::ceil(bounds.right()) + 240 + 2, 180 - std::floor(bounds.bottom()) + 2))
+                           .intersected(QRect(0, 0, 480, 360));
+    ASSERT_FALSE(rect.isEmpty());
+    QImage gpu(rect.size(), QImage::Format_ARGB32);
+    QImage cpu(rect.size(), QImage::Format_ARGB32);
+
+    for (int y = 0; y < rect.height(); y++) {
+        for (int x = 0; x < rect.width(); x++) {
+            const int stageX = rect.left() + x;
+            const int stageY = rect.top() + y;
+            gpu.setPixel(x, y, qAlpha(image.pixel(stageX, stageY)) > 0 ? qRgb(0, 0, 0) : qRgb(255, 255, 255));
+            cpu.setPixel(x, y, target.containsScratchPoint(stageX - 239.5, 179.5 - stageY) ? qRgb(0, 0, 0) : qRgb(255, 255, 255));
+        }
+    }
+
+    ASSERT_LE(fuzzyCompareImages(gpu, cpu), 0.05);
+}
@@ -2,11 +2,13 @@
 #include <QOffscreenSurface>
 #include <QOpenGLShaderProgram>
 #include <QFile>
+#include <QDir>
+#include <QTemporaryDir>
 #include <QOpenGLFunctions>
+#include <QMatrix4x4>
 #include <scratchcpp/scratchconfiguration.h>
 #include <shadermanager.h>
 #include <graphicseffect.h>
-#include <renderedtargetmock.h>
 
 #include "../common.h"
 
@@ -25,6 +27,9 @@ class ShaderManagerTest : public testing::Test
             m_surface.create();
             Q_ASSERT(m_surface.isValid());
             m_context.makeCurrent(&m_surface);
+
+            // Programs loaded from the disk cache don't have shaders
+            ShaderManager::setProgramCacheDirectory("");
         }
 
         void TearDown() override
@@ -35,7 +40,6 @@ class ShaderManagerTest : public testing::Test
 
         QOpenGLContext m_context;
         QOffscreenSurface m_surface;
-        RenderedTargetMock m_target;
 };
 
 TEST_F(ShaderManagerTest, RegisteredEffects)
@@ -68,12 +72,30 @@ TEST_F(ShaderManagerTest, Instance)
     ASSERT_TRUE(ShaderManager::instance());
 }
 
+TEST_F(ShaderManagerTest, ShaderSource)
+{
+    static const QString fileName = ":/qt/qml/ScratchCPP/Render/shaders/sprite.vert";
+    QFile file(fileName);
+    ASSERT_TRUE(file.open(QFile::ReadOnly));
+    const QByteArray source = file.readAll();
+    ASSERT_FALSE(source.isEmpty());
+
+    // The GLSL version is on the first line, followed by the defines and the file contents
+    QByteArray result = ShaderManager::shaderSource(fileName);
+    ASSERT_TRUE(result.startsWith("#version "));
+    ASSERT_EQ(result.mid(result.indexOf('\n') + 1), source);
+
+    result = ShaderManager::shaderSource(fileName, "#define INSTANCED\n");
+    ASSERT_TRUE(result.startsWith("#version "));
+    ASSERT_EQ(result.mid(result.indexOf('\n') + 1), "#define INSTANCED\n" + source);
+}
+
 TEST_F(ShaderManagerTest, GetShaderProgram)
 {
     ShaderManager manager;
     const std::unordered_map<ShaderManager::Effect, double> effects = { { ShaderManager::Effect::Color, 64.9 }, { ShaderManager::Effect::Ghost, 12.5 } };
 
-    QOpenGLShaderProgram *program = manager.getShaderProgram(&m_target, effects);
+    QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     ASSERT_EQ(program->parent(), &manager);
     ASSERT_TRUE(program->isLinked());
 
@@ -85,26 +107,125 @@ TEST_F(ShaderManagerTest, GetShaderProgram)
     ASSERT_EQ(frag->shaderType(), QOpenGLShader::Fragment);
 
     // Test shader program cache
-    program = manager.getShaderProgram(&m_target, effects);
+    program = manager.getShaderProgram(effects);
     ASSERT_EQ(program, program);
 
-    program = manager.getShaderProgram(&m_target, effects);
+    program = manager.getShaderProgram(effects);
     ASSERT_EQ(program, program);
 }
 
-TEST_F(ShaderManagerTest, GetShaderProgram_AnotherTarget)
+TEST_F(ShaderManagerTest, GetShaderProgram_Shared)
 {
     ShaderManager manager;
     const std::unordered_map<ShaderManager::Effect, double> effects = { { ShaderManager::Effect::Color, 64.9 }, { ShaderManager::Effect::Ghost, 12.5 } };
+    QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
+
+    // Programs only depend on the enabled effects (the values are uniforms)
+    const std::unordered_map<ShaderManager::Effect, double> otherEffects = { { ShaderManager::Effect::Color, -20 }, { ShaderManager::Effect::Ghost, 100 } };
+    ASSERT_EQ(manager.getShaderProgram(otherEffects), program);
 
-    QOpenGLShaderProgram *program = manager.getShaderProgram(&m_target, effects);
+    const std::unordered_map<ShaderManager::Effect, double> zeroEffects = { { ShaderManager::Effect::Color, 64.9 }, { ShaderManager::Effect::Ghost, 12.5 }, { ShaderManager::Effect::Whirl, 0 } };
+    ASSERT_EQ(manager.getShaderProgram(zeroEffects), program);
 
-    RenderedTargetMock anotherTarget;
-    QOpenGLShaderProgram *anotherProgram = manager.getShaderProgram(&anotherTarget, effects);
+    QOpenGLShaderProgram *anotherProgram = manager.getShaderProgram({ { ShaderManager::Effect::Color, 64.9 } });
     ASSERT_NE(anotherProgram, nullptr);
     ASSERT_NE(anotherProgram, program);
 
-    ASSERT_EQ(manager.getShaderProgram(&anotherTarget, effects), anotherProgram);
+    QOpenGLShaderProgram *silhouetteProgram = manager.getShaderProgram(effects, ShaderManager::DrawMode::Silhouette);
+    ASSERT_NE(silhouetteProgram, nullptr);
+    ASSERT_NE(silhouetteProgram, program);
+}
+
+TEST_F(ShaderManagerTest, Precompile)
+{
+    ShaderManager manager;
+    ASSERT_FALSE(manager.precompilationPending());
+    ASSERT_FALSE(manager.precompile(0));
+
+    const std::vector<ShaderManager::Effect> masks = ShaderManager::allEffectMasks();
+    ASSERT_EQ(masks.size(), 128);
+    ASSERT_EQ(masks.front(), ShaderManager::Effect::NoEffect);
+    ASSERT_EQ(masks.back(), static_cast<ShaderManager::Effect>(127));
+
+    manager.queuePrecompilation({ ShaderManager::Effect::Ghost, ShaderManager::Effect::Color | ShaderManager::Effect::Ghost });
+    ASSERT_TRUE(manager.precompilationPending());
+
+    // At least one program is compiled even without time budget
+    ASSERT_TRUE(manager.precompile(0));
+    ASSERT_TRUE(manager.precompilationPending());
+    ASSERT_FALSE(manager.precompile(0));
+    ASSERT_FALSE(manager.precompilationPending());
+
+    // The precompiled programs are used later
+    QObjectList children = manager.children();
+    const qsizetype count = children.size();
+    QOpenGLShaderProgram *program = manager.getShaderProgram({ { ShaderManager::Effect::Ghost, 50 } });
+    ASSERT_TRUE(program->isLinked());
+    ASSERT_TRUE(children.contains(program));
+    program = manager.getShaderProgram({ { ShaderManager::Effect::Ghost, 50 }, { ShaderManager::Effect::Color, 20 } });
+    ASSERT_TRUE(children.contains(program));
+    ASSERT_EQ(manager.children().size(), count);
+}
+
+TEST_F(ShaderManagerTest, SetMatrices)
+{
+    QOpenGLFunctions glF(&m_context);
+    glF.initializeOpenGLFunctions();
+    ShaderManager manager;
+
+    QOpenGLShaderProgram *program = manager.getShaderProgram({});
+    program->bind();
+
+    QMatrix4x4 projectionMatrix;
+    projectionMatrix.ortho(0, 10, 0, 20, -1, 1);
+    QMatrix4x4 modelMatrix;
+    modelMatrix.translate(5, 2);
+    manager.setMatrices(program, projectionMatrix, modelMatrix);
+
+    GLfloat values[16];
+    glF.glGetUniformfv(program->programId(), program->uniformLocation("u_projectionMatrix"), values);
+    ASSERT_EQ(QMatrix4x4(values).transposed(), projectionMatrix);
+
+    glF.glGetUniformfv(program->programId(), program->uniformLocation("u_modelMatrix"), values);
+    ASSERT_EQ(QMatrix4x4(values).transposed(), modelMatrix);
+
+    program->release();
+}
+
+TEST_F(ShaderManagerTest, GetInstancedShaderProgram)
+{
+    ShaderManager manager;
+    const ShaderManager::Effect mask = ShaderManager::Effect::Color | ShaderManager::Effect::Whirl;
+
+    QOpenGLShaderProgram *program = manager.getInstancedShaderProgram(mask);
+    ASSERT_TRUE(program);
+    ASSERT_TRUE(program->isLinked());
+    ASSERT_EQ(program->attributeLocation("a_matrix"), ShaderManager::INSTANCE_MATRIX_LOCATION);
+    ASSERT_EQ(program->attributeLocation("a_effects"), ShaderManager::INSTANCE_EFFECTS_LOCATION);
+    ASSERT_EQ(program->attributeLocation("a_shapeEffects"), ShaderManager::INSTANCE_SHAPE_EFFECTS_LOCATION);
+    ASSERT_EQ(program->attributeLocation("a_uvRect"), ShaderManager::INSTANCE_UV_RECT_LOCATION);
+
+    // Instanced shader programs are shared by all targets
+    ASSERT_EQ(manager.getInstancedShaderProgram(mask), program);
+    ASSERT_NE(manager.getInstancedShaderProgram(ShaderManager::Effect::Color), program);
+}
+
+TEST_F(ShaderManagerTest, InstanceValues)
+{
+    const std::unordered_map<ShaderManager::Effect, double> effects = { { ShaderManager::Effect::Ghost, 50 }, { ShaderManager::Effect::Mosaic, 0 } };
+    ASSERT_EQ(ShaderManager::effectMask(effects), ShaderManager::Effect::Ghost);
+
+    ShaderManager::InstanceEffectValues values;
+    values.fill(-1);
+    ShaderManager::getInstanceValuesForEffects(effects, values);
+
+    std::unordered_map<ShaderManager::Effect, float> uniformValues;
+    ShaderManager::getUniformValuesForEffects(effects, uniformValues);
+
+    // Color, brightness, ghost, fisheye, whirl, pixelate, mosaic
+    ASSERT_EQ(values[0], 0);
+    ASSERT_EQ(values[2], uniformValues[ShaderManager::Effect::Ghost]);
+    ASSERT_EQ(values[6], uniformValues[ShaderManager::Effect::Mosaic]);
 }
 
 TEST_F(ShaderManagerTest, SetUniforms)
@@ -114,7 +235,7 @@ TEST_F(ShaderManagerTest, SetUniforms)
     ShaderManager manager;
 
     std::unordered_map<ShaderManager::Effect, double> effects = { { ShaderManager::Effect::Color, 64.9 }, { ShaderManager::Effect::Ghost, 12.5 } };
-    QOpenGLShaderProgram *program = manager.getShaderProgram(&m_target, effects);
+    QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 4, QSize(), effects);
 
@@ -130,6 +251,69 @@ TEST_F(ShaderManagerTest, SetUniforms)
     glF.glGetUniformfv(program->programId(), program->uniformLocation("u_ghost"), &value);
     ASSERT_NE(value, 0.0f);
 
+    // The whole texture is used by default
+    GLfloat uvRect[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glF.glGetUniformfv(program->programId(), program->uniformLocation("u_uvRect"), uvRect);
+    ASSERT_EQ(uvRect[0], 0.0f);
+    ASSERT_EQ(uvRect[1], 0.0f);
+    ASSERT_EQ(uvRect[2], 1.0f);
+    ASSERT_EQ(uvRect[3], 1.0f);
+
+    manager.setUniforms(program, 4, QSize(), effects, QRectF(0.25, 0.5, 0.125, 0.0625));
+    glF.glGetUniformfv(program->programId(), program->uniformLocation("u_uvRect"), uvRect);
+    ASSERT_EQ(uvRect[0], 0.25f);
+    ASSERT_EQ(uvRect[1], 0.5f);
+    ASSERT_EQ(uvRect[2], 0.125f);
+    ASSERT_EQ(uvRect[3], 0.0625f);
+
+    program->release();
+}
+
+TEST_F(ShaderManagerTest, UpdateUniforms)
+{
+    QOpenGLFunctions glF(&m_context);
+    glF.initializeOpenGLFunctions();
+    ShaderManager manager;
+
+    std::unordered_map<ShaderManager::Effect, double> effects = { { ShaderManager::Effect::Color, 64.9 } };
+    QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
+    program->bind();
+    manager.updateUniforms(program, 4, QSize(10, 20), effects);
+
+    GLint texUnit = -1;
+    glF.glGetUniformiv(program->programId(), program->uniformLocation("u_skin"), &texUnit);
+    ASSERT_EQ(texUnit, 4);
+
+    // Nothing is uploaded if the values didn't change
+    program->setUniformValue("u_skin", 2);
+    manager.updateUniforms(program, 4, QSize(10, 20), effects);
+    glF.glGetUniformiv(program->programId(), program->uniformLocation("u_skin"), &texUnit);
+    ASSERT_EQ(texUnit, 2);
+
+    // Changed effect value
+    effects[ShaderManager::Effect::Color] = 20;
+    manager.updateUniforms(program, 4, QSize(10, 20), effects);
+    glF.glGetUniformiv(program->programId(), program->uniformLocation("u_skin"), &texUnit);
+    ASSERT_EQ(texUnit, 4);
+
+    // Changed skin size
+    program->setUniformValue("u_skin", 2);
+    manager.updateUniforms(program, 4, QSize(10, 21), effects);
+    glF.glGetUniformiv(program->programId(), program->uniformLocation("u_skin"), &texUnit);
+    ASSERT_EQ(texUnit, 4);
+
+    // Changed UV rectangle
+    program->setUniformValue("u_skin", 2);
+    manager.updateUniforms(program, 4, QSize(10, 21), effects, QRectF(0, 0, 0.5, 0.5));
+    glF.glGetUniformiv(program->programId(), program->uniformLocation("u_skin"), &texUnit);
+    ASSERT_EQ(texUnit, 4);
+
+    // setUniforms() always uploads and updates the stored values
+    manager.setUniforms(program, 3, QSize(10, 21), effects);
+    manager.updateUniforms(program, 3, QSize(10, 21), effects);
+    glF.glGetUniformiv(program->programId(), program->uniformLocation("u_skin"), &texUnit);
+    ASSERT_EQ(texUnit, 3);
+
     program->release();
 }
 
@@ -147,7 +331,7 @@ TEST_F(ShaderManagerTest, ColorEffectValue)
 
     // In range
     std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 64.9 } };
-    QOpenGLShaderProgram *program = manager.getShaderProgram(&m_target, effects);
+    QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -159,7 +343,7 @@ TEST_F(ShaderManagerTest, ColorEffectValue)
 
     // Below the minimum
     effects[effect] = -395.7;
-    program = manager.getShaderProgram(&m_target, effects);
+    program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -171,7 +355,7 @@ TEST_F(ShaderManagerTest, ColorEffectValue)
 
     // Above the maximum
     effects[effect] = 579.05;
-    program = manager.getShaderProgram(&m_target, effects);
+    program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -198,7 +382,7 @@ TEST_F(ShaderManagerTest, BrightnessEffectValue)
 
     // In range
     std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 4.6 } };
-    QOpenGLShaderProgram *program = manager.getShaderProgram(&m_target, effects);
+    QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -210,7 +394,7 @@ TEST_F(ShaderManagerTest, BrightnessEffectValue)
 
     // Below the minimum
     effects[effect] = -102.9;
-    program = manager.getShaderProgram(&m_target, effects);
+    program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -222,7 +406,7 @@ TEST_F(ShaderManagerTest, BrightnessEffectValue)
 
     // Above the maximum
     effects[effect] = 353.2;
-    program = manager.getShaderProgram(&m_target, effects);
+    program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -249,7 +433,7 @@ TEST_F(ShaderManagerTest, GhostEffectValue)
 
     // In range
     std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 58.5 } };
-    QOpenGLShaderProgram *program = manager.getShaderProgram(&m_target, effects);
+    QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -298,7 +482,7 @@ TEST_F(ShaderManagerTest, FisheyeEffectValue)
 
     // In range
     std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 58.5 } };
-    QOpenGLShaderProgram *program = manager.getShaderProgram(&m_target, effects);
+    QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -346,7 +530,7 @@ TEST_F(ShaderManagerTest, WhirlEffectValue)
 
     // In range
     std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 58.5 } };
-    QOpenGLShaderProgram *program = manager.getShaderProgram(&m_target, effects);
+    QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -383,7 +567,7 @@ TEST_F(ShaderManagerTest, PixelateEffectValue)
 
     // In range
     std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 58.5 } };
-    QOpenGLShaderProgram *program = manager.getShaderProgram(&m_target, effects);
+    QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -420,7 +604,7 @@ TEST_F(ShaderManagerTest, MosaicEffectValue)
 
     // In range
     std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 58.5 } };
-    QOpenGLShaderProgram *program = manager.getShaderProgram(&m_target, effects);
+    QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -489,3 +673,81 @@ TEST_F(ShaderManagerTest, EffectShapeChanges)
     ASSERT_TRUE(ShaderManager::effectShapeChanges(ShaderManager::Effect::Pixelate));
     ASSERT_TRUE(ShaderManager::effectShapeChanges(ShaderManager::Effect::Mosaic));
 }
+
+TEST_F(ShaderManagerTest, ProgramCache)
+{
+    QOpenGLFunctions glF(&m_context);
+    glF.initializeOpenGLFunctions();
+    GLint formats = 0;
+    glF.glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+    QTemporaryDir tempDir;
+    ASSERT_TRUE(tempDir.isValid());
+    ShaderManager::setProgramCacheDirectory(tempDir.path());
+    ASSERT_EQ(ShaderManager::programCacheDirectory(), tempDir.path() + "/v1");
+
+    const std::unordered_map<ShaderManager::Effect, double> effects = { { ShaderManager::Effect::Color, 64.9 }, { ShaderManager::Effect::Ghost, 12.5 } };
+    QDir cacheDir(ShaderManager::programCacheDirectory());
+
+    // The cache is disabled by default
+    ASSERT_FALSE(ShaderManager::programCacheEnabled());
+
+    {
+        ShaderManager manager;
+        QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
+        ASSERT_TRUE(program->isLinked());
+        ASSERT_EQ(program->shaders().size(), 2);
+    }
+
+    ASSERT_FALSE(cacheDir.exists());
+
+    ShaderManager::setProgramCacheEnabled(true);
+    ASSERT_TRUE(ShaderManager::programCacheEnabled());
+
+    {
+        ShaderManager manager;
+        QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
+        ASSERT_TRUE(program->isLinked());
+        ASSERT_EQ(program->shaders().size(), 2);
+    }
+
+    if (formats <= 0) {
+        // Program binaries aren't supported by the driver
+        ASSERT_FALSE(cacheDir.exists());
+        ShaderManager::setProgramCacheEnabled(false);
+        return;
+    }
+
+    const QStringList files = cacheDir.entryList(QDir::Files);
+    ASSERT_EQ(files.size(), 1);
+
+    // The program is loaded from the cache
+    {
+        ShaderManager manager;
+        QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
+        ASSERT_TRUE(program->isLinked());
+        ASSERT_TRUE(program->shaders().isEmpty());
+        ASSERT_NE(program->uniformLocation("u_color"), -1);
+    }
+
+    // Invalid binaries are removed and the program is compiled from source
+    QFile file(cacheDir.filePath(files[0]));
+    ASSERT_TRUE(file.open(QFile::WriteOnly));
+    file.write("invalid");
+    file.close();
+
+    {
+        ShaderManager manager;
+        QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
+        ASSERT_TRUE(program->isLinked());
+        ASSERT_EQ(program->shaders().size(), 2);
+    }
+
+    // The binary is saved again
+    ASSERT_EQ(cacheDir.entryList(QDir::Files).size(), 1);
+    ASSERT_GT(QFileInfo(cacheDir.filePath(files[0])).size(), 7);
+
+    ShaderManager::setProgramCacheDirectory("");
+    ASSERT_TRUE(ShaderManager::programCacheDirectory().isEmpty());
+    ShaderManager::setProgramCacheEnabled(false);
+}
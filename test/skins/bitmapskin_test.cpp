@@ -79,3 +79,35 @@ TEST_F(BitmapSkinTest, GetTextureScale)
     ASSERT_EQ(m_jpegSkin->getTextureScale(Texture()), 1);
     ASSERT_EQ(m_pngSkin->getTextureScale(Texture()), 1);
 }
+
+TEST_F(BitmapSkinTest, TextureAtlas)
+{
+    Skin::setAtlasEnabled(true);
+
+    Costume costume("", "", "");
+    std::string costumeData = readFileStr("image.png");
+    char *data = (char *)malloc((costumeData.size() + 1) * sizeof(char));
+    memcpy(data, costumeData.c_str(), (costumeData.size() + 1) * sizeof(char));
+    costume.setData(costumeData.size(), data);
+    BitmapSkin skin(&costume);
+    BitmapSkin anotherSkin(&costume);
+
+    Skin::setAtlasEnabled(false);
+
+    // Small textures share the atlas texture
+    Texture texture = skin.getTexture(1);
+    Texture anotherTexture = anotherSkin.getTexture(1);
+    ASSERT_TRUE(texture.isInAtlas());
+    ASSERT_TRUE(anotherTexture.isInAtlas());
+    ASSERT_EQ(texture.handle(), anotherTexture.handle());
+    ASSERT_NE(texture.id(), anotherTexture.id());
+    ASSERT_EQ(texture.width(), 4);
+    ASSERT_EQ(texture.height(), 6);
+
+    QBuffer buffer;
+    texture.toImage().save(&buffer, "png");
+    QFile ref("png_result.png");
+    ref.open(QFile::ReadOnly);
+    buffer.open(QBuffer::ReadOnly);
+    ASSERT_EQ(buffer.readAll(), ref.readAll());
+}
@@ -0,0 +1,279 @@
+#include <QtTest/QSignalSpy>
+#include <stagecompositor.h>
+#include <stagecompositorpainter.h>
+#include <stagemodel.h>
+#include <spritemodel.h>
+#include <penstamp.h>
+#include <scratchcpp/stage.h>
+#include <scratchcpp/sprite.h>
+#include <enginemock.h>
+#include <renderedtargetmock.h>
+#include <penlayermock.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+using namespace libscratchcpp;
+
+using ::testing::Return;
+using ::testing::Invoke;
+using ::testing::_;
+
+class StageCompositorTest : public testing::Test
+{
+    public:
+        void SetUp() override
+        {
+            m_context.create();
+            ASSERT_TRUE(m_context.isValid());
+
+            m_surface.setFormat(m_context.format());
+            m_surface.create();
+            Q_ASSERT(m_surface.isValid());
+            m_context.makeCurrent(&m_surface);
+        }
+
+        void TearDown() override
+        {
+            ASSERT_EQ(m_context.surface(), &m_surface);
+            m_context.doneCurrent();
+        }
+
+        QOpenGLContext m_context;
+        QOffscreenSurface m_surface;
+};
+
+TEST_F(StageCompositorTest, Engine)
+{
+    StageCompositor compositor;
+    QSignalSpy spy(&compositor, &StageCompositor::engineChanged);
+    ASSERT_EQ(compositor.engine(), nullptr);
+
+    EngineMock engine;
+    compositor.setEngine(&engine);
+    ASSERT_EQ(compositor.engine(), &engine);
+    ASSERT_EQ(spy.count(), 1);
+
+    compositor.setEngine(&engine);
+    ASSERT_EQ(spy.count(), 1);
+}
+
+TEST_F(StageCompositorTest, PenLayer)
+{
+    StageCompositor compositor;
+    QSignalSpy spy(&compositor, &StageCompositor::penLayerChanged);
+    ASSERT_EQ(compositor.penLayer(), nullptr);
+
+    PenLayerMock penLayer;
+    compositor.setPenLayer(&penLayer);
+    ASSERT_EQ(compositor.penLayer(), &penLayer);
+    ASSERT_EQ(spy.count(), 1);
+
+    compositor.setPenLayer(&penLayer);
+    ASSERT_EQ(spy.count(), 1);
+}
+
+TEST_F(StageCompositorTest, GetTargets)
+{
+    StageCompositor compositor;
+    std::vector<IRenderedTarget *> targets;
+    compositor.getTargets(targets);
+    ASSERT_TRUE(targets.empty());
+
+    EngineMock engine;
+    Stage stage;
+    Sprite sprite1, sprite2;
+    StageModel stageModel;
+    SpriteModel model1, model2;
+    stage.setInterface(&stageModel);
+    sprite1.setInterface(&model1);
+    sprite2.setInterface(&model2);
+
+    RenderedTargetMock stageTarget, target1, target2;
+    stageModel.setRenderedTarget(&stageTarget);
+    model1.setRenderedTarget(&target1);
+    model2.setRenderedTarget(&target2);
+
+    // The visible targets are sorted from the top, the compositor draws them from the bottom
+    compositor.setEngine(&engine);
+    EXPECT_CALL(engine, getVisibleTargets(_)).WillOnce(Invoke([&](std::vector<Target *> &dst) { dst = { &sprite2, &sprite1, &stage }; }));
+    compositor.getTargets(targets);
+    ASSERT_EQ(targets, std::vector<IRenderedTarget *>({ &stageTarget, &target1, &target2 }));
+
+    EXPECT_CALL(engine, getVisibleTargets(_)).WillOnce(Invoke([&](std::vector<Target *> &dst) { dst = { &sprite1 }; }));
+    compositor.getTargets(targets);
+    ASSERT_EQ(targets, std::vector<IRenderedTarget *>({ &target1 }));
+}
+
+TEST_F(StageCompositorTest, Paint)
+{
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+
+    QOpenGLExtraFunctions glF(&m_context);
+    glF.initializeOpenGLFunctions();
+
+    // Stage texture (red)
+    QOpenGLFramebufferObject stageFbo(48, 36, format);
+    stageFbo.bind();
+    glF.glClearColor(1.0f, 0.0f, 0.0f, 1.0f);
+    glF.glClear(GL_COLOR_BUFFER_BIT);
+
+    // Pen layer covering the left half of the stage (semi-transparent blue with premultiplied alpha)
+    QOpenGLFramebufferObject penFbo(24, 36, format);
+    penFbo.bind();
+    glF.glClearColor(0.0f, 0.0f, 0.5f, 0.5f);
+    glF.glClear(GL_COLOR_BUFFER_BIT);
+    penFbo.release();
+
+    EngineMock engine;
+    Stage stage;
+    Sprite sprite;
+    StageModel stageModel;
+    SpriteModel spriteModel;
+    stage.setInterface(&stageModel);
+    sprite.setInterface(&spriteModel);
+
+    RenderedTargetMock stageTarget, spriteTarget;
+    stageModel.setRenderedTarget(&stageTarget);
+    spriteModel.setRenderedTarget(&spriteTarget);
+
+    PenLayerMock penLayer;
+    StageCompositor compositor;
+    compositor.setEngine(&engine);
+    compositor.setPenLayer(&penLayer);
+
+    // Synchronize (costumes of composited targets are loaded by the compositor)
+    QOpenGLFramebufferObject fbo(48, 36, format);
+    StageCompositorPainter painter(&fbo);
+    EXPECT_CALL(engine, getVisibleTargets(_)).WillOnce(Invoke([&](std::vector<Target *> &dst) { dst = { &sprite, &stage }; }));
+    EXPECT_CALL(stageTarget, costumesLoaded()).WillOnce(Return(false));
+    EXPECT_CALL(stageTarget, loadCostumes());
+    EXPECT_CALL(spriteTarget, costumesLoaded()).WillOnce(Return(true));
+    EXPECT_CALL(spriteTarget, loadCostumes()).Times(0);
+    painter.synchronize(&compositor);
+
+    // Paint (the sprite is outside the stage)
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(48));
+    EXPECT_CALL(stageTarget, getStamp(1.0, _)).WillOnce(Invoke([&stageFbo](double, PenStamp &dst) {
+        dst.texture = stageFbo.texture();
+        dst.skinSize = stageFbo.size();
+        dst.viewport = QRect(QPoint(0, 0), stageFbo.size());
+        dst.matrix = QMatrix4x4();
+        return true;
+    }));
+    EXPECT_CALL(stageTarget, texture()).WillOnce(Return(Texture()));
+    EXPECT_CALL(stageTarget, stageModel()).WillRepeatedly(Return(&stageModel));
+    EXPECT_CALL(spriteTarget, getStamp(1.0, _)).WillOnce(Return(false));
+    EXPECT_CALL(spriteTarget, texture()).Times(0);
+    EXPECT_CALL(spriteTarget, stageModel()).WillRepeatedly(Return(nullptr));
+    EXPECT_CALL(penLayer, framebufferObject()).WillOnce(Return(&penFbo));
+    EXPECT_CALL(penLayer, framebufferRect()).WillOnce(Return(QRectF(0, 0, 0.5, 1)));
+    painter.paint(nullptr);
+
+    // The pen layer is blended over the stage
+    const QImage image = fbo.toImage();
+    ASSERT_EQ(image.pixel(36, 18), qRgba(255, 0, 0, 255));
+
+    const QRgb pixel = image.pixel(12, 18);
+    ASSERT_LE(std::abs(qRed(pixel) - 128), 1);
+    ASSERT_EQ(qGreen(pixel), 0);
+    ASSERT_LE(std::abs(qBlue(pixel) - 128), 1);
+    ASSERT_EQ(qAlpha(pixel), 255);
+}
+
+TEST_F(StageCompositorTest, PaintSprites)
+{
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+
+    QOpenGLExtraFunctions glF(&m_context);
+    glF.initializeOpenGLFunctions();
+
+    // Stage texture (red)
+    QOpenGLFramebufferObject stageFbo(48, 36, format);
+    stageFbo.bind();
+    glF.glClearColor(1.0f, 0.0f, 0.0f, 1.0f);
+    glF.glClear(GL_COLOR_BUFFER_BIT);
+
+    // Pen layer covering the left half of the stage (blue)
+    QOpenGLFramebufferObject penFbo(24, 36, format);
+    penFbo.bind();
+    glF.glClearColor(0.0f, 0.0f, 1.0f, 1.0f);
+    glF.glClear(GL_COLOR_BUFFER_BIT);
+
+    // Sprite texture shared by the clones (green)
+    QOpenGLFramebufferObject spriteFbo(8, 8, format);
+    spriteFbo.bind();
+    glF.glClearColor(0.0f, 1.0f, 0.0f, 1.0f);
+    glF.glClear(GL_COLOR_BUFFER_BIT);
+    spriteFbo.release();
+
+    EngineMock engine;
+    Stage stage;
+    Sprite sprite1, sprite2;
+    StageModel stageModel;
+    SpriteModel spriteModel1, spriteModel2;
+    stage.setInterface(&stageModel);
+    sprite1.setInterface(&spriteModel1);
+    sprite2.setInterface(&spriteModel2);
+
+    RenderedTargetMock stageTarget, spriteTarget1, spriteTarget2;
+    stageModel.setRenderedTarget(&stageTarget);
+    spriteModel1.setRenderedTarget(&spriteTarget1);
+    spriteModel2.setRenderedTarget(&spriteTarget2);
+
+    PenLayerMock penLayer;
+    StageCompositor compositor;
+    compositor.setEngine(&engine);
+    compositor.setPenLayer(&penLayer);
+
+    QOpenGLFramebufferObject fbo(48, 36, format);
+    StageCompositorPainter painter(&fbo);
+    EXPECT_CALL(engine, getVisibleTargets(_)).WillOnce(Invoke([&](std::vector<Target *> &dst) { dst = { &sprite2, &sprite1, &stage }; }));
+    EXPECT_CALL(stageTarget, costumesLoaded()).WillOnce(Return(true));
+    EXPECT_CALL(spriteTarget1, costumesLoaded()).WillOnce(Return(true));
+    EXPECT_CALL(spriteTarget2, costumesLoaded()).WillOnce(Return(true));
+    painter.synchronize(&compositor);
+
+    // Paint (the first clone overlaps the pen layer)
+    auto spriteStamp = [&spriteFbo](const QRect &viewport) {
+        return [&spriteFbo, viewport](double, PenStamp &dst) {
+            dst.texture = spriteFbo.texture();
+            dst.skinSize = spriteFbo.size();
+            dst.viewport = viewport;
+            dst.matrix = QMatrix4x4();
+            return true;
+        };
+    };
+
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(48));
+    EXPECT_CALL(stageTarget, getStamp(1.0, _)).WillOnce(Invoke([&stageFbo](double, PenStamp &dst) {
+        dst.texture = stageFbo.texture();
+        dst.skinSize = stageFbo.size();
+        dst.viewport = QRect(QPoint(0, 0), stageFbo.size());
+        dst.matrix = QMatrix4x4();
+        return true;
+    }));
+    EXPECT_CALL(stageTarget, texture()).WillOnce(Return(Texture()));
+    EXPECT_CALL(stageTarget, stageModel()).WillRepeatedly(Return(&stageModel));
+    EXPECT_CALL(spriteTarget1, getStamp(1.0, _)).WillOnce(Invoke(spriteStamp(QRect(4, 14, 8, 8))));
+    EXPECT_CALL(spriteTarget1, texture()).WillOnce(Return(Texture()));
+    EXPECT_CALL(spriteTarget1, stageModel()).WillRepeatedly(Return(nullptr));
+    EXPECT_CALL(spriteTarget2, getStamp(1.0, _)).WillOnce(Invoke(spriteStamp(QRect(32, 14, 8, 8))));
+    EXPECT_CALL(spriteTarget2, texture()).WillOnce(Return(Texture()));
+    EXPECT_CALL(spriteTarget2, stageModel()).WillRepeatedly(Return(nullptr));
+    EXPECT_CALL(penLayer, framebufferObject()).WillOnce(Return(&penFbo));
+    EXPECT_CALL(penLayer, framebufferRect()).WillOnce(Return(QRectF(0, 0, 0.5, 1)));
+    painter.paint(nullptr);
+
+    // Sprites are drawn above the pen layer
+    const QImage image = fbo.toImage();
+    ASSERT_EQ(image.pixel(8, 18), qRgba(0, 255, 0, 255));
+    ASSERT_EQ(image.pixel(20, 5), qRgba(0, 0, 255, 255));
+    ASSERT_EQ(image.pixel(36, 18), qRgba(0, 255, 0, 255));
+    ASSERT_EQ(image.pixel(44, 5), qRgba(255, 0, 0, 255));
+
+    // Stage, pen layer and both clones in a single batch
+    ASSERT_EQ(painter.drawCalls(), 3);
+}
@@ -1,5 +1,6 @@
 #include <cputexturemanager.h>
 #include <texture.h>
+#include <effecttransform.h>
 #include <qnanopainter.h>
 
 #include "../common.h"
@@ -93,18 +94,21 @@ TEST_F(CpuTextureManagerTest, TextureDataAndHullPoints)
 
     // Read texture data
     CpuTextureManager manager;
+    std::vector<GLubyte> data;
     std::vector<QPoint> hullPoints;
 
     for (int i = 0; i < 2; i++) {
         Texture texture1(imgPainter1.fbo()->texture(), imgPainter1.fbo()->size());
-        GLubyte *data = manager.getTextureData(texture1);
-        ASSERT_EQ(memcmp(data, refData1, 96), 0);
+        ASSERT_TRUE(manager.getTextureData(texture1, data));
+        ASSERT_EQ(data.size(), 96u);
+        ASSERT_EQ(memcmp(data.data(), refData1, 96), 0);
         manager.getTextureConvexHullPoints(texture1, QSize(), ShaderManager::Effect::NoEffect, {}, hullPoints);
         ASSERT_EQ(hullPoints, refHullPoints1);
 
         Texture texture2(imgPainter2.fbo()->texture(), imgPainter2.fbo()->size());
-        data = manager.getTextureData(texture2);
-        ASSERT_EQ(memcmp(data, refData2, 96), 0);
+        ASSERT_TRUE(manager.getTextureData(texture2, data));
+        ASSERT_EQ(data.size(), 96u);
+        ASSERT_EQ(memcmp(data.data(), refData2, 96), 0);
         manager.getTextureConvexHullPoints(texture2, QSize(), ShaderManager::Effect::NoEffect, {}, hullPoints);
         ASSERT_EQ(hullPoints, refHullPoints2);
 
@@ -118,14 +122,14 @@ TEST_F(CpuTextureManagerTest, TextureDataAndHullPoints)
     // Test removeTexture()
     imgPainter1.paint(&painter, "image.jpg");
     Texture texture(imgPainter1.fbo()->texture(), imgPainter1.fbo()->size());
-    GLubyte *data = manager.getTextureData(texture);
-    ASSERT_EQ(memcmp(data, refData1, 96), 0);
+    ASSERT_TRUE(manager.getTextureData(texture, data));
+    ASSERT_EQ(memcmp(data.data(), refData1, 96), 0);
     manager.getTextureConvexHullPoints(texture, QSize(), ShaderManager::Effect::NoEffect, {}, hullPoints);
     ASSERT_EQ(hullPoints, refHullPoints1);
 
     manager.removeTexture(texture);
-    data = manager.getTextureData(texture);
-    ASSERT_EQ(memcmp(data, refData2, 96), 0);
+    ASSERT_TRUE(manager.getTextureData(texture, data));
+    ASSERT_EQ(memcmp(data.data(), refData2, 96), 0);
     manager.getTextureConvexHullPoints(texture, QSize(), ShaderManager::Effect::NoEffect, {}, hullPoints);
     ASSERT_EQ(hullPoints, refHullPoints2);
 
@@ -173,6 +177,16 @@ TEST_F(CpuTextureManagerTest, GetPointColor)
     ASSERT_EQ(manager.getPointColor(texture, 2, 1, mask, effects), qRgb(255, 128, 0));
     ASSERT_EQ(manager.getPointColor(texture, 3, 1, mask, effects), qRgb(192, 255, 128));
 
+    // Multiple points at once (including points outside the texture)
+    effects[ShaderManager::Effect::Whirl] = 45;
+    mask |= ShaderManager::Effect::Whirl;
+    const std::vector<QPoint> points = { { 1, 1 }, { -1, 0 }, { 2, 1 }, { 3, 1 }, { 3, 3 }, { 4, 6 }, { 1, 3 } };
+    std::vector<QRgb> colors(points.size());
+    manager.getPointColors(texture, points.data(), points.size(), mask, effects, colors.data());
+
+    for (size_t i = 0; i < points.size(); i++)
+        ASSERT_EQ(colors[i], manager.getPointColor(texture, points[i].x(), points[i].y(), mask, effects));
+
     // TODO: Test point transform (graphic effects that change shape)
 
     // Cleanup
@@ -229,3 +243,151 @@ TEST_F(CpuTextureManagerTest, TextureContainsPoint)
     emit context.aboutToBeDestroyed();
     context.doneCurrent();
 }
+
+TEST_F(CpuTextureManagerTest, EffectLookupTable)
+{
+    static const std::vector<std::pair<ShaderManager::Effect, double>> effects = {
+        { ShaderManager::Effect::Whirl, 70 },
+        { ShaderManager::Effect::Fisheye, 45 },
+        { ShaderManager::Effect::Pixelate, 30 },
+        { ShaderManager::Effect::Mosaic, 25 }
+    };
+
+    static const QSize textureSize(13, 9);
+    static const std::vector<QSize> skinSizes = { textureSize, QSize(26, 18), QSize(7, 20) };
+    CpuTextureManager::clearEffectLookupTables();
+
+    for (const auto &[effect, value] : effects) {
+        const std::unordered_map<ShaderManager::Effect, double> effectValues = { { effect, value } };
+
+        for (const QSize &skinSize : skinSizes) {
+            const std::vector<int> &table = CpuTextureManager::getEffectLookupTable(textureSize, skinSize, effect, effectValues);
+            ASSERT_EQ(table.size(), 13 * 9);
+
+            for (int y = 0; y < textureSize.height(); y++) {
+                for (int x = 0; x < textureSize.width(); x++) {
+                    QVector2D transformed;
+                    EffectTransform::transformPoint(effect, effectValues, skinSize, QVector2D(x / 13.0f, y / 9.0f), transformed);
+                    const int transformedX = transformed.x() * textureSize.width();
+                    const int transformedY = transformed.y() * textureSize.height();
+
+                    if ((transformedX >= 0 && transformedX < textureSize.width()) && (transformedY >= 0 && transformedY < textureSize.height()))
+                        ASSERT_EQ(table[y * textureSize.width() + x], transformedY * textureSize.width() + transformedX);
+                    else
+                        ASSERT_EQ(table[y * textureSize.width() + x], -1);
+                }
+            }
+        }
+    }
+
+    // Pixelate depends on the skin size
+    const std::unordered_map<ShaderManager::Effect, double> pixelate = { { ShaderManager::Effect::Pixelate, 30 } };
+    ASSERT_NE(
+        CpuTextureManager::getEffectLookupTable(textureSize, textureSize, ShaderManager::Effect::Pixelate, pixelate),
+        CpuTextureManager::getEffectLookupTable(textureSize, QSize(26, 18), ShaderManager::Effect::Pixelate, pixelate));
+
+    CpuTextureManager::clearEffectLookupTables();
+    ASSERT_EQ(CpuTextureManager::effectLookupMemory(), 0);
+}
+
+TEST_F(CpuTextureManagerTest, EffectLookupTableCache)
+{
+    // 1024x1024 tables take 4 MiB each, so 4 of them fit into the 16 MiB budget
+    static const QSize size(1024, 1024);
+    static const size_t tableMemory = 1024 * 1024 * sizeof(int);
+    auto whirl = [](double value) { return std::unordered_map<ShaderManager::Effect, double>({ { ShaderManager::Effect::Whirl, value } }); };
+    CpuTextureManager::clearEffectLookupTables();
+
+    const int *table1 = CpuTextureManager::getEffectLookupTable(size, size, ShaderManager::Effect::Whirl, whirl(10)).data();
+    CpuTextureManager::getEffectLookupTable(size, size, ShaderManager::Effect::Whirl, whirl(20));
+    CpuTextureManager::getEffectLookupTable(size, size, ShaderManager::Effect::Whirl, whirl(30));
+    CpuTextureManager::getEffectLookupTable(size, size, ShaderManager::Effect::Whirl, whirl(40));
+    ASSERT_EQ(CpuTextureManager::effectLookupMemory(), 4 * tableMemory);
+
+    // Reuse (this also makes the first table the most recently used one)
+    ASSERT_EQ(CpuTextureManager::getEffectLookupTable(size, size, ShaderManager::Effect::Whirl, whirl(10)).data(), table1);
+    ASSERT_EQ(CpuTextureManager::effectLookupMemory(), 4 * tableMemory);
+
+    // Eviction of the least recently used table
+    CpuTextureManager::getEffectLookupTable(size, size, ShaderManager::Effect::Whirl, whirl(50));
+    ASSERT_EQ(CpuTextureManager::effectLookupMemory(), 4 * tableMemory);
+    ASSERT_TRUE(CpuTextureManager::hasEffectLookupTable(size, size, ShaderManager::Effect::Whirl, whirl(10)));
+    ASSERT_FALSE(CpuTextureManager::hasEffectLookupTable(size, size, ShaderManager::Effect::Whirl, whirl(20)));
+    ASSERT_TRUE(CpuTextureManager::hasEffectLookupTable(size, size, ShaderManager::Effect::Whirl, whirl(30)));
+    ASSERT_TRUE(CpuTextureManager::hasEffectLookupTable(size, size, ShaderManager::Effect::Whirl, whirl(40)));
+    ASSERT_TRUE(CpuTextureManager::hasEffectLookupTable(size, size, ShaderManager::Effect::Whirl, whirl(50)));
+
+    // A table larger than the budget is still kept (alone)
+    CpuTextureManager::getEffectLookupTable(QSize(3000, 2000), QSize(3000, 2000), ShaderManager::Effect::Whirl, whirl(10));
+    ASSERT_EQ(CpuTextureManager::effectLookupMemory(), 3000 * 2000 * sizeof(int));
+    ASSERT_FALSE(CpuTextureManager::hasEffectLookupTable(size, size, ShaderManager::Effect::Whirl, whirl(10)));
+
+    CpuTextureManager::clearEffectLookupTables();
+    ASSERT_EQ(CpuTextureManager::effectLookupMemory(), 0);
+}
+
+TEST_F(CpuTextureManagerTest, EffectLookupTableSharing)
+{
+    // Create OpenGL context
+    QOpenGLContext context;
+    QOffscreenSurface surface;
+    createContextAndSurface(&context, &surface);
+
+    // Paint
+    QNanoPainter painter;
+    ImagePainter imgPainter(&painter, "image.png");
+
+    Texture texture(imgPainter.fbo()->texture(), imgPainter.fbo()->size());
+    const QSize skinSize(8, 12);
+    const ShaderManager::Effect mask = ShaderManager::Effect::Whirl | ShaderManager::Effect::Pixelate;
+    const std::unordered_map<ShaderManager::Effect, double> effects = { { ShaderManager::Effect::Whirl, 80 }, { ShaderManager::Effect::Pixelate, 20 } };
+    CpuTextureManager manager;
+    CpuTextureManager::clearEffectLookupTables();
+
+    auto directColor = [&manager, &texture, &skinSize, mask, &effects](int x, int y) {
+        QVector2D transformed;
+        EffectTransform::transformPoint(mask, effects, skinSize, QVector2D(x / 4.0f, y / 6.0f), transformed);
+        const QRgb color = manager.getPointColor(texture, transformed.x() * 4, transformed.y() * 6, ShaderManager::Effect::NoEffect, {});
+        return EffectTransform::transformColor(mask, effects, color);
+    };
+
+    // A few texels are transformed directly
+    for (int y = 0; y < 6; y++) {
+        for (int x = 0; x < 4; x++) {
+            const QRgb color = directColor(x, y);
+            ASSERT_EQ(manager.getPointColor(texture, x, y, mask, effects, skinSize), color);
+            ASSERT_EQ(manager.textureContainsPoint(texture, QPointF(x, y), mask, effects, skinSize), qAlpha(color) > 0);
+        }
+    }
+
+    ASSERT_FALSE(CpuTextureManager::hasEffectLookupTable(texture.size(), skinSize, mask, effects));
+    ASSERT_EQ(CpuTextureManager::effectLookupMemory(), 0);
+
+    // Many texels use a lookup table
+    for (int i = 0; i < 2; i++) {
+        for (int y = 0; y < 6; y++) {
+            for (int x = 0; x < 4; x++)
+                ASSERT_EQ(manager.getPointColor(texture, x, y, mask, effects, skinSize), directColor(x, y));
+        }
+    }
+
+    ASSERT_TRUE(CpuTextureManager::hasEffectLookupTable(texture.size(), skinSize, mask, effects));
+    ASSERT_EQ(CpuTextureManager::effectLookupMemory(), 4 * 6 * sizeof(int));
+
+    // The convex hull uses the same table
+    std::vector<QPoint> hullPoints;
+    manager.getTextureConvexHullPoints(texture, skinSize, mask, effects, hullPoints);
+    ASSERT_EQ(CpuTextureManager::effectLookupMemory(), 4 * 6 * sizeof(int));
+
+    // A different skin size doesn't
+    ASSERT_FALSE(CpuTextureManager::hasEffectLookupTable(texture.size(), texture.size(), mask, effects));
+    manager.getTextureConvexHullPoints(texture, texture.size(), mask, effects, hullPoints);
+    ASSERT_TRUE(CpuTextureManager::hasEffectLookupTable(texture.size(), texture.size(), mask, effects));
+    ASSERT_EQ(CpuTextureManager::effectLookupMemory(), 2 * 4 * 6 * sizeof(int));
+
+    CpuTextureManager::clearEffectLookupTables();
+
+    // Cleanup
+    emit context.aboutToBeDestroyed();
+    context.doneCurrent();
+}
@@ -34,9 +34,42 @@ TEST(TextureTest, Constructors)
         ASSERT_EQ(tex.size().height(), 8);
         ASSERT_EQ(tex.width(), 5);
         ASSERT_EQ(tex.height(), 8);
+        ASSERT_FALSE(tex.isInAtlas());
+    }
+
+    {
+        Texture tex(2, QSize(5, 8), QPoint(3, 4), QSize(64, 32));
+        ASSERT_EQ(tex.handle(), 2);
+        ASSERT_TRUE(tex.isValid());
+        ASSERT_EQ(tex.width(), 5);
+        ASSERT_EQ(tex.height(), 8);
+        ASSERT_TRUE(tex.isInAtlas());
+        ASSERT_EQ(tex.atlasOffset(), QPoint(3, 4));
     }
 }
 
+TEST(TextureTest, UvRect)
+{
+    ASSERT_EQ(Texture().uvRect(), QRectF(0, 0, 1, 1));
+    ASSERT_EQ(Texture(2, 5, 8).uvRect(), QRectF(0, 0, 1, 1));
+    ASSERT_EQ(Texture(2, QSize(16, 8), QPoint(32, 4), QSize(64, 32)).uvRect(), QRectF(0.5, 0.125, 0.25, 0.25));
+}
+
+TEST(TextureTest, Id)
+{
+    ASSERT_EQ(Texture(2, 5, 8).id(), Texture(2, 10, 10).id());
+    ASSERT_NE(Texture(2, 5, 8).id(), Texture(3, 5, 8).id());
+
+    // Textures in an atlas share the handle
+    Texture t1(2, QSize(5, 8), QPoint(1, 1), QSize(64, 64));
+    Texture t2(2, QSize(5, 8), QPoint(7, 1), QSize(64, 64));
+    Texture t3(2, QSize(5, 8), QPoint(1, 10), QSize(64, 64));
+    ASSERT_NE(t1.id(), t2.id());
+    ASSERT_NE(t1.id(), t3.id());
+    ASSERT_NE(t2.id(), t3.id());
+    ASSERT_EQ(t1.id(), Texture(2, QSize(5, 8), QPoint(1, 1), QSize(64, 64)).id());
+}
+
 TEST(TextureTest, ToImage)
 {
     QOpenGLContext context;
@@ -103,6 +136,16 @@ TEST(TextureTest, Release)
     ASSERT_FALSE(glF.glIsTexture(handle));
     ASSERT_FALSE(tex.isValid());
 
+    // Textures in an atlas don't own the OpenGL texture
+    glF.glGenTextures(1, &handle);
+    glF.glBindTexture(GL_TEXTURE_2D, handle);
+    glF.glBindTexture(GL_TEXTURE_2D, 0);
+    Texture atlasTex(handle, QSize(1, 1), QPoint(), QSize(1, 1));
+    atlasTex.release();
+    ASSERT_TRUE(glF.glIsTexture(handle));
+    ASSERT_FALSE(atlasTex.isValid());
+    glF.glDeleteTextures(1, &handle);
+
     context.doneCurrent();
 }
 
@@ -124,4 +167,12 @@ TEST(TextureTest, Operators)
     Texture t5(2, 10, 10);
     ASSERT_FALSE(t4 == t5);
     ASSERT_TRUE(t4 != t5);
+
+    Texture t6(3, QSize(10, 10), QPoint(5, 0), QSize(64, 64));
+    ASSERT_FALSE(t4 == t6);
+    ASSERT_TRUE(t4 != t6);
+
+    Texture t7(3, QSize(10, 10), QPoint(5, 0), QSize(64, 64));
+    ASSERT_TRUE(t6 == t7);
+    ASSERT_FALSE(t6 != t7);
 }
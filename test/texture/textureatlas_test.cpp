@@ -0,0 +1,97 @@
+#include <textureatlas.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+
+class TextureAtlasTest : public testing::Test
+{
+    public:
+        void SetUp() override
+        {
+            m_context.create();
+            ASSERT_TRUE(m_context.isValid());
+
+            m_surface.setFormat(m_context.format());
+            m_surface.create();
+            Q_ASSERT(m_surface.isValid());
+            m_context.makeCurrent(&m_surface);
+        }
+
+        void TearDown() override
+        {
+            ASSERT_EQ(m_context.surface(), &m_surface);
+            m_context.doneCurrent();
+        }
+
+        QImage createImage(int width, int height, QRgb color)
+        {
+            QImage image(width, height, QImage::Format_RGBA8888);
+            image.fill(QColor::fromRgba(color));
+            return image;
+        }
+
+        QOpenGLContext m_context;
+        QOffscreenSurface m_surface;
+};
+
+TEST_F(TextureAtlasTest, Constructor)
+{
+    TextureAtlas atlas(64);
+    ASSERT_TRUE(atlas.isValid());
+    ASSERT_NE(atlas.handle(), 0);
+    ASSERT_EQ(atlas.size(), 64);
+
+    // The atlas is transparent
+    Texture texture(atlas.handle(), 64, 64);
+    QImage image = texture.toImage();
+    ASSERT_EQ(image.pixel(0, 0), qRgba(0, 0, 0, 0));
+    ASSERT_EQ(image.pixel(63, 63), qRgba(0, 0, 0, 0));
+}
+
+TEST_F(TextureAtlasTest, AddTexture)
+{
+    TextureAtlas atlas(64);
+    const QImage image1 = createImage(10, 5, qRgba(255, 0, 0, 255));
+    const QImage image2 = createImage(8, 8, qRgba(0, 0, 255, 255));
+    const QImage image3 = createImage(40, 3, qRgba(0, 255, 0, 255));
+
+    Texture t1 = atlas.addTexture(image1);
+    ASSERT_TRUE(t1.isValid());
+    ASSERT_TRUE(t1.isInAtlas());
+    ASSERT_EQ(t1.handle(), atlas.handle());
+    ASSERT_EQ(t1.size(), QSize(10, 5));
+    ASSERT_EQ(t1.atlasOffset(), QPoint(TextureAtlas::PADDING, TextureAtlas::PADDING));
+
+    // The first shelf is too low for this texture, so a new one is created
+    Texture t2 = atlas.addTexture(image2);
+    ASSERT_TRUE(t2.isValid());
+    ASSERT_EQ(t2.atlasOffset(), QPoint(TextureAtlas::PADDING, 5 + 3 * TextureAtlas::PADDING));
+
+    // The lowest shelf with enough space is used (the texture is placed next to the first one)
+    Texture t3 = atlas.addTexture(image3);
+    ASSERT_TRUE(t3.isValid());
+    ASSERT_EQ(t3.atlasOffset(), QPoint(10 + 3 * TextureAtlas::PADDING, TextureAtlas::PADDING));
+
+    ASSERT_EQ(t1.toImage(), image1);
+    ASSERT_EQ(t2.toImage(), image2);
+    ASSERT_EQ(t3.toImage(), image3);
+}
+
+TEST_F(TextureAtlasTest, Full)
+{
+    TextureAtlas atlas(32);
+
+    // Too large
+    ASSERT_FALSE(atlas.addTexture(createImage(31, 2, qRgba(255, 0, 0, 255))).isValid());
+
+    Texture t1 = atlas.addTexture(createImage(30, 20, qRgba(255, 0, 0, 255)));
+    ASSERT_TRUE(t1.isValid());
+
+    Texture t2 = atlas.addTexture(createImage(30, 8, qRgba(255, 0, 0, 255)));
+    ASSERT_TRUE(t2.isValid());
+    ASSERT_EQ(t2.atlasOffset(), QPoint(TextureAtlas::PADDING, 20 + 3 * TextureAtlas::PADDING));
+
+    // There isn't enough space
+    ASSERT_FALSE(atlas.addTexture(createImage(4, 4, qRgba(255, 0, 0, 255))).isValid());
+}
@@ -0,0 +1,172 @@
+#include <texturespans.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+
+// 4x3 image, rows from top to bottom
+static const GLubyte DATA[] = {
+    0,  0,  0,  0,   255, 0,   0,   255, 0,   255, 0,   128, 0,   0,   0,   0,   // row 0
+    0,  0,  0,  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   // row 1
+    10, 20, 30, 255, 0,   0,   0,   0,   40,  50,  60,  70,  80,  90,  100, 255, // row 2
+};
+
+TEST(TextureSpansTest, Empty)
+{
+    TextureSpans spans;
+    ASSERT_EQ(spans.width(), 0);
+    ASSERT_EQ(spans.height(), 0);
+    ASSERT_TRUE(spans.isEmpty());
+    ASSERT_EQ(spans.pixel(0, 0), qRgba(0, 0, 0, 0));
+    ASSERT_FALSE(spans.containsPixel(0, 0));
+    ASSERT_EQ(spans.spanCount(0), 0);
+    ASSERT_EQ(spans.rowSpans(0), nullptr);
+}
+
+TEST(TextureSpansTest, Spans)
+{
+    TextureSpans spans(DATA, 4, 3);
+    ASSERT_EQ(spans.width(), 4);
+    ASSERT_EQ(spans.height(), 3);
+    ASSERT_FALSE(spans.isEmpty());
+
+    ASSERT_EQ(spans.spanCount(-1), 0);
+    ASSERT_EQ(spans.spanCount(0), 1);
+    ASSERT_EQ(spans.spanCount(1), 0);
+    ASSERT_EQ(spans.spanCount(2), 2);
+    ASSERT_EQ(spans.spanCount(3), 0);
+
+    const TextureSpans::Span *row = spans.rowSpans(0);
+    ASSERT_EQ(row[0].start, 1);
+    ASSERT_EQ(row[0].end, 3);
+
+    row = spans.rowSpans(2);
+    ASSERT_EQ(row[0].start, 0);
+    ASSERT_EQ(row[0].end, 1);
+    ASSERT_EQ(row[1].start, 2);
+    ASSERT_EQ(row[1].end, 4);
+}
+
+TEST(TextureSpansTest, Pixel)
+{
+    TextureSpans spans(DATA, 4, 3);
+
+    for (int y = -1; y <= 3; y++) {
+        for (int x = -1; x <= 4; x++) {
+            QRgb expected = qRgba(0, 0, 0, 0);
+
+            if (x >= 0 && x < 4 && y >= 0 && y < 3) {
+                const GLubyte *pixel = DATA + (y * 4 + x) * 4;
+                expected = qRgba(pixel[0], pixel[1], pixel[2], pixel[3]);
+            }
+
+            ASSERT_EQ(spans.pixel(x, y), expected);
+            ASSERT_EQ(spans.containsPixel(x, y), qAlpha(expected) > 0);
+        }
+    }
+}
+
+TEST(TextureSpansTest, ReadRow)
+{
+    TextureSpans spans(DATA, 4, 3);
+
+    for (int y = -1; y <= 3; y++) {
+        for (int x = -2; x <= 4; x++) {
+            for (int count = 0; count <= 6; count++) {
+                std::vector<QRgb> row(count, qRgb(1, 2, 3));
+                spans.readRow(y, x, count, row.data());
+
+                for (int i = 0; i < count; i++)
+                    ASSERT_EQ(row[i], spans.pixel(x + i, y));
+            }
+        }
+    }
+}
+
+TEST(TextureSpansTest, ToRgba)
+{
+    TextureSpans spans(DATA, 4, 3);
+    GLubyte data[sizeof(DATA)];
+    spans.toRgba(data);
+    ASSERT_EQ(memcmp(data, DATA, sizeof(DATA)), 0);
+}
+
+TEST(TextureSpansTest, Intersects)
+{
+    TextureSpans spans(DATA, 4, 3);
+
+    ASSERT_TRUE(spans.rowIntersects(0, spans, 0, 0));
+    ASSERT_TRUE(spans.rowIntersects(0, spans, 0, 1));
+    ASSERT_FALSE(spans.rowIntersects(0, spans, 0, 2));
+    ASSERT_FALSE(spans.rowIntersects(0, spans, 0, -2));
+    ASSERT_FALSE(spans.rowIntersects(0, spans, 1, 0));
+    ASSERT_TRUE(spans.rowIntersects(0, spans, 2, 0));
+    ASSERT_TRUE(spans.rowIntersects(0, spans, 2, 1));
+    ASSERT_FALSE(spans.rowIntersects(0, spans, 2, 3));
+    ASSERT_TRUE(spans.rowIntersects(2, spans, 0, 1));
+    ASSERT_TRUE(spans.rowIntersects(2, spans, 0, -1));
+    ASSERT_FALSE(spans.rowIntersects(2, spans, 0, -3));
+    ASSERT_FALSE(spans.rowIntersects(0, spans, 3, 0));
+
+    ASSERT_TRUE(spans.intersects(spans, QPoint(0, 0)));
+    ASSERT_TRUE(spans.intersects(spans, QPoint(1, 0)));
+    ASSERT_TRUE(spans.intersects(spans, QPoint(0, 2)));
+    ASSERT_TRUE(spans.intersects(spans, QPoint(1, 2)));
+    ASSERT_FALSE(spans.intersects(spans, QPoint(3, 2)));
+    ASSERT_FALSE(spans.intersects(spans, QPoint(0, 1)));
+    ASSERT_FALSE(spans.intersects(spans, QPoint(4, 0)));
+    ASSERT_FALSE(spans.intersects(spans, QPoint(0, 3)));
+}
+
+TEST(TextureSpansTest, AddRow)
+{
+    TextureSpans spans(6);
+    ASSERT_EQ(spans.width(), 6);
+    ASSERT_EQ(spans.height(), 0);
+    ASSERT_TRUE(spans.isEmpty());
+
+    spans.addRow({ { 1, 3, 0 }, { 4, 6, 0 } });
+    spans.addRow({});
+    spans.addRow({ { 0, 2, 0 } });
+    ASSERT_EQ(spans.height(), 3);
+    ASSERT_FALSE(spans.isEmpty());
+
+    ASSERT_EQ(spans.spanCount(0), 2);
+    ASSERT_EQ(spans.spanCount(1), 0);
+    ASSERT_EQ(spans.spanCount(2), 1);
+
+    // The spans have no colors
+    static const bool covered[] = { false, true, true, false, true, true, false, false, false, false, false, false, true, true, false, false, false, false };
+
+    for (int y = 0; y < 3; y++) {
+        for (int x = 0; x < 6; x++) {
+            ASSERT_EQ(spans.containsPixel(x, y), covered[y * 6 + x]);
+            ASSERT_EQ(spans.pixel(x, y), qRgba(0, 0, 0, 0));
+        }
+    }
+
+    // Spans with colors intersect spans without colors
+    TextureSpans other(DATA, 4, 3);
+    ASSERT_TRUE(spans.intersects(other, QPoint(0, 0)));
+    ASSERT_FALSE(spans.rowIntersects(0, other, 0, 5));
+    ASSERT_TRUE(spans.rowIntersects(2, other, 2, 0));
+    ASSERT_FALSE(spans.rowIntersects(2, other, 2, 2));
+}
+
+TEST(TextureSpansTest, MemoryUsage)
+{
+    // A mostly transparent texture takes much less memory than the uncompressed data
+    const int width = 100;
+    const int height = 100;
+    std::vector<GLubyte> data(width * height * 4, 0);
+
+    for (int y = 40; y < 60; y++) {
+        for (int x = 40; x < 60; x++)
+            data[(y * width + x) * 4 + 3] = 255;
+    }
+
+    TextureSpans spans(data.data(), width, height);
+    ASSERT_LT(spans.memoryUsage() * 4, data.size());
+    ASSERT_TRUE(spans.containsPixel(50, 50));
+    ASSERT_FALSE(spans.containsPixel(39, 50));
+}